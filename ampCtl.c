@@ -10,8 +10,11 @@
 #include <getopt.h>
 #include <sys/time.h>
 #include <pthread.h>
+#include <signal.h>
+#include <limits.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <semaphore.h>
 
 #include <mpd/client.h>
 #include <mpd/status.h>
@@ -26,75 +29,14 @@
 
 #include "log.h"
 #include "gpio.h"
-
- /****************************************************************
- * Constants
- ****************************************************************/
- 
-#define AMP_SYSFS_GPIO_DIR 			"/sys/class/gpio"
-#define AMP_OFF_CLICK_TIMEOUT 		1000000  	/*  1.0 seconds 	*/
-#define AMP_PAUSE_TIMEOUT_DELAY		300  		/*  5 minutes 		*/
-#define AMP_DRIVER_PROTECT_DELAY 	1500000		/*  1.5 seconds 	*/
-#define AMP_DEBOUNCE 				50000 		/*  0.05 seconds 	*/
-#define AMP_DOUBLE_CLICK_DELAY		300000 		/*  0.3 seconds 	*/
-#define AMP_READ_GPIO 				3			/* 3 GPIOs are read : switch encoderA and encoderB */
-#define AMP_DEF_CONFIG_FILE			"ampCtl.conf"
-#define AMP_MPD_CMD					"service mpd restart"
-#define AMP_SWITCH_ON				1
-#define AMP_SWITCH_OFF				2
-#define AMP_SWITCH_MUTE_ON			4
-#define AMP_SWITCH_MUTE_OFF			8
-#define AMP_SWITCH_VOL				16
-#define AMP_MPD_PLAY				32
-#define AMP_MPD_PAUSE				64
-#define AMP_MPD_STOP				128
-#define AMP_PAUSE_TIMEOUT			256
-#define	AMP_DRIVER_PROTECT			512
-#define AMP_SWITCH_LONG_PRESSED		1024
-#define AMP_DOUBLE_CLICK			2048
-#define AMP_MPD_NB_CNX_ATTEMPT		5
-#define	AMP_MPD_CNX_TIMEOUT			2			/* 2 seconds 		*/
-
-#define AMP_UNMUTE					0
-#define AMP_MUTE					1
-#define AMP_ON						1
-#define AMP_OFF						0
-
-#define MAX_BUF 64
-
- 
-struct amp {									//Structure containing the full amplifier status
-	struct gpio 			button;				//Hw On-Off switch
-	struct gpio 			mute;				//Mute relay
-	struct gpio 			off;				//On-Off relay
-	struct gpio				encoderA;			//Encoder 1st input
-	struct gpio				encoderB;			//Encoder 2nd input
-	struct timeval 			pprev;				//Time of the previous previous event
-	struct timeval 			prev;				//Time of the previous event
-	struct timeval 			cur;				//Time of the current event
-	bool					init;				//Is init completed ?
-	bool					pressed;			//Is the On-Off switch pressed a long time ?
-	int 					stateAmp;			//Amplifier on or off
-	int						stateMute;			//Amplifier muted or not
-	struct mpd_connection 	*connMpd;			//Connection to mpd
-	int						prevEncoded;		//Previous value from the rotary encoder
-	char					gpioPath[MAX_BUF];	//Path of the gpios in the user space
-	char					logFile[MAX_BUF];	//Log file name
-	char					mpdCmd[MAX_BUF];	//Shell command to restart mpd
-	int						pauseTimeout;		//Duration of the pause timeout
-	int						driverProtect;		//Duration of the delay before unmuting the amplifier when switching on
-	int						event;				//Event to manage
-	bool					muteOngoing;		//Is a mute on going ?
-	pthread_t				pauseThread;		//Pause thread ID
-	pthread_t				longPressedThread;	//LongPressed thread ID
-	pthread_t				doubleClickThread;	//LongPressed thread ID
-};
+#include "ampCtl.h"
+#include "mpdProxy.h"
+#include "dsp.h"
+#include "meter.h"
+#include "loudness.h"
 
 static void *pauseTimeout (void *arg);
-void 		ampState(struct amp *ampCtl, int state);
-void 		ampMute (struct amp *ampCtl, int state);
 void 		handleMPDerror(struct mpd_connection *c);
-void 		processEvent(struct amp *ampCtl, int evt, int inc);
 void 		help();
 void 		closeGpios(struct amp *ampCtl);
 void 		initTime(struct amp *p);
@@ -108,12 +50,28 @@ void 		readEncoderCallback(void *userData);
 static void interruptHandler (void *arg);
 static void *mpdHandler (void *arg);
 void 		readButtonCallback(void *userData);
+cfg_t 		*readConfig(struct amp *ampCtl, char *configFile);
+static void *configReloader (void *arg);
+static void *volumeSync (void *arg);
+static void *signalHandler (void *arg);
+static void *postedHandler (void *arg);
+void 		setupOffTimeout(struct amp *ampCtl, int delay, int evt);
+void 		setHwVolume(struct amp *ampCtl, int volume);
+void 		forwardSignal(int sig);
+static int	streamRate(void);
 //int 		execCmdMpd(bool (* mpdFunction)(), struct mpd_connection *connMpd, int nbArg, int inc);
 
 
 
 static pthread_mutex_t 	mutexProcess = PTHREAD_MUTEX_INITIALIZER;
 static int 				MPDcountError = 0;
+static pid_t 			pidChild = 0;
+static sem_t			volumeChanged;			//Posted when the encoder changes the volume of the DSP engine
+static pthread_mutex_t	mutexPosted = PTHREAD_MUTEX_INITIALIZER;	//Guards the events posted and the play request, never held long
+static sem_t			eventPosted;			//Posted with each event queued by postEvent
+static struct postedEvent {int evt; int inc;} posted[AMP_POST_QUEUE];
+static unsigned			postedHead, postedTail;	//Events queued, processed from the head
+static struct timeval	postedRequest;			//Time of the last play request seen by the proxy, taken by processEvent
 
 /****************************************************************
  * Main
@@ -122,12 +80,12 @@ int main(int argc, char **argv, char **envp)
 {
 	static struct amp 	ampCtl;	
 	pthread_t 			threadId ;	   
-	pid_t 				pidChild;
     int 				status;
 	int 				c;
 	int 				option_index = 0;
 	char				*configFile = NULL;
 	char				*logFile = NULL;
+	bool				dspOnly = false;
 
 	static struct option long_options[] =
 	{
@@ -136,35 +94,33 @@ int main(int argc, char **argv, char **envp)
 	  {"help",    no_argument,       0, 'h'},	  
 	  {"config",  required_argument, 0, 'c'},
 	  {"logfile", required_argument, 0, 'l'},
+	  {"dsp",     no_argument,       0, 'D'},
 	  {0, 0, 0, 0}
 	};
 
-   
-	cfg_opt_t opts[] = {
-        CFG_SIMPLE_INT("button", 		&ampCtl.button.pin),
-        CFG_SIMPLE_INT("encoderA", 		&ampCtl.encoderA.pin),
-        CFG_SIMPLE_INT("encoderB", 		&ampCtl.encoderB.pin),
-        CFG_SIMPLE_INT("switch", 		&ampCtl.off.pin),
-        CFG_SIMPLE_INT("mute", 			&ampCtl.mute.pin),
-        CFG_SIMPLE_INT("pauseTimeout", 	&ampCtl.pauseTimeout),
-        CFG_SIMPLE_INT("driverProtect", &ampCtl.driverProtect),
-		CFG_SIMPLE_STR("gpioPath", 		ampCtl.gpioPath),
-		CFG_SIMPLE_STR("logFile", 		ampCtl.logFile),
-		CFG_SIMPLE_STR("mpdCmd", 		ampCtl.mpdCmd),
-        CFG_END()
-    };
-    cfg_t *cfg;
+    cfg_t 				*cfg;
+	sigset_t			sigHup;
 
 	//Default values are copied before reading the config file
-	strcpy(ampCtl.gpioPath, AMP_SYSFS_GPIO_DIR);
-	strcpy(ampCtl.mpdCmd, AMP_MPD_CMD);
+	ampCtl.gpioPath = strdup(AMP_SYSFS_GPIO_DIR);
+	ampCtl.mpdCmd = strdup(AMP_MPD_CMD);
 	ampCtl.pauseTimeout = AMP_PAUSE_TIMEOUT_DELAY;	
 	ampCtl.driverProtect = AMP_DRIVER_PROTECT_DELAY;
+	ampCtl.proxyBulkSlots = AMP_PROXY_BULK_SLOTS;
+	ampCtl.dspBlock = DSP_BLOCK;
+	ampCtl.dspLatency = DSP_LATENCY;
+	ampCtl.volume = ampCtl.volumeSent = 100;
+	ampCtl.dspSignalLevel = DSP_SIGNAL_LEVEL;
+	ampCtl.dspSignalHysteresis = DSP_SIGNAL_HYSTERESIS;
+	ampCtl.dspSignalAttack = DSP_SIGNAL_ATTACK;
+	ampCtl.dspMeterRate = METER_RATE;
+	ampCtl.dspLoudnessRef = LOUDNESS_STEPS;
+	ampCtl.streamRate = streamRate;
 
 	// Command line options decoding
 	while (1)
     {
-		c = getopt_long (argc, argv, "c:dhl:v", long_options, &option_index);
+		c = getopt_long (argc, argv, "c:dDhl:v", long_options, &option_index);
 
 		if (c == -1) break;			/* End of the options */
 
@@ -190,6 +146,10 @@ int main(int argc, char **argv, char **envp)
 				logFile = optarg;
 				break;
 
+			case 'D':
+				dspOnly = true;
+				break;
+
 			case '?':
 				help();
 				break;
@@ -200,15 +160,45 @@ int main(int argc, char **argv, char **envp)
     }
 	
 	//Parsing the config file either the one provided with the c switch or the default one
-    cfg = cfg_init(opts, 0);
-    if (configFile) status = cfg_parse(cfg, configFile);
-	else status = cfg_parse(cfg, AMP_DEF_CONFIG_FILE);
-	if (status == CFG_FILE_ERROR) logError("Non existing config file");
-	if (status == CFG_PARSE_ERROR) logError("Config file parse error");
-	if (status != CFG_SUCCESS) exit(-1);
+	ampCtl.configFile = configFile ? configFile : AMP_DEF_CONFIG_FILE;
+	if ((cfg = readConfig(&ampCtl, ampCtl.configFile)) == NULL) exit(-1);
+
+	//When the proxy is used, mpd listens on another port : connect to it directly, also from the DSP mode (rate of the song)
+	//libmpdclient picks those variables when connections are created with the default host and port
+	if (ampCtl.mpdHost != NULL) setenv("MPD_HOST", ampCtl.mpdHost, 1);
+	if (ampCtl.mpdPort != 0) {
+		char port[16];
+		snprintf(port, sizeof(port), "%i", ampCtl.mpdPort);
+		setenv("MPD_PORT", port, 1);
+	}
+
+	//DSP mode : only the crossover runs, reading stdin until its end (mpd "pipe" output)
+	//The log file of the daemon is left alone
+	if (dspOnly) {
+		setLogFile(logFile);
+		if (dspLoadConfig(&ampCtl, cfg) < 0) exit(-1);
+		cfg_free(cfg);
+		ampCtl.dspInput = NULL;
+		sigemptyset(&sigHup);										//SIGHUP applies the new delays
+		sigaddset(&sigHup, SIGHUP);
+		pthread_sigmask(SIG_BLOCK, &sigHup, NULL);
+		if (pthread_create(&threadId, NULL, configReloader, &ampCtl) != 0) logError("Error creating configReloader thread");
+		exit(dspRun(&ampCtl) < 0 ? -1 : 0);
+	}
+
 	if (logFile != NULL) setLogFile(logFile);
 	else setLogFile(ampCtl.logFile);
 
+	if (proxyLoadRules(cfg) < 0) exit(-1);
+	if (dspLoadConfig(&ampCtl, cfg) < 0) exit(-1);
+	cfg_free(cfg);
+
+	//SIGHUP reloads the configuration : the parent forwards it to the child
+	//where it is blocked in all the threads and waited for by the configReloader thread
+	signal(SIGHUP, forwardSignal);
+	sigemptyset(&sigHup);
+	sigaddset(&sigHup, SIGHUP);
+
 	//The configuration is now loaded
 	logInfo("Starting %s with button on : %i, encoder on : %i %i, switch on %i, mute on : %i", argv[0], ampCtl.button.pin, ampCtl.encoderA.pin, ampCtl.encoderB.pin, ampCtl.off.pin, ampCtl.mute.pin);
 	logInfo("Gpio path : %s", ampCtl.gpioPath);
@@ -234,6 +224,7 @@ int main(int argc, char **argv, char **envp)
 
 		// Child section : initialisation
 		logInfo("Child process initializing...");
+		pthread_sigmask(SIG_BLOCK, &sigHup, NULL);
 		
 		gpioInit(&ampCtl, &ampCtl.off, GPIO_WRITE, NULL);		//On-off relay
 		gpioInit(&ampCtl, &ampCtl.mute, GPIO_WRITE, NULL);		//Mute relay
@@ -273,6 +264,21 @@ int main(int argc, char **argv, char **envp)
 		//interruptHandler is in charge of gpios events
 		int task = pthread_create (&threadId, NULL, mpdHandler, &ampCtl);
 		if(task) logError("Error creating mpdHandler thread. Error : %i", task);
+		task = pthread_create (&threadId, NULL, configReloader, &ampCtl);
+		if(task) logError("Error creating configReloader thread. Error : %i", task);
+		if (ampCtl.proxyPort) {									//Events of the proxy processed out of its connection threads
+			sem_init(&eventPosted, 0, 0);
+			if (pthread_create(&threadId, NULL, postedHandler, &ampCtl) != 0) logError("Error creating postedHandler thread");
+			if (proxyStart(&ampCtl) < 0) logError("Error starting the mpd proxy");
+		}
+		if (ampCtl.dspInput && dspStart(&ampCtl) < 0) logError("Error starting the DSP engine");
+		if (ampCtl.dspInput && ampCtl.dspVolume > 0) {			//Volume in the DSP engine : mpd is told afterwards
+			sem_init(&volumeChanged, 0, 0);
+			if (pthread_create(&threadId, NULL, volumeSync, &ampCtl) != 0) logError("Error creating volumeSync thread");
+		}
+		if (ampCtl.dspInput && ampCtl.dspStandby > 0) {		//Power driven by the signal on the input of the DSP engine
+			if (pthread_create(&threadId, NULL, signalHandler, &ampCtl) != 0) logError("Error creating signalHandler thread");
+		}
 		interruptHandler(&ampCtl); 
 		
 		//Normally this point should never be reached as interruptHandler is an infinite loop
@@ -281,6 +287,192 @@ int main(int argc, char **argv, char **envp)
 	}
 }
 
+//Parses the configuration file
+//Simple values are stored in the amplifier control structure, the returned configuration holds the sections
+//(proxy interception rules). Returns NULL if the file cannot be parsed
+//ampCtl : pointer on the amplifier control structure
+//configFile : configuration file to parse
+cfg_t *readConfig(struct amp *ampCtl, char *configFile) {
+	int 	status;
+	cfg_t 	*cfg;
+	cfg_opt_t opts[] = {
+        CFG_SIMPLE_INT("button", 		&ampCtl->button.pin),
+        CFG_SIMPLE_INT("encoderA", 		&ampCtl->encoderA.pin),
+        CFG_SIMPLE_INT("encoderB", 		&ampCtl->encoderB.pin),
+        CFG_SIMPLE_INT("switch", 		&ampCtl->off.pin),
+        CFG_SIMPLE_INT("mute", 			&ampCtl->mute.pin),
+        CFG_SIMPLE_INT("pauseTimeout", 	&ampCtl->pauseTimeout),
+        CFG_SIMPLE_INT("driverProtect", &ampCtl->driverProtect),
+		CFG_SIMPLE_STR("gpioPath", 		&ampCtl->gpioPath),
+		CFG_SIMPLE_STR("logFile", 		&ampCtl->logFile),
+		CFG_SIMPLE_STR("mpdCmd", 		&ampCtl->mpdCmd),
+		CFG_SIMPLE_STR("mpdHost", 		&ampCtl->mpdHost),
+        CFG_SIMPLE_INT("mpdPort", 		&ampCtl->mpdPort),
+        CFG_SIMPLE_INT("proxyPort", 	&ampCtl->proxyPort),
+        CFG_SIMPLE_INT("predictivePowerOn", &ampCtl->predictivePowerOn),
+        CFG_SIMPLE_INT("proxyBulkSlots", &ampCtl->proxyBulkSlots),
+		CFG_SIMPLE_STR("captureFile", 	&ampCtl->captureFile),
+		CFG_SIMPLE_STR("volumeCmd", 	&ampCtl->volumeCmd),
+		CFG_SEC("rule", 				proxyRuleOpts, CFGF_MULTI | CFGF_TITLE),
+		CFG_SIMPLE_STR("dspInput", 		&ampCtl->dspInput),
+		CFG_SIMPLE_STR("dspPre", 		&ampCtl->dspPre),
+		CFG_SIMPLE_STR("dspInputRate", 	&ampCtl->dspInputRate),
+        CFG_SIMPLE_INT("dspBlock", 		&ampCtl->dspBlock),
+        CFG_SIMPLE_INT("dspLatency", 	&ampCtl->dspLatency),
+        CFG_SIMPLE_INT("dspPeriods", 	&ampCtl->dspPeriods),
+		CFG_SIMPLE_STR("dspKernel", 	&ampCtl->dspKernel),
+        CFG_SIMPLE_INT("dspWorkers", 	&ampCtl->dspWorkers),
+        CFG_SIMPLE_INT("dspPriority", 	&ampCtl->dspPriority),
+		CFG_SIMPLE_STR("dspCores", 		&ampCtl->dspCores),
+		CFG_SIMPLE_STR("dspStats", 		&ampCtl->dspStats),
+		CFG_SIMPLE_STR("dspMeter", 		&ampCtl->dspMeter),
+        CFG_SIMPLE_INT("dspMeterRate", 	&ampCtl->dspMeterRate),
+        CFG_SIMPLE_INT("dspMeterSpectrum", &ampCtl->dspMeterSpectrum),
+        CFG_SIMPLE_INT("dspVolume", 	&ampCtl->dspVolume),
+        CFG_SIMPLE_INT("dspLoudness", 	&ampCtl->dspLoudness),
+        CFG_SIMPLE_INT("dspLoudnessRef", &ampCtl->dspLoudnessRef),
+        CFG_SIMPLE_INT("dspStandby", 	&ampCtl->dspStandby),
+        CFG_SIMPLE_INT("dspSignalLevel", &ampCtl->dspSignalLevel),
+        CFG_SIMPLE_INT("dspSignalHysteresis", &ampCtl->dspSignalHysteresis),
+        CFG_SIMPLE_INT("dspSignalAttack", &ampCtl->dspSignalAttack),
+		CFG_SEC("output", 				dspOutputOpts, CFGF_MULTI | CFGF_TITLE),
+		CFG_SEC("node", 				dspNodeOpts, CFGF_MULTI | CFGF_TITLE),
+        CFG_END()
+    };
+
+    cfg = cfg_init(opts, 0);
+    status = cfg_parse(cfg, configFile);
+	if (status == CFG_FILE_ERROR) logError("Non existing config file");
+	if (status == CFG_PARSE_ERROR) logError("Config file parse error");
+	if (status != CFG_SUCCESS) {
+		cfg_free(cfg);
+		return NULL;
+	}
+	return cfg;
+}
+
+//Parent process signal handler : forwards the signal to the child process
+void forwardSignal(int sig) {
+	if (pidChild > 0) kill(pidChild, sig);
+}
+
+//configReloader : reloads the proxy interception rules and the DSP delays when SIGHUP is received
+//
+//The configuration file is parsed again into a scratch structure : only the rules and the delays are taken into account,
+//the other parameters need a restart. Client connections are kept, they use the new rules for their next commands
+//arg : pointer on the amplifier control structure
+static void *configReloader (void *arg){
+	struct amp 	*ampCtl = (struct amp *) arg;
+	struct amp 	scratch;
+	sigset_t	sigHup;
+	cfg_t		*cfg;
+	int			sig;
+
+	sigemptyset(&sigHup);
+	sigaddset(&sigHup, SIGHUP);
+	while (true) {
+		if (sigwait(&sigHup, &sig) != 0) continue;
+		logInfo("Reloading %s", ampCtl->configFile);
+		memset(&scratch, 0, sizeof(scratch));
+		if ((cfg = readConfig(&scratch, ampCtl->configFile)) == NULL) continue;	//Keep the current rules
+		proxyLoadRules(cfg);
+		dspReload(cfg);
+		cfg_free(cfg);
+		free(scratch.gpioPath); free(scratch.logFile); free(scratch.mpdCmd);
+		free(scratch.mpdHost); free(scratch.captureFile); free(scratch.volumeCmd);
+		free(scratch.dspInput); free(scratch.dspPre); free(scratch.dspKernel);
+		free(scratch.dspCores); free(scratch.dspStats); free(scratch.dspInputRate);
+		free(scratch.dspMeter);
+	}
+	return NULL;
+}
+
+
+//volumeSync : tells mpd the volume set by the encoder in the DSP engine, on its own connection
+//
+//The encoder changes the gain of the engine at once and posts volumeChanged. The changes made while a volume is sent are
+//merged : only the last one is sent. Until mpd has acknowledged it, the volume mpd reports is the echo of a former change
+//and is ignored (AMP_MPD_VOLUME)
+//arg : pointer on the amplifier control structure
+static void *volumeSync (void *arg){
+	struct amp 				*ampCtl = (struct amp *) arg;
+	struct mpd_connection 	*connMpd;
+	int						volume, sent;
+
+	connMpd = mpd_connection_new(NULL, 0, 30000);
+	if (mpd_connection_get_error(connMpd) != MPD_ERROR_SUCCESS) {
+		handleMPDerror(connMpd);
+		return NULL;
+	}
+	while (true) {
+		sem_wait(&volumeChanged);
+		pthread_mutex_lock(&mutexProcess);
+		volume = ampCtl->volume;
+		sent = ampCtl->volumeSent;
+		pthread_mutex_unlock(&mutexProcess);
+		if (volume == sent) continue;							//Already sent with an earlier post
+		if (!mpd_run_set_volume(connMpd, volume)) {
+			handleMPDerror(connMpd);
+			sem_post(&volumeChanged);							//Sent again on the connection restored
+			continue;
+		}
+		pthread_mutex_lock(&mutexProcess);
+		ampCtl->volumeSent = volume;
+		pthread_mutex_unlock(&mutexProcess);
+		logDebug("Volume %i sent to mpd", volume);
+	}
+	return NULL;
+}
+
+//signalHandler : turns the changes of the signal detected on the input of the DSP engine into events
+//arg : pointer on the amplifier control structure
+static void *signalHandler (void *arg){
+	struct amp 	*ampCtl = (struct amp *) arg;
+
+	while (true) processEvent(ampCtl, dspSignalWait() ? AMP_SIGNAL_ON : AMP_SIGNAL_OFF, 0);
+	return NULL;
+}
+
+//postEvent : queues an event processed by the postedHandler thread, in order
+//Used by the threads which must not wait for mutexProcess, held across the mpd commands
+//The event is dropped if AMP_POST_QUEUE events are already waiting
+void postEvent(struct amp *ampCtl, int evt, int inc){
+	pthread_mutex_lock(&mutexPosted);
+	if (postedTail - postedHead == AMP_POST_QUEUE) {
+		pthread_mutex_unlock(&mutexPosted);
+		logError("Event %i dropped, %i events waiting", evt, AMP_POST_QUEUE);
+		return;
+	}
+	posted[postedTail % AMP_POST_QUEUE].evt = evt;
+	posted[postedTail % AMP_POST_QUEUE].inc = inc;
+	postedTail++;
+	pthread_mutex_unlock(&mutexPosted);
+	sem_post(&eventPosted);
+}
+
+//stampPlayRequest : records the time of a play request, to measure the time to sound
+//Taken by the next processEvent, dropped if mpd is already playing unmuted by then
+void stampPlayRequest(struct amp *ampCtl){
+	pthread_mutex_lock(&mutexPosted);
+	gettimeofday(&postedRequest, NULL);
+	pthread_mutex_unlock(&mutexPosted);
+}
+
+//postedHandler : processes the events queued by postEvent
+//arg : pointer on the amplifier control structure
+static void *postedHandler (void *arg){
+	struct amp 			*ampCtl = (struct amp *) arg;
+	struct postedEvent	e;
+
+	while (true) {
+		sem_wait(&eventPosted);
+		pthread_mutex_lock(&mutexPosted);
+		e = posted[postedHead++ % AMP_POST_QUEUE];
+		pthread_mutex_unlock(&mutexPosted);
+		processEvent(ampCtl, e.evt, e.inc);
+	}
+	return NULL;
+}
 
 //Handler in charge of managing gpios interrupts
 //Grab all events on the gpios file descriptors in an infinite loop. Uses poll to wait for interrupts which blocks
@@ -336,6 +528,8 @@ static void *mpdHandler (void *arg){
 	struct amp 				*ampCtl = (struct amp *) arg;
 	struct mpd_status 		*status;
 	struct mpd_connection 	*connMpd;
+	bool					dspVolume = ampCtl->dspInput && ampCtl->dspVolume > 0;
+	enum mpd_idle			idle;
 
 
 	connMpd = mpd_connection_new(NULL, 0, 30000);					// Create another MPD connection for this thread in charge of sensing MPD changes 
@@ -343,15 +537,28 @@ static void *mpdHandler (void *arg){
 		handleMPDerror(connMpd);
 		return NULL;
 	}
+	if (dspVolume) {											//The DSP engine starts at the volume of mpd
+		if ((status = mpd_run_status(connMpd)) == NULL) handleMPDerror(connMpd);
+		else {
+			if (mpd_status_get_volume(status) >= 0) processEvent(ampCtl, AMP_MPD_VOLUME, mpd_status_get_volume(status));
+			mpd_status_free(status);
+		}
+	}
 
 	while(true) {												//Infinite loop to catch mpd events
-		if (mpd_run_idle_mask(connMpd, MPD_IDLE_PLAYER) == 0) handleMPDerror(connMpd);
+		idle = mpd_run_idle_mask(connMpd, dspVolume ? MPD_IDLE_PLAYER | MPD_IDLE_MIXER : MPD_IDLE_PLAYER);
+		if (idle == 0) handleMPDerror(connMpd);
 		if(!mpd_send_status(connMpd)) handleMPDerror(connMpd);
 		status = mpd_recv_status(connMpd);
 		if (status == NULL) handleMPDerror(connMpd);
 		
 		logDebug("MPD event received");
 		
+		if (dspVolume && (idle & MPD_IDLE_MIXER) && status != NULL) {				//Volume set by a client : applied by the DSP engine
+			if (mpd_status_get_volume(status) >= 0) processEvent(ampCtl, AMP_MPD_VOLUME, mpd_status_get_volume(status));
+			else logError("MPD has no volume : set mixer_type \"null\" on the output feeding the DSP engine");
+		}
+		if (!(idle & MPD_IDLE_PLAYER)) continue;
 		if (mpd_status_get_state(status) == MPD_STATE_STOP) {	//Depending on the mpd event nature, event is processed
 			logDebug("MPD Stopped, switching off");
 			processEvent(ampCtl, AMP_MPD_STOP, 0);
@@ -371,7 +578,7 @@ static void *mpdHandler (void *arg){
 //mpdFunction is a pointer on the mpd function to execute
 //the following args are the mpd function arguments
 //int execCmdMpd(int (* mpdFunction)(struct mpd_connection *c), struct mpd_connection *connMpd, int nbArg, ...) { 
-int execCmdMpd(bool (* mpdFunction)(), struct amp *ampCtl, int nbArg, int inc) { 
+int execCmdMpdRetry(bool (* mpdFunction)(), struct amp *ampCtl, int nbArg, int inc) { 
 	int s;
 	int attempt = 0;
 	struct mpd_connection *connMpd = ampCtl->connMpd;
@@ -411,6 +618,17 @@ int execCmdMpd(bool (* mpdFunction)(), struct amp *ampCtl, int nbArg, int inc) {
 	return -1; 		//Never reached as there an exit to terminate the loop (attempt #2)
 }
 
+//Front panel commands run on their own mpd connection and the proxy holds the bulk queries of its clients meanwhile
+//Same arguments as execCmdMpdRetry
+int execCmdMpd(bool (* mpdFunction)(), struct amp *ampCtl, int nbArg, int inc) {
+	int s;
+
+	proxyPriority(true);
+	s = execCmdMpdRetry(mpdFunction, ampCtl, nbArg, inc);
+	proxyPriority(false);
+	return s;
+}
+
 //Helper routine for processEvent used to switch off the amplifier
 //ampCtl : pointer on the amplifier controling structure
 void processEventSwitchOff(struct amp *ampCtl){
@@ -430,19 +648,38 @@ void processEventSwitchOff(struct amp *ampCtl){
 //ampCtl : pointer on the amplifier controling structure
 //evt : event to process
 //inc : optional argument containing a value to apply with the event (like volume increment)
+//      with AMP_DELAYED_OFF, offGeneration when the delayed switch off was requested
 //
 void processEvent(struct amp *ampCtl, int evt, int inc) {
-	int 		prevEvt;
+	int 			prevEvt;
+	struct timeval	now;
 	
 	pthread_mutex_lock(&mutexProcess);					//Holding the mutex
+	if (evt & AMP_DELAYED_OFF) {						//Dropped if anything switched the amplifier on in the meantime
+		if (inc != ampCtl->offGeneration) {
+			logDebug("Delayed switch off cancelled");
+			pthread_mutex_unlock(&mutexProcess);
+			return;
+		}
+		logDebug("Delayed switch off");
+		evt &= ~AMP_DELAYED_OFF;
+		inc = 0;
+	}
+	pthread_mutex_lock(&mutexPosted);					//Play request seen by the proxy
+	if (timerisset(&postedRequest) && !(ampCtl->mpdPlaying && ampCtl->stateMute == AMP_UNMUTE)) ampCtl->playRequest = postedRequest;
+	timerclear(&postedRequest);
+	pthread_mutex_unlock(&mutexPosted);
 	prevEvt = ampCtl->event;							//Copy the event and store the previous value
 	ampCtl->event = evt;
 	
 	if (evt & AMP_SWITCH_ON) {
 		logDebug("Process Event Switch on");
+		ampCtl->offGeneration++;						//Cancels a pending delayed switch off
+		timerclear(&ampCtl->playRequest);
 		ampState(ampCtl, AMP_ON);
 	}
 	if (evt & AMP_SWITCH_OFF) {
+		timerclear(&ampCtl->playRequest);
 		processEventSwitchOff(ampCtl);
 	}
 	if (evt & AMP_SWITCH_MUTE_ON) {
@@ -461,24 +698,55 @@ void processEvent(struct amp *ampCtl, int evt, int inc) {
 	}
 	if (evt & AMP_SWITCH_VOL) {
 		logDebug("Process Event Switch volume");
-		if(ampCtl->stateAmp) {				/* Amp is off. No change in volume */
+		if(ampCtl->stateAmp && ampCtl->dspInput && ampCtl->dspVolume > 0) {	/* Volume of the DSP engine : heard from its next block */
+			ampCtl->volume = ampCtl->volume + inc < 0 ? 0 : ampCtl->volume + inc > 100 ? 100 : ampCtl->volume + inc;
+			dspSetVolume(ampCtl->volume);
+			sem_post(&volumeChanged);					/* mpd told by the volumeSync thread */
+		}
+		else if(ampCtl->stateAmp) {			/* Amp is off. No change in volume */
 			if(! execCmdMpd((bool (*)())mpd_run_change_volume, ampCtl, 1, inc))
 				logError("Error connecting to MPD : %s", mpd_connection_get_error_message(ampCtl->connMpd));
 		}
 	}
+	if (evt & AMP_MPD_VOLUME) {
+		logDebug("Process Event MPD volume : %i", inc);
+		if (ampCtl->volume == ampCtl->volumeSent && inc != ampCtl->volume) {	/* Set by a client : not an encoder change being sent */
+			ampCtl->volume = ampCtl->volumeSent = inc;
+			dspSetVolume(inc);
+		}
+	}
+	if (evt & AMP_SIGNAL_ON) {
+		logDebug("Process Event Signal on");
+		ampCtl->offGeneration++;							/* Cancels a pending delayed switch off */
+		if (!ampCtl->stateAmp) ampState(ampCtl, AMP_ON);	/* Unmuted at the end of the drivers protection */
+	}
+	if (evt & AMP_SIGNAL_OFF) {
+		logDebug("Process Event Signal off");
+		if (ampCtl->stateAmp) {
+			logInfo("No signal for %i s, standby", ampCtl->dspStandby);
+			ampCtl->muteOngoing = false;
+			ampState(ampCtl, AMP_OFF);
+			ampMute(ampCtl, AMP_MUTE);
+		}
+	}
 	if (evt & AMP_MPD_PLAY) {
 		logDebug("Process Event MPD Play");
-		if (ampCtl->stateAmp) ampMute(ampCtl, AMP_UNMUTE);	/* Amp is already on just unmute */
-		else ampState(ampCtl, AMP_ON);						/* Switch on Amp */
+		ampCtl->offGeneration++;
+		ampCtl->mpdPlaying = true;
+		ampCtl->predictiveOngoing = false;					/* A predictive power on is confirmed */
+		if (!ampCtl->stateAmp) ampState(ampCtl, AMP_ON);	/* Switch on Amp */
+		else if (!ampCtl->protectOngoing) ampMute(ampCtl, AMP_UNMUTE);	/* Amp is already on just unmute, unless still protecting the drivers */
 		ampCtl->muteOngoing = false;
 	}
 	if (evt & AMP_MPD_PAUSE) {
 		logDebug("Process Event MPD Pause");
+		ampCtl->mpdPlaying = false;
 		ampMute(ampCtl, AMP_MUTE);
 		setupPauseTimeout(ampCtl);
 	}
 	if (evt & AMP_MPD_STOP) {
 		logDebug("Process Event MPD Stop");
+		ampCtl->mpdPlaying = false;
 		ampCtl->muteOngoing = false;
 		ampState(ampCtl, AMP_OFF);
 	}
@@ -492,10 +760,13 @@ void processEvent(struct amp *ampCtl, int evt, int inc) {
 	}
 	if (evt & AMP_DRIVER_PROTECT) {
 		logDebug("Process Event Drivers protection");
-		ampMute(ampCtl, AMP_UNMUTE);
-		if (prevEvt & AMP_SWITCH_ON)
-			if(! execCmdMpd((bool (*)())mpd_run_play, ampCtl, 0, 0))
-				logError("Error connecting to MPD : %s", mpd_connection_get_error_message(ampCtl->connMpd));
+		ampCtl->protectOngoing = false;
+		if (ampCtl->stateAmp) {							/* The amplifier may have been switched off in the meantime */
+			ampMute(ampCtl, AMP_UNMUTE);
+			if (prevEvt & AMP_SWITCH_ON)
+				if(! execCmdMpd((bool (*)())mpd_run_play, ampCtl, 0, 0))
+					logError("Error connecting to MPD : %s", mpd_connection_get_error_message(ampCtl->connMpd));
+		}
 	}
 	if (evt & AMP_SWITCH_LONG_PRESSED) {
 		logDebug("Process Event Long Pressed");
@@ -508,6 +779,58 @@ void processEvent(struct amp *ampCtl, int evt, int inc) {
 				logError("Error connecting to MPD : %s", mpd_connection_get_error_message(ampCtl->connMpd));
 		}
 	}
+	if (evt & AMP_PROXY_ON) {
+		logDebug("Process Event Proxy on");
+		ampCtl->offGeneration++;
+		ampState(ampCtl, AMP_ON);
+	}
+	if (evt & AMP_PROXY_OFF) {
+		logDebug("Process Event Proxy off, delay : %i s", inc);
+		if (inc > 0) setupOffTimeout(ampCtl, inc, AMP_PROXY_OFF);
+		else {
+			ampCtl->muteOngoing = false;
+			ampState(ampCtl, AMP_OFF);
+		}
+	}
+	if (evt & AMP_PROXY_MUTE) {
+		logDebug("Process Event Proxy mute");
+		ampMute(ampCtl, AMP_MUTE);
+		setupPauseTimeout(ampCtl);
+	}
+	if (evt & AMP_PROXY_UNMUTE) {
+		logDebug("Process Event Proxy unmute");
+		if (ampCtl->stateAmp && !ampCtl->protectOngoing) ampMute(ampCtl, AMP_UNMUTE);
+		ampCtl->muteOngoing = false;
+	}
+	if (evt & AMP_PROXY_VOLUME) {
+		logDebug("Process Event Proxy volume : %i", inc);
+		setHwVolume(ampCtl, inc);
+	}
+	if (evt & AMP_PROXY_PLAY) {
+		logDebug("Process Event Proxy play request");
+		if (inc > 0 && !ampCtl->stateAmp) {				/* Start the power sequence while mpd starts its decoder */
+			ampState(ampCtl, AMP_ON);
+			ampCtl->predictiveOngoing = true;
+			setupOffTimeout(ampCtl, inc, AMP_PROXY_ROLLBACK);	/* Cancelled by mpd playing */
+		}
+	}
+	if (evt & AMP_PROXY_ROLLBACK) {
+		logDebug("Process Event Proxy rollback");
+		if (ampCtl->predictiveOngoing && !ampCtl->mpdPlaying) {
+			logInfo("mpd did not play, predictive power on rolled back");
+			ampCtl->muteOngoing = false;
+			ampState(ampCtl, AMP_OFF);
+		}
+		ampCtl->predictiveOngoing = false;
+		timerclear(&ampCtl->playRequest);
+	}
+
+	//Time to sound : from the play request to the amplifier unmuted with mpd playing
+	if (timerisset(&ampCtl->playRequest) && ampCtl->stateAmp && ampCtl->stateMute == AMP_UNMUTE && ampCtl->mpdPlaying) {
+		gettimeofday(&now, NULL);
+		logInfo("Time to sound : %i ms", delay(&ampCtl->playRequest, &now) / 1000);
+		timerclear(&ampCtl->playRequest);
+	}
 	
 	pthread_mutex_unlock(&mutexProcess);
 }
@@ -579,6 +902,59 @@ void setupPauseTimeout(struct amp *ampCtl){
 	}	
 }
 
+struct offTimeout {								//Argument of the delayed switch off thread
+	struct amp	*ampCtl;
+	int			delay;							//Delay in seconds
+	int			event;							//Event switching off
+	int			generation;						//Value of offGeneration when the switch off was requested
+};
+
+//offTimeout is the function run by the delayed switch off thread
+//processEvent drops the switch off if anything switched the amplifier on again in the meantime, under its mutex
+//arg is a pointer on a struct offTimeout, freed here
+static void *offTimeout (void *arg){
+	struct offTimeout 	*t = (struct offTimeout *) arg;
+
+	sleep(t->delay);
+	processEvent(t->ampCtl, t->event | AMP_DELAYED_OFF, t->generation);
+	free(t);
+	return 0;
+}
+
+//Helper procedure to switch off the amplifier after a delay
+//amp is a pointer on the amplifier status structure
+//delay is the delay in seconds
+//evt is the event processed after the delay : AMP_PROXY_OFF or AMP_PROXY_ROLLBACK
+//Called by processEvent, mutexProcess held
+void setupOffTimeout(struct amp *ampCtl, int delay, int evt){
+	struct offTimeout 	*t;
+	pthread_t			threadId;
+	int					task;
+
+	if ((t = malloc(sizeof(struct offTimeout))) == NULL) return;
+	t->ampCtl = ampCtl;
+	t->delay = delay;
+	t->event = evt;
+	t->generation = ++ampCtl->offGeneration;		//Also cancels a previous pending switch off
+	task = pthread_create (&threadId, NULL, offTimeout, t);
+	if(task) {
+		logError("Error creating switch off thread. Error : %i", task);
+		free(t);
+	}
+	else pthread_detach(threadId);
+}
+
+//Sets the hardware volume running the volumeCmd shell command with the volume as last argument
+//ampCtl : pointer on the amplifier control structure
+//volume : volume to set
+void setHwVolume(struct amp *ampCtl, int volume) {
+	char cmd[PATH_MAX];
+
+	if (ampCtl->volumeCmd == NULL) return;
+	snprintf(cmd, sizeof(cmd), "%s %i", ampCtl->volumeCmd, volume);
+	if (system(cmd) != 0) logError("Error setting the volume : %s", cmd);
+}
+
 //Routine to be called within a separate thread to delay the unmute when the amplifier is starting
 //arg : pointer on the amplifier control structure
 static void *unmuteDelay (void *arg){
@@ -590,17 +966,120 @@ static void *unmuteDelay (void *arg){
 	return 0;
 }
 
+struct muteSequence {							//Argument of the thread coordinating the mute relay and the ramps of the DSP engine
+	struct amp	*ampCtl;
+	int			state;							//AMP_MUTE or AMP_UNMUTE
+	int			generation;						//Value of muteGeneration when the change was requested
+	int			seq;							//Mute : ramp to silence requested to the DSP engine
+	uint64_t	start;							//Time of the request in ns
+};
+
+static uint64_t monotonicNs(){
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+//Waits until the devices play the point of the DSP ramp request seq, at most until deadline (ns)
+//Returns the time they play it in ns, 0 if no audio was flowing or the deadline was reached first
+static int64_t waitRamp(struct muteSequence *m, int seq, uint64_t deadline){
+	struct timespec	t;
+	int64_t			when;
+
+	while ((when = dspMuteTime(seq)) == -1 && monotonicNs() < deadline && m->generation == m->ampCtl->muteGeneration) usleep(1000);
+	if (when <= 0) return 0;
+	if (when > (int64_t) monotonicNs()) {
+		t.tv_sec = when / 1000000000;
+		t.tv_nsec = when % 1000000000;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) == EINTR);
+	}
+	return when;
+}
+
+//muteSequence is the function run by the thread of a mute change with the DSP engine in the daemon
+//Mute : the engine ramps to silence, the relay engages once the devices have played the silence
+//Unmute : the relay released, the engine ramps up so that the ramp is heard AMP_RELAY_SETTLE later
+//Both steps run here so that they keep their order, a later change cancelling the pending step. The timing trace is
+//logged at info level : times from the request in ms, and whether the order was kept
+//arg is a pointer on a struct muteSequence, freed here
+static void *muteSequence (void *arg){
+	struct muteSequence	*m = (struct muteSequence *) arg;
+	struct amp			*ampCtl = m->ampCtl;
+	int64_t				heard;
+	uint64_t			step;
+	bool				done;
+	int					wait, seq = m->seq;
+
+	if (m->state == AMP_MUTE) {
+		heard = waitRamp(m, seq, m->start + (uint64_t) dspMuteDelay() * 1000);
+		usleep(AMP_RELAY_MARGIN);
+		pthread_mutex_lock(&mutexProcess);
+		if ((done = m->generation == ampCtl->muteGeneration)) gpio_set_value(&ampCtl->mute, 0);	//The relay is active when low
+		pthread_mutex_unlock(&mutexProcess);
+		step = monotonicNs();
+		if (!done) logInfo("Mute trace : cancelled by an unmute after %.1f ms", (step - m->start) / 1e6);
+		else if (heard == 0) logInfo("Mute trace : no audio flowing, relay engaged at %.1f ms", (step - m->start) / 1e6);
+		else if (step >= (uint64_t) heard) logInfo("Mute trace : ramp down requested at 0 ms, silence heard at %.1f ms, relay engaged at %.1f ms : ordered",
+			(heard - (int64_t) m->start) / 1e6, (step - m->start) / 1e6);
+		else logError("Mute trace : relay engaged at %.1f ms before the silence heard at %.1f ms", (step - m->start) / 1e6, (heard - (int64_t) m->start) / 1e6);
+	}
+	else {
+		if ((wait = AMP_RELAY_SETTLE - dspBuffered()) > 0) usleep(wait);	//What the devices buffer is heard after the relay has settled
+		pthread_mutex_lock(&mutexProcess);
+		if ((done = m->generation == ampCtl->muteGeneration)) seq = dspMute(false);
+		pthread_mutex_unlock(&mutexProcess);
+		step = monotonicNs();
+		if (!done) {
+			logInfo("Unmute trace : cancelled by a mute after %.1f ms", (step - m->start) / 1e6);
+			free(m);
+			return 0;
+		}
+		heard = waitRamp(m, seq, step + (uint64_t) dspMuteDelay() * 1000);
+		if (heard == 0) logInfo("Unmute trace : relay released at 0 ms, ramp up requested at %.1f ms, no audio flowing", (step - m->start) / 1e6);
+		else if (heard >= (int64_t) m->start + AMP_RELAY_SETTLE * 1000) logInfo("Unmute trace : relay released at 0 ms, ramp up requested at %.1f ms, heard from %.1f ms : ordered",
+			(step - m->start) / 1e6, (heard - (int64_t) m->start) / 1e6);
+		else logError("Unmute trace : ramp up heard at %.1f ms, before the relay settled at %.1f ms", (heard - (int64_t) m->start) / 1e6, AMP_RELAY_SETTLE / 1e3);
+	}
+	free(m);
+	return 0;
+}
+
 //Routine in charge of muting the amp
+//With the DSP engine in the daemon and the amp on, the relay and the ramps of the engine are sequenced by a muteSequence
+//thread. With the amp off or switching on, nothing is heard : the relay and the engine change at once
 //arg : pointer on the amplifier control structure
 //state : state to apply 
 void ampMute (struct amp *ampCtl, int state) {
+	struct muteSequence	*m;
+	pthread_t			threadId;
+	int					task;
 		
 	if(ampCtl->stateMute == state) return;
 
 	logInfo("Mute changing to : %d", state);
 	
 	ampCtl->stateMute = state;
-	gpio_set_value(&ampCtl->mute, !state);			//Transfer to Gpio (the relay is active when low)
+	ampCtl->muteGeneration++;						//Cancels the pending step of the former change
+	if (ampCtl->dspInput == NULL || ampCtl->stateAmp != AMP_ON || (m = malloc(sizeof(struct muteSequence))) == NULL) {
+		gpio_set_value(&ampCtl->mute, !state);		//Transfer to Gpio (the relay is active when low)
+		if (ampCtl->dspInput != NULL) dspMute(state);
+		return;
+	}
+	m->ampCtl = ampCtl;
+	m->state = state;
+	m->generation = ampCtl->muteGeneration;
+	m->start = monotonicNs();
+	if (state) m->seq = dspMute(true);				//Ramp to silence from the next block, the relay follows
+	else gpio_set_value(&ampCtl->mute, 1);			//Relay released at once, the ramp up follows
+	task = pthread_create (&threadId, NULL, muteSequence, m);
+	if(task) {
+		logError("Error creating mute sequence thread. Error : %i", task);
+		gpio_set_value(&ampCtl->mute, !state);
+		if (!state) dspMute(false);
+		free(m);
+	}
+	else pthread_detach(threadId);
 }
 
 //Routine in charge of switching on and off the amplifier
@@ -613,14 +1092,21 @@ void ampState(struct amp *ampCtl, int state) {
 
 	logInfo("Amp changing to : %d", state);
 	
-	ampCtl->stateAmp = state;
 	if(state) {										//Amp is switching on : mute first and unmute sometime later to protect drivers
-		ampMute(ampCtl, AMP_MUTE);
+		if (ampCtl->stateMute == AMP_MUTE) {		//A mute sequence may still be waiting to engage the relay
+			ampCtl->muteGeneration++;
+			gpio_set_value(&ampCtl->mute, 0);
+		}
+		else ampMute(ampCtl, AMP_MUTE);				//Amp still off : relay engaged before the power
+		ampCtl->stateAmp = state;
+		ampCtl->protectOngoing = true;
 		gpio_set_value(&ampCtl->off, state);
 		int task = pthread_create (&threadId, NULL, unmuteDelay, ampCtl);	// Short delay to protect drivers with a concurrent waiting thread
 		if(task) logError("Error creating driver protect thread. Error : %i", task);
 	}
 	else {											//Amp switching off, simply change the relay state
+		ampCtl->stateAmp = state;
+		ampCtl->protectOngoing = false;
 		gpio_set_value(&ampCtl->off, state);
 	}
 }
@@ -638,6 +1124,22 @@ int restoreMPDcnx(struct mpd_connection *c) {
 	return(status);
 }
 
+//Returns the rate of the song mpd plays, asked on a connection of its own : the DSP engine converts it (dspInputRate "mpd")
+//Returns 0 if mpd cannot tell
+static int streamRate(void){
+	struct mpd_connection 		*c = mpd_connection_new(NULL, 0, 3000);
+	struct mpd_status			*status = NULL;
+	const struct mpd_audio_format	*format;
+	int							rate = 0;
+
+	if (mpd_connection_get_error(c) == MPD_ERROR_SUCCESS && (status = mpd_run_status(c)) != NULL
+		&& (format = mpd_status_get_audio_format(status)) != NULL) rate = format->sample_rate;
+	if (mpd_connection_get_error(c) != MPD_ERROR_SUCCESS) logError("DSP input : rate asked to mpd : %s", mpd_connection_get_error_message(c));
+	if (status != NULL) mpd_status_free(status);
+	mpd_connection_free(c);
+	return rate;
+}
+
 //Routine to handle MPD errors which is mainly used in the MPD events reception thread
 //processEvent uses another routine to perform mpd commands which has its integrated error handling mechanism
 //c : pointer to the MPD connection
@@ -801,7 +1303,8 @@ void help() {
 		printf("-d	: Debug messages\n");
 		printf("-h	: This message\n");
 		printf("-l	: specify a log file (default : ampCtl.log)\n");
-		printf("-c	: specify a configuration file (default : ampCtl.conf)\n\n");
+		printf("-c	: specify a configuration file (default : ampCtl.conf)\n");
+		printf("-D	: DSP mode : runs only the crossover, reading s32_le 44100 Hz stereo on stdin\n\n");
 		printf("The config file may contain the following informations :\n");
 		printf("button\t\t: gpio port where the switch is connected\t\t\tRequired\n");
 		printf("encoderA\t: gpio port where the first encoder input is connected\t\tRequired\n");
@@ -811,6 +1314,37 @@ void help() {
 		printf("pauseTimeout\t: timeout switching off when left in mute mode\t\t\t%i mn\n", AMP_PAUSE_TIMEOUT_DELAY / 60);
 		printf("driverProtect\t: timeout unmuting after switch on\t\t\t\t%f s\n", AMP_DRIVER_PROTECT_DELAY / 10000000.0);
 		printf("gpioPath\t: path to the gpios in the unix user space\t\t\t/sys/class/gpio\n");
-		printf("logFile\t\t: path to the log file\t\t\t\t\t\tampCtl.conf\n\n");
+		printf("logFile\t\t: path to the log file\t\t\t\t\t\tampCtl.conf\n");
+		printf("proxyPort\t: port where the mpd proxy accepts clients\t\t\tno proxy\n");
+		printf("mpdPort\t\t: port where mpd listens\t\t\t\t\t6600\n");
+		printf("mpdHost\t\t: host where mpd runs\t\t\t\t\tlocalhost\n");
+		printf("captureFile\t: file recording the proxied traffic\t\t\t\tnone\n");
+		printf("volumeCmd\t: command setting the hardware volume\t\t\t\tnone\n");
+		printf("predictivePowerOn: power on when a client asks to play, rollback delay\t0 (off)\n");
+		printf("proxyBulkSlots\t: bulk queries sent to mpd at the same time (0 : no limit)\t%i\n", AMP_PROXY_BULK_SLOTS);
+		printf("rule\t\t: proxy interception rule : rule \"command [arg]\" { action = ... delay = ... }\n");
+		printf("dspInput\t: FIFO written by mpd or alsa:<capture device> read by the DSP engine\tno DSP\n");
+		printf("dspPre\t\t: ecasound preset file of the pre-EQ chain\t\t\tnone\n");
+		printf("dspInputRate\t: rate of the DSP input converted to 44100 Hz, or mpd : rate of the song\t44100\n");
+		printf("dspBlock\t: frames processed per block\t\t\t\t\t%i\n", DSP_BLOCK);
+		printf("dspLatency\t: buffering of the output devices\t\t\t\t%i ms\n", DSP_LATENCY);
+		printf("dspPeriods\t: periods of one block buffered by the devices, low latency\t0 (dspLatency)\n");
+		printf("dspKernel\t: vector kernel : scalar, sse2, avx2, neon\t\t\tbest supported\n");
+		printf("dspWorkers\t: threads running the output chains, 0 : single thread\t0\n");
+		printf("dspPriority\t: SCHED_FIFO priority of the DSP threads, memory locked\t0 (normal)\n");
+		printf("dspCores\t: cores of the DSP reader thread and workers : \"0,1,2\"\tnext ones\n");
+		printf("dspStats\t: file where the xruns, overruns and worst block are exported\tnone\n");
+		printf("dspMeter\t: shared memory where the levels of the outputs are published : \"%s\"\tnone\n", METER_NAME);
+		printf("dspMeterRate\t: updates of the levels per s\t\t\t\t\t%i\n", METER_RATE);
+		printf("dspMeterSpectrum: octave spectrum published with the levels\t\t0 (off)\n");
+		printf("dspVolume\t: range in dB of the volume set by the encoder in the DSP engine\t0 (volume of mpd)\n");
+		printf("dspLoudness\t: dB of bass boosted at the bottom of dspVolume, treble in proportion\t0 (off)\n");
+		printf("dspLoudnessRef\t: volume step from which the loudness compensation is flat\t%i\n", LOUDNESS_STEPS);
+		printf("dspStandby\t: silence on the DSP input before standby, signal detection\t0 s (off)\n");
+		printf("dspSignalLevel\t: RMS level of the DSP input waking the amplifier\t\t%i dBFS\n", DSP_SIGNAL_LEVEL);
+		printf("dspSignalHysteresis: dB below dspSignalLevel the peaks stay when silent\t%i dB\n", DSP_SIGNAL_HYSTERESIS);
+		printf("dspSignalAttack\t: signal above dspSignalLevel before waking\t\t%i ms\n", DSP_SIGNAL_ATTACK);
+		printf("output\t\t: DSP output : output \"name\" { input = \"node\" chain = \"file.ecp\" sink = \"alsa:device\" follow = \"output\" delay = us dither = none|tpdf|shaped }\n");
+		printf("node\t\t: DSP graph node : node \"name\" { type = chain|gain|delay|sum|fir input = ... chain|gain|delay|ir = ... }\n\n");
 		exit(-1);
 }
\ No newline at end of file
@@ -0,0 +1,134 @@
+#ifndef AMPCTL_H
+#define AMPCTL_H
+
+#include <stdbool.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include <mpd/client.h>
+
+#include "gpio.h"
+
+ /****************************************************************
+ * Constants
+ ****************************************************************/
+
+#define AMP_SYSFS_GPIO_DIR 			"/sys/class/gpio"
+#define AMP_OFF_CLICK_TIMEOUT 		1000000  	/*  1.0 seconds 	*/
+#define AMP_PAUSE_TIMEOUT_DELAY		300  		/*  5 minutes 		*/
+#define AMP_DRIVER_PROTECT_DELAY 	1500000		/*  1.5 seconds 	*/
+#define AMP_RELAY_SETTLE			10000		/*  0.01 seconds : mute relay released before the DSP ramp up is heard */
+#define AMP_RELAY_MARGIN			2000		/*  0.002 seconds : mute relay engaged after the DSP silence is heard */
+#define AMP_DEBOUNCE 				50000 		/*  0.05 seconds 	*/
+#define AMP_DOUBLE_CLICK_DELAY		300000 		/*  0.3 seconds 	*/
+#define AMP_READ_GPIO 				3			/* 3 GPIOs are read : switch encoderA and encoderB */
+#define AMP_POST_QUEUE				16			/* Events posted by the proxy waiting to be processed */
+#define AMP_DEF_CONFIG_FILE			"ampCtl.conf"
+#define AMP_MPD_CMD					"service mpd restart"
+#define AMP_SWITCH_ON				1
+#define AMP_SWITCH_OFF				2
+#define AMP_SWITCH_MUTE_ON			4
+#define AMP_SWITCH_MUTE_OFF			8
+#define AMP_SWITCH_VOL				16
+#define AMP_MPD_PLAY				32
+#define AMP_MPD_PAUSE				64
+#define AMP_MPD_STOP				128
+#define AMP_PAUSE_TIMEOUT			256
+#define	AMP_DRIVER_PROTECT			512
+#define AMP_SWITCH_LONG_PRESSED		1024
+#define AMP_DOUBLE_CLICK			2048
+#define AMP_PROXY_ON				4096		/* Events triggered by the proxy interception rules */
+#define AMP_PROXY_OFF				8192
+#define AMP_PROXY_MUTE				16384
+#define AMP_PROXY_UNMUTE			32768
+#define AMP_PROXY_VOLUME			65536
+#define AMP_PROXY_PLAY				131072		/* A client asked mpd to play : predictive power on */
+#define AMP_PROXY_ROLLBACK			262144		/* mpd rejected the play request or did not start playing */
+#define AMP_MPD_VOLUME				524288		/* Volume changed in mpd by a client */
+#define AMP_SIGNAL_ON				1048576		/* Signal appeared on the input of the DSP engine */
+#define AMP_SIGNAL_OFF				2097152		/* Input of the DSP engine silent for dspStandby */
+#define AMP_DELAYED_OFF				4194304		/* With AMP_PROXY_OFF or AMP_PROXY_ROLLBACK at the end of their delay */
+#define AMP_MPD_NB_CNX_ATTEMPT		5
+#define	AMP_MPD_CNX_TIMEOUT			2			/* 2 seconds 		*/
+#define AMP_PROXY_BULK_SLOTS		1			/* Bulk queries sent to mpd at the same time by the proxy */
+
+#define AMP_UNMUTE					0
+#define AMP_MUTE					1
+#define AMP_ON						1
+#define AMP_OFF						0
+
+#define MAX_BUF 64
+
+
+struct amp {									//Structure containing the full amplifier status
+	struct gpio 			button;				//Hw On-Off switch
+	struct gpio 			mute;				//Mute relay
+	struct gpio 			off;				//On-Off relay
+	struct gpio				encoderA;			//Encoder 1st input
+	struct gpio				encoderB;			//Encoder 2nd input
+	struct timeval 			pprev;				//Time of the previous previous event
+	struct timeval 			prev;				//Time of the previous event
+	struct timeval 			cur;				//Time of the current event
+	bool					init;				//Is init completed ?
+	bool					pressed;			//Is the On-Off switch pressed a long time ?
+	int 					stateAmp;			//Amplifier on or off
+	int						stateMute;			//Amplifier muted or not
+	struct mpd_connection 	*connMpd;			//Connection to mpd
+	int						prevEncoded;		//Previous value from the rotary encoder
+	char					*configFile;		//Configuration file, parsed again on SIGHUP
+	char					*gpioPath;			//Path of the gpios in the user space
+	char					*logFile;			//Log file name
+	char					*mpdCmd;			//Shell command to restart mpd
+	int						pauseTimeout;		//Duration of the pause timeout
+	int						driverProtect;		//Duration of the delay before unmuting the amplifier when switching on
+	int						event;				//Event to manage
+	bool					muteOngoing;		//Is a mute on going ?
+	pthread_t				pauseThread;		//Pause thread ID
+	pthread_t				longPressedThread;	//LongPressed thread ID
+	pthread_t				doubleClickThread;	//LongPressed thread ID
+	char					*mpdHost;			//Host of the mpd server (NULL : libmpdclient default)
+	int						mpdPort;			//Port of the mpd server (0 : libmpdclient default)
+	int						proxyPort;			//Port where the proxy accepts mpd clients (0 : no proxy)
+	char					*captureFile;		//When set, all the proxied traffic is recorded in this file
+	char					*volumeCmd;			//Shell command setting the hardware volume, the volume is appended
+	int						offGeneration;		//Incremented to cancel a pending delayed switch off, under mutexProcess
+	int						predictivePowerOn;	//Power on as soon as a client asks to play, rolled back after this delay in s if mpd does not play (0 : off)
+	bool					protectOngoing;		//Is the drivers protection delay running ?
+	bool					predictiveOngoing;	//Was the amplifier powered on by a play request not yet confirmed by mpd ?
+	bool					mpdPlaying;			//Is mpd playing ?
+	struct timeval			playRequest;		//Time of the last play request seen by the proxy, to measure the time to sound
+	int						proxyBulkSlots;		//Max bulk queries (listallinfo...) sent to mpd at the same time by the proxy (0 : no limit)
+	char					*dspInput;			//FIFO written by mpd or "alsa:<capture device>" read by the DSP engine ("-" : stdin, NULL : no DSP)
+	char					*dspPre;			//Preset file of the pre-EQ chain shared by all the outputs
+	char					*dspInputRate;		//Rate of the input in Hz, or "mpd" : rate of the song played (NULL : 44100)
+	int						(*streamRate)(void);	//Returns the rate of the song mpd plays, 0 if unknown
+	int						dspBlock;			//Frames processed per block
+	int						dspLatency;			//Buffering requested to the output devices in ms
+	int						dspPeriods;			//Periods of one block buffered by the devices, in place of dspLatency (0 : off)
+	char					*dspKernel;			//Biquad kernel (scalar, sse2, avx2, neon), NULL : best supported
+	int						dspWorkers;			//Threads running the output chains, 0 : all the graph in the reader thread
+	int						dspPriority;		//SCHED_FIFO priority of the DSP threads, 0 : normal scheduling
+	char					*dspCores;			//Cores of the reader thread and of the workers, "0,1,2"
+	char					*dspStats;			//File where the DSP counters are exported, NULL : none
+	char					*dspMeter;			//Shared memory segment where the levels of the outputs are published, NULL : none
+	int						dspMeterRate;		//Updates of the levels per s
+	int						dspMeterSpectrum;	//Octave spectrum of the outputs published with their levels (0 : off)
+	int						dspVolume;			//Range in dB of the volume applied by the DSP engine (0 : volume of mpd)
+	int						dspLoudness;		//dB of bass boosted at the bottom of dspVolume, treble in proportion (0 : off)
+	int						dspLoudnessRef;		//Volume step from which the loudness compensation is flat
+	int						volume;				//Volume applied by the DSP engine, 0 to 100
+	int						volumeSent;			//Last volume sent to mpd, or received from it
+	int						dspStandby;			//Silence on the input of the DSP engine before standby in s (0 : no signal detection)
+	int						dspSignalLevel;		//RMS level waking the amplifier in dBFS
+	int						dspSignalHysteresis;	//dB below dspSignalLevel the peaks stay when silent
+	int						dspSignalAttack;	//Signal above dspSignalLevel before waking in ms
+	int						muteGeneration;		//Incremented by each mute change, cancels the pending step of the former one
+};
+
+void 		processEvent(struct amp *ampCtl, int evt, int inc);
+void 		postEvent(struct amp *ampCtl, int evt, int inc);
+void 		stampPlayRequest(struct amp *ampCtl);
+void 		ampState(struct amp *ampCtl, int state);
+void 		ampMute (struct amp *ampCtl, int state);
+
+#endif
@@ -0,0 +1,220 @@
+/*
+ * biquad : cascade kernels of the crossover
+ *
+ * A bank runs several cascades side by side, one lane per chain and channel : the left and right channels of the
+ * pre chain, or the left and right channels of the woofer and tweeter chains fed by the same signal.
+ * The buffers hold the frames one after the other, each frame holding the sample of every lane (width floats),
+ * so that a vector instruction computes the same section for several lanes at once.
+ * Each section runs over the whole block before the next one (transposed direct form II), keeping its coefficients
+ * and its state in registers. The vector kernels run the sections two by two to hide the latency of the recurrence.
+ *
+ * The scalar kernel is the reference : the vector kernels do the same operations in the same order, without fused
+ * multiply-add, and give the same results bit for bit.
+ * The kernel is chosen at run time among the ones the CPU supports : NEON on ARM (Wandboard), SSE2 or AVX2 on x86.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#include "log.h"
+#include "cpu.h"
+#include "ecp.h"
+#include "biquad.h"
+
+static struct biquadKernel	*kernel = NULL;		//Kernel of the new banks
+
+//Reference implementation, one lane after the other
+static void runScalar(struct biquadBank *b, float *buf, int frames){
+	float	b0, b1, b2, a1, a2, z0, z1, x, y, *c;
+	int		i, f, l, w = b->width;
+
+	for (l = 0 ; l < b->lanes ; l++) {
+		for (i = 0 ; i < b->nbSections ; i++) {
+			c = &b->coef[i * 5 * w + l];
+			b0 = c[0]; b1 = c[w]; b2 = c[2 * w]; a1 = c[3 * w]; a2 = c[4 * w];
+			z0 = b->z[i * 2 * w + l]; z1 = b->z[(i * 2 + 1) * w + l];
+			for (f = 0 ; f < frames ; f++) {
+				x = buf[f * w + l];
+				y = b0 * x + z0;
+				z0 = b1 * x - a1 * y + z1;
+				z1 = b2 * x - a2 * y;
+				buf[f * w + l] = y;
+			}
+			b->z[i * 2 * w + l] = z0; b->z[(i * 2 + 1) * w + l] = z1;
+		}
+	}
+}
+
+//Body of the vector kernels, vec holding width lanes
+//The sections run two by two, the second one a frame behind the first one : both recurrences are independent
+//within an iteration and overlap in the pipeline of the CPU, instead of waiting for each other
+#define SECTION(y, x, b0, b1, b2, a1, a2, z0, z1)											\
+	y = ADD(MUL(b0, x), z0);																	\
+	z0 = ADD(SUB(MUL(b1, x), MUL(a1, y)), z1);												\
+	z1 = SUB(MUL(b2, x), MUL(a2, y));
+
+#define VECTOR_KERNEL(name, vec, lanesAtOnce)															\
+static void name(struct biquadBank *b, float *buf, int frames){								\
+	vec		b0, b1, b2, a1, a2, z0, z1, c0, c1, c2, d1, d2, v0, v1, x, y, u;					\
+	float	*c, *z;																				\
+	int		i, f, g, w = b->width;																\
+																								\
+	if (frames <= 0) return;																	\
+	for (g = 0 ; g < b->lanes ; g += lanesAtOnce) {												\
+		for (i = 0 ; i < b->nbSections ; i += 2) {												\
+			c = &b->coef[i * 5 * w + g];														\
+			z = &b->z[i * 2 * w + g];															\
+			b0 = LOAD(c); b1 = LOAD(c + w); b2 = LOAD(c + 2 * w); a1 = LOAD(c + 3 * w); a2 = LOAD(c + 4 * w);	\
+			z0 = LOAD(z); z1 = LOAD(z + w);														\
+			if (i + 1 == b->nbSections) {						/* Last section alone */		\
+				for (f = 0 ; f < frames ; f++) {												\
+					x = LOAD(&buf[f * w + g]);													\
+					SECTION(y, x, b0, b1, b2, a1, a2, z0, z1)									\
+					STORE(&buf[f * w + g], y);													\
+				}																				\
+				STORE(z, z0); STORE(z + w, z1);													\
+				break;																			\
+			}																					\
+			c0 = LOAD(c + 5 * w); c1 = LOAD(c + 6 * w); c2 = LOAD(c + 7 * w); d1 = LOAD(c + 8 * w); d2 = LOAD(c + 9 * w);	\
+			v0 = LOAD(z + 2 * w); v1 = LOAD(z + 3 * w);											\
+			x = LOAD(buf + g);																	\
+			SECTION(u, x, b0, b1, b2, a1, a2, z0, z1)											\
+			for (f = 1 ; f < frames ; f++) {													\
+				x = LOAD(&buf[f * w + g]);														\
+				SECTION(y, u, c0, c1, c2, d1, d2, v0, v1)		/* Second section, frame f - 1 */	\
+				STORE(&buf[(f - 1) * w + g], y);												\
+				SECTION(u, x, b0, b1, b2, a1, a2, z0, z1)		/* First section, frame f */	\
+			}																					\
+			SECTION(y, u, c0, c1, c2, d1, d2, v0, v1)											\
+			STORE(&buf[(frames - 1) * w + g], y);												\
+			STORE(z, z0); STORE(z + w, z1); STORE(z + 2 * w, v0); STORE(z + 3 * w, v1);		\
+		}																						\
+	}																							\
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#define LOAD	_mm_load_ps
+#define STORE	_mm_store_ps
+#define ADD		_mm_add_ps
+#define SUB		_mm_sub_ps
+#define MUL		_mm_mul_ps
+__attribute__((target("sse2")))
+VECTOR_KERNEL(runSse2, __m128, 4)
+#undef LOAD
+#undef STORE
+#undef ADD
+#undef SUB
+#undef MUL
+
+#define LOAD	_mm256_load_ps
+#define STORE	_mm256_store_ps
+#define ADD		_mm256_add_ps
+#define SUB		_mm256_sub_ps
+#define MUL		_mm256_mul_ps
+__attribute__((target("avx2")))
+VECTOR_KERNEL(runAvx2, __m256, 8)
+#undef LOAD
+#undef STORE
+#undef ADD
+#undef SUB
+#undef MUL
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+//vmulq and vaddq rather than vmlaq / vfmaq to keep the results of the scalar kernel
+#define LOAD	vld1q_f32
+#define STORE	vst1q_f32
+#define ADD		vaddq_f32
+#define SUB		vsubq_f32
+#define MUL		vmulq_f32
+VECTOR_KERNEL(runNeon, float32x4_t, 4)
+#undef LOAD
+#undef STORE
+#undef ADD
+#undef SUB
+#undef MUL
+#endif
+
+//Kernels by order of preference, the last supported one is chosen
+struct biquadKernel biquadKernels[] = {
+	{"scalar",	cpuAlways,	1,	runScalar},
+#if defined(__x86_64__) || defined(__i386__)
+	{"sse2",	cpuSse2,	4,	runSse2},
+	{"avx2",	cpuAvx2,	8,	runAvx2},
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+	{"neon",	cpuNeon,	4,	runNeon},
+#endif
+	{NULL}
+};
+
+//Selects the kernel of the banks set up from now on
+//name : kernel name, NULL or "auto" for the best one the CPU supports
+//Returns NULL if the kernel is unknown or not supported by the CPU
+struct biquadKernel *biquadSelect(char *name){
+	struct biquadKernel *k;
+
+	if ((k = cpuSelect(biquadKernels, sizeof(struct biquadKernel), name, "Biquad")) == NULL) return NULL;
+	kernel = k;
+	return kernel;
+}
+
+//Packs the sections of several chains into a bank, each chain running on channels lanes
+//sos : coefficients compiled by ecpDesign (ECP_SOS_STRIDE floats per section)
+//Returns -1 on error
+int biquadSetup(struct biquadBank *b, float **sos, int *nbSections, int nbChains, int channels){
+	float	*s;
+	int		i, c, l, n = 0, size;
+
+	if (kernel == NULL && biquadSelect(NULL) == NULL) return -1;
+	memset(b, 0, sizeof(struct biquadBank));
+	for (c = 0 ; c < nbChains ; c++) if (nbSections[c] > n) n = nbSections[c];
+
+	b->kernel = kernel;
+	b->lanes = nbChains * channels;
+	b->width = (b->lanes + kernel->width - 1) / kernel->width * kernel->width;
+	b->nbSections = n;
+	size = (n > 0 ? n : 1) * b->width * sizeof(float);
+	if (posix_memalign((void **) &b->coef, BQ_ALIGN, 5 * size) != 0 || posix_memalign((void **) &b->z, BQ_ALIGN, 2 * size) != 0) {
+		logError("Biquad bank : out of memory");
+		return -1;
+	}
+	memset(b->coef, 0, 5 * size);
+	memset(b->z, 0, 2 * size);
+	for (i = 0 ; i < n ; i++) {
+		for (l = 0 ; l < b->width ; l++) {
+			c = l / channels;
+			if (l < b->lanes && i < nbSections[c]) s = &sos[c][i * ECP_SOS_STRIDE];
+			else s = NULL;
+			b->coef[(i * 5) * b->width + l] = s ? s[0] : 1;				//Pass-through : b0 = 1
+			b->coef[(i * 5 + 1) * b->width + l] = s ? s[1] : 0;
+			b->coef[(i * 5 + 2) * b->width + l] = s ? s[2] : 0;
+			b->coef[(i * 5 + 3) * b->width + l] = s ? s[3] : 0;
+			b->coef[(i * 5 + 4) * b->width + l] = s ? s[4] : 0;
+		}
+	}
+	return 0;
+}
+
+void biquadReset(struct biquadBank *b){
+	if (b->z != NULL) memset(b->z, 0, (b->nbSections > 0 ? b->nbSections : 1) * 2 * b->width * sizeof(float));
+}
+
+void biquadFree(struct biquadBank *b){
+	free(b->coef);
+	free(b->z);
+	b->coef = b->z = NULL;
+	b->nbSections = 0;
+}
+
+//Runs the bank in place on frames of width floats
+void biquadRun(struct biquadBank *b, float *buf, int frames){
+	if (b->nbSections > 0) b->kernel->run(b, buf, frames);
+}
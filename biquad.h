@@ -0,0 +1,33 @@
+#ifndef BIQUAD_H
+#define BIQUAD_H
+
+#define BQ_MAX_WIDTH		8				/* Widest vector of the kernels in floats (AVX2) */
+#define BQ_ALIGN			64
+
+struct biquadBank;
+
+struct biquadKernel {						//One implementation of the cascade
+	char	*name;							//First fields : those of struct cpuKernel (cpu.h)
+	int		(*supported)(void);				//Runtime CPU detection
+	int		width;							//Lanes processed at once
+	void	(*run)(struct biquadBank *b, float *buf, int frames);
+};
+
+struct biquadBank {							//Cascades run side by side : one lane per chain and channel
+	struct biquadKernel	*kernel;
+	int		lanes;							//Lanes used
+	int		width;							//Lanes of the buffers : lanes padded to the vector width of the kernel
+	int		nbSections;						//Sections of the longest chain, the others are padded with pass-through sections
+	float	*coef;							//Per section : b0 of all the lanes, b1, b2, a1, a2 (nbSections * 5 * width)
+	float	*z;								//Per section : z0 of all the lanes, z1 (nbSections * 2 * width)
+};
+
+extern struct biquadKernel biquadKernels[];	// All the kernels built in, the scalar reference first, NULL name at the end
+
+struct biquadKernel *biquadSelect(char *name);
+int 	biquadSetup(struct biquadBank *b, float **sos, int *nbSections, int nbChains, int channels);
+void 	biquadReset(struct biquadBank *b);
+void 	biquadFree(struct biquadBank *b);
+void 	biquadRun(struct biquadBank *b, float *buf, int frames);
+
+#endif
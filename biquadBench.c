@@ -0,0 +1,215 @@
+/*
+ * biquadBench : checks the biquad kernels against the scalar reference and measures them
+ *
+ * Check : each kernel the CPU supports runs random peaking EQ cascades on noise, side by side with the scalar
+ * kernel, over several blocks. The largest difference in ULP must stay within the tolerance (0 : bit exact).
+ * Benchmark : ns per frame of each kernel by number of sections and number of stereo chains run side by side.
+ * The exit status is 1 if a kernel fails the check.
+ *
+ * Usage : biquadBench [-u tolerance ULP] [-b block frames] [-t seconds per measure] [-c check only]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+
+#include "log.h"
+#include "ecp.h"
+#include "biquad.h"
+
+#define BENCH_RATE		44100
+#define BENCH_CHANNELS	2
+#define BENCH_BLOCK		1024
+#define BENCH_BLOCKS	64			/* Blocks compared by the check */
+#define BENCH_TIME		0.2			/* Seconds per measure */
+
+static int stages[] = {1, 2, 4, 8, 16, 32, 0};
+static int chains[] = {1, 2, 4, 0};
+
+//Designs random peaking EQ cascades, the first chain with nbSections sections, the next ones with one less each
+void randomChains(struct ecpChain *c, int nbChains, int nbSections){
+	int i, j;
+
+	for (i = 0 ; i < nbChains ; i++) {
+		memset(&c[i], 0, sizeof(struct ecpChain));
+		c[i].nbPlugins = nbSections - i > 0 ? nbSections - i : 1;
+		for (j = 0 ; j < c[i].nbPlugins ; j++) {
+			c[i].plugin[j].type = ECP_PARAEQ;
+			c[i].plugin[j].nbSections = 1;
+			c[i].plugin[j].p[0] = (drand48() - 0.5) * 24;					//gain -12..12 dB
+			c[i].plugin[j].p[1] = 20 * pow(1000, drand48());				//20 Hz..20 kHz
+			c[i].plugin[j].p[2] = 0.3 + drand48() * 8;						//Q
+		}
+		ecpDesign(&c[i], BENCH_RATE);
+	}
+}
+
+//Sets up a bank of the chains for the current kernel
+int setup(struct biquadBank *b, struct ecpChain *c, int nbChains){
+	float	*sos[BQ_MAX_WIDTH];
+	int		nbSections[BQ_MAX_WIDTH];
+	int		i;
+
+	for (i = 0 ; i < nbChains ; i++) {
+		sos[i] = c[i].sos;
+		nbSections[i] = c[i].nbSections;
+	}
+	return biquadSetup(b, sos, nbSections, nbChains, BENCH_CHANNELS);
+}
+
+//Fills a block with noise, each chain getting the same stereo signal
+void noise(float *buf, int width, int lanes, int frames){
+	float	x[BENCH_CHANNELS];
+	int		i, l;
+
+	for (i = 0 ; i < frames ; i++) {
+		for (l = 0 ; l < BENCH_CHANNELS ; l++) x[l] = drand48() - 0.5;
+		for (l = 0 ; l < width ; l++) buf[i * width + l] = l < lanes ? x[l % BENCH_CHANNELS] : 0;
+	}
+}
+
+//Distance in units in the last place between two floats
+int64_t ulp(float a, float b){
+	int32_t ia, ib;
+
+	memcpy(&ia, &a, sizeof(ia));
+	memcpy(&ib, &b, sizeof(ib));
+	if (ia < 0) ia = INT32_MIN - ia;
+	if (ib < 0) ib = INT32_MIN - ib;
+	return llabs((int64_t) ia - ib);
+}
+
+//Compares a kernel with the scalar reference, returns the largest difference in ULP
+int64_t check(struct biquadKernel *k, int nbChains, int nbSections, int block){
+	struct ecpChain		c[BQ_MAX_WIDTH];
+	struct biquadBank	ref, test;
+	float				*in = NULL, *bufRef = NULL, *bufTest = NULL;
+	int64_t				d, maxUlp = 0;
+	int					i, f, l;
+
+	randomChains(c, nbChains, nbSections);
+	biquadSelect("scalar");
+	setup(&ref, c, nbChains);
+	biquadSelect(k->name);
+	setup(&test, c, nbChains);
+	posix_memalign((void **) &in, BQ_ALIGN, block * test.width * sizeof(float));
+	posix_memalign((void **) &bufRef, BQ_ALIGN, block * ref.width * sizeof(float));
+	posix_memalign((void **) &bufTest, BQ_ALIGN, block * test.width * sizeof(float));
+
+	for (i = 0 ; i < BENCH_BLOCKS ; i++) {
+		noise(in, test.width, test.lanes, block);
+		memcpy(bufTest, in, block * test.width * sizeof(float));
+		for (f = 0 ; f < block ; f++)
+			for (l = 0 ; l < ref.width ; l++) bufRef[f * ref.width + l] = in[f * test.width + l];
+		biquadRun(&ref, bufRef, block);
+		biquadRun(&test, bufTest, block);
+		for (f = 0 ; f < block ; f++) {
+			for (l = 0 ; l < ref.lanes ; l++) {
+				d = ulp(bufRef[f * ref.width + l], bufTest[f * test.width + l]);
+				if (d > maxUlp) maxUlp = d;
+			}
+		}
+	}
+	biquadFree(&ref);
+	biquadFree(&test);
+	for (i = 0 ; i < nbChains ; i++) ecpFree(&c[i]);
+	free(in); free(bufRef); free(bufTest);
+	return maxUlp;
+}
+
+//Returns the ns per frame of a kernel
+double measure(struct biquadKernel *k, int nbChains, int nbSections, int block, double seconds){
+	struct ecpChain		c[BQ_MAX_WIDTH];
+	struct biquadBank	b;
+	struct timespec		t0, t1;
+	float				*buf = NULL;
+	double				elapsed;
+	long				frames = 0;
+	int					i;
+
+	randomChains(c, nbChains, nbSections);
+	biquadSelect(k->name);
+	setup(&b, c, nbChains);
+	posix_memalign((void **) &buf, BQ_ALIGN, block * b.width * sizeof(float));
+	noise(buf, b.width, b.lanes, block);
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	do {
+		for (i = 0 ; i < 16 ; i++) {
+			biquadRun(&b, buf, block);
+			frames += block;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	} while (elapsed < seconds);
+
+	biquadFree(&b);
+	for (i = 0 ; i < nbChains ; i++) ecpFree(&c[i]);
+	free(buf);
+	return elapsed * 1e9 / frames;
+}
+
+//Flushes denormal numbers to zero, as the DSP engine does
+void flushDenormals(){
+#if defined(__SSE__)
+	unsigned int csr;
+	__asm__ volatile ("stmxcsr %0" : "=m" (csr));
+	csr |= 0x8040;
+	__asm__ volatile ("ldmxcsr %0" : : "m" (csr));
+#endif
+}
+
+int main(int argc, char *argv[]){
+	struct biquadKernel	*k;
+	int64_t				d, u, tolerance = 0;
+	double				seconds = BENCH_TIME;
+	bool				checkOnly = false;
+	int					block = BENCH_BLOCK, opt, i, j, status = 0;
+
+	while ((opt = getopt(argc, argv, "u:b:t:c")) != -1) {
+		switch (opt) {
+			case 'u': tolerance = atoll(optarg); break;
+			case 'b': block = atoi(optarg); break;
+			case 't': seconds = atof(optarg); break;
+			case 'c': checkOnly = true; break;
+			default:
+				fprintf(stderr, "Usage : %s [-u tolerance ULP] [-b block frames] [-t seconds per measure] [-c]\n", argv[0]);
+				return 1;
+		}
+	}
+	flushDenormals();
+	srand48(1);
+
+	printf("Check against the scalar kernel, %i blocks of %i frames, tolerance %lli ULP\n", BENCH_BLOCKS, block, (long long) tolerance);
+	for (k = biquadKernels ; k->name != NULL ; k++) {
+		if (!k->supported()) {
+			printf("  %-8s not supported by this CPU\n", k->name);
+			continue;
+		}
+		for (d = 0, i = 0 ; chains[i] != 0 ; i++)
+			for (j = 0 ; stages[j] != 0 ; j++) {
+				u = check(k, chains[i], stages[j], block);
+				if (u > d) d = u;
+			}
+		printf("  %-8s max %lli ULP %s\n", k->name, (long long) d, d > tolerance ? "FAILED" : "ok");
+		if (d > tolerance) status = 1;
+	}
+	if (checkOnly) return status;
+
+	printf("\nns per frame, block of %i frames\n%-8s %-7s", block, "kernel", "chains");
+	for (j = 0 ; stages[j] != 0 ; j++) printf(" %7i", stages[j]);
+	printf("  sections\n");
+	for (k = biquadKernels ; k->name != NULL ; k++) {
+		if (!k->supported()) continue;
+		for (i = 0 ; chains[i] != 0 ; i++) {
+			printf("%-8s %-7i", k->name, chains[i]);
+			for (j = 0 ; stages[j] != 0 ; j++) printf(" %7.2f", measure(k, chains[i], stages[j], block, seconds));
+			printf("\n");
+		}
+	}
+	return status;
+}
@@ -0,0 +1,69 @@
+/*
+ * cpu : runtime detection of the vector instructions and choice of the kernels of the DSP modules
+ *
+ * Each module with vector kernels builds them for the instruction sets of the target and lists them with the probe
+ * of the CPU they need : the one named in dspKernel is taken, or else the last one the CPU supports.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__arm__) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+#include "log.h"
+#include "cpu.h"
+
+//Probe of the scalar kernels
+int cpuAlways(){
+	return 1;
+}
+
+int cpuSse2(){
+#if defined(__x86_64__) || defined(__i386__)
+	return __builtin_cpu_supports("sse2");
+#else
+	return 0;
+#endif
+}
+
+int cpuAvx2(){
+#if defined(__x86_64__) || defined(__i386__)
+	return __builtin_cpu_supports("avx2");
+#else
+	return 0;
+#endif
+}
+
+int cpuNeon(){
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#if defined(__arm__)
+	return (getauxval(AT_HWCAP) & HWCAP_NEON) != 0;
+#else
+	return 1;													//Always present on aarch64
+#endif
+#else
+	return 0;
+#endif
+}
+
+//Looks for a kernel in the table of a module, kernels of size bytes each
+//name : kernel name, NULL or "auto" for the last one the CPU supports, what : module named in the log
+//Returns NULL if the kernel is unknown or not supported by the CPU
+void *cpuSelect(void *kernels, size_t size, char *name, char *what){
+	struct cpuKernel	*k, *best = NULL;
+	char				*p;
+
+	for (p = kernels ; (k = (struct cpuKernel *) p)->name != NULL ; p += size) {
+		if (!k->supported()) continue;
+		if (name == NULL || strcmp(name, "auto") == 0 || strcmp(name, k->name) == 0) best = k;
+	}
+	if (best == NULL) {
+		logError("%s kernel %s not supported", what, name);
+		return NULL;
+	}
+	logDebug("%s kernel %s", what, best->name);
+	return best;
+}
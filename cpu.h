@@ -0,0 +1,19 @@
+#ifndef CPU_H
+#define CPU_H
+
+#include <stddef.h>
+
+//The vector kernels of a module are listed in a table by order of preference, the scalar reference first and a NULL
+//name at the end. Their structures start with these two fields, for cpuSelect
+struct cpuKernel {
+	char	*name;
+	int		(*supported)(void);				//Runtime CPU detection
+};
+
+int 	cpuAlways(void);
+int 	cpuSse2(void);
+int 	cpuAvx2(void);
+int 	cpuNeon(void);
+void 	*cpuSelect(void *kernels, size_t size, char *name, char *what);
+
+#endif
@@ -0,0 +1,141 @@
+/*
+ * delay : time alignment of the drivers, with a resolution finer than a frame
+ *
+ * The delay is split into whole frames, read back from a ring, and a fraction of a frame given by a windowed sinc
+ * of DELAY_TAPS taps (within 0.1 dB up to 20 kHz at 44100 Hz). The filter itself delays by DELAY_LATENCY frames,
+ * taken from the whole frames : a fractional delay needs at least DELAY_LATENCY frames, shorter ones are rounded.
+ * The first DELAY_TAPS - 1 frames of the ring are copied after its end so that the taps are always read in one
+ * piece : the cost per frame is the same whatever the delay.
+ *
+ * delaySet may be called from another thread while playing : it computes the filter and publishes it with a
+ * pointer, taken by delayRun at the start of the next block. The output then crossfades from the former delay to
+ * the new one over DELAY_FADE s, without click. delayRun publishes the oldest setting it may still read : the ones
+ * published before are freed by the next delaySet.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "log.h"
+#include "sinc.h"
+#include "delay.h"
+
+//Allocates a ring for delays up to maxDelay s, no delay set
+//Returns -1 on error
+int delayInit(struct delayLine *d, double maxDelay, int rate){
+	memset(d, 0, sizeof(struct delayLine));
+	d->rate = rate;
+	d->size = lrint(maxDelay * rate) + DELAY_TAPS;
+	d->fadeFrames = lrint(DELAY_FADE * rate);
+	if ((d->line = calloc((d->size + DELAY_TAPS - 1) * DELAY_CHANNELS, sizeof(float))) == NULL) return -1;
+	delaySet(d, 0);
+	d->cur = d->oldest = d->next;
+	return 0;
+}
+
+//Publishes a new delay in s, applied with a crossfade from the next block
+//Returns the delay applied in s : rounded to a whole frame under DELAY_LATENCY frames, at most the length of the ring
+double delaySet(struct delayLine *d, double delay){
+	struct delayTaps	*t, *older, *oldest = __atomic_load_n(&d->oldest, __ATOMIC_ACQUIRE);
+	double				frames = delay * d->rate, frac, x, sum;
+	int					k;
+
+	for (t = oldest != NULL ? oldest->older : NULL ; t != NULL ; t = older) {	//Settings delayRun is done with
+		older = t->older;
+		free(t);
+	}
+	if (oldest != NULL) oldest->older = NULL;
+	if (frames < 0) frames = 0;
+	if (frames > d->size - DELAY_TAPS) frames = d->size - DELAY_TAPS;
+	frac = frames - floor(frames);
+	if (frac < 1e-6 || frac > 1 - 1e-6 || frames < DELAY_LATENCY) frames = round(frames);
+	if (d->next != NULL && d->next->frames == frames) return frames / d->rate;
+	if ((t = calloc(1, sizeof(struct delayTaps))) == NULL) {
+		logError("Delay : out of memory");
+		return d->next != NULL ? d->next->frames / d->rate : 0;
+	}
+	t->frames = frames;
+	t->fractional = frames != round(frames);
+	t->whole = t->fractional ? (int) floor(frames) - DELAY_LATENCY : (int) frames;
+	if (t->fractional) {
+		for (sum = 0, k = 0 ; k < DELAY_TAPS ; k++) {			//Tap k reads the input whole + k frames back
+			x = k - DELAY_LATENCY - (frames - floor(frames));
+			t->h[DELAY_TAPS - 1 - k] = sincLowpass(x, 1) * sincKaiser(x, DELAY_TAPS / 2, DELAY_BETA);
+			sum += t->h[DELAY_TAPS - 1 - k];
+		}
+		for (k = 0 ; k < DELAY_TAPS ; k++) t->h[k] /= sum;		//Unity gain at DC
+	}
+	t->older = d->next;
+	__atomic_store_n(&d->next, t, __ATOMIC_RELEASE);
+	return frames / d->rate;
+}
+
+//Starts a session : silence in the ring, the last delay published applied at once
+void delayReset(struct delayLine *d){
+	memset(d->line, 0, (d->size + DELAY_TAPS - 1) * DELAY_CHANNELS * sizeof(float));
+	d->pos = 0;
+	d->cur = __atomic_load_n(&d->next, __ATOMIC_ACQUIRE);
+	d->fade = 0;
+	__atomic_store_n(&d->oldest, d->cur, __ATOMIC_RELEASE);
+}
+
+void delayFree(struct delayLine *d){
+	struct delayTaps *t, *older;
+
+	for (t = d->next ; t != NULL ; t = older) {
+		older = t->older;
+		free(t);
+	}
+	free(d->line);
+	memset(d, 0, sizeof(struct delayLine));
+}
+
+//Output of a setting for the newest frame of the ring, both channels
+static inline void readTaps(struct delayLine *d, struct delayTaps *t, float *y){
+	float	*x, l = 0, r = 0;
+	int		b, k;
+
+	if (!t->fractional) {
+		b = d->pos - t->whole < 0 ? d->pos - t->whole + d->size : d->pos - t->whole;
+		y[0] = d->line[b * DELAY_CHANNELS];
+		y[1] = d->line[b * DELAY_CHANNELS + 1];
+		return;
+	}
+	b = d->pos - t->whole - (DELAY_TAPS - 1);
+	x = d->line + (b < 0 ? b + d->size : b) * DELAY_CHANNELS;
+	for (k = 0 ; k < DELAY_TAPS ; k++) {
+		l += t->h[k] * x[k * DELAY_CHANNELS];
+		r += t->h[k] * x[k * DELAY_CHANNELS + 1];
+	}
+	y[0] = l;
+	y[1] = r;
+}
+
+//Delays stereo frames, left at in[i * inStride] and right just after, out may be in
+void delayRun(struct delayLine *d, float *in, int inStride, float *out, int outStride, int frames){
+	struct delayTaps	*next = __atomic_load_n(&d->next, __ATOMIC_ACQUIRE);
+	float				y[DELAY_CHANNELS], z[DELAY_CHANNELS], a;
+	int					i, ch;
+
+	if (next != d->cur && d->fade == 0) {						//A new setting, once the previous crossfade is over
+		d->prev = d->cur;
+		d->cur = next;
+		d->fade = d->fadeFrames;
+		__atomic_store_n(&d->oldest, d->prev, __ATOMIC_RELEASE);	//The former prev is no longer read
+	}
+	for (i = 0 ; i < frames ; i++) {
+		d->pos = d->pos + 1 == d->size ? 0 : d->pos + 1;
+		for (ch = 0 ; ch < DELAY_CHANNELS ; ch++) {
+			d->line[d->pos * DELAY_CHANNELS + ch] = in[i * inStride + ch];
+			if (d->pos < DELAY_TAPS - 1) d->line[(d->size + d->pos) * DELAY_CHANNELS + ch] = in[i * inStride + ch];
+		}
+		readTaps(d, d->cur, y);
+		if (d->fade > 0) {
+			readTaps(d, d->prev, z);
+			a = (float) d->fade-- / d->fadeFrames;
+			for (ch = 0 ; ch < DELAY_CHANNELS ; ch++) y[ch] += (z[ch] - y[ch]) * a;
+		}
+		for (ch = 0 ; ch < DELAY_CHANNELS ; ch++) out[i * outStride + ch] = y[ch];
+	}
+}
@@ -0,0 +1,39 @@
+#ifndef DELAY_H
+#define DELAY_H
+
+#include <stdbool.h>
+
+#define DELAY_CHANNELS		2
+#define DELAY_TAPS			32				/* Taps of the fractional delay filter */
+#define DELAY_LATENCY		(DELAY_TAPS / 2 - 1)	/* Frames of the filter : shortest delay with a fractional part */
+#define DELAY_BETA			4.0				/* Kaiser window of the filter */
+#define DELAY_FADE			0.02			/* Crossfade when the delay changes, in s */
+
+struct delayTaps {							//One setting of the delay, published by delaySet
+	double				frames;				//Delay in frames
+	int					whole;				//Frames between the newest input and the newest tap
+	bool				fractional;			//false : a whole number of frames, no filter
+	float				h[DELAY_TAPS];		//Filter, in the order of the line : oldest frame first
+	struct delayTaps	*older;				//Settings published before, freed by delaySet once delayRun is done with them
+};
+
+struct delayLine {							//Whole frames from a ring, fraction of a frame by a short windowed sinc
+	int					rate;
+	int					size;				//Frames of the ring, followed by a copy of its first DELAY_TAPS - 1 frames
+	float				*line;
+	int					pos;				//Frame of the newest input
+	struct delayTaps	*cur;
+	struct delayTaps	*prev;				//Setting faded out
+	int					fade;				//Frames left in the crossfade from prev to cur
+	int					fadeFrames;
+	struct delayTaps	*next;				//Last setting published, taken by delayRun at the start of a block
+	struct delayTaps	*oldest;			//Oldest setting delayRun may still read, published by it : the older ones are unused
+};
+
+int 	delayInit(struct delayLine *d, double maxDelay, int rate);
+double 	delaySet(struct delayLine *d, double delay);
+void 	delayReset(struct delayLine *d);
+void 	delayRun(struct delayLine *d, float *in, int inStride, float *out, int outStride, int frames);
+void 	delayFree(struct delayLine *d);
+
+#endif
@@ -0,0 +1,157 @@
+/*
+ * detect : presence of a signal on the input of the DSP engine, for the automatic power on and standby
+ *
+ * Each block read is measured once, before the volume : its peak and its RMS. The signal appears when the RMS stays
+ * above the level for the attack time (a click or a hum peak does not wake the amplifier) and goes when the peaks stay
+ * below the level minus the hysteresis for the hold time (a quiet passage keeps it on). The times are counted in
+ * frames of the input : they stop with it.
+ *
+ * The measure is one pass of loads, an absolute value, a max and a multiply-add per sample : a vector kernel is chosen
+ * at run time as the biquad kernels (see biquad.c). The peaks are the same whatever the kernel, the sums of squares
+ * differ by their rounding only.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#include "log.h"
+#include "cpu.h"
+#include "detect.h"
+
+#define DETECT_SCALE		(1.0f / 2147483648.0f)	/* s32 to full scale 1 */
+
+static struct detectKernel	*kernel = NULL;		//Kernel of the detectors set up from now on
+
+//Reference implementation : peak and sum of squares of s32 samples, full scale 1
+static void runScalar(int32_t *in, int samples, float *peak, float *power){
+	float	x, p = 0, s = 0;
+	int		i;
+
+	for (i = 0 ; i < samples ; i++) {
+		x = in[i] * DETECT_SCALE;
+		p = fabsf(x) > p ? fabsf(x) : p;
+		s += x * x;
+	}
+	*peak = p;
+	*power = s;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2")))
+static void runSse2(int32_t *in, int samples, float *peak, float *power){
+	__m128	k = _mm_set1_ps(DETECT_SCALE), sign = _mm_set1_ps(-0.0f), p = _mm_setzero_ps(), s = _mm_setzero_ps(), x;
+	float	l[4], tp, ts;
+	int		i, j;
+
+	for (i = 0 ; i + 4 <= samples ; i += 4) {
+		x = _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((__m128i *) (in + i))), k);
+		p = _mm_max_ps(p, _mm_andnot_ps(sign, x));
+		s = _mm_add_ps(s, _mm_mul_ps(x, x));
+	}
+	runScalar(in + i, samples - i, &tp, &ts);
+	_mm_storeu_ps(l, p);
+	for (j = 0 ; j < 4 ; j++) tp = l[j] > tp ? l[j] : tp;
+	_mm_storeu_ps(l, s);
+	*peak = tp;
+	*power = ts + (l[0] + l[1]) + (l[2] + l[3]);
+}
+
+__attribute__((target("avx2")))
+static void runAvx2(int32_t *in, int samples, float *peak, float *power){
+	__m256	k = _mm256_set1_ps(DETECT_SCALE), sign = _mm256_set1_ps(-0.0f), p = _mm256_setzero_ps(), s = _mm256_setzero_ps(), x;
+	float	l[8], tp, ts;
+	int		i, j;
+
+	for (i = 0 ; i + 8 <= samples ; i += 8) {
+		x = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_loadu_si256((__m256i *) (in + i))), k);
+		p = _mm256_max_ps(p, _mm256_andnot_ps(sign, x));
+		s = _mm256_add_ps(s, _mm256_mul_ps(x, x));
+	}
+	runScalar(in + i, samples - i, &tp, &ts);
+	_mm256_storeu_ps(l, p);
+	for (j = 0 ; j < 8 ; j++) tp = l[j] > tp ? l[j] : tp;
+	_mm256_storeu_ps(l, s);
+	*peak = tp;
+	*power = ts + ((l[0] + l[1]) + (l[2] + l[3])) + ((l[4] + l[5]) + (l[6] + l[7]));
+}
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+static void runNeon(int32_t *in, int samples, float *peak, float *power){
+	float32x4_t	k = vdupq_n_f32(DETECT_SCALE), p = vdupq_n_f32(0), s = vdupq_n_f32(0), x;
+	float		l[4], tp, ts;
+	int			i, j;
+
+	for (i = 0 ; i + 4 <= samples ; i += 4) {
+		x = vmulq_f32(vcvtq_f32_s32(vld1q_s32(in + i)), k);
+		p = vmaxq_f32(p, vabsq_f32(x));
+		s = vaddq_f32(s, vmulq_f32(x, x));
+	}
+	runScalar(in + i, samples - i, &tp, &ts);
+	vst1q_f32(l, p);
+	for (j = 0 ; j < 4 ; j++) tp = l[j] > tp ? l[j] : tp;
+	vst1q_f32(l, s);
+	*peak = tp;
+	*power = ts + (l[0] + l[1]) + (l[2] + l[3]);
+}
+#endif
+
+//Kernels by order of preference, the last supported one is chosen
+struct detectKernel detectKernels[] = {
+	{"scalar",	cpuAlways,	runScalar},
+#if defined(__x86_64__) || defined(__i386__)
+	{"sse2",	cpuSse2,	runSse2},
+	{"avx2",	cpuAvx2,	runAvx2},
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+	{"neon",	cpuNeon,	runNeon},
+#endif
+	{NULL}
+};
+
+//Selects the kernel of the detectors set up from now on
+//name : kernel name, NULL or "auto" for the best one the CPU supports
+//Returns NULL if the kernel is unknown or not supported by the CPU
+struct detectKernel *detectSelect(char *name){
+	struct detectKernel *k;
+
+	if ((k = cpuSelect(detectKernels, sizeof(struct detectKernel), name, "Detector")) == NULL) return NULL;
+	kernel = k;
+	return kernel;
+}
+
+//level : RMS waking in dBFS, hysteresis : dB below level the peaks stay when silent
+//attack : s above level before the signal is present, hold : s of silence before it is absent
+void detectInit(struct detect *d, float level, float hysteresis, float attack, float hold, int rate){
+	memset(d, 0, sizeof(struct detect));
+	if (kernel == NULL) detectSelect(NULL);
+	d->kernel = kernel;
+	d->on = pow(10, level / 20);
+	d->off = pow(10, (level - hysteresis) / 20);
+	d->attack = attack * rate;
+	d->hold = hold * rate;
+}
+
+//Measures a block of interleaved stereo frames
+//Returns true when the presence of the signal changes
+bool detectRun(struct detect *d, int32_t *in, int frames){
+	float power;
+
+	if (frames <= 0) return false;
+	d->kernel->run(in, frames * DETECT_CHANNELS, &d->peak, &power);
+	d->rms = sqrtf(power / (frames * DETECT_CHANNELS));
+	if (d->present ? d->peak < d->off : d->rms >= d->on) d->count += frames;
+	else d->count = 0;
+	if (d->count < (d->present ? d->hold : d->attack)) return false;
+	d->present = !d->present;
+	d->count = 0;
+	return true;
+}
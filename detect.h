@@ -0,0 +1,33 @@
+#ifndef DETECT_H
+#define DETECT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define DETECT_CHANNELS		2
+
+struct detectKernel {						//One implementation of the level measure
+	char	*name;							//First fields : those of struct cpuKernel (cpu.h)
+	int		(*supported)(void);				//Runtime CPU detection
+	void	(*run)(int32_t *in, int samples, float *peak, float *power);
+};
+
+struct detect {								//Presence of a signal on the input of the engine
+	struct detectKernel	*kernel;
+	float				on;					//RMS of a block waking, full scale 1
+	float				off;				//Peak below which a block is silent
+	int64_t				attack;				//Frames above on before the signal is present
+	int64_t				hold;				//Frames below off before the signal is absent
+	int64_t				count;				//Frames toward the next change
+	bool				present;
+	float				peak;				//Last block, full scale 1
+	float				rms;
+};
+
+extern struct detectKernel detectKernels[];	// All the kernels built in, the scalar reference first, NULL name at the end
+
+struct detectKernel *detectSelect(char *name);
+void 	detectInit(struct detect *d, float level, float hysteresis, float attack, float hold, int rate);
+bool 	detectRun(struct detect *d, int32_t *in, int frames);
+
+#endif
@@ -0,0 +1,243 @@
+/*
+ * dither : conversion of the outputs to s16 for the 16 bits DACs
+ *
+ * Each sample is scaled to 16 bits, added a triangular (TPDF) dither of +-1 LSB, saturated and rounded to the
+ * nearest : the quantisation error becomes a white noise independent of the signal instead of the distortion of
+ * the truncation, audible on quiet passages and fade outs.
+ * The dither comes from DITHER_LANES xorshift32 generators, one per sample of a group of 4 frames : the vector
+ * kernels step them all at once. A triangular value is the difference of the two halves of a 32 bits draw.
+ *
+ * Modes : none (rounding only), tpdf, shaped (tpdf and a 3 taps error feedback filter, F-weighted after Wannamaker,
+ * pushing the noise above 15 kHz where the ear is less sensitive). The error feedback is a recurrence from one
+ * sample to the next : the shaped mode runs the scalar code whatever the kernel.
+ *
+ * The scalar kernel is the reference : the vector kernels do the same operations in the same order and give the
+ * same samples. The kernel is chosen at run time among the ones the CPU supports, as the biquad kernels (see biquad.c).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#include "log.h"
+#include "cpu.h"
+#include "dither.h"
+
+#define DITHER_SCALE		(1.0f / 65536)	/* Triangular value to LSB */
+#define DITHER_MAX_ERR		2.0f			/* Error fed back when the output saturates, in LSB */
+
+static const float shape[DITHER_ORDER] = {1.623f, -0.982f, 0.109f};
+
+static struct ditherKernel	*kernel = NULL;		//Kernel of the new outputs
+
+char *ditherModes[] = {"none", "tpdf", "shaped", NULL};
+
+//Steps the generators
+static inline void nextGroup(uint32_t *s){
+	int l;
+
+	for (l = 0 ; l < DITHER_LANES ; l++) {
+		s[l] ^= s[l] << 13;
+		s[l] ^= s[l] >> 17;
+		s[l] ^= s[l] << 5;
+	}
+}
+
+//Triangular value in -65535..65535 from a draw
+static inline float triangular(uint32_t r){
+	return (float) ((int32_t) (r & 0xFFFF) - (int32_t) (r >> 16));
+}
+
+//Reference implementation : frames of stereo samples, left at in[i * stride] and right just after
+//scale : dither in LSB per triangular unit, 0 for none
+static void runScalar(uint32_t *state, float *in, int stride, int16_t *out, int frames, float scale){
+	float	a, b, v;
+	int		i, f, ch;
+
+	for (i = 0 ; i < frames ; i += DITHER_LANES / DITHER_CHANNELS) {
+		nextGroup(state);
+		for (f = i ; f < frames && f < i + DITHER_LANES / DITHER_CHANNELS ; f++) {
+			for (ch = 0 ; ch < DITHER_CHANNELS ; ch++) {
+				a = in[f * stride + ch] * 32768.0f;
+				b = triangular(state[(f - i) * DITHER_CHANNELS + ch]) * scale;
+				v = a + b;
+				v = v < 32767.0f ? v : 32767.0f;
+				v = v > -32768.0f ? v : -32768.0f;
+				out[f * DITHER_CHANNELS + ch] = lrintf(v);
+			}
+		}
+	}
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+//xorshift32 of 4 generators
+#define XORSHIFT_SSE(s)																		\
+	s = _mm_xor_si128(s, _mm_slli_epi32(s, 13));												\
+	s = _mm_xor_si128(s, _mm_srli_epi32(s, 17));												\
+	s = _mm_xor_si128(s, _mm_slli_epi32(s, 5));
+
+//Scaled, dithered and saturated samples of 2 frames, rounded to the nearest
+#define CONVERT_SSE(x, s)																	\
+	_mm_cvtps_epi32(_mm_max_ps(_mm_min_ps(_mm_add_ps(_mm_mul_ps(x, k32768),					\
+		_mm_mul_ps(_mm_cvtepi32_ps(_mm_sub_epi32(_mm_and_si128(s, low), _mm_srli_epi32(s, 16))), k)), max), min))
+
+__attribute__((target("sse2")))
+static void runSse2(uint32_t *state, float *in, int stride, int16_t *out, int frames, float scale){
+	__m128i	s0 = _mm_loadu_si128((__m128i *) state), s1 = _mm_loadu_si128((__m128i *) (state + 4));
+	__m128i	low = _mm_set1_epi32(0xFFFF);
+	__m128	k = _mm_set1_ps(scale), k32768 = _mm_set1_ps(32768.0f), max = _mm_set1_ps(32767.0f), min = _mm_set1_ps(-32768.0f);
+	__m128	x0, x1;
+	int		i;
+
+	for (i = 0 ; i + 4 <= frames ; i += 4) {
+		XORSHIFT_SSE(s0)
+		XORSHIFT_SSE(s1)
+		x0 = _mm_loadh_pi(_mm_loadl_pi(_mm_setzero_ps(), (__m64 *) (in + i * stride)), (__m64 *) (in + (i + 1) * stride));
+		x1 = _mm_loadh_pi(_mm_loadl_pi(_mm_setzero_ps(), (__m64 *) (in + (i + 2) * stride)), (__m64 *) (in + (i + 3) * stride));
+		_mm_storeu_si128((__m128i *) (out + i * DITHER_CHANNELS), _mm_packs_epi32(CONVERT_SSE(x0, s0), CONVERT_SSE(x1, s1)));
+	}
+	_mm_storeu_si128((__m128i *) state, s0);
+	_mm_storeu_si128((__m128i *) (state + 4), s1);
+	if (i < frames) runScalar(state, in + i * stride, stride, out + i * DITHER_CHANNELS, frames - i, scale);
+}
+
+__attribute__((target("avx2")))
+static void runAvx2(uint32_t *state, float *in, int stride, int16_t *out, int frames, float scale){
+	__m256i	s = _mm256_loadu_si256((__m256i *) state), v;
+	__m256i	low = _mm256_set1_epi32(0xFFFF);
+	__m256	k = _mm256_set1_ps(scale), k32768 = _mm256_set1_ps(32768.0f), max = _mm256_set1_ps(32767.0f), min = _mm256_set1_ps(-32768.0f);
+	__m256	x;
+	__m128	x0, x1;
+	int		i;
+
+	for (i = 0 ; i + 4 <= frames ; i += 4) {
+		s = _mm256_xor_si256(s, _mm256_slli_epi32(s, 13));
+		s = _mm256_xor_si256(s, _mm256_srli_epi32(s, 17));
+		s = _mm256_xor_si256(s, _mm256_slli_epi32(s, 5));
+		x0 = _mm_loadh_pi(_mm_loadl_pi(_mm_setzero_ps(), (__m64 *) (in + i * stride)), (__m64 *) (in + (i + 1) * stride));
+		x1 = _mm_loadh_pi(_mm_loadl_pi(_mm_setzero_ps(), (__m64 *) (in + (i + 2) * stride)), (__m64 *) (in + (i + 3) * stride));
+		x = _mm256_insertf128_ps(_mm256_castps128_ps256(x0), x1, 1);
+		v = _mm256_cvtps_epi32(_mm256_max_ps(_mm256_min_ps(_mm256_add_ps(_mm256_mul_ps(x, k32768),
+			_mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_and_si256(s, low), _mm256_srli_epi32(s, 16))), k)), max), min));
+		_mm_storeu_si128((__m128i *) (out + i * DITHER_CHANNELS), _mm_packs_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1)));
+	}
+	_mm256_storeu_si256((__m256i *) state, s);
+	if (i < frames) runScalar(state, in + i * stride, stride, out + i * DITHER_CHANNELS, frames - i, scale);
+}
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define XORSHIFT_NEON(s)																	\
+	s = veorq_u32(s, vshlq_n_u32(s, 13));														\
+	s = veorq_u32(s, vshrq_n_u32(s, 17));														\
+	s = veorq_u32(s, vshlq_n_u32(s, 5));
+
+//ARMv7 has no conversion rounding to the nearest : adding 1.5 * 2^23 leaves the rounded value in the low bits
+#define CONVERT_NEON(x, s)																	\
+	vsubq_s32(vreinterpretq_s32_f32(vaddq_f32(vmaxq_f32(vminq_f32(vaddq_f32(vmulq_f32(x, k32768),				\
+		vmulq_f32(vcvtq_f32_s32(vsubq_s32(vreinterpretq_s32_u32(vandq_u32(s, low)), vreinterpretq_s32_u32(vshrq_n_u32(s, 16)))), k)),	\
+		max), min), magic)), vreinterpretq_s32_f32(magic))
+
+static void runNeon(uint32_t *state, float *in, int stride, int16_t *out, int frames, float scale){
+	uint32x4_t	s0 = vld1q_u32(state), s1 = vld1q_u32(state + 4), low = vdupq_n_u32(0xFFFF);
+	float32x4_t	k = vdupq_n_f32(scale), k32768 = vdupq_n_f32(32768.0f), max = vdupq_n_f32(32767.0f), min = vdupq_n_f32(-32768.0f);
+	float32x4_t	magic = vdupq_n_f32(12582912.0f), x0, x1;
+	int			i;
+
+	for (i = 0 ; i + 4 <= frames ; i += 4) {
+		XORSHIFT_NEON(s0)
+		XORSHIFT_NEON(s1)
+		x0 = vcombine_f32(vld1_f32(in + i * stride), vld1_f32(in + (i + 1) * stride));
+		x1 = vcombine_f32(vld1_f32(in + (i + 2) * stride), vld1_f32(in + (i + 3) * stride));
+		vst1q_s16(out + i * DITHER_CHANNELS, vcombine_s16(vqmovn_s32(CONVERT_NEON(x0, s0)), vqmovn_s32(CONVERT_NEON(x1, s1))));
+	}
+	vst1q_u32(state, s0);
+	vst1q_u32(state + 4, s1);
+	if (i < frames) runScalar(state, in + i * stride, stride, out + i * DITHER_CHANNELS, frames - i, scale);
+}
+#endif
+
+//Kernels by order of preference, the last supported one is chosen
+struct ditherKernel ditherKernels[] = {
+	{"scalar",	cpuAlways,	runScalar},
+#if defined(__x86_64__) || defined(__i386__)
+	{"sse2",	cpuSse2,	runSse2},
+	{"avx2",	cpuAvx2,	runAvx2},
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+	{"neon",	cpuNeon,	runNeon},
+#endif
+	{NULL}
+};
+
+//Selects the kernel of the outputs set up from now on
+//name : kernel name, NULL or "auto" for the best one the CPU supports
+//Returns NULL if the kernel is unknown or not supported by the CPU
+struct ditherKernel *ditherSelect(char *name){
+	struct ditherKernel *k;
+
+	if ((k = cpuSelect(ditherKernels, sizeof(struct ditherKernel), name, "Dither")) == NULL) return NULL;
+	kernel = k;
+	return kernel;
+}
+
+//Returns the mode of a name, -1 if unknown
+int ditherMode(char *name){
+	int m;
+
+	for (m = 0 ; ditherModes[m] != NULL && strcmp(ditherModes[m], name) != 0 ; m++);
+	return ditherModes[m] != NULL ? m : -1;
+}
+
+//seed : different for each output, so that their dithers are not correlated
+void ditherInit(struct dither *d, enum ditherMode mode, uint32_t seed){
+	int l;
+
+	memset(d, 0, sizeof(struct dither));
+	if (kernel == NULL) ditherSelect(NULL);
+	d->kernel = kernel;
+	d->mode = mode;
+	for (l = 0 ; l < DITHER_LANES ; l++) d->state[l] = 0x9E3779B9u * (seed * DITHER_LANES + l + 1) | 1;	//Never 0
+}
+
+//Starts a session : no error to feed back
+void ditherReset(struct dither *d){
+	memset(d->err, 0, sizeof(d->err));
+}
+
+//Shaped mode : the error of each sample filtered and subtracted from the next ones
+static void runShaped(struct dither *d, float *in, int stride, int16_t *out, int frames){
+	float	w, v, e, *err;
+	int		i, f, ch, j;
+
+	for (i = 0 ; i < frames ; i += DITHER_LANES / DITHER_CHANNELS) {
+		nextGroup(d->state);
+		for (f = i ; f < frames && f < i + DITHER_LANES / DITHER_CHANNELS ; f++) {
+			for (ch = 0 ; ch < DITHER_CHANNELS ; ch++) {
+				err = d->err[ch];
+				w = in[f * stride + ch] * 32768.0f;
+				for (j = 0 ; j < DITHER_ORDER ; j++) w -= shape[j] * err[j];
+				v = w + triangular(d->state[(f - i) * DITHER_CHANNELS + ch]) * DITHER_SCALE;
+				v = v < 32767.0f ? v : 32767.0f;
+				v = v > -32768.0f ? v : -32768.0f;
+				out[f * DITHER_CHANNELS + ch] = lrintf(v);
+				e = out[f * DITHER_CHANNELS + ch] - w;
+				for (j = DITHER_ORDER - 1 ; j > 0 ; j--) err[j] = err[j - 1];
+				err[0] = e > DITHER_MAX_ERR ? DITHER_MAX_ERR : (e < -DITHER_MAX_ERR ? -DITHER_MAX_ERR : e);
+			}
+		}
+	}
+}
+
+//Converts stereo frames, left at in[i * stride] and right just after, to interleaved s16
+void ditherRun(struct dither *d, float *in, int stride, int16_t *out, int frames){
+	if (d->mode == DITHER_SHAPED) runShaped(d, in, stride, out, frames);
+	else d->kernel->run(d->state, in, stride, out, frames, d->mode == DITHER_TPDF ? DITHER_SCALE : 0);
+}
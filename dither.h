@@ -0,0 +1,34 @@
+#ifndef DITHER_H
+#define DITHER_H
+
+#include <stdint.h>
+
+#define DITHER_CHANNELS		2
+#define DITHER_LANES		8				/* Generators of the dither : one per sample of 4 frames */
+#define DITHER_ORDER		3				/* Taps of the noise shaping filter */
+
+enum ditherMode {DITHER_NONE, DITHER_TPDF, DITHER_SHAPED};
+
+struct ditherKernel {						//One implementation of the conversion to s16
+	char	*name;							//First fields : those of struct cpuKernel (cpu.h)
+	int		(*supported)(void);				//Runtime CPU detection
+	void	(*run)(uint32_t *state, float *in, int stride, int16_t *out, int frames, float scale);
+};
+
+struct dither {								//Conversion of an output to s16
+	enum ditherMode		mode;
+	struct ditherKernel	*kernel;
+	uint32_t			state[DITHER_LANES];	//xorshift32 generators
+	float				err[DITHER_CHANNELS][DITHER_ORDER];	//Shaped : last quantisation errors, newest first
+};
+
+extern struct ditherKernel ditherKernels[];	// All the kernels built in, the scalar reference first, NULL name at the end
+extern char *ditherModes[];					// Names of the modes, NULL at the end
+
+struct ditherKernel *ditherSelect(char *name);
+int 	ditherMode(char *name);
+void 	ditherInit(struct dither *d, enum ditherMode mode, uint32_t seed);
+void 	ditherReset(struct dither *d);
+void 	ditherRun(struct dither *d, float *in, int stride, int16_t *out, int frames);
+
+#endif
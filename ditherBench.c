@@ -0,0 +1,203 @@
+/*
+ * ditherBench : checks the conversion of the outputs to s16, measures it and the distortion of the dither
+ *
+ * Check : each kernel the CPU supports converts noise going beyond full scale, with several strides and block sizes,
+ * and must give the samples of the scalar reference.
+ * Benchmark : ns per stereo frame of each kernel and mode, and CPU load at 44100 Hz in % of one core.
+ * Distortion : a 1 kHz tone is converted at a loud and a quiet level in each mode and analysed offline : THD+N, level
+ * of the noise, and harmonics 2 to 9 compared with the noise floor around them. With a dither, the harmonics must
+ * stay in the noise : the exit status is 1 otherwise, or if a kernel differs from the reference.
+ *
+ * Usage : ditherBench [-t seconds per measure] [-c check only]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+
+#include "log.h"
+#include "dither.h"
+
+#define BENCH_RATE		44100
+#define BENCH_FRAMES	65536		/* Frames of the test tone */
+#define BENCH_TONE		1486		/* Periods of the tone in BENCH_FRAMES : 999.97 Hz, an exact number of bins */
+#define BENCH_HARMONICS	9
+#define BENCH_NEIGHBOURS 24			/* Bins on each side of a harmonic giving the noise floor */
+#define BENCH_FLOOR		4.0			/* A harmonic stands out of the noise above this ratio of its rms */
+#define BENCH_BLOCK		1024
+#define BENCH_TIME		0.2
+
+static int strides[] = {2, 4, 8, 0};
+static int blocks[] = {1024, 37, 3, 512, 1, 0};
+
+//Converts with a kernel, block after block
+void convert(struct ditherKernel *k, enum ditherMode mode, float *in, int stride, int16_t *out, int frames){
+	struct dither	d;
+	int				i, j, n;
+
+	ditherSelect(k->name);
+	ditherInit(&d, mode, 1);
+	for (i = 0, j = 0 ; i < frames ; i += n, j++) {
+		n = blocks[j % 5] < frames - i ? blocks[j % 5] : frames - i;
+		ditherRun(&d, in + i * stride, stride, out + i * 2, n);
+	}
+}
+
+//Compares the kernels with the scalar one, returns the number of kernels failing
+int check(){
+	struct ditherKernel	*k;
+	float				*in;
+	int16_t				*ref, *out;
+	int					i, s, m, failed = 0, diff;
+
+	in = malloc(BENCH_FRAMES * 8 * sizeof(float));
+	ref = malloc(BENCH_FRAMES * 2 * sizeof(int16_t));
+	out = malloc(BENCH_FRAMES * 2 * sizeof(int16_t));
+	for (i = 0 ; i < BENCH_FRAMES * 8 ; i++) in[i] = (drand48() - 0.5) * 2.4;
+	for (i = 0 ; i < 64 ; i++) in[i] = (i % 2 ? 1 : -1) * (1 - i / 65536.0);				//Close to full scale
+	printf("Check against the scalar kernel, %i frames, strides 2 4 8\n", BENCH_FRAMES);
+	for (k = ditherKernels + 1 ; k->name != NULL ; k++) {
+		if (!k->supported()) {
+			printf("  %-8s not supported by this CPU\n", k->name);
+			continue;
+		}
+		for (diff = 0, m = DITHER_NONE ; m <= DITHER_TPDF ; m++) {
+			for (s = 0 ; strides[s] != 0 ; s++) {
+				convert(&ditherKernels[0], m, in, strides[s], ref, BENCH_FRAMES);
+				convert(k, m, in, strides[s], out, BENCH_FRAMES);
+				for (i = 0 ; i < BENCH_FRAMES * 2 ; i++) diff += ref[i] != out[i];
+			}
+		}
+		printf("  %-8s %i samples differ %s\n", k->name, diff, diff ? "FAILED" : "ok");
+		failed += diff != 0;
+	}
+	free(in); free(ref); free(out);
+	return failed;
+}
+
+//Returns ns per stereo frame
+double measure(struct ditherKernel *k, enum ditherMode mode, int stride, double seconds){
+	struct dither		d;
+	struct timespec		t0, t1;
+	float				*in = malloc(BENCH_BLOCK * stride * sizeof(float));
+	int16_t				*out = malloc(BENCH_BLOCK * 2 * sizeof(int16_t));
+	double				elapsed;
+	long				frames = 0;
+	int					i;
+
+	for (i = 0 ; i < BENCH_BLOCK * stride ; i++) in[i] = drand48() - 0.5;
+	ditherSelect(k->name);
+	ditherInit(&d, mode, 1);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	do {
+		for (i = 0 ; i < 64 ; i++) {
+			ditherRun(&d, in, stride, out, BENCH_BLOCK);
+			frames += BENCH_BLOCK;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	} while (elapsed < seconds);
+	free(in); free(out);
+	return elapsed * 1e9 / frames;
+}
+
+//Components of bin b of the left channel : x[i] ~ re cos + im sin, in LSB
+void bin(int16_t *x, int b, double *re, double *im){
+	int i;
+
+	for (*re = 0, *im = 0, i = 0 ; i < BENCH_FRAMES ; i++) {
+		*re += x[i * 2] * cos(2 * M_PI * (double) b * i / BENCH_FRAMES);
+		*im += x[i * 2] * sin(2 * M_PI * (double) b * i / BENCH_FRAMES);
+	}
+	*re *= 2.0 / BENCH_FRAMES;
+	*im *= 2.0 / BENCH_FRAMES;
+}
+
+double amplitude(int16_t *x, int b){
+	double re, im;
+
+	bin(x, b, &re, &im);
+	return sqrt(re * re + im * im);
+}
+
+//Converts a tone of level dBFS, prints its distortion and returns the number of harmonics out of the noise
+int distortion(enum ditherMode mode, double level){
+	struct dither	d;
+	float			*in = malloc(BENCH_FRAMES * 2 * sizeof(float));
+	int16_t			*out = malloc(BENCH_FRAMES * 2 * sizeof(int16_t));
+	double			a = pow(10, level / 20), re, im, w, x, power = 0, h, floor, worst = -200;
+	int				i, j, b, n, above = 0;
+
+	for (i = 0 ; i < BENCH_FRAMES ; i++) in[i * 2] = in[i * 2 + 1] = a * sin(2 * M_PI * BENCH_TONE * (double) i / BENCH_FRAMES);
+	ditherSelect(NULL);
+	ditherInit(&d, mode, 1);
+	for (i = 0 ; i < BENCH_FRAMES ; i += BENCH_BLOCK) ditherRun(&d, in + i * 2, 2, out + i * 2, BENCH_BLOCK);
+
+	bin(out, BENCH_TONE, &re, &im);											//Noise and distortion : what remains without the tone
+	for (i = 0 ; i < BENCH_FRAMES ; i++) {
+		w = 2 * M_PI * BENCH_TONE * (double) i / BENCH_FRAMES;
+		x = out[i * 2] - re * cos(w) - im * sin(w);
+		power += x * x;
+	}
+	for (j = 2 ; j <= BENCH_HARMONICS ; j++) {
+		b = j * BENCH_TONE % BENCH_FRAMES;
+		if (b > BENCH_FRAMES / 2) b = BENCH_FRAMES - b;
+		h = amplitude(out, b);
+		for (floor = 0, n = 0, i = b - BENCH_NEIGHBOURS ; i <= b + BENCH_NEIGHBOURS ; i++) {
+			if (abs(i - b) < 3 || i <= 0 || i >= BENCH_FRAMES / 2) continue;
+			x = amplitude(out, i);
+			floor += x * x;
+			n++;
+		}
+		if (h > BENCH_FLOOR * sqrt(floor / n)) above++;
+		if (20 * log10(h / 32768 + 1e-12) > worst) worst = 20 * log10(h / 32768 + 1e-12);
+	}
+	printf("  %-7s %6.1f dBFS : THD+N %6.1f dB, noise %6.1f dBFS, worst harmonic %6.1f dBFS, %i harmonics out of the noise\n",
+		ditherModes[mode], level, 10 * log10(power / BENCH_FRAMES / ((re * re + im * im) / 2)),
+		10 * log10(power / BENCH_FRAMES / (32768.0 * 32768 / 2)), worst, above);
+	free(in); free(out);
+	return above;
+}
+
+int main(int argc, char *argv[]){
+	struct ditherKernel	*k;
+	double				seconds = BENCH_TIME, ns;
+	bool				checkOnly = false;
+	int					opt, m, s, status = 0;
+
+	while ((opt = getopt(argc, argv, "t:c")) != -1) {
+		switch (opt) {
+			case 't': seconds = atof(optarg); break;
+			case 'c': checkOnly = true; break;
+			default:
+				fprintf(stderr, "Usage : %s [-t seconds per measure] [-c]\n", argv[0]);
+				return 1;
+		}
+	}
+	srand48(1);
+
+	if (check() > 0) status = 1;
+
+	printf("\nDistortion of a 1 kHz tone, %i frames\n", BENCH_FRAMES);
+	for (m = DITHER_NONE ; m <= DITHER_SHAPED ; m++) {
+		distortion(m, -1);
+		if (distortion(m, -80) > 0 && m != DITHER_NONE) status = 1;
+	}
+	if (checkOnly) return status;
+
+	printf("\nns per stereo frame, CPU load at %i Hz in %% of one core\n", BENCH_RATE);
+	for (k = ditherKernels ; k->name != NULL ; k++) {
+		if (!k->supported()) continue;
+		for (m = DITHER_NONE ; m <= DITHER_SHAPED ; m++) {
+			if (m == DITHER_SHAPED && k != ditherKernels) continue;			//Scalar whatever the kernel
+			for (s = 0 ; strides[s] != 0 ; s++) {
+				ns = measure(k, m, strides[s], seconds);
+				printf("  %-8s %-7s stride %i : %6.2f ns, %.3f %%\n", k->name, ditherModes[m], strides[s], ns, ns * BENCH_RATE * 1e-7);
+			}
+		}
+	}
+	return status;
+}
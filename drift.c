@@ -0,0 +1,156 @@
+/*
+ * drift : keeps an output in lock with the device of another one
+ *
+ * Each USB DAC plays at the pace of its own crystal : two outputs on two cards drift apart by some ppm, which
+ * shifts the phase between the woofer and the tweeter along a session. The output following the other one is
+ * resampled with a ratio close to 1 : a windowed sinc interpolation (DRIFT_HALF taps on each side, table of
+ * DRIFT_PHASES phases interpolated linearly) reads its input at a fractional position moving by 1 / (1 + correction)
+ * frame per output frame.
+ * After each block the difference of the fill levels of both devices is compared with the one measured when the
+ * session started, and a PI loop adjusts the correction to hold it. The loop is fast for DRIFT_ACQUIRE seconds to
+ * catch the skew, then slow : the fill levels move by whole frames and a fast loop would turn this into jitter.
+ * The frames inserted or dropped along the session are the drift accumulated by the devices.
+ * The output followed goes through the same delay of DRIFT_HALF frames, without interpolation, so that both stay aligned.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "log.h"
+#include "sinc.h"
+#include "drift.h"
+
+#define DRIFT_TAPS		(2 * DRIFT_HALF)
+
+static float table[DRIFT_PHASES + 1][DRIFT_TAPS];		//table[p][k] : tap k for a position p / DRIFT_PHASES after the frame
+static bool tableReady = false;
+
+//Computes the taps of the interpolation filter for all the phases, normalised to a unity gain at DC
+static void buildTable(){
+	double	h[DRIFT_TAPS], t, w, sum;
+	int		p, k;
+
+	for (p = 0 ; p <= DRIFT_PHASES ; p++) {
+		for (sum = 0, k = 0 ; k < DRIFT_TAPS ; k++) {
+			t = (double) p / DRIFT_PHASES + DRIFT_HALF - 1 - k;			//Distance to the position in frames
+			w = fabs(t) < DRIFT_HALF ? sincKaiser(t, DRIFT_HALF, DRIFT_BETA) : 0;
+			h[k] = sincLowpass(t, DRIFT_CUTOFF) * w;
+			sum += h[k];
+		}
+		for (k = 0 ; k < DRIFT_TAPS ; k++) table[p][k] = h[k] / sum;
+	}
+	tableReady = true;
+}
+
+//Allocates the buffers for blocks of up to block frames
+//fixed : only delays the output (output followed)
+//Returns -1 on error
+int driftInit(struct drift *d, int block, int rate, bool fixed){
+	memset(d, 0, sizeof(struct drift));
+	if (!tableReady) buildTable();
+	d->fixed = fixed;
+	d->rate = rate;
+	d->block = block;
+	d->hist = calloc((DRIFT_TAPS + block) * DRIFT_CHANNELS, sizeof(float));
+	d->out = calloc((block + block / 512 + 4) * DRIFT_CHANNELS, sizeof(float));
+	if (d->hist == NULL || d->out == NULL) {
+		driftFree(d);
+		return -1;
+	}
+	driftReset(d);
+	return 0;
+}
+
+//Starts a session : silence in the filter, no correction, fill levels to measure again
+void driftReset(struct drift *d){
+	memset(d->hist, 0, (DRIFT_TAPS + d->block) * DRIFT_CHANNELS * sizeof(float));
+	d->fill = DRIFT_TAPS - 1;
+	d->pos = DRIFT_HALF - 1;
+	d->correction = 0;
+	d->target = 0;
+	d->error = 0;
+	d->integral = 0;
+	d->maxError = 0;
+	d->settle = DRIFT_SETTLE * d->rate;
+	d->acquire = DRIFT_ACQUIRE * d->rate;
+	d->in = 0;
+	d->outFrames = 0;
+}
+
+//Resamples a block of stereo frames (left at in[i * stride], right just after) into d->out
+//Returns the number of frames written in d->out
+int driftRun(struct drift *d, float *in, int stride, int frames){
+	float	*x, *c0, *c1, c, l, r, f;
+	double	step = 1 / (1 + d->correction);
+	int		i, k, p, n = 0;
+
+	for (i = 0 ; i < frames ; i++) {
+		d->hist[(d->fill + i) * DRIFT_CHANNELS] = in[i * stride];
+		d->hist[(d->fill + i) * DRIFT_CHANNELS + 1] = in[i * stride + 1];
+	}
+	d->fill += frames;
+
+	while ((i = (int) d->pos) + DRIFT_HALF < d->fill) {
+		if (d->fixed) {
+			l = d->hist[i * DRIFT_CHANNELS];
+			r = d->hist[i * DRIFT_CHANNELS + 1];
+		}
+		else {
+			f = (d->pos - i) * DRIFT_PHASES;
+			p = (int) f;
+			f -= p;
+			c0 = table[p];
+			c1 = table[p + 1];
+			x = &d->hist[(i - DRIFT_HALF + 1) * DRIFT_CHANNELS];
+			for (l = 0, r = 0, k = 0 ; k < DRIFT_TAPS ; k++) {
+				c = c0[k] + f * (c1[k] - c0[k]);
+				l += c * x[k * DRIFT_CHANNELS];
+				r += c * x[k * DRIFT_CHANNELS + 1];
+			}
+		}
+		d->out[n * DRIFT_CHANNELS] = l;
+		d->out[n * DRIFT_CHANNELS + 1] = r;
+		n++;
+		d->pos += step;
+	}
+
+	k = (int) d->pos - (DRIFT_HALF - 1);								//Frames no longer needed
+	memmove(d->hist, d->hist + k * DRIFT_CHANNELS, (d->fill - k) * DRIFT_CHANNELS * sizeof(float));
+	d->fill -= k;
+	d->pos -= k;
+	d->in += frames;
+	d->outFrames += n;
+	return n;
+}
+
+//Adjusts the correction after a block
+//ahead : frames the device of this output has buffered beyond the one followed
+//The first DRIFT_SETTLE seconds measure the difference to hold
+void driftUpdate(struct drift *d, double ahead, int frames){
+	double	e = ahead, t = (double) frames / d->rate, max = DRIFT_MAX_PPM * 1e-6;
+	double	wn = d->acquire > 0 ? DRIFT_FAST : DRIFT_SLOW;
+
+	if (d->fixed) return;
+	if (d->settle > 0) {
+		d->target += e * frames;
+		d->settle -= frames;
+		if (d->settle <= 0) d->target /= (int) (DRIFT_SETTLE * d->rate) - d->settle;
+		return;
+	}
+	//Fill level difference e' = rate * (correction - skew) : critically damped loop of natural frequency wn,
+	//the error smoothed ten times faster
+	d->error += (e - d->target - d->error) * (1 - exp(-t * 10 * wn));
+	if (d->acquire > 0) d->acquire -= frames;
+	else if (fabs(d->error) > d->maxError) d->maxError = fabs(d->error);
+	d->integral += wn * wn / d->rate * d->error * t;
+	d->integral = fmax(-max, fmin(max, d->integral));
+	d->correction = fmax(-max, fmin(max, -(2 * wn / d->rate * d->error + d->integral)));
+}
+
+void driftFree(struct drift *d){
+	free(d->hist);
+	free(d->out);
+	d->hist = NULL;
+	d->out = NULL;
+}
@@ -0,0 +1,43 @@
+#ifndef DRIFT_H
+#define DRIFT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define DRIFT_CHANNELS		2
+#define DRIFT_HALF			32				/* Taps on each side of the interpolation filter */
+#define DRIFT_PHASES		256				/* Phases of the filter table, linear interpolation in between */
+#define DRIFT_CUTOFF		0.92			/* Cutoff of the filter, fraction of the Nyquist frequency */
+#define DRIFT_BETA			9.0				/* Kaiser window */
+#define DRIFT_MAX_PPM		1000			/* Largest correction */
+#define DRIFT_SETTLE		1.0				/* Seconds averaging the fill levels before locking */
+#define DRIFT_ACQUIRE		20.0			/* Seconds of fast loop once locking */
+#define DRIFT_FAST			0.5				/* Natural frequency of the lock loop while acquiring, rad/s */
+#define DRIFT_SLOW			0.05			/* Natural frequency of the lock loop then : less jitter on the ratio */
+
+struct drift {								//Resampler keeping an output in lock with the device of another one
+	bool		fixed;						//Ratio 1 : only delays as much as the resampler (output followed)
+	int			rate;
+	int			block;
+	float		*hist;						//Input frames not consumed yet, interleaved
+	int			fill;						//Frames in hist
+	double		pos;						//Read position in hist, in frames
+	float		*out;						//Output of the last block, interleaved
+	double		correction;					//Output rate - 1 : positive when the device plays faster than the one followed
+	double		target;						//Fill level difference to hold, in frames
+	double		error;						//Fill level difference - target, smoothed
+	double		integral;
+	double		maxError;					//Largest error once acquired, in frames
+	int			settle;						//Frames left before locking
+	int			acquire;					//Frames left in the fast loop
+	uint64_t	in;							//Frames processed
+	uint64_t	outFrames;
+};
+
+int 	driftInit(struct drift *d, int block, int rate, bool fixed);
+void 	driftReset(struct drift *d);
+int 	driftRun(struct drift *d, float *in, int stride, int frames);
+void 	driftUpdate(struct drift *d, double ahead, int frames);
+void 	driftFree(struct drift *d);
+
+#endif
@@ -0,0 +1,817 @@
+/*
+ * dsp : crossover engine replacing the ecasound pipe of mpd
+ *
+ * Reads s32_le 44100 Hz stereo from stdin (mpd "pipe" output running ampCtl --dsp) or from a FIFO
+ * (mpd "fifo" output read by the daemon), runs the processing graph of the configuration file (see graph.c) and
+ * writes each output (woofer, tweeter...) to its sink : no extra process, no copy through a pipe between the stages
+ * and no fork when mpd restarts its output.
+ *
+ * The former configuration gives the same graph as the former ecasound command line :
+ *   -a:pre -pf:pre.ecp -i:stdin -o:loop,1 -a:woofer -pf:woofer.ecp -o:alsa... -a:tweeter -pf:tweeter.ecp -o:alsa...
+ *
+ * With dspWorkers = 0 the whole graph runs in the reader thread. Otherwise the reader thread runs the nodes shared by
+ * several outputs on its own core and hands each block over to dspWorkers worker threads, pinned on the next cores,
+ * through one ring of preallocated blocks per worker (see ring.c). The outputs are shared out between the workers,
+ * each of them running the nodes feeding only its outputs and writing to their sinks.
+ *
+ * The preset files are watched while playing : a chain changed is compiled again off the audio threads and faded in.
+ *
+ * With dspVolume, the rotary encoder sets the gain of the engine directly (dspSetVolume), applied when the input is
+ * converted to float : no round trip through mpd and its software mixer, mpd is told the new volume afterwards.
+ * The mute relay is coordinated with a soft mute of the engine (dspMute) : the outputs ramp to silence before the relay
+ * engages and ramp up once it has released (see ampMute).
+ *
+ * The input may also be an ALSA capture device (dspInput = "alsa:hw:0,0"), read without end. With dspStandby, each
+ * block read goes through a signal detector (see detect.c) : the amplifier powers on when a signal appears, whatever
+ * its source, and goes to standby after dspStandby s of silence, even while mpd plays.
+ *
+ * With dspPriority, the reader thread and the workers run SCHED_FIFO, pinned on the cores of dspCores, and the memory of
+ * the process is locked : all the buffers are allocated when the engine opens, the blocks are processed without
+ * allocation, lock or log (make rtcheck builds a version checking it, see rtcheck.c) and the device waits are the only
+ * blocking calls. The time each stage takes per block is measured : a block longer than the block period is an overrun,
+ * counted with the xruns of the devices and the longest block since the start in the dspStats file.
+ *
+ * With dspPeriods, the devices run in periods of one block and buffer dspPeriods of them (2 : double buffering, the
+ * device plays one period while the engine fills the other), in place of dspLatency : with blocks of 32 to 128 frames
+ * the input is heard within a few ms. The latency from the arrival of each block to its last frame played by the
+ * devices is measured and logged with the measures of each playback.
+ *
+ * With dspInputRate, the input is at another rate than DSP_RATE : a fixed one (a capture device at 48000 Hz) or, with
+ * "mpd", the rate of the song mpd plays (format "*:32:2"), asked to mpd each time it opens the input. It is converted
+ * once to DSP_RATE by the polyphase resampler (see resample.c) before the graph, in the reader thread : mpd sends the
+ * songs at their own rate and its converter is not used. The filter tables of the common rates are built when the
+ * engine opens. The chains stay designed at DSP_RATE : the presets and the devices are not reconfigured.
+ *
+ * With dspMeter, the thread of each output measures its peaks, RMS, clipped samples and, with dspMeterSpectrum, its
+ * octave spectrum dspMeterRate times per second, published in a shared memory segment under a seqlock (see meter.c).
+ *
+ * With dspLoudness, the bass and the treble of the input are boosted as the volume of dspVolume goes down below the
+ * dspLoudnessRef step, by shelves designed for each volume step when the configuration is loaded (see loudness.c).
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <time.h>
+#include <limits.h>
+#include <sys/mman.h>
+
+#include <confuse.h>
+
+#include "log.h"
+#include "graph.h"
+#include "ring.h"
+#include "detect.h"
+#include "resample.h"
+#include "rtcheck.h"
+#include "dsp.h"
+
+#define DSP_ALIGN			64			/* Alignment of the sample buffers */
+#define DSP_RING_BLOCKS		2			/* Blocks queued per worker : the reader thread runs one block ahead */
+#define DSP_STACK_PREFAULT	(64 * 1024)	/* Stack of the audio threads touched before processing */
+#define DSP_STATS_PERIOD	1			/* Period of the update of the dspStats file in s */
+#define DSP_RATE_MIN		8000		/* Rates of the input accepted by dspInputRate */
+#define DSP_RATE_MAX		384000
+
+struct dspStats {						//Measures of one stage during a playback session, from the input opening to its end
+	uint64_t			frames;
+	uint64_t			cpu;			//Thread CPU time in ns
+	uint64_t			busy;			//Time spent processing in ns, waits for the sinks and the rings excluded
+	uint64_t			maxBlock;		//Longest block processing in ns
+	uint64_t			delaySum;		//Sum of the device delays sampled after each block, in frames
+	uint64_t			queueSum;		//Sum of the blocks queued in the rings sampled after each block
+	int					blocks;			//Samples of the device delays or of the rings
+	uint64_t			latencySum;		//Sum of the end to end latencies measured after each block in ns
+	uint64_t			latencyMax;
+	int					latencies;		//Samples of the latencies, one per sink and block
+};
+
+struct dspCounters {					//Measures of one stage since the start, written by its thread only
+	uint64_t			blocks;
+	uint64_t			overruns;		//Blocks processed in more than the block period
+	uint64_t			worst;			//Longest block processing in ns
+};
+
+struct dspBlock {						//Block handed over to the workers
+	int					frames;			//0 : end of the playback session
+	uint64_t			arrival;		//Time its last frame arrived on the input, ns of CLOCK_MONOTONIC
+	float				data[];			//Outputs of the reader thread used by the worker, interleaved stereo
+};
+
+struct dspWorker {						//Runs the part of the graph of some outputs
+	int					id;				//Thread of the graph
+	struct ring			ring;			//Blocks from the reader thread
+	sem_t				done;			//Posted when the worker has processed the end of a session
+	uint64_t			cpuMark;		//Thread CPU time at the end of the previous session
+	struct dspStats		st;
+	struct dspCounters	total;
+	bool				failed;			//A sink of the worker failed, taken by the reader thread to end the session
+};
+
+cfg_opt_t dspOutputOpts[] = {
+	CFG_STR("input", 0, CFGF_NODEFAULT),
+	CFG_STR("chain", 0, CFGF_NODEFAULT),
+	CFG_STR("sink", "null", CFGF_NONE),
+	CFG_STR("follow", 0, CFGF_NODEFAULT),
+	CFG_FLOAT("skew", 0, CFGF_NONE),
+	CFG_FLOAT("delay", 0, CFGF_NODEFAULT),
+	CFG_STR("dither", "tpdf", CFGF_NONE),
+	CFG_FLOAT("limit", 0, CFGF_NODEFAULT),
+	CFG_FLOAT("attack", LIMIT_ATTACK, CFGF_NONE),
+	CFG_FLOAT("release", LIMIT_RELEASE, CFGF_NONE),
+	CFG_END()
+};
+
+cfg_opt_t dspNodeOpts[] = {
+	CFG_STR("type", "chain", CFGF_NONE),
+	CFG_STR_LIST("input", 0, CFGF_NODEFAULT),
+	CFG_STR("chain", 0, CFGF_NODEFAULT),
+	CFG_FLOAT("gain", 0, CFGF_NONE),
+	CFG_FLOAT("delay", 0, CFGF_NONE),
+	CFG_STR_LIST("ir", 0, CFGF_NODEFAULT),
+	CFG_INT("partition", 0, CFGF_NONE),
+	CFG_END()
+};
+
+static struct amp			*amp;
+static struct graph			graph;
+static struct dspWorker		worker[GRAPH_MAX_THREADS];		//Worker i runs thread i of the graph, 0 is the reader thread (counters only)
+static int					cores[GRAPH_MAX_THREADS];		//Core of each thread, -1 : default
+static int					nbWorkers = 0;
+static int					block;
+static int32_t				*in;				//Block read from the input
+static int32_t				*raw;				//Block read from the input at its own rate, converted to in
+static int					inputRate = DSP_RATE;	//Rate of the input of the session
+static struct resampler		resampler;
+static struct meterShm		*meterShm = NULL;	//Levels published, NULL : no meter
+static struct meter			meters[METER_MAX_OUTPUTS];
+static struct loudness		loudness;			//Shelves following the volume, with dspLoudness
+static uint64_t				inputTime;			//Time spent converting the input since the last block processed, in ns
+static uint64_t				arrival;			//Time the last frame of the block read arrived, ns of CLOCK_MONOTONIC
+static bool					opened = false;		//Graph opened : its delays may be changed
+static bool					playing = false;	//Input opened : blocks are flowing, or mpd paused without closing it
+static snd_pcm_t			*capture = NULL;	//Input read from an ALSA capture device
+static bool					captureS16;			//The capture device gives s16, widened to s32
+static int					captureXruns = 0;	//Overruns of the capture device
+static struct detect		detector;			//Presence of a signal on the input
+static bool					detecting = false;
+static sem_t				signalChanged;		//Posted by the reader thread when the signal appears or goes
+static int					mpdRates[] = {32000, 48000, 88200, 96000, 176400, 192000, 0};	//Tables built for dspInputRate "mpd"
+
+//Reads the cores of the reader thread and of the workers, such as "2,3,3" (dspCores), the missing ones left to the default
+//Returns -1 if the list is invalid
+static int parseCores(char *list){
+	char	*p = list, *end;
+	int		i;
+
+	for (i = 0 ; i < GRAPH_MAX_THREADS ; i++) cores[i] = -1;
+	for (i = 0 ; p != NULL && *p != '\0' ; i++) {
+		if (i == GRAPH_MAX_THREADS || (cores[i] = strtol(p, &end, 10)) < 0 || end == p || (*end != ',' && *end != '\0')) {
+			logError("DSP : invalid cores %s", list);
+			return -1;
+		}
+		p = *end == ',' ? end + 1 : end;
+	}
+	return 0;
+}
+
+//Reads the processing graph, checks it and shares it out between the threads
+//Returns -1 if the graph is invalid
+int dspLoadConfig(struct amp *ampCtl, cfg_t *cfg){
+	amp = ampCtl;
+	if (biquadSelect(ampCtl->dspKernel) == NULL || fftSelect(ampCtl->dspKernel) == NULL || ditherSelect(ampCtl->dspKernel) == NULL
+		|| detectSelect(ampCtl->dspKernel) == NULL || resampleSelect(ampCtl->dspKernel) == NULL
+		|| limitSelect(ampCtl->dspKernel) == NULL) return -1;
+	if (graphLoad(&graph, cfg, ampCtl->dspPre, ampCtl->dspWorkers, DSP_RATE) < 0) return -1;
+	if (ampCtl->dspLoudness != 0) {											//Designed here, off the audio threads
+		if (loudnessInit(&loudness, ampCtl->dspLoudness, ampCtl->dspLoudnessRef, ampCtl->dspVolume, DSP_RATE) < 0) return -1;
+		graph.loudness = &loudness;
+	}
+	nbWorkers = graph.nbThreads - 1;
+	if (parseCores(ampCtl->dspCores) < 0) return -1;
+	if (ampCtl->dspPeriods == 1 || ampCtl->dspPeriods < 0) {
+		logError("DSP : %i periods, at least 2", ampCtl->dspPeriods);
+		return -1;
+	}
+	if (ampCtl->dspInputRate != NULL && strcmp(ampCtl->dspInputRate, "mpd") != 0
+		&& (atoi(ampCtl->dspInputRate) < DSP_RATE_MIN || atoi(ampCtl->dspInputRate) > DSP_RATE_MAX)) {
+		logError("DSP : input rate %s, mpd or %i..%i Hz", ampCtl->dspInputRate, DSP_RATE_MIN, DSP_RATE_MAX);
+		return -1;
+	}
+	if (ampCtl->dspMeter != NULL && (ampCtl->dspMeterRate <= 0 || ampCtl->dspMeterRate > DSP_RATE / 32)) {
+		logError("DSP : meter rate %i, 1..%i updates per s", ampCtl->dspMeterRate, DSP_RATE / 32);
+		return -1;
+	}
+	if (ampCtl->dspPriority < 0 || ampCtl->dspPriority > sched_get_priority_max(SCHED_FIFO)) {
+		logError("DSP : priority %i out of 1..%i", ampCtl->dspPriority, sched_get_priority_max(SCHED_FIFO));
+		return -1;
+	}
+	logInfo("DSP : biquad kernel %s, %i nodes, %i worker threads", biquadSelect(ampCtl->dspKernel)->name, graph.nbNodes, nbWorkers);
+	return 0;
+}
+
+//Applies the options of the configuration file which may change while playing : the delays
+void dspReload(cfg_t *cfg){
+	if (__atomic_load_n(&opened, __ATOMIC_ACQUIRE)) graphSetDelays(&graph, cfg);
+}
+
+//Sets the volume of the engine, 0 to 100 as mpd : dspVolume dB below full scale at 1, silence at 0
+//Heard from the next block read, the gain gliding over a few ms
+void dspSetVolume(int volume){
+	float gain = volume <= 0 ? 0 : pow(10, (volume - 100) * amp->dspVolume / 2000.0);
+
+	graphSetVolume(&graph, gain);
+	logDebug("DSP : volume %i, gain %.1f dB", volume, 20 * log10(gain + 1e-30));
+}
+
+//Starts the soft mute (mute true) or its release : the outputs ramp to silence or back over GRAPH_MUTE_TIME from the
+//next block. Returns the number of the request, for dspMuteTime
+int dspMute(bool mute){
+	return graphSetMute(&graph, mute);
+}
+
+//Returns the time the devices play the end of the ramp to silence or the start of the ramp up of the request seq, in ns
+//of CLOCK_MONOTONIC. 0 : no device clock, -1 : not processed yet, -2 : no input opened, nothing to ramp
+int64_t dspMuteTime(int seq){
+	if (!__atomic_load_n(&playing, __ATOMIC_ACQUIRE)) return -2;
+	return graphMuteTime(&graph, seq);
+}
+
+//Returns the buffering of the devices in us : dspPeriods blocks, or else dspLatency
+static int deviceLatency(){
+	if (amp->dspPeriods > 0) return ceil((double) amp->dspPeriods * (amp->dspBlock > 0 ? amp->dspBlock : DSP_BLOCK) * 1000000 / DSP_RATE);
+	return (amp->dspLatency > 0 ? amp->dspLatency : DSP_LATENCY) * 1000;
+}
+
+//Returns the longest time in us from a soft mute request to its ramp heard : the ramp, the block being processed,
+//the block read meanwhile and the buffering of the devices
+int dspMuteDelay(){
+	return GRAPH_MUTE_TIME * 1e6 + (int64_t) 2 * (amp->dspBlock > 0 ? amp->dspBlock : DSP_BLOCK) * 1000000 / DSP_RATE + deviceLatency();
+}
+
+//Returns the audio buffered by the output devices in us
+int dspBuffered(){
+	return (int64_t) graphBuffered(&graph) * 1000000 / DSP_RATE;
+}
+
+void *alignedAlloc(int size){
+	void *p;
+
+	if (posix_memalign(&p, DSP_ALIGN, size) != 0) return NULL;
+	memset(p, 0, size);
+	return p;
+}
+
+//Flushes denormal numbers to zero : IIR tails decaying into denormals are very slow on the FPU
+void flushDenormals(){
+#if defined(__SSE__)
+	unsigned int csr;
+	__asm__ volatile ("stmxcsr %0" : "=m" (csr));
+	csr |= 0x8040;												//FTZ and DAZ
+	__asm__ volatile ("ldmxcsr %0" : : "m" (csr));
+#elif defined(__arm__) && defined(__VFP_FP__) && !defined(__SOFTFP__)
+	unsigned int fpscr;
+	__asm__ volatile ("vmrs %0, fpscr" : "=r" (fpscr));
+	fpscr |= 1 << 24;											//FZ
+	__asm__ volatile ("vmsr fpscr, %0" : : "r" (fpscr));
+#endif
+}
+
+//Pins the calling thread on a core, modulo the number of cores
+void pinThread(int core){
+	cpu_set_t	set;
+	int			n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	CPU_ZERO(&set);
+	CPU_SET(core % (n > 0 ? n : 1), &set);
+	if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) logError("DSP : cannot pin a thread on core %i", core);
+}
+
+//Sets up the calling audio thread, 0 : the reader thread, i : worker i
+//Pinned on its core of dspCores, by default the reader on core 0 and worker i on core i when there are workers, run
+//SCHED_FIFO with dspPriority and its stack touched once : no page fault on the first blocks
+void rtThread(int id){
+	char				stack[DSP_STACK_PREFAULT];
+	struct sched_param	param;
+	int					err;
+
+	if (cores[id] >= 0) pinThread(cores[id]);
+	else if (nbWorkers > 0) pinThread(id);
+	if (amp->dspPriority > 0) {
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = amp->dspPriority;
+		if ((err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param)) != 0)
+			logError("DSP : cannot run thread %i SCHED_FIFO %i : %s", id, amp->dspPriority, strerror(err));
+	}
+	memset(stack, 0, sizeof(stack));
+	__asm__ volatile ("" : : "r" (stack) : "memory");		//Not optimized out
+	flushDenormals();
+}
+
+uint64_t nowNs(clockid_t clock){
+	struct timespec t;
+
+	clock_gettime(clock, &t);
+	return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+//Counts a block processed by a thread in t ns, read by the export of the counters
+static void countBlock(struct dspCounters *c, uint64_t t, int frames){
+	__atomic_store_n(&c->blocks, c->blocks + 1, __ATOMIC_RELAXED);
+	if (t * DSP_RATE > (uint64_t) frames * 1000000000) __atomic_store_n(&c->overruns, c->overruns + 1, __ATOMIC_RELAXED);
+	if (t > c->worst) __atomic_store_n(&c->worst, t, __ATOMIC_RELAXED);
+}
+
+//Writes the block processed by thread t to its sinks and samples their delays and the end to end latency : from the
+//arrival of the last frame of the block to the time the device plays it, once the frames it buffers are played
+//Returns -1 on a sink error
+int writeSinks(int t, struct dspStats *st, int frames, uint64_t arrival){
+	struct graphNode	*n;
+	uint64_t			now, latency;
+	int					i;
+
+	if (graphWrite(&graph, t, frames) < 0) return -1;
+	now = nowNs(CLOCK_MONOTONIC);
+	for (i = 0 ; i < graph.nbNodes ; i++) {
+		n = &graph.node[i];
+		if (n->type != NODE_SINK || n->owner != t) continue;
+		st->delaySum += n->deviceDelay;
+		st->blocks++;
+		if (n->sink.simulated) continue;									//Delay of a simulated device, not of the system clock
+		latency = now - arrival + (uint64_t) n->deviceDelay * 1000000000 / DSP_RATE;
+		st->latencySum += latency;
+		st->latencies++;
+		if (latency > st->latencyMax) st->latencyMax = latency;
+	}
+	return 0;
+}
+
+//Worker thread : processes the blocks of its ring
+static void *workerHandler(void *arg){
+	struct dspWorker	*w = arg;
+	struct dspBlock		*b;
+	uint64_t			t, cpu;
+
+	rtThread(w->id);
+	w->cpuMark = nowNs(CLOCK_THREAD_CPUTIME_ID);
+	for (;;) {
+		b = ringReadBlock(&w->ring);
+		if (b->frames > 0) {
+			t = nowNs(CLOCK_MONOTONIC);
+			RT_ENTER();
+			graphImport(&graph, w->id, b->data);
+			graphProcess(&graph, w->id, NULL, b->frames);
+			RT_LEAVE();
+			t = nowNs(CLOCK_MONOTONIC) - t;
+			countBlock(&w->total, t, b->frames);
+			w->st.busy += t;
+			if (t > w->st.maxBlock) w->st.maxBlock = t;
+			w->st.frames += b->frames;
+			if (writeSinks(w->id, &w->st, b->frames, b->arrival) < 0) __atomic_store_n(&w->failed, true, __ATOMIC_RELEASE);
+		}
+		else {
+			cpu = nowNs(CLOCK_THREAD_CPUTIME_ID);
+			w->st.cpu = cpu - w->cpuMark;
+			w->cpuMark = cpu;
+			sem_post(&w->done);
+		}
+		ringPop(&w->ring);
+	}
+	return NULL;
+}
+
+//Watches the preset files of the chains and reloads them when they change
+static void *watchHandler(void *arg){
+	graphWatch(&graph);
+	return NULL;
+}
+
+//Writes the counters since the start to the dspStats file each DSP_STATS_PERIOD s, replaced at once
+static void *statsHandler(void *arg){
+	struct limiter	*l;
+	char			tmp[PATH_MAX];
+	FILE			*f;
+	float			minGain;
+	uint64_t		worst, w;
+	int			i, xruns;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", amp->dspStats);
+	while (true) {
+		sleep(DSP_STATS_PERIOD);
+		if ((f = fopen(tmp, "w")) == NULL) {
+			logError("DSP stats %s : %s", tmp, strerror(errno));
+			return NULL;
+		}
+		xruns = __atomic_load_n(&captureXruns, __ATOMIC_RELAXED);
+		for (i = 0 ; i < graph.nbNodes ; i++) if (graph.node[i].type == NODE_SINK) xruns += __atomic_load_n(&graph.node[i].sink.xruns, __ATOMIC_RELAXED);
+		for (i = 0, worst = 0 ; i <= nbWorkers ; i++) if ((w = __atomic_load_n(&worker[i].total.worst, __ATOMIC_RELAXED)) > worst) worst = w;
+		fprintf(f, "block_frames %i\nblock_period_us %.1f\nblocks %llu\nxruns %i\noverruns %llu\nworst_us %.1f\n", block, block * 1e6 / DSP_RATE,
+			(unsigned long long) __atomic_load_n(&worker[0].total.blocks, __ATOMIC_RELAXED), xruns,
+			(unsigned long long) __atomic_load_n(&worker[0].total.overruns, __ATOMIC_RELAXED), worst / 1e3);
+		for (i = 0 ; i <= nbWorkers ; i++) {
+			if (i > 0) fprintf(f, "worker%i_overruns %llu\n", i, (unsigned long long) __atomic_load_n(&worker[i].total.overruns, __ATOMIC_RELAXED));
+			if (i > 0) fprintf(f, "worker%i_worst_us %.1f\n", i, __atomic_load_n(&worker[i].total.worst, __ATOMIC_RELAXED) / 1e3);
+			else fprintf(f, "reader_worst_us %.1f\n", __atomic_load_n(&worker[0].total.worst, __ATOMIC_RELAXED) / 1e3);
+		}
+		for (i = 0 ; i < graph.nbNodes ; i++) {
+			if ((l = graph.node[i].limiter) == NULL) continue;
+			__atomic_load(&l->minGain, &minGain, __ATOMIC_RELAXED);
+			fprintf(f, "%s_events %llu\n%s_limited_ms %.1f\n%s_max_reduction_db %.1f\n", graph.node[i].name,
+				(unsigned long long) __atomic_load_n(&l->events, __ATOMIC_RELAXED), graph.node[i].name,
+				__atomic_load_n(&l->limited, __ATOMIC_RELAXED) * 1e3 / DSP_RATE, graph.node[i].name, 20 * log10(1 / minGain));
+		}
+		fclose(f);
+		if (rename(tmp, amp->dspStats) < 0) logError("DSP stats %s : %s", amp->dspStats, strerror(errno));
+	}
+	return NULL;
+}
+
+//Allocates the buffers, opens the sinks and starts the workers, the watch of the presets and the export of the counters,
+//once for all the playback sessions. With dspPriority the memory is locked first : the pages of the buffers touched
+//here and of all the memory the process uses later stay in RAM. With dspInputRate the filter tables are built here
+int dspOpen(){
+	struct dspWorker	*w;
+	pthread_t			threadId;
+	int					i, k, flags = MCL_CURRENT | MCL_FUTURE;
+
+#ifdef MCL_ONFAULT
+	flags |= MCL_ONFAULT;										//Locked when touched : the stacks of the other threads are not filled
+#endif
+	if (amp->dspPriority > 0 && mlockall(flags) < 0) logError("DSP : cannot lock the memory : %s", strerror(errno));
+	block = amp->dspBlock > 0 ? amp->dspBlock : DSP_BLOCK;
+	if ((in = alignedAlloc(block * DSP_CHANNELS * sizeof(int32_t))) == NULL) return -1;
+	if (amp->dspInputRate != NULL) {
+		if ((raw = alignedAlloc(block * DSP_CHANNELS * sizeof(int32_t))) == NULL) return -1;
+		if (strcmp(amp->dspInputRate, "mpd") != 0) {
+			if (atoi(amp->dspInputRate) != DSP_RATE && resampleTable(atoi(amp->dspInputRate), DSP_RATE) == NULL) return -1;
+		}
+		else for (i = 0 ; mpdRates[i] != 0 ; i++) resampleTable(mpdRates[i], DSP_RATE);
+	}
+	if (graphOpen(&graph, block, deviceLatency(), amp->dspPeriods) < 0) return -1;
+	if (amp->dspMeter != NULL && (meterShm = meterOpen(amp->dspMeter, amp->dspMeterRate, amp->dspMeterSpectrum > 0, DSP_RATE)) != NULL) {
+		for (i = 0, k = 0 ; i < graph.nbNodes ; i++) {				//Before the workers run the sinks
+			if (graph.node[i].type == NODE_SINK && meterInit(&meters[k], meterShm, graph.node[i].name, DSP_RATE) == 0) graph.node[i].meter = &meters[k++];
+		}
+	}
+	for (i = 1 ; i <= nbWorkers ; i++) {
+		w = &worker[i];
+		w->id = i;
+		if (ringInit(&w->ring, DSP_RING_BLOCKS, sizeof(struct dspBlock) + block * graph.thread[i].importFloats * sizeof(float)) < 0) return -1;
+		sem_init(&w->done, 0, 0);
+		if (pthread_create(&threadId, NULL, workerHandler, w) != 0) return -1;
+		pthread_detach(threadId);
+	}
+	if (pthread_create(&threadId, NULL, watchHandler, NULL) == 0) pthread_detach(threadId);		//Before the reader thread runs SCHED_FIFO : not inherited
+	if (amp->dspStats != NULL && pthread_create(&threadId, NULL, statsHandler, NULL) == 0) pthread_detach(threadId);
+	__atomic_store_n(&opened, true, __ATOMIC_RELEASE);
+	return 0;
+}
+
+//Reads a full block into buf, returns the number of frames read (less than a block at the end of the input)
+int readBlock(int fd, int32_t *buf){
+	char 	*p = (char *) buf;
+	int 	len = block * DSP_CHANNELS * sizeof(int32_t);
+	int 	n, done = 0;
+
+	while (done < len) {
+		if ((n = read(fd, p + done, len - done)) < 0) {
+			if (errno == EINTR) continue;
+			logError("DSP input : %s", strerror(errno));
+			break;
+		}
+		if (n == 0) break;
+		done += n;
+	}
+	arrival = nowNs(CLOCK_MONOTONIC);
+	return done / (DSP_CHANNELS * sizeof(int32_t));
+}
+
+//Opens an ALSA capture device as the input, in s32 or else in s16
+//Returns -1 on error
+int captureOpen(char *device){
+	int err, latency = deviceLatency(), period = amp->dspPeriods > 0 ? block : 0;
+
+	if ((err = snd_pcm_open(&capture, device, SND_PCM_STREAM_CAPTURE, 0)) == 0) {
+		captureS16 = false;
+		if (sinkAlsaParams(capture, SND_PCM_FORMAT_S32_LE, DSP_CHANNELS, inputRate, latency, period) < 0) {
+			captureS16 = true;
+			err = sinkAlsaParams(capture, SND_PCM_FORMAT_S16_LE, DSP_CHANNELS, inputRate, latency, period);
+		}
+	}
+	if (err < 0) {
+		logError("DSP input %s : %s", device, snd_strerror(err));
+		if (capture != NULL) snd_pcm_close(capture);
+		capture = NULL;
+		return -1;
+	}
+	logInfo("DSP input %s opened in %s at %i Hz", device, captureS16 ? "s16" : "s32", inputRate);
+	return 0;
+}
+
+//Reads a full block from the capture device into buf, overruns recovered
+//Returns the number of frames read, less than a block on a fatal error
+int captureBlock(int32_t *buf){
+	int16_t				*s16 = (int16_t *) buf;
+	snd_pcm_sframes_t	delay;
+	int					done = 0, n, i;
+
+	while (done < block) {
+		n = snd_pcm_readi(capture, captureS16 ? (void *) (s16 + done * DSP_CHANNELS) : (void *) (buf + done * DSP_CHANNELS), block - done);
+		if (n < 0) {
+			if (n == -EPIPE) __atomic_store_n(&captureXruns, captureXruns + 1, __ATOMIC_RELAXED);
+			if ((n = snd_pcm_recover(capture, n, 1)) < 0) {
+				logError("DSP input : %s", snd_strerror(n));
+				break;
+			}
+			continue;
+		}
+		done += n;
+	}
+	arrival = nowNs(CLOCK_MONOTONIC);
+	if (snd_pcm_delay(capture, &delay) == 0 && delay > 0) arrival -= (uint64_t) delay * 1000000000 / inputRate;	//Captured before, not read yet
+	if (captureS16) for (i = done * DSP_CHANNELS - 1 ; i >= 0 ; i--) buf[i] = s16[i] * 65536;	//Backwards : in place
+	return done;
+}
+
+//Returns true if a sink of a worker failed since the last call
+static bool workersFailed(){
+	bool	failed = false;
+	int		i;
+
+	for (i = 1 ; i <= nbWorkers ; i++) failed |= __atomic_exchange_n(&worker[i].failed, false, __ATOMIC_ACQ_REL);
+	return failed;
+}
+
+//Runs the reader thread part of the graph on one block, hands it over to the workers and writes the sinks of the reader thread
+//Returns -1 on error
+int dspProcess(struct dspStats *st, int frames){
+	struct dspBlock	*b;
+	uint64_t		t = nowNs(CLOCK_MONOTONIC), start;
+	int				i, n;
+
+	RT_ENTER();
+	if (detecting && detectRun(&detector, in, frames)) sem_post(&signalChanged);
+	graphProcess(&graph, 0, in, frames);
+	RT_LEAVE();
+	t = nowNs(CLOCK_MONOTONIC) - t + inputTime;							//With the conversion of the input
+	inputTime = 0;
+	for (i = 1 ; i <= nbWorkers ; i++) {
+		b = ringWriteBlock(&worker[i].ring);							//Waits while the worker is a block behind : not processing time
+		start = nowNs(CLOCK_MONOTONIC);
+		RT_ENTER();
+		graphExport(&graph, i, b->data, frames);
+		b->frames = frames;
+		b->arrival = arrival;
+		ringPush(&worker[i].ring);
+		RT_LEAVE();
+		t += nowNs(CLOCK_MONOTONIC) - start;
+		n = ringFill(&worker[i].ring);									//This block and the ones ahead, if not taken yet
+		if (n > 1) st->queueSum += n - 1;
+	}
+	countBlock(&worker[0].total, t, frames);
+	st->busy += t;
+	st->frames += frames;
+	if (t > st->maxBlock) st->maxBlock = t;
+	if (nbWorkers > 0) {
+		st->blocks += nbWorkers;
+		return workersFailed() ? -1 : 0;								//A sink of a worker failed on a former block
+	}
+	return writeSinks(0, st, frames, arrival);
+}
+
+//Returns the rate of the input of a session : dspInputRate, or the rate of the song mpd plays with "mpd"
+static int sessionRate(){
+	int rate;
+
+	if (amp->dspInputRate == NULL) return DSP_RATE;
+	if (strcmp(amp->dspInputRate, "mpd") != 0) return atoi(amp->dspInputRate);
+	rate = amp->streamRate != NULL ? amp->streamRate() : 0;
+	if (rate < DSP_RATE_MIN || rate > DSP_RATE_MAX) {
+		logError("DSP input : rate of the song unknown (%i), %i Hz assumed", rate, DSP_RATE);
+		return DSP_RATE;
+	}
+	return rate;
+}
+
+//Converts the input to DSP_RATE and processes it by full blocks until its end, then the frames left in the filter
+//Returns -1 on error
+static int resampleRun(struct dspStats *st, bool alsa, int fd){
+	uint64_t	t;
+	int			frames, n, fill = 0, tail;
+
+	while ((frames = alsa ? captureBlock(raw) : readBlock(fd, raw)) > 0) {
+		t = nowNs(CLOCK_MONOTONIC);
+		RT_ENTER();
+		resampleWrite(&resampler, raw, frames);
+		while ((fill += resampleRead(&resampler, in + fill * DSP_CHANNELS, block - fill)) == block) {
+			RT_LEAVE();
+			inputTime += nowNs(CLOCK_MONOTONIC) - t;
+			if (dspProcess(st, block) < 0) return -1;
+			t = nowNs(CLOCK_MONOTONIC);
+			fill = 0;
+			RT_ENTER();
+		}
+		RT_LEAVE();
+		inputTime += nowNs(CLOCK_MONOTONIC) - t;
+	}
+	memset(raw, 0, block * DSP_CHANNELS * sizeof(int32_t));			//Silence pushing the end through the filter
+	for (tail = resampleLatency(&resampler) ; tail > 0 ; tail -= n) {
+		if ((n = resampleRead(&resampler, in + fill * DSP_CHANNELS, tail < block - fill ? tail : block - fill)) == 0) {
+			resampleWrite(&resampler, raw, block);
+			continue;
+		}
+		if ((fill += n) == block || n == tail) {
+			if (dspProcess(st, fill) < 0) return -1;
+			fill = 0;
+		}
+	}
+	return 0;
+}
+
+//Sends the end of the session to the workers and waits until they have processed it
+void dspEndSession(){
+	struct dspBlock	*b;
+	int				i;
+
+	for (i = 1 ; i <= nbWorkers ; i++) {
+		b = ringWriteBlock(&worker[i].ring);
+		b->frames = 0;
+		ringPush(&worker[i].ring);
+	}
+	for (i = 1 ; i <= nbWorkers ; i++) while (sem_wait(&worker[i].done) < 0 && errno == EINTR);
+}
+
+//Logs the measures of a playback session
+//The latency added by the engine is the block being filled, the blocks queued for the workers and what the devices have buffered,
+//the end to end latency is the one measured after each block
+//The headroom is what remains of the block period at the slowest stage for its longest block
+void dspReport(struct dspStats *st){
+	struct dspWorker	*w;
+	struct graphNode	*n;
+	double				seconds = (double) st->frames / DSP_RATE;
+	double				period = block * 1e9 / DSP_RATE;
+	uint64_t			cpu = st->cpu, maxBlock = st->maxBlock, delaySum = 0;
+	uint64_t			overruns = worker[0].total.overruns, latencySum = st->latencySum, latencyMax = st->latencyMax;
+	int					i, blocks = 0, latencies = st->latencies, xruns = captureXruns;
+
+	if (st->frames == 0) return;
+	for (i = 0 ; i < graph.nbNodes ; i++) if (graph.node[i].type == NODE_SINK) xruns += graph.node[i].sink.xruns;
+	for (i = 1 ; i <= nbWorkers ; i++) overruns += worker[i].total.overruns;
+	if (nbWorkers == 0) {
+		delaySum = st->delaySum;
+		blocks = st->blocks;
+	}
+	for (i = 1 ; i <= nbWorkers ; i++) {
+		w = &worker[i];
+		delaySum += w->st.delaySum;
+		blocks += w->st.blocks;
+		cpu += w->st.cpu;
+		if (w->st.maxBlock > maxBlock) maxBlock = w->st.maxBlock;
+		latencySum += w->st.latencySum;
+		latencies += w->st.latencies;
+		if (w->st.latencyMax > latencyMax) latencyMax = w->st.latencyMax;
+	}
+	logInfo("DSP : %.1f s of audio, CPU %.2f ms per s of audio, max block processing %.2f ms, xruns %i, overruns %llu since the start",
+		seconds, cpu / 1e6 / seconds, maxBlock / 1e6, xruns, (unsigned long long) overruns);
+#ifdef DSP_RTCHECK
+	logInfo("DSP RT check : %i forbidden calls while processing since the start", rtViolations());
+#endif
+	if (nbWorkers > 0) {
+		logInfo("DSP stage reader : %i steps, busy %.2f ms per s of audio, max block %.2f ms",
+			graph.thread[0].nbSteps, st->busy / 1e6 / seconds, st->maxBlock / 1e6);
+		for (i = 1 ; i <= nbWorkers ; i++)
+			logInfo("DSP stage worker %i : %i outputs, %i steps, busy %.2f ms per s of audio, max block %.2f ms", i,
+				graph.thread[i].nbSinks, graph.thread[i].nbSteps, worker[i].st.busy / 1e6 / seconds, worker[i].st.maxBlock / 1e6);
+	}
+	for (i = 0 ; i < graph.nbNodes ; i++) {
+		n = &graph.node[i];
+		if (n->follow < 0 || n->drift == NULL) continue;
+		logInfo("DSP drift %s : locked to %s, %+lli frames accumulated, correction %+.1f ppm, fill error max %.1f frames",
+			n->name, graph.node[n->follow].name, (long long) n->drift->outFrames - (long long) n->drift->in, n->drift->correction * 1e6, n->drift->maxError);
+	}
+	logInfo("DSP headroom : %.1f %% of the %.2f ms block period", 100 * (1 - maxBlock / period), period / 1e6);
+	logInfo("DSP latency : block %.1f ms + queue %.1f ms + device %.1f ms", period / 1e6,
+		nbWorkers > 0 && st->blocks ? (double) st->queueSum / st->blocks * period / 1e6 : 0,
+		blocks ? delaySum * 1000.0 / blocks / DSP_RATE : 0);
+	if (latencies > 0) logInfo("DSP end to end latency : %.1f ms on average, %.1f ms max, from the input to the devices playing",
+		latencySum / 1e6 / latencies, latencyMax / 1e6);
+	if (graph.loudness != NULL) logInfo("DSP loudness : +%.1f dB at %.0f Hz at the volume of the end, step %.1f", loudnessBoost(&loudness, loudness.pos),
+		LOUDNESS_LOW, loudness.pos);
+	for (i = 0 ; i < graph.nbNodes ; i++) {
+		if ((n = &graph.node[i])->limiter == NULL) continue;
+		logInfo("DSP limit %s : %llu gain reductions, %.1f s limited, %.1f dB at most since the start", n->name,
+			(unsigned long long) n->limiter->events, (double) n->limiter->limited / DSP_RATE, 20 * log10(1 / n->limiter->minGain));
+	}
+	for (i = 0 ; i < graph.nbNodes ; i++) {
+		if ((n = &graph.node[i])->meter == NULL) continue;
+		logInfo("DSP meter %s : highest peak %.1f dBFS, %llu samples clipped since the start", n->name, 20 * log10(n->meter->top + 1e-10),
+			(unsigned long long) (n->meter->clips[0] + n->meter->clips[1]));
+	}
+}
+
+//Processes the input until its end
+//stdin is read once, a FIFO is opened again each time mpd closes it
+//Returns -1 on error
+int dspRun(struct amp *ampCtl){
+	struct dspStats st;
+	uint64_t 		cpu;
+	bool			alsa = ampCtl->dspInput != NULL && strncmp(ampCtl->dspInput, "alsa:", 5) == 0;
+	bool			fifo = ampCtl->dspInput != NULL && strcmp(ampCtl->dspInput, "-") != 0 && !alsa;
+	int 			fd, frames, i, status;
+
+	amp = ampCtl;
+	if (dspOpen() < 0) return -1;
+	rtThread(0);
+
+	if (alsa) inputRate = sessionRate();
+	if (alsa && captureOpen(ampCtl->dspInput + 5) < 0) return -1;
+
+	do {
+		if (!fifo) fd = 0;
+		else if ((fd = open(ampCtl->dspInput, O_RDONLY)) < 0) {		//Blocks until mpd opens the FIFO for writing
+			logError("DSP input %s : %s", ampCtl->dspInput, strerror(errno));
+			return -1;
+		}
+		logDebug("DSP input opened");
+		if (!alsa) inputRate = sessionRate();							//Asked to mpd once it has opened the input for the song
+		if (inputRate != DSP_RATE) {
+			if (resampleInit(&resampler, inputRate, DSP_RATE, block) < 0) return -1;
+			logInfo("DSP input : %i Hz converted to %i Hz, kernel %s, filter latency %.1f ms", inputRate, DSP_RATE,
+				resampler.kernel->name, resampleLatency(&resampler) * 1000.0 / DSP_RATE);
+		}
+		memset(&st, 0, sizeof(st));
+		graphReset(&graph);
+		for (i = 1 ; i <= nbWorkers ; i++) memset(&worker[i].st, 0, sizeof(struct dspStats));	//The workers wait for the first block
+		__atomic_store_n(&playing, true, __ATOMIC_RELEASE);
+		cpu = nowNs(CLOCK_THREAD_CPUTIME_ID);
+
+		if (inputRate != DSP_RATE) status = resampleRun(&st, alsa, fd);
+		else for (status = 0 ; status == 0 && (frames = alsa ? captureBlock(in) : readBlock(fd, in)) > 0 ; ) status = dspProcess(&st, frames);
+
+		__atomic_store_n(&playing, false, __ATOMIC_RELEASE);
+		dspEndSession();
+		if (workersFailed()) status = -1;								//On the last blocks
+		st.cpu = nowNs(CLOCK_THREAD_CPUTIME_ID) - cpu;
+		dspReport(&st);
+		if (status < 0) logError("DSP : session stopped by an output error, not by the end of the input");
+		if (inputRate != DSP_RATE) resampleFree(&resampler);
+		if (fifo) close(fd);
+	} while (fifo);
+
+	if (capture != NULL) snd_pcm_close(capture);
+	for (i = 0 ; i < graph.nbNodes ; i++) if (graph.node[i].meter != NULL) meterFree(graph.node[i].meter);
+	graphClose(&graph);
+	return 0;
+}
+
+static void *dspHandler(void *arg){
+	dspRun((struct amp *) arg);
+	return NULL;
+}
+
+//Waits until the signal detected on the input appears or goes (dspStandby)
+//Returns true if it is present
+bool dspSignalWait(){
+	static bool	present = false;
+	bool		p;
+
+	while (true) {
+		while (sem_wait(&signalChanged) < 0 && errno == EINTR);
+		if ((p = __atomic_load_n(&detector.present, __ATOMIC_ACQUIRE)) == present) continue;	//Changed back meanwhile
+		present = p;
+		logInfo("DSP input : signal %s, last block peak %.1f dBFS RMS %.1f dBFS", present ? "present" : "absent",
+			20 * log10(detector.peak + 1e-10), 20 * log10(detector.rms + 1e-10));
+		return present;
+	}
+}
+
+//Starts the DSP engine in its own thread, reading the FIFO written by mpd or a capture device
+//With dspStandby, the signal detected on the input powers the amplifier on and to standby
+int dspStart(struct amp *ampCtl){
+	pthread_t 	threadId;
+	int			i, sinks = 0;
+
+	sem_init(&signalChanged, 0, 0);								//Waited for by dspSignalWait, even if the engine does not start
+	if (ampCtl->dspStandby > 0) {
+		detectInit(&detector, ampCtl->dspSignalLevel, ampCtl->dspSignalHysteresis, ampCtl->dspSignalAttack / 1000.0, ampCtl->dspStandby, DSP_RATE);
+		detecting = true;
+		logInfo("DSP signal detection : on above %i dBFS RMS for %i ms, standby below %i dBFS peak for %i s, kernel %s", ampCtl->dspSignalLevel,
+			ampCtl->dspSignalAttack, ampCtl->dspSignalLevel - ampCtl->dspSignalHysteresis, ampCtl->dspStandby, detector.kernel->name);
+	}
+	for (i = 0 ; i < graph.nbNodes ; i++) sinks += graph.node[i].type == NODE_SINK;
+	if (sinks == 0) {
+		logError("DSP input without output");
+		return -1;
+	}
+	if (pthread_create(&threadId, NULL, dspHandler, ampCtl) != 0) return -1;
+	pthread_detach(threadId);
+	logInfo("DSP engine reading %s", ampCtl->dspInput);
+	return 0;
+}
@@ -0,0 +1,32 @@
+#ifndef DSP_H
+#define DSP_H
+
+#include <stdint.h>
+#include <confuse.h>
+
+#include "ampCtl.h"
+
+#define DSP_RATE			44100
+#define DSP_CHANNELS		2
+#define DSP_BLOCK			1024		/* Frames per block, as ecasound -b:1024 */
+#define DSP_LATENCY			50			/* Buffering requested to the ALSA devices in ms */
+#define DSP_SIGNAL_LEVEL	-60			/* RMS of the input waking the amplifier in dBFS */
+#define DSP_SIGNAL_HYSTERESIS	10		/* The input is silent when its peaks stay this many dB below */
+#define DSP_SIGNAL_ATTACK	100			/* Signal before waking in ms */
+
+extern cfg_opt_t dspOutputOpts[];		// Options of the "output" sections of the configuration file
+extern cfg_opt_t dspNodeOpts[];			// Options of the "node" sections : processing graph
+
+int dspLoadConfig(struct amp *ampCtl, cfg_t *cfg);
+void dspReload(cfg_t *cfg);
+void dspSetVolume(int volume);
+int dspMute(bool mute);
+int64_t dspMuteTime(int seq);
+int dspMuteDelay();
+int dspBuffered();
+bool dspSignalWait();
+int dspStart(struct amp *ampCtl);
+int dspRun(struct amp *ampCtl);
+void flushDenormals();
+
+#endif
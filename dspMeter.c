@@ -0,0 +1,168 @@
+/*
+ * dspMeter : reads the levels of the outputs of the DSP engine from its shared memory segment (dspMeter, see meter.c)
+ *
+ * Prints each output dspMeterRate times per second, or every -i ms : the peak and the RMS of each channel in dBFS, the
+ * samples clipped since the start and, with dspMeterSpectrum, the octave bands. The segment is only read : any number of
+ * dspMeter or other readers may run along with the engine.
+ *
+ * Check (-c) : a thread measures a 1 kHz tone whose level changes at each update, as fast as it can, in a segment of its
+ * own, while the main thread reads it in a loop. Each copy must be of a single update : same levels on both channels
+ * and in the 1 kHz band, as written. Then the accuracy of the levels and the cost of the measure in ns per frame.
+ * The exit status is 1 if a copy mixes two updates or if a level is wrong.
+ *
+ * Usage : dspMeter [-n segment] [-i ms between prints] [-k prints] [-c check]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "log.h"
+#include "fft.h"
+#include "meter.h"
+
+#define CHECK_NAME		"/ampCtl.meter.check"
+#define CHECK_RATE		44100
+#define CHECK_UPDATES	20			/* Updates per s of the check : periods of 2205 frames, more than METER_FFT */
+#define CHECK_TIME		1.0			/* s of reading */
+#define CHECK_STEPS		64			/* Levels of the tone, one per update */
+
+static struct meterShm	*checkShm;
+static volatile bool	stop = false;
+
+static double dB(double x){
+	return 20 * log10(x + 1e-10);
+}
+
+static double seconds(){
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+//Level of the tone of update u, written in the 1 kHz band
+static float level(uint64_t u){
+	return (float) (u % CHECK_STEPS + 1) / CHECK_STEPS;
+}
+
+//Measures periods of a 1 kHz tone, its level changing at each update, until stopped
+static void *writer(void *arg){
+	struct meter	*m = (struct meter *) arg;
+	float			*x = malloc(m->period * METER_CHANNELS * sizeof(float)), a;
+	long			n = 0;
+	int				i;
+
+	while (!stop) {
+		a = level(m->levels->updates);
+		for (i = 0 ; i < m->period ; i++, n++) x[i * 2] = x[i * 2 + 1] = a * sin(2 * M_PI * 1000.0 * n / CHECK_RATE);
+		meterRun(m, x, METER_CHANNELS, m->period);
+	}
+	free(x);
+	return NULL;
+}
+
+//Reads the segment while it is written, checks each copy and the levels
+//Returns 1 if a copy mixes two updates or a level is wrong
+int check(){
+	struct meter		m;
+	struct meterLevels	l;
+	pthread_t			thread;
+	double				start, err = 0, a;
+	long				reads = 0, torn = 0, updates = 0;
+	uint64_t			last = 0;
+	float				*x;
+	int					i, failed = 0;
+
+	if ((checkShm = meterOpen(CHECK_NAME, CHECK_UPDATES, true, CHECK_RATE)) == NULL || meterInit(&m, checkShm, "check", CHECK_RATE) < 0) return 1;
+	pthread_create(&thread, NULL, writer, &m);
+	for (start = seconds() ; seconds() - start < CHECK_TIME ; reads++) {
+		if (!meterRead(checkShm, 0, &l)) continue;
+		if (l.updates != last) updates++;
+		last = l.updates;
+		a = level(l.updates - 1);												//Level of the tone of the period published
+		if (l.peak[0] != l.peak[1] || l.rms[0] != l.rms[1] || l.band[0][5] != l.band[1][5] || fabs(dB(l.rms[0] * M_SQRT2 / a)) > 0.01
+			|| fabs(dB(l.band[0][5] / l.rms[0])) > 0.1) torn++;
+		else err = fmax(err, fmax(fabs(dB(l.peak[0] / a)), fabs(dB(l.band[0][5] / l.rms[0]))));
+	}
+	stop = true;
+	pthread_join(thread, NULL);
+	printf("Check of the seqlock : %li reads of %li updates written as fast as possible, %li mixing two updates %s\n",
+		reads, updates, torn, torn > 0 || updates == 0 ? "FAILED" : "ok");
+	printf("Levels of a 1 kHz tone : peak and 1 kHz band within %.3f dB of the tone %s\n", err, err > 0.1 ? "FAILED" : "ok");
+	failed = torn > 0 || updates == 0 || err > 0.1;
+
+	//Cost of the measure in the audio thread : levels only, then with the spectrum of each update
+	x = malloc(m.period * METER_CHANNELS * sizeof(float));
+	for (i = 0 ; i < m.period * METER_CHANNELS ; i++) x[i] = drand48() - 0.5;
+	printf("\nns per stereo frame, CPU load at %i Hz in %% of one core, %i updates per s\n", CHECK_RATE, CHECK_UPDATES);
+	for (i = 0 ; i < 2 ; i++) {
+		m.spectrum = i == 1;
+		for (start = seconds(), updates = 0 ; seconds() - start < 0.2 ; updates++) meterRun(&m, x, METER_CHANNELS, m.period);
+		a = (seconds() - start) * 1e9 / (updates * m.period);
+		printf("  %-8s : %6.2f ns, %.3f %%\n", i == 0 ? "levels" : "spectrum", a, a * CHECK_RATE * 1e-7);
+	}
+	free(x);
+	meterFree(&m);
+	munmap(checkShm, sizeof(struct meterShm));
+	shm_unlink(CHECK_NAME);
+	return failed;
+}
+
+//Prints the levels of the outputs of the engine
+void print(struct meterShm *shm){
+	struct meterLevels	l;
+	int					i, k, ch;
+
+	for (i = 0 ; i < __atomic_load_n(&shm->nbOutputs, __ATOMIC_ACQUIRE) ; i++) {
+		if (!meterRead(shm, i, &l)) continue;
+		printf("%-12s peak %6.1f %6.1f dBFS  RMS %6.1f %6.1f dBFS  clipped %llu %llu\n", l.name, dB(l.peak[0]), dB(l.peak[1]),
+			dB(l.rms[0]), dB(l.rms[1]), (unsigned long long) l.clips[0], (unsigned long long) l.clips[1]);
+		for (ch = 0 ; shm->bands > 0 && ch < METER_CHANNELS ; ch++) {
+			printf("  %s", ch == 0 ? "L" : "R");
+			for (k = 0 ; k < shm->bands ; k++) printf(" %5.0f", dB(l.band[ch][k]));
+			printf("\n");
+		}
+	}
+}
+
+int main(int argc, char *argv[]){
+	struct meterShm	*shm;
+	char			*name = METER_NAME;
+	int				opt, k, interval = 0, prints = 0;
+	bool			checkOnly = false;
+
+	while ((opt = getopt(argc, argv, "n:i:k:c")) != -1) {
+		switch (opt) {
+			case 'n': name = optarg; break;
+			case 'i': interval = atoi(optarg); break;
+			case 'k': prints = atoi(optarg); break;
+			case 'c': checkOnly = true; break;
+			default:
+				fprintf(stderr, "Usage : %s [-n segment] [-i ms between prints] [-k prints] [-c]\n", argv[0]);
+				return 1;
+		}
+	}
+	if (checkOnly) return check();
+
+	if ((shm = meterAttach(name)) == NULL) {
+		fprintf(stderr, "No levels published in %s : is dspMeter set and the engine running ?\n", name);
+		return 1;
+	}
+	if (interval <= 0) interval = 1000 / shm->rate;
+	if (shm->bands > 0) {
+		printf("Bands in dBFS :");
+		for (k = 0 ; k < shm->bands ; k++) printf(" %5.0f", shm->centre[k]);
+		printf(" Hz\n");
+	}
+	for (k = 0 ; prints == 0 || k < prints ; k++) {
+		if (k > 0) usleep(interval * 1000);
+		print(shm);
+	}
+	return 0;
+}
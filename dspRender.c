@@ -0,0 +1,580 @@
+/*
+ * dspRender : renders test signals through the processing graph of a configuration file, checks and measures it
+ *
+ * Offline and headless : the graph is loaded as ampCtl --dsp does, with all its nodes in one thread, and the sinks
+ * are replaced by null sinks. Each output is captured in float before its conversion to s16 (checked by ditherBench)
+ * and, for the locked outputs, before their resampler. Both channels get the same signal, with the polarity of the
+ * right one reversed to catch swapped channels.
+ *
+ * Signals : an impulse, an exponential sine sweep and a multitone (1/3 octave, Schroeder phases, analysed over one
+ * period after two of warm up), and tones at 100 Hz, 1 kHz and 10 kHz.
+ * Check : the magnitude and phase response of each output measured with the impulse, the sweep (ratio of the
+ * spectra of the output and of the input) and the multitone are compared with the response computed in double
+ * along the graph from the compiled chains, the delay filters and the impulse responses of the FIR nodes, 12 points
+ * per octave from 20 Hz to 20 kHz. THD of the tones (harmonics 2 to 9) and distortion plus noise of the multitone
+ * must stay under RENDER_THD and RENDER_NOISE.
+ * Golden file : the response measured with the impulse may be written (-w) and later compared (-g) with a larger
+ * tolerance, which also catches a change of the design of the chains.
+ * Speed : frames/s of the whole graph and of each step of the schedule run alone (bank of chains, FIR, delay, limiter,
+ * conversion to s16), and of each kernel of the signal detector, checked against the scalar one.
+ * The exit status is 1 if a check fails.
+ *
+ * The configuration file holds the DSP options of ampCtl only (dspPre, dspBlock, dspKernel, output, node...).
+ * With -o, the inputs and the outputs are written as float WAV files : <dir>/in.<signal>.wav, <dir>/<output>.<signal>.wav
+ *
+ * Usage : dspRender [-o directory] [-g golden] [-w golden] [-k kernel] [-t seconds per measure] [-v] file.conf
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <math.h>
+#include <complex.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include <confuse.h>
+
+#include "log.h"
+#include "graph.h"
+#include "dsp.h"
+#include "detect.h"
+
+#define RENDER_RATE			DSP_RATE
+#define RENDER_LEVEL		0.25		/* -12 dBFS : sweep, tones, peak of the multitone */
+#define RENDER_IMPULSE		131072		/* Frames of the impulse response recorded */
+#define RENDER_SWEEP		4.0			/* s, from 10 Hz to 22 kHz */
+#define RENDER_FADE			0.005		/* s, fade in and out of the sweep */
+#define RENDER_TAIL			131072		/* Frames recorded after the sweep */
+#define RENDER_PERIOD		65536		/* Frames of the multitone and of the tones analysed, after 2 periods of warm up */
+#define RENDER_TONES		30			/* Tones of the multitone : 1/3 octave from 20 Hz */
+#define RENDER_HARMONICS	9
+#define RENDER_STEPS		12			/* Points per octave of the check */
+#define RENDER_FLOOR		-60			/* dB, responses compared above this level */
+#define RENDER_MAGNITUDE	0.05		/* dB, tolerance against the response computed : rounding of the chains in float */
+#define RENDER_PHASE		0.5			/* Degrees */
+#define RENDER_GOLDEN_MAG	0.1			/* dB, tolerance against the golden file */
+#define RENDER_GOLDEN_PHASE	1.0			/* Degrees */
+#define RENDER_THD			-100		/* dB, THD of the tones */
+#define RENDER_NOISE		-60			/* dB, distortion plus noise of the multitone : rounding of the sections with poles close to 1 */
+#define RENDER_TIME			0.5			/* Seconds per measure of speed */
+
+struct signal {								//Test signal and the outputs it gives, interleaved stereo
+	char	*name;
+	int		frames;
+	int		skip;							//Frames of warm up before the analysis
+	float	*x;
+	float	*y[GRAPH_MAX_NODES];			//Output of each sink
+};
+
+static struct graph		graph;
+static int				nbSinks;
+static int				sink[GRAPH_MAX_NODES];		//Sink nodes
+static struct graphBuf	*sinkIn[GRAPH_MAX_NODES];	//Their input in thread 0
+static float			*irData[GRAPH_MAX_NODES][FIR_CHANNELS];	//FIR nodes : impulse response of each channel
+static int				irTaps[GRAPH_MAX_NODES];
+static int				tones[RENDER_TONES];		//Bins of the multitone
+static int				thdTones[] = {100, 1000, 10000, 0};
+
+//Stereo signal : right channel with the polarity reversed
+struct signal *newSignal(char *name, int frames, int skip){
+	struct signal *s = calloc(1, sizeof(struct signal));
+	int k;
+
+	s->name = name;
+	s->frames = frames;
+	s->skip = skip;
+	s->x = calloc(frames * GRAPH_CHANNELS, sizeof(float));
+	for (k = 0 ; k < nbSinks ; k++) s->y[k] = calloc(frames * GRAPH_CHANNELS, sizeof(float));
+	return s;
+}
+
+void setSample(struct signal *s, int i, double v){
+	s->x[i * 2] = v;
+	s->x[i * 2 + 1] = -v;
+}
+
+//Runs a signal through the graph block after block, from silence
+void render(struct signal *s){
+	int32_t	*in = malloc(graph.block * GRAPH_CHANNELS * sizeof(int32_t));
+	double	v;
+	int		i, j, k, n;
+
+	graphReset(&graph);
+	for (i = 0 ; i < s->frames ; i += n) {
+		n = graph.block < s->frames - i ? graph.block : s->frames - i;
+		for (j = 0 ; j < n * GRAPH_CHANNELS ; j++) {
+			v = s->x[i * GRAPH_CHANNELS + j] * 2147483648.0;
+			in[j] = v > INT32_MAX ? INT32_MAX : v < INT32_MIN ? INT32_MIN : lrint(v);
+		}
+		graphProcess(&graph, 0, in, n);
+		for (k = 0 ; k < nbSinks ; k++)
+			for (j = 0 ; j < n ; j++) {
+				s->y[k][(i + j) * 2] = sinkIn[k]->base[j * sinkIn[k]->stride];
+				s->y[k][(i + j) * 2 + 1] = sinkIn[k]->base[j * sinkIn[k]->stride + 1];
+			}
+	}
+	free(in);
+}
+
+//Writes interleaved stereo samples to a float WAV file
+int writeWav(char *file, float *x, int frames){
+	FILE		*fp;
+	uint32_t	h[11] = {0x46464952, 36 + frames * 8, 0x45564157, 0x20746d66, 16, 3 | GRAPH_CHANNELS << 16,
+						RENDER_RATE, RENDER_RATE * 8, 8 | 32 << 16, 0x61746164, frames * 8};		//Little endian
+
+	if ((fp = fopen(file, "wb")) == NULL || fwrite(h, 4, 11, fp) != 11 || fwrite(x, 8, frames, fp) != frames) {
+		fprintf(stderr, "Cannot write %s\n", file);
+		if (fp != NULL) fclose(fp);
+		return -1;
+	}
+	fclose(fp);
+	return 0;
+}
+
+void writeSignal(struct signal *s, char *dir){
+	char	file[512];
+	int		k;
+
+	snprintf(file, sizeof(file), "%s/in.%s.wav", dir, s->name);
+	writeWav(file, s->x, s->frames);
+	for (k = 0 ; k < nbSinks ; k++) {
+		snprintf(file, sizeof(file), "%s/%s.%s.wav", dir, graph.node[sink[k]].name, s->name);
+		writeWav(file, s->y[k], s->frames);
+	}
+}
+
+//Spectrum of frames samples x[i * stride] at f Hz
+double complex dtft(float *x, int stride, int frames, double f){
+	double complex	z = cexp(-I * 2 * M_PI * f / RENDER_RATE), p = 1, sum = 0;
+	int				i;
+
+	for (i = 0 ; i < frames ; i++, p *= z) sum += x[i * stride] * p;
+	return sum;
+}
+
+//Spectrum of channel ch of a stereo signal at f Hz, over frames frames from frame skip
+double complex spectrum(float *x, int skip, int frames, int ch, double f){
+	return dtft(x + skip * GRAPH_CHANNELS + ch, GRAPH_CHANNELS, frames, f);
+}
+
+//Response of a compiled chain at f Hz, as ecpMagnitude
+double complex chainResponse(struct ecpChain *c, double f){
+	double complex	z1 = cexp(-I * 2 * M_PI * f / c->rate), z2 = z1 * z1, h = 1;
+	float			*s;
+	int				i;
+
+	for (i = 0 ; i < c->nbSections ; i++) {
+		s = &c->sos[i * ECP_SOS_STRIDE];
+		h *= (s[0] + s[1] * z1 + s[2] * z2) / (1 + s[3] * z1 + s[4] * z2);
+	}
+	if (c->delay > 0) h *= c->dry + c->wet * cpow(z1, c->delay);
+	return h;
+}
+
+//Reads the impulse responses of a FIR node as firLoad does
+int loadIr(struct graphNode *n, int i){
+	float	*data[FIR_MAX_FILES] = {NULL};
+	int		channels[FIR_MAX_FILES], frames[FIR_MAX_FILES];
+	int		c, j, k;
+
+	for (k = 0 ; k < n->nbIrFiles ; k++) {
+		if ((frames[k] = readWav(n->irFiles[k], RENDER_RATE, &data[k], &channels[k])) < 0) return -1;
+		if (frames[k] > irTaps[i]) irTaps[i] = frames[k];
+	}
+	for (c = 0 ; c < FIR_CHANNELS ; c++) {
+		k = n->nbIrFiles > 1 ? c : 0;
+		irData[i][c] = calloc(irTaps[i], sizeof(float));
+		for (j = 0 ; j < frames[k] ; j++) irData[i][c][j] = data[k][j * channels[k] + (n->nbIrFiles > 1 ? 0 : c % channels[k])];
+	}
+	for (k = 0 ; k < n->nbIrFiles ; k++) free(data[k]);
+	return 0;
+}
+
+//Response of the output of node i, channel ch, at f Hz, computed in double along the graph
+double complex response(int i, int ch, double f){
+	struct graphNode	*n = &graph.node[i];
+	struct graphStep	*s;
+	struct delayTaps	*t;
+	double complex		h = 0, z = cexp(-I * 2 * M_PI * f / RENDER_RATE);
+	int					j, k;
+
+	switch (n->type) {
+		case NODE_INPUT:
+			return 1;
+		case NODE_CHAIN:
+			for (k = 0 ; k < graph.thread[0].nbSteps ; k++) {
+				s = &graph.thread[0].step[k];
+				for (j = 0 ; j < s->nbMembers ; j++) if (s->member[j] == i) return chainResponse(&s->bank->ecp[j], f) * response(n->input[0], ch, f);
+			}
+			return 0;
+		case NODE_GAIN:
+			return n->gain * response(n->input[0], ch, f);
+		case NODE_DELAY:
+			t = n->line->cur;
+			if (!t->fractional) return cpow(z, t->whole) * response(n->input[0], ch, f);
+			for (k = 0 ; k < DELAY_TAPS ; k++) h += t->h[k] * cpow(z, t->whole + DELAY_TAPS - 1 - k);
+			return h * response(n->input[0], ch, f);
+		case NODE_SUM:
+			for (k = 0 ; k < n->nbInputs ; k++) h += response(n->input[k], ch, f);
+			return h;
+		case NODE_FIR:
+			return dtft(irData[i][ch], 1, irTaps[i], f) * response(n->input[0], ch, f);
+		case NODE_LIMIT:													//Below the ceiling : its look-ahead only
+			return cpow(z, n->limiter->lookahead) * response(n->input[0], ch, f);
+		default:
+			return response(n->input[0], ch, f);
+	}
+}
+
+double toDb(double complex h){
+	return 20 * log10(cabs(h) + 1e-30);
+}
+
+//Largest deviations of the responses measured from the ones computed, at the frequencies given
+//bins : frequencies of the multitone, NULL for the check frequencies
+void compare(struct signal *s, int k, int *bins, int nbBins, double *mag, double *phase){
+	double complex	ref, got;
+	double			f, d;
+	int				ch, b;
+
+	*mag = *phase = 0;
+	for (ch = 0 ; ch < GRAPH_CHANNELS ; ch++) {
+		for (b = 0, f = 20 ; bins != NULL ? b < nbBins : f < 20001 ; b++, f *= pow(2, 1.0 / RENDER_STEPS)) {
+			if (bins != NULL) f = (double) bins[b] * RENDER_RATE / RENDER_PERIOD;
+			ref = response(sink[k], ch, f);
+			if (toDb(ref) < RENDER_FLOOR) continue;
+			got = spectrum(s->y[k], s->skip, s->frames - s->skip, ch, f) / spectrum(s->x, s->skip, s->frames - s->skip, ch, f);
+			if ((d = fabs(toDb(got) - toDb(ref))) > *mag) *mag = d;
+			if ((d = fabs(carg(got / ref)) * 180 / M_PI) > *phase) *phase = d;
+		}
+	}
+}
+
+//Distortion plus noise of the multitone : power left without the tones relative to the tones, in dB
+double multitoneDistortion(struct signal *s, int k){
+	double	total = 0, tone = 0, a;
+	int		ch, i, b;
+
+	for (ch = 0 ; ch < GRAPH_CHANNELS ; ch++) {
+		for (i = s->skip ; i < s->frames ; i++) total += (double) s->y[k][i * 2 + ch] * s->y[k][i * 2 + ch];
+		for (b = 0 ; b < RENDER_TONES ; b++) {
+			a = cabs(spectrum(s->y[k], s->skip, RENDER_PERIOD, ch, (double) tones[b] * RENDER_RATE / RENDER_PERIOD)) * 2 / RENDER_PERIOD;
+			tone += a * a / 2 * RENDER_PERIOD;
+		}
+	}
+	return 10 * log10(fabs(total - tone) / tone + 1e-30);
+}
+
+//THD of a tone at bin b, in dB, 0 if the tone is filtered out
+double thd(struct signal *s, int k, int b){
+	double	a1, h = 0, a;
+	int		ch, j;
+
+	a1 = cabs(spectrum(s->y[k], s->skip, RENDER_PERIOD, 0, (double) b * RENDER_RATE / RENDER_PERIOD)) * 2 / RENDER_PERIOD;
+	if (20 * log10(a1 / RENDER_LEVEL + 1e-30) < RENDER_FLOOR + 20) return 0;
+	for (ch = 0 ; ch < GRAPH_CHANNELS ; ch++)
+		for (j = 2 ; j <= RENDER_HARMONICS && j * b < RENDER_PERIOD / 2 ; j++) {
+			a = cabs(spectrum(s->y[k], s->skip, RENDER_PERIOD, ch, (double) j * b * RENDER_RATE / RENDER_PERIOD)) * 2 / RENDER_PERIOD;
+			h += a * a / 2;
+		}
+	return 10 * log10(h / 2 / (a1 * a1 / 2) + 1e-30);
+}
+
+//Writes the response of each output measured with the impulse
+int writeGolden(char *file, struct signal *s){
+	double complex	h;
+	FILE			*fp;
+	double			f;
+	int				k, ch;
+
+	if ((fp = fopen(file, "w")) == NULL) {
+		fprintf(stderr, "Cannot write %s\n", file);
+		return -1;
+	}
+	fprintf(fp, "# output channel Hz dB degrees : response measured by dspRender with an impulse\n");
+	for (k = 0 ; k < nbSinks ; k++)
+		for (ch = 0 ; ch < GRAPH_CHANNELS ; ch++)
+			for (f = 20 ; f < 20001 ; f *= pow(2, 1.0 / RENDER_STEPS)) {
+				h = spectrum(s->y[k], 0, s->frames, ch, f) / spectrum(s->x, 0, s->frames, ch, f);
+				fprintf(fp, "%s %i %.3f %.4f %.3f\n", graph.node[sink[k]].name, ch, f, toDb(h), carg(h) * 180 / M_PI);
+			}
+	fclose(fp);
+	return 0;
+}
+
+//Compares the response measured with the impulse with the golden file, returns the number of points out of tolerance
+int checkGolden(char *file, struct signal *s){
+	double complex	h;
+	FILE			*fp;
+	char			line[256], name[64];
+	double			f, mag, phase, d, maxMag = 0, maxPhase = 0;
+	int				k, ch, points = 0, failed = 0;
+
+	if ((fp = fopen(file, "r")) == NULL) {
+		printf("Golden file %s : cannot open FAILED\n", file);
+		return 1;
+	}
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (line[0] == '#' || sscanf(line, "%63s %i %lf %lf %lf", name, &ch, &f, &mag, &phase) != 5) continue;
+		for (k = 0 ; k < nbSinks && strcmp(graph.node[sink[k]].name, name) != 0 ; k++);
+		if (k == nbSinks || ch < 0 || ch >= GRAPH_CHANNELS) {
+			printf("  golden output %s channel %i : not in the graph FAILED\n", name, ch);
+			failed++;
+			continue;
+		}
+		if (mag < RENDER_FLOOR) continue;
+		h = spectrum(s->y[k], 0, s->frames, ch, f) / spectrum(s->x, 0, s->frames, ch, f);
+		if ((d = fabs(toDb(h) - mag)) > maxMag) maxMag = d;
+		failed += d > RENDER_GOLDEN_MAG;
+		d = fabs(remainder(carg(h) * 180 / M_PI - phase, 360));
+		if (d > maxPhase) maxPhase = d;
+		failed += d > RENDER_GOLDEN_PHASE;
+		points++;
+	}
+	fclose(fp);
+	printf("Golden file %s : %i points, max deviation %.4f dB %.3f degrees %s\n", file, points, maxMag, maxPhase,
+		failed > 0 || points == 0 ? "FAILED" : "ok");
+	return failed + (points == 0);
+}
+
+//Runs one step of the schedule alone, or the whole graph when s is NULL
+//Returns frames per second
+double speed(struct graphStep *s, double seconds){
+	struct timespec		t0, t1;
+	struct graphNode	*n = s != NULL ? &graph.node[s->node] : NULL;
+	int32_t				*in = malloc(graph.block * GRAPH_CHANNELS * sizeof(int32_t));
+	float				*buf;
+	double				elapsed;
+	long				frames = 0;
+	int					i;
+
+	if (posix_memalign((void **) &buf, 64, graph.block * FLT_MAX_CHAINS * GRAPH_CHANNELS * 2 * sizeof(float)) != 0) return 0;	//Aligned as the buffers of the graph
+
+	for (i = 0 ; i < graph.block * GRAPH_CHANNELS ; i++) in[i] = (drand48() - 0.5) * 2147483648.0;
+	for (i = 0 ; i < graph.block * FLT_MAX_CHAINS * GRAPH_CHANNELS * 2 ; i++) buf[i] = drand48() - 0.5;
+	graphReset(&graph);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	do {
+		for (i = 0 ; i < 16 ; i++) {
+			if (s == NULL) graphProcess(&graph, 0, in, graph.block);
+			else if (s->type == NODE_CHAIN) filterRun(s->bank, buf, graph.block);
+			else if (s->type == NODE_FIR) firRun(n->fir, buf, GRAPH_CHANNELS, buf + graph.block * GRAPH_CHANNELS, GRAPH_CHANNELS, graph.block);
+			else if (s->type == NODE_DELAY) delayRun(n->line, buf, GRAPH_CHANNELS, buf, GRAPH_CHANNELS, graph.block);
+			else if (s->type == NODE_LIMIT) limitRun(n->limiter, buf, GRAPH_CHANNELS, buf, GRAPH_CHANNELS, graph.block);
+			else ditherRun(&n->dither, buf, GRAPH_CHANNELS, n->pcm, graph.block);
+			frames += graph.block;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	} while (elapsed < seconds);
+	free(in); free(buf);
+	return frames / elapsed;
+}
+
+void printSpeed(char *what, double fps){
+	printf("  %-48s %8.2f Mframes/s, %7.1f x real time\n", what, fps / 1e6, fps / RENDER_RATE);
+}
+
+//Measures each kernel of the signal detector on a block, after checking it against the scalar one
+//Returns the number of kernels failing
+int detectSpeed(double seconds){
+	struct detectKernel	*k;
+	struct timespec		t0, t1;
+	int32_t				*in = malloc(graph.block * GRAPH_CHANNELS * sizeof(int32_t));
+	float				peak, power, refPeak, refPower;
+	double				elapsed;
+	long				frames;
+	char				what[128];
+	int					i, failed = 0;
+
+	for (i = 0 ; i < graph.block * GRAPH_CHANNELS ; i++) in[i] = (drand48() - 0.5) * 2147483648.0;
+	in[graph.block / 3] = INT32_MIN;
+	detectKernels[0].run(in, graph.block * GRAPH_CHANNELS, &refPeak, &refPower);
+	for (k = detectKernels ; k->name != NULL ; k++) {
+		if (!k->supported()) continue;
+		k->run(in, graph.block * GRAPH_CHANNELS, &peak, &power);
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		frames = 0;
+		do {
+			for (i = 0 ; i < 16 ; i++, frames += graph.block) k->run(in, graph.block * GRAPH_CHANNELS, &peak, &power);
+			clock_gettime(CLOCK_MONOTONIC, &t1);
+			elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+		} while (elapsed < seconds);
+		snprintf(what, sizeof(what), "signal detector %s%s", k->name, peak != refPeak || fabs(power - refPower) > 1e-4 * refPower ? " FAILED" : "");
+		failed += peak != refPeak || fabs(power - refPower) > 1e-4 * refPower;
+		printSpeed(what, frames / elapsed);
+	}
+	free(in);
+	return failed;
+}
+
+//Loads the graph with null sinks and all its nodes in one thread
+//Returns -1 if the configuration is invalid
+int load(char *file, char *kernel){
+	static struct amp	amp;
+	cfg_t				*cfg;
+	struct graphStep	*s;
+	int					i, status;
+	cfg_opt_t			opts[] = {
+		CFG_SIMPLE_STR("dspInput", 		&amp.dspInput),
+		CFG_SIMPLE_STR("dspPre", 		&amp.dspPre),
+		CFG_SIMPLE_INT("dspBlock", 		&amp.dspBlock),
+		CFG_SIMPLE_INT("dspLatency", 	&amp.dspLatency),
+		CFG_SIMPLE_STR("dspKernel", 	&amp.dspKernel),
+		CFG_SIMPLE_INT("dspWorkers", 	&amp.dspWorkers),
+		CFG_SEC("output", 				dspOutputOpts, CFGF_MULTI | CFGF_TITLE),
+		CFG_SEC("node", 				dspNodeOpts, CFGF_MULTI | CFGF_TITLE),
+		CFG_END()
+	};
+
+	amp.dspBlock = DSP_BLOCK;
+	cfg = cfg_init(opts, 0);
+	if ((status = cfg_parse(cfg, file)) != CFG_SUCCESS) {
+		fprintf(stderr, "%s : %s\n", file, status == CFG_FILE_ERROR ? "cannot open" : "parse error");
+		return -1;
+	}
+	if (kernel == NULL) kernel = amp.dspKernel;
+	if (biquadSelect(kernel) == NULL || fftSelect(kernel) == NULL || ditherSelect(kernel) == NULL || limitSelect(kernel) == NULL) return -1;
+	if (graphLoad(&graph, cfg, amp.dspPre, 0, RENDER_RATE) < 0) return -1;
+	cfg_free(cfg);
+	for (i = 0 ; i < graph.nbNodes ; i++) {
+		if (graph.node[i].type == NODE_FIR && loadIr(&graph.node[i], i) < 0) return -1;
+		if (graph.node[i].type != NODE_SINK) continue;
+		free(graph.node[i].sinkSpec);
+		graph.node[i].sinkSpec = strdup("null");
+		graph.node[i].skew = 0;
+		graph.node[i].follow = -1;
+	}
+	if (graphOpen(&graph, amp.dspBlock, 0, 0) < 0) return -1;
+	for (i = 0 ; i < graph.thread[0].nbSteps ; i++) {
+		s = &graph.thread[0].step[i];
+		if (s->type != NODE_SINK) continue;
+		sink[nbSinks] = s->node;
+		sinkIn[nbSinks++] = s->in[0];
+	}
+	printf("%s : %i nodes, %i outputs, block %i frames, kernel %s\n", file, graph.nbNodes, nbSinks, graph.block, biquadSelect(kernel)->name);
+	return 0;
+}
+
+int main(int argc, char *argv[]){
+	struct signal	*imp, *sweep, *multi, *tone[4];
+	struct graphStep *s;
+	char			*dir = NULL, *golden = NULL, *write = NULL, *kernel = NULL, what[256];
+	double			seconds = RENDER_TIME, mag, phase, d, w, t, k1, peak, x;
+	bool			verbose = false, failed;
+	int				opt, i, j, k, b, status = 0;
+
+	while ((opt = getopt(argc, argv, "o:g:w:k:t:v")) != -1) {
+		switch (opt) {
+			case 'o': dir = optarg; break;
+			case 'g': golden = optarg; break;
+			case 'w': write = optarg; break;
+			case 'k': kernel = optarg; break;
+			case 't': seconds = atof(optarg); break;
+			case 'v': verbose = true; break;
+			default:
+				optind = argc;
+		}
+	}
+	if (optind != argc - 1) {
+		fprintf(stderr, "Usage : %s [-o directory] [-g golden] [-w golden] [-k kernel] [-t seconds per measure] [-v] file.conf\n", argv[0]);
+		return 1;
+	}
+	setLogLevel(verbose ? LOG_INFO : LOG_ERROR);
+	flushDenormals();
+	srand48(1);
+	if (load(argv[optind], kernel) < 0) return 1;
+
+	imp = newSignal("impulse", RENDER_IMPULSE, 0);
+	setSample(imp, 0, 0.5);
+	sweep = newSignal("sweep", lrint(RENDER_SWEEP * RENDER_RATE) + RENDER_TAIL, 0);
+	k1 = log(22000.0 / 10) / RENDER_SWEEP;
+	for (i = 0 ; i < lrint(RENDER_SWEEP * RENDER_RATE) ; i++) {
+		t = (double) i / RENDER_RATE;
+		w = fmin(1, fmin(t, RENDER_SWEEP - t) / RENDER_FADE);
+		setSample(sweep, i, RENDER_LEVEL * (0.5 - 0.5 * cos(M_PI * w)) * sin(2 * M_PI * 10 / k1 * (exp(k1 * t) - 1)));
+	}
+	multi = newSignal("multitone", 3 * RENDER_PERIOD, 2 * RENDER_PERIOD);
+	for (b = 0 ; b < RENDER_TONES ; b++) tones[b] = lrint(20 * pow(2, b / 3.0) * RENDER_PERIOD / RENDER_RATE);
+	for (peak = 0, i = 0 ; i < RENDER_PERIOD ; i++) {
+		for (x = 0, b = 0 ; b < RENDER_TONES ; b++) x += sin(2 * M_PI * tones[b] * i / RENDER_PERIOD - M_PI * b * (b + 1) / RENDER_TONES);
+		for (j = 0 ; j < 3 ; j++) setSample(multi, i + j * RENDER_PERIOD, x);
+		peak = fmax(peak, fabs(x));
+	}
+	for (i = 0 ; i < multi->frames * GRAPH_CHANNELS ; i++) multi->x[i] *= RENDER_LEVEL / peak;
+	for (j = 0 ; thdTones[j] != 0 ; j++) {
+		tone[j] = newSignal(NULL, 3 * RENDER_PERIOD, 2 * RENDER_PERIOD);
+		tone[j]->name = malloc(16);
+		snprintf(tone[j]->name, 16, "tone%i", thdTones[j]);
+		b = lrint((double) thdTones[j] * RENDER_PERIOD / RENDER_RATE);
+		for (i = 0 ; i < tone[j]->frames ; i++) setSample(tone[j], i, RENDER_LEVEL * sin(2 * M_PI * b * (double) (i % RENDER_PERIOD) / RENDER_PERIOD));
+	}
+
+	render(imp); render(sweep); render(multi);
+	for (j = 0 ; thdTones[j] != 0 ; j++) render(tone[j]);
+	if (dir != NULL) {
+		mkdir(dir, 0755);
+		writeSignal(imp, dir); writeSignal(sweep, dir); writeSignal(multi, dir);
+		for (j = 0 ; thdTones[j] != 0 ; j++) writeSignal(tone[j], dir);
+		printf("Signals and outputs written to %s\n", dir);
+	}
+
+	for (k = 0 ; k < nbSinks ; k++) {
+		printf("Output %s, reading %s\n", graph.node[sink[k]].name, graph.node[graph.node[sink[k]].input[0]].name);
+		compare(imp, k, NULL, 0, &mag, &phase);
+		failed = mag > RENDER_MAGNITUDE || phase > RENDER_PHASE;
+		printf("  impulse   : max deviation %.4f dB %.3f degrees %s\n", mag, phase, failed ? "FAILED" : "ok");
+		status |= failed;
+		compare(sweep, k, NULL, 0, &mag, &phase);
+		failed = mag > RENDER_MAGNITUDE || phase > RENDER_PHASE;
+		printf("  sweep     : max deviation %.4f dB %.3f degrees %s\n", mag, phase, failed ? "FAILED" : "ok");
+		status |= failed;
+		compare(multi, k, tones, RENDER_TONES, &mag, &phase);
+		d = multitoneDistortion(multi, k);
+		failed = mag > RENDER_MAGNITUDE || phase > RENDER_PHASE || d > RENDER_NOISE;
+		printf("  multitone : max deviation %.4f dB %.3f degrees, distortion + noise %.1f dB %s\n", mag, phase, d, failed ? "FAILED" : "ok");
+		status |= failed;
+		printf("  THD       :");
+		for (failed = false, j = 0 ; thdTones[j] != 0 ; j++) {
+			d = thd(tone[j], k, lrint((double) thdTones[j] * RENDER_PERIOD / RENDER_RATE));
+			if (d == 0) printf(" %i Hz filtered out,", thdTones[j]);
+			else printf(" %i Hz %.1f dB,", thdTones[j], d);
+			failed |= d != 0 && d > RENDER_THD;
+		}
+		printf(" %s\n", failed ? "FAILED" : "ok");
+		status |= failed;
+		for (peak = 0, i = 0 ; i < sweep->frames * GRAPH_CHANNELS ; i++) peak = fmax(peak, fabs(sweep->y[k][i]));
+		printf("  peak      : %+.1f dBFS with the sweep at %.1f dBFS%s\n", 20 * log10(peak + 1e-30), 20 * log10(RENDER_LEVEL),
+			peak >= 1 ? ", clipped in s16" : "");
+		if (verbose) {
+			printf("  %10s %10s %10s\n", "Hz", "dB", "degrees");
+			for (w = 20 ; w < 20001 ; w *= pow(2, 1.0 / RENDER_STEPS))
+				printf("  %10.1f %10.3f %10.2f\n", w, toDb(response(sink[k], 0, w)), carg(response(sink[k], 0, w)) * 180 / M_PI);
+		}
+	}
+	if (write != NULL && writeGolden(write, imp) == 0) printf("Golden file %s written\n", write);
+	if (golden != NULL && checkGolden(golden, imp) > 0) status = 1;
+
+	printf("Speed, block of %i frames, steps run alone\n", graph.block);
+	printSpeed("graph", speed(NULL, seconds));
+	for (i = 0 ; i < graph.thread[0].nbSteps ; i++) {
+		s = &graph.thread[0].step[i];
+		if (s->type == NODE_CHAIN) {
+			for (snprintf(what, sizeof(what), "chain"), j = 0 ; j < s->nbMembers ; j++)
+				snprintf(what + strlen(what), sizeof(what) - strlen(what), " %s", graph.node[s->member[j]].name);
+			for (b = 0, j = 0 ; j < s->nbMembers ; j++) b += s->bank->ecp[j].nbSections;
+			snprintf(what + strlen(what), sizeof(what) - strlen(what), " (%i sections)", b);
+		}
+		else if (s->type == NODE_FIR || s->type == NODE_DELAY || s->type == NODE_LIMIT || s->type == NODE_SINK)
+			snprintf(what, sizeof(what), "%s %s", s->type == NODE_FIR ? "fir" : s->type == NODE_DELAY ? "delay" : s->type == NODE_LIMIT ? "limit" : "s16 output",
+				graph.node[s->node].name);
+		else continue;
+		printSpeed(what, speed(s, seconds));
+	}
+	if (detectSpeed(seconds) > 0) status = 1;
+	graphClose(&graph);
+	return status;
+}
@@ -0,0 +1,222 @@
+/*
+ * ecp : compiler of the ecasound preset files (.ecp) of the crossover
+ *
+ * A preset file holds a line "name = -el:plugin,param1,param2... -el:..." read unchanged from /etc/ampCtl.
+ * The chain is first parsed into its list of plugins, then designed for the sample rate in use :
+ * each LADSPA plugin gives one or several biquads (RBJ cookbook formulas, as the rt-plugins used with ecasound)
+ * stored one after the other in a single aligned array, in the order they run.
+ * A delay plugin gives the delay stage of the chain : delays and biquads commute, so it runs after the biquads.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <complex.h>
+
+#include "log.h"
+#include "ecp.h"
+
+#define ECP_LINE_LEN		1024
+#define ECP_BUTTERWORTH_Q	0.70710678
+
+struct ecpDef {								//Plugins known by the compiler
+	char			*name;
+	enum ecpType	type;
+	int				minParams;				//Extra parameters are ignored, as the plugins ignore unused ports
+	int				nbSections;
+};
+
+static struct ecpDef ecpDefs[] = {
+	{"RTparaeq",		ECP_PARAEQ,			3, 1},		//gain (dB), frequency, Q
+	{"RTlowpass",		ECP_LOWPASS,		2, 1},		//frequency, Q
+	{"RThighpass",		ECP_HIGHPASS,		2, 1},		//frequency, Q
+	{"RTlr4lowpass",	ECP_LR4_LOWPASS,	1, 2},		//frequency
+	{"RTlr4hipass",		ECP_LR4_HIGHPASS,	1, 2},		//frequency
+	{"delay_0.01s",		ECP_DELAY,			2, 0},		//delay (s), dry/wet balance
+	{NULL}
+};
+
+//Stores a section from its unnormalized coefficients
+void sosSet(float *s, double b0, double b1, double b2, double a0, double a1, double a2){
+	s[0] = b0 / a0;
+	s[1] = b1 / a0;
+	s[2] = b2 / a0;
+	s[3] = a1 / a0;
+	s[4] = a2 / a0;
+}
+
+//Peaking EQ : gain in dB at freq, bandwidth given by q
+void sosPeaking(float *s, int rate, double freq, double q, double gain){
+	double a = pow(10, gain / 40);
+	double w0 = 2 * M_PI * freq / rate;
+	double alpha = sin(w0) / (2 * q);
+
+	sosSet(s, 1 + alpha * a, -2 * cos(w0), 1 - alpha * a, 1 + alpha / a, -2 * cos(w0), 1 - alpha / a);
+}
+
+void sosLowpass(float *s, int rate, double freq, double q){
+	double w0 = 2 * M_PI * freq / rate;
+	double alpha = sin(w0) / (2 * q);
+
+	sosSet(s, (1 - cos(w0)) / 2, 1 - cos(w0), (1 - cos(w0)) / 2, 1 + alpha, -2 * cos(w0), 1 - alpha);
+}
+
+void sosHighpass(float *s, int rate, double freq, double q){
+	double w0 = 2 * M_PI * freq / rate;
+	double alpha = sin(w0) / (2 * q);
+
+	sosSet(s, (1 + cos(w0)) / 2, -(1 + cos(w0)), (1 + cos(w0)) / 2, 1 + alpha, -2 * cos(w0), 1 - alpha);
+}
+
+//Parses one plugin "plugin,p1,p2..." and appends it to the chain
+//Returns -1 if the plugin is unknown or misses parameters
+int parsePlugin(struct ecpChain *c, char *plugin){
+	struct ecpPlugin	*pl;
+	struct ecpDef		*d;
+	char 				*s, *end;
+
+	if (c->nbPlugins == ECP_MAX_PLUGINS) {
+		logError("Filter chain %s : more than %i plugins", c->name, ECP_MAX_PLUGINS);
+		return -1;
+	}
+	pl = &c->plugin[c->nbPlugins];
+	if ((s = strchr(plugin, ',')) != NULL) *s++ = '\0';
+	while (s != NULL && pl->nbParams < ECP_MAX_PARAMS) {
+		pl->p[pl->nbParams++] = strtod(s, &end);
+		s = (*end == ',') ? end + 1 : NULL;
+	}
+	for (d = ecpDefs ; d->name != NULL && strcmp(d->name, plugin) != 0 ; d++);
+	if (d->name == NULL || pl->nbParams < d->minParams) {
+		logError("Filter chain %s : unsupported plugin %s with %i parameters", c->name, plugin, pl->nbParams);
+		return -1;
+	}
+	if (d->type == ECP_DELAY && (pl->p[0] < 0 || pl->p[0] > ECP_MAX_DELAY)) {
+		logError("Filter chain %s : delay %g s out of range", c->name, pl->p[0]);
+		return -1;
+	}
+	pl->type = d->type;
+	pl->nbSections = d->nbSections;
+	snprintf(pl->name, sizeof(pl->name), "%s", plugin);
+	c->nbPlugins++;
+	return 0;
+}
+
+//Computes the coefficients of the chain for a sample rate
+//Can be called again when the rate changes. Returns -1 if the chain does not fit
+int ecpDesign(struct ecpChain *c, int rate){
+	struct ecpPlugin	*pl;
+	float				*s;
+	int					i, n = 0, delays = 0;
+
+	for (i = 0 ; i < c->nbPlugins ; i++) {
+		n += c->plugin[i].nbSections;
+		delays += c->plugin[i].type == ECP_DELAY;
+	}
+	if (n > ECP_MAX_SECTIONS || delays > 1) {
+		logError("Filter chain %s : %i sections and %i delays, max %i and 1", c->name, n, delays, ECP_MAX_SECTIONS);
+		return -1;
+	}
+	free(c->sos);
+	if (posix_memalign((void **) &c->sos, ECP_ALIGN, (n > 0 ? n : 1) * ECP_SOS_STRIDE * sizeof(float)) != 0) {
+		c->sos = NULL;
+		return -1;
+	}
+	memset(c->sos, 0, (n > 0 ? n : 1) * ECP_SOS_STRIDE * sizeof(float));
+	c->rate = rate;
+	c->nbSections = 0;
+	c->delay = 0;
+	c->dry = 1;
+	c->wet = 0;
+
+	for (i = 0 ; i < c->nbPlugins ; i++) {
+		pl = &c->plugin[i];
+		pl->firstSection = c->nbSections;
+		s = &c->sos[c->nbSections * ECP_SOS_STRIDE];
+		switch (pl->type) {
+			case ECP_PARAEQ:
+				sosPeaking(s, rate, pl->p[1], pl->p[2], pl->p[0]);
+				break;
+			case ECP_LOWPASS:
+				sosLowpass(s, rate, pl->p[0], pl->p[1]);
+				break;
+			case ECP_HIGHPASS:
+				sosHighpass(s, rate, pl->p[0], pl->p[1]);
+				break;
+			case ECP_LR4_LOWPASS:									//Linkwitz-Riley 4th order : two Butterworth biquads
+				sosLowpass(s, rate, pl->p[0], ECP_BUTTERWORTH_Q);
+				sosLowpass(s + ECP_SOS_STRIDE, rate, pl->p[0], ECP_BUTTERWORTH_Q);
+				break;
+			case ECP_LR4_HIGHPASS:
+				sosHighpass(s, rate, pl->p[0], ECP_BUTTERWORTH_Q);
+				sosHighpass(s + ECP_SOS_STRIDE, rate, pl->p[0], ECP_BUTTERWORTH_Q);
+				break;
+			case ECP_DELAY:
+				c->delay = lrint(pl->p[0] * rate);
+				c->wet = pl->p[1];
+				c->dry = 1 - pl->p[1];
+				break;
+		}
+		c->nbSections += pl->nbSections;
+	}
+	logDebug("Filter chain %s : %i sections, delay %i frames at %i Hz", c->name, c->nbSections, c->delay, rate);
+	return 0;
+}
+
+//Compiles the first preset of an ecasound preset file for a sample rate
+//Returns -1 if the file cannot be read or holds an unsupported chain
+int ecpCompile(struct ecpChain *c, char *ecpFile, int rate){
+	FILE 	*fp;
+	char 	line[ECP_LINE_LEN];
+	char 	*s, *tok, *save;
+	int		status = -1;
+
+	memset(c, 0, sizeof(struct ecpChain));
+	if ((fp = fopen(ecpFile, "r")) == NULL) {
+		logError("Filter chain %s : %s", ecpFile, strerror(errno));
+		return -1;
+	}
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		for (s = line ; *s == ' ' || *s == '\t' ; s++);
+		if (*s == '#' || *s == '\n' || *s == '\0' || (tok = strchr(s, '=')) == NULL) continue;
+
+		*tok = '\0';
+		sscanf(s, "%31s", c->name);
+		status = 0;
+		for (tok = strtok_r(tok + 1, " \t\r\n", &save) ; tok != NULL && status == 0 ; tok = strtok_r(NULL, " \t\r\n", &save)) {
+			if (strncmp(tok, "-el:", 4) == 0) status = parsePlugin(c, tok + 4);
+			else {
+				logError("Filter chain %s : unsupported option %s", c->name, tok);
+				status = -1;
+			}
+		}
+		break;													//Only the first preset is used, as ecasound -pf does
+	}
+	fclose(fp);
+	if (status == 0) status = ecpDesign(c, rate);
+	if (status == 0) logInfo("Filter chain %s compiled from %s : %i sections", c->name, ecpFile, c->nbSections);
+	else logError("Filter chain %s : no valid preset", ecpFile);
+	return status;
+}
+
+void ecpFree(struct ecpChain *c){
+	free(c->sos);
+	c->sos = NULL;
+	c->nbSections = 0;
+}
+
+//Magnitude response in dB of the compiled chain at freq, computed from the stored coefficients
+double ecpMagnitude(struct ecpChain *c, double freq){
+	double complex	z1, z2, h = 1;
+	float			*s;
+	int				i;
+
+	z1 = cexp(-I * 2 * M_PI * freq / c->rate);
+	z2 = z1 * z1;
+	for (i = 0 ; i < c->nbSections ; i++) {
+		s = &c->sos[i * ECP_SOS_STRIDE];
+		h *= (s[0] + s[1] * z1 + s[2] * z2) / (1 + s[3] * z1 + s[4] * z2);
+	}
+	if (c->delay > 0) h *= c->dry + c->wet * cpow(z1, c->delay);
+	return 20 * log10(cabs(h));
+}
@@ -0,0 +1,38 @@
+#ifndef ECP_H
+#define ECP_H
+
+#define ECP_MAX_PLUGINS		32				/* Max plugins (-el:) in a chain */
+#define ECP_MAX_SECTIONS	32				/* Max biquads in a chain */
+#define ECP_MAX_PARAMS		8				/* Max parameters of a plugin */
+#define ECP_SOS_STRIDE		8				/* Floats per section : b0 b1 b2 a1 a2 and padding, 2 sections per cache line */
+#define ECP_ALIGN			64				/* Alignment of the coefficient array */
+#define ECP_MAX_DELAY		0.01			/* delay_0.01s : longest delay in s */
+
+enum ecpType {ECP_PARAEQ, ECP_LOWPASS, ECP_HIGHPASS, ECP_LR4_LOWPASS, ECP_LR4_HIGHPASS, ECP_DELAY};
+
+struct ecpPlugin {							//One plugin of the chain, as written in the preset file
+	enum ecpType	type;
+	char			name[32];
+	int				nbParams;
+	double			p[ECP_MAX_PARAMS];
+	int				firstSection;			//Sections compiled from this plugin
+	int				nbSections;
+};
+
+struct ecpChain {							//Chain of an ecasound preset file (.ecp) compiled for a sample rate
+	char				name[32];			//Name of the preset
+	int					rate;
+	int					nbPlugins;
+	struct ecpPlugin	plugin[ECP_MAX_PLUGINS];
+	int					nbSections;
+	float				*sos;				//nbSections * ECP_SOS_STRIDE coefficients, normalized (a0 = 1), ECP_ALIGN aligned
+	int					delay;				//Delay stage in frames (0 : none)
+	float				dry, wet;			//Mix of the delay stage
+};
+
+int 	ecpCompile(struct ecpChain *c, char *ecpFile, int rate);
+int 	ecpDesign(struct ecpChain *c, int rate);
+void 	ecpFree(struct ecpChain *c);
+double 	ecpMagnitude(struct ecpChain *c, double freq);
+
+#endif
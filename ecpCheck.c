@@ -0,0 +1,121 @@
+/*
+ * ecpCheck : compiles ecasound preset files as ampCtl does and checks the result
+ *
+ * Prints the compiled sections of each chain, then compares the magnitude response computed from the stored
+ * coefficients with the one of the reference design : the analog prototype of each plugin taken through the
+ * bilinear transform prewarped at its frequency, which is how the RBJ cookbook filters are defined.
+ * The exit status is 1 if a chain deviates more than the tolerance or cannot be compiled.
+ *
+ * Usage : ecpCheck [-r rate] [-t tolerance dB] [-v] file.ecp...
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <math.h>
+#include <complex.h>
+
+#include "log.h"
+#include "ecp.h"
+
+#define CHECK_RATE		44100
+#define CHECK_TOLERANCE	0.05		/* dB */
+#define CHECK_FLOOR		-80			/* dB, deeper attenuations are compared at this level */
+#define CHECK_STEPS		12			/* Points per octave */
+
+//Response of the analog prototype of a plugin at the digital frequency w (rad / sample)
+double complex reference(struct ecpPlugin *pl, double w, int rate){
+	double complex	s, h;
+	double			w0, a, q;
+
+	if (pl->type == ECP_DELAY) return (1 - pl->p[1]) + pl->p[1] * cexp(-I * w * lrint(pl->p[0] * rate));	//Whole frames, as the plugin
+
+	w0 = 2 * M_PI * (pl->type == ECP_PARAEQ ? pl->p[1] : pl->p[0]) / rate;
+	s = I * tan(w / 2) / tan(w0 / 2);						//Bilinear transform prewarped at w0
+	q = pl->type == ECP_PARAEQ ? pl->p[2] : pl->p[1];
+	switch (pl->type) {
+		case ECP_PARAEQ:
+			a = pow(10, pl->p[0] / 40);
+			return (s * s + s * a / q + 1) / (s * s + s / (a * q) + 1);
+		case ECP_LOWPASS:
+			return 1 / (s * s + s / q + 1);
+		case ECP_HIGHPASS:
+			return s * s / (s * s + s / q + 1);
+		case ECP_LR4_LOWPASS:
+			h = 1 / (s * s + sqrt(2) * s + 1);				//Butterworth squared
+			return h * h;
+		case ECP_LR4_HIGHPASS:
+			h = s * s / (s * s + sqrt(2) * s + 1);
+			return h * h;
+		default:
+			return 1;
+	}
+}
+
+double toDb(double complex h){
+	double db = 20 * log10(cabs(h));
+	return db < CHECK_FLOOR ? CHECK_FLOOR : db;
+}
+
+//Checks one preset file, returns the largest deviation in dB, or -1 if the file cannot be compiled
+double check(char *file, int rate, bool verbose){
+	struct ecpChain	c;
+	double complex	h;
+	double			f, got, ref, dev, maxDev = 0, maxFreq = 0;
+	float			*s;
+	int				i;
+
+	if (ecpCompile(&c, file, rate) < 0) return -1;
+	printf("%s : chain %s, %i plugins, %i sections, delay %i frames at %i Hz\n", file, c.name, c.nbPlugins, c.nbSections, c.delay, rate);
+	for (i = 0 ; i < c.nbSections ; i++) {
+		s = &c.sos[i * ECP_SOS_STRIDE];
+		printf("  section %2i : b0 %+.9f b1 %+.9f b2 %+.9f a1 %+.9f a2 %+.9f\n", i, s[0], s[1], s[2], s[3], s[4]);
+	}
+	if (verbose) printf("  %10s %10s %10s %10s\n", "Hz", "compiled", "reference", "deviation");
+
+	for (f = 10 ; f < rate * 0.49 ; f *= pow(2, 1.0 / CHECK_STEPS)) {
+		for (h = 1, i = 0 ; i < c.nbPlugins ; i++) h *= reference(&c.plugin[i], 2 * M_PI * f / rate, rate);
+		got = ecpMagnitude(&c, f);
+		got = got < CHECK_FLOOR ? CHECK_FLOOR : got;
+		ref = toDb(h);
+		dev = fabs(got - ref);
+		if (dev > maxDev) {
+			maxDev = dev;
+			maxFreq = f;
+		}
+		if (verbose) printf("  %10.1f %10.3f %10.3f %10.4f\n", f, got, ref, dev);
+	}
+	printf("  max deviation %.4f dB at %.1f Hz\n", maxDev, maxFreq);
+	ecpFree(&c);
+	return maxDev;
+}
+
+int main(int argc, char *argv[]){
+	double	tolerance = CHECK_TOLERANCE, dev;
+	bool	verbose = false;
+	int		rate = CHECK_RATE, opt, i, status = 0;
+
+	while ((opt = getopt(argc, argv, "r:t:v")) != -1) {
+		switch (opt) {
+			case 'r': rate = atoi(optarg); break;
+			case 't': tolerance = atof(optarg); break;
+			case 'v': verbose = true; break;
+			default:
+				fprintf(stderr, "Usage : %s [-r rate] [-t tolerance dB] [-v] file.ecp...\n", argv[0]);
+				return 1;
+		}
+	}
+	if (optind == argc) {											//No file checked is not a success
+		fprintf(stderr, "Usage : %s [-r rate] [-t tolerance dB] [-v] file.ecp...\n", argv[0]);
+		return 1;
+	}
+	for (i = optind ; i < argc ; i++) {
+		dev = check(argv[i], rate, verbose);
+		if (dev < 0 || dev > tolerance) {
+			printf("  FAILED (tolerance %.4f dB)\n", tolerance);
+			status = 1;
+		}
+	}
+	return status;
+}
@@ -0,0 +1,273 @@
+/*
+ * fft : real FFT and spectral products of the FIR convolution (see fir.c)
+ *
+ * The n real points are packed as m = n / 2 complex points (even samples in the real part, odd ones in the
+ * imaginary part), transformed by an iterative radix-2 FFT and split into the n / 2 + 1 bins of the real signal.
+ * The inverse runs the same steps backwards and is not normalised : its output is m times the signal.
+ * The spectra are kept split, real parts and imaginary parts in separate arrays, so that the butterflies of a pass
+ * and the complex products of the convolution run on whole vectors without shuffles.
+ *
+ * The vector kernels run the passes whose butterflies are at least a vector apart, the first passes stay scalar.
+ * The kernel is chosen at run time among the ones the CPU supports, as the biquad kernels (see biquad.c).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#include "log.h"
+#include "cpu.h"
+#include "fft.h"
+
+static struct fftKernel	*kernel = NULL;		//Kernel of the new FFTs
+
+//One radix-2 pass of the complex FFT of m points : butterflies h points apart, twiddles at wr[h + j]
+static void passScalar(float *re, float *im, float *wr, float *wi, int m, int h){
+	float	tr, ti;
+	int		g, j, a, b;
+
+	for (g = 0 ; g < m ; g += 2 * h) {
+		for (j = 0 ; j < h ; j++) {
+			a = g + j;
+			b = a + h;
+			tr = re[b] * wr[h + j] - im[b] * wi[h + j];
+			ti = re[b] * wi[h + j] + im[b] * wr[h + j];
+			re[b] = re[a] - tr;
+			im[b] = im[a] - ti;
+			re[a] += tr;
+			im[a] += ti;
+		}
+	}
+}
+
+//Accumulates the product of two spectra : y += x * h
+static void macScalar(float *yr, float *yi, float *xr, float *xi, float *hr, float *hi, int bins){
+	int k;
+
+	for (k = 0 ; k < bins ; k++) {
+		yr[k] += xr[k] * hr[k] - xi[k] * hi[k];
+		yi[k] += xr[k] * hi[k] + xi[k] * hr[k];
+	}
+}
+
+//Bodies of the vector kernels, vec holding lanesAtOnce floats
+//The passes need h >= lanesAtOnce, the spectra bins padded to a multiple of lanesAtOnce, all the buffers aligned
+#define VECTOR_PASS(name, vec, lanesAtOnce)																\
+static void name(float *re, float *im, float *wr, float *wi, int m, int h){							\
+	vec		ar, ai, br, bi, cr, ci, tr, ti;																\
+	int		g, j, a, b;																					\
+																										\
+	for (g = 0 ; g < m ; g += 2 * h) {																	\
+		for (j = 0 ; j < h ; j += lanesAtOnce) {														\
+			a = g + j;																					\
+			b = a + h;																					\
+			ar = LOAD(re + a); ai = LOAD(im + a); br = LOAD(re + b); bi = LOAD(im + b);				\
+			cr = LOAD(wr + h + j); ci = LOAD(wi + h + j);												\
+			tr = SUB(MUL(br, cr), MUL(bi, ci));															\
+			ti = ADD(MUL(br, ci), MUL(bi, cr));															\
+			STORE(re + b, SUB(ar, tr)); STORE(im + b, SUB(ai, ti));									\
+			STORE(re + a, ADD(ar, tr)); STORE(im + a, ADD(ai, ti));									\
+		}																								\
+	}																									\
+}
+
+#define VECTOR_MAC(name, vec, lanesAtOnce)																\
+static void name(float *yr, float *yi, float *xr, float *xi, float *hr, float *hi, int bins){		\
+	vec		ar, ai, br, bi;																				\
+	int		k;																							\
+																										\
+	for (k = 0 ; k < bins ; k += lanesAtOnce) {															\
+		ar = LOAD(xr + k); ai = LOAD(xi + k); br = LOAD(hr + k); bi = LOAD(hi + k);					\
+		STORE(yr + k, ADD(LOAD(yr + k), SUB(MUL(ar, br), MUL(ai, bi))));								\
+		STORE(yi + k, ADD(LOAD(yi + k), ADD(MUL(ar, bi), MUL(ai, br))));								\
+	}																									\
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#define LOAD	_mm_load_ps
+#define STORE	_mm_store_ps
+#define ADD		_mm_add_ps
+#define SUB		_mm_sub_ps
+#define MUL		_mm_mul_ps
+__attribute__((target("sse2")))
+VECTOR_PASS(passSse2, __m128, 4)
+__attribute__((target("sse2")))
+VECTOR_MAC(macSse2, __m128, 4)
+#undef LOAD
+#undef STORE
+#undef ADD
+#undef SUB
+#undef MUL
+
+#define LOAD	_mm256_load_ps
+#define STORE	_mm256_store_ps
+#define ADD		_mm256_add_ps
+#define SUB		_mm256_sub_ps
+#define MUL		_mm256_mul_ps
+__attribute__((target("avx2")))
+VECTOR_PASS(passAvx2, __m256, 8)
+__attribute__((target("avx2")))
+VECTOR_MAC(macAvx2, __m256, 8)
+#undef LOAD
+#undef STORE
+#undef ADD
+#undef SUB
+#undef MUL
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define LOAD	vld1q_f32
+#define STORE	vst1q_f32
+#define ADD		vaddq_f32
+#define SUB		vsubq_f32
+#define MUL		vmulq_f32
+VECTOR_PASS(passNeon, float32x4_t, 4)
+VECTOR_MAC(macNeon, float32x4_t, 4)
+#undef LOAD
+#undef STORE
+#undef ADD
+#undef SUB
+#undef MUL
+#endif
+
+//Kernels by order of preference, the last supported one is chosen
+struct fftKernel fftKernels[] = {
+	{"scalar",	cpuAlways,	1,	passScalar,	macScalar},
+#if defined(__x86_64__) || defined(__i386__)
+	{"sse2",	cpuSse2,	4,	passSse2,	macSse2},
+	{"avx2",	cpuAvx2,	8,	passAvx2,	macAvx2},
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+	{"neon",	cpuNeon,	4,	passNeon,	macNeon},
+#endif
+	{NULL}
+};
+
+//Selects the kernel of the FFTs set up from now on
+//name : kernel name, NULL or "auto" for the best one the CPU supports
+//Returns NULL if the kernel is unknown or not supported by the CPU
+struct fftKernel *fftSelect(char *name){
+	struct fftKernel *k;
+
+	if ((k = cpuSelect(fftKernels, sizeof(struct fftKernel), name, "FFT")) == NULL) return NULL;
+	kernel = k;
+	return kernel;
+}
+
+static float *fftAlloc(int floats){
+	float *p;
+
+	if (posix_memalign((void **) &p, FFT_ALIGN, (floats > FFT_MAX_WIDTH ? floats : FFT_MAX_WIDTH) * sizeof(float)) != 0) return NULL;
+	return p;
+}
+
+//Computes the tables of a real FFT of n points, n a power of 2 of at least 4
+//Returns -1 on error
+int fftSetup(struct fft *f, int n){
+	int i, j, h, bits;
+
+	memset(f, 0, sizeof(struct fft));
+	if (kernel == NULL && fftSelect(NULL) == NULL) return -1;
+	if (n < 4 || (n & (n - 1)) != 0) {
+		logError("FFT of %i points : not a power of 2", n);
+		return -1;
+	}
+	f->kernel = kernel;
+	f->n = n;
+	f->m = n / 2;
+	f->rev = malloc(f->m * sizeof(int));
+	f->wr = fftAlloc(f->m); f->wi = fftAlloc(f->m);
+	f->pr = fftAlloc(f->m + 1); f->pi = fftAlloc(f->m + 1);
+	f->zr = fftAlloc(f->m); f->zi = fftAlloc(f->m);
+	if (f->rev == NULL || f->wr == NULL || f->wi == NULL || f->pr == NULL || f->pi == NULL || f->zr == NULL || f->zi == NULL) {
+		logError("FFT : out of memory");
+		fftFree(f);
+		return -1;
+	}
+	for (bits = 0 ; (1 << bits) < f->m ; bits++);
+	for (i = 0 ; i < f->m ; i++) {
+		for (f->rev[i] = 0, j = 0 ; j < bits ; j++) if (i & (1 << j)) f->rev[i] |= 1 << (bits - 1 - j);
+	}
+	for (h = 1 ; h < f->m ; h *= 2) {
+		for (j = 0 ; j < h ; j++) {
+			f->wr[h + j] = cos(M_PI * j / h);
+			f->wi[h + j] = -sin(M_PI * j / h);
+		}
+	}
+	for (i = 0 ; i <= f->m ; i++) {
+		f->pr[i] = cos(2 * M_PI * i / n);
+		f->pi[i] = -sin(2 * M_PI * i / n);
+	}
+	return 0;
+}
+
+void fftFree(struct fft *f){
+	free(f->rev);
+	free(f->wr); free(f->wi);
+	free(f->pr); free(f->pi);
+	free(f->zr); free(f->zi);
+	memset(f, 0, sizeof(struct fft));
+}
+
+//Complex FFT of the work buffer, loaded in bit reversed order
+static void complexFft(struct fft *f){
+	int h;
+
+	for (h = 1 ; h < f->m ; h *= 2) {
+		if (h < f->kernel->width) passScalar(f->zr, f->zi, f->wr, f->wi, f->m, h);
+		else f->kernel->pass(f->zr, f->zi, f->wr, f->wi, f->m, h);
+	}
+}
+
+//Spectrum of n real points x : bins 0 to n / 2 in re and im
+void fftForward(struct fft *f, float *x, float *re, float *im){
+	float	ar, ai, br, bi, er, ei, or, oi;
+	int		k, m = f->m;
+
+	for (k = 0 ; k < m ; k++) {
+		f->zr[f->rev[k]] = x[2 * k];
+		f->zi[f->rev[k]] = x[2 * k + 1];
+	}
+	complexFft(f);
+	re[0] = f->zr[0] + f->zi[0];
+	im[0] = 0;
+	re[m] = f->zr[0] - f->zi[0];
+	im[m] = 0;
+	for (k = 1 ; k < m ; k++) {										//Spectra of the even and odd samples, then butterfly
+		ar = f->zr[k]; ai = f->zi[k];
+		br = f->zr[m - k]; bi = -f->zi[m - k];
+		er = 0.5f * (ar + br); ei = 0.5f * (ai + bi);
+		or = 0.5f * (ai - bi); oi = -0.5f * (ar - br);
+		re[k] = er + f->pr[k] * or - f->pi[k] * oi;
+		im[k] = ei + f->pr[k] * oi + f->pi[k] * or;
+	}
+}
+
+//n real points x, times n / 2, from the bins 0 to n / 2 of their spectrum
+void fftInverse(struct fft *f, float *re, float *im, float *x){
+	float	ar, ai, br, bi, er, ei, dr, di, or, oi;
+	int		k, m = f->m;
+
+	for (k = 0 ; k < m ; k++) {										//Spectra of the even and odd samples, conjugated
+		ar = re[k]; ai = im[k];
+		br = re[m - k]; bi = -im[m - k];
+		er = 0.5f * (ar + br); ei = 0.5f * (ai + bi);
+		dr = 0.5f * (ar - br); di = 0.5f * (ai - bi);
+		or = dr * f->pr[k] + di * f->pi[k];
+		oi = di * f->pr[k] - dr * f->pi[k];
+		f->zr[f->rev[k]] = er - oi;
+		f->zi[f->rev[k]] = -(ei + or);
+	}
+	complexFft(f);
+	for (k = 0 ; k < m ; k++) {
+		x[2 * k] = f->zr[k];
+		x[2 * k + 1] = -f->zi[k];
+	}
+}
@@ -0,0 +1,33 @@
+#ifndef FFT_H
+#define FFT_H
+
+#define FFT_ALIGN			64
+#define FFT_MAX_WIDTH		8				/* Widest vector of the kernels in floats (AVX2) */
+
+struct fftKernel {							//One implementation of the vector loops of the FFT and of the convolution
+	char	*name;							//First fields : those of struct cpuKernel (cpu.h)
+	int		(*supported)(void);				//Runtime CPU detection
+	int		width;							//Floats processed at once
+	void	(*pass)(float *re, float *im, float *wr, float *wi, int m, int h);
+	void	(*mac)(float *yr, float *yi, float *xr, float *xi, float *hr, float *hi, int bins);
+};
+
+struct fft {								//Real FFT of n points through a complex FFT of m = n / 2 points
+	struct fftKernel	*kernel;
+	int		n;
+	int		m;
+	int		*rev;							//Bit reversed indices of m
+	float	*wr, *wi;						//Twiddles of the complex passes : exp(-i pi j / h) at h + j
+	float	*pr, *pi;						//Twiddles of the real FFT : exp(-2 i pi k / n), k <= m
+	float	*zr, *zi;						//Work buffer of m points
+};
+
+extern struct fftKernel fftKernels[];		// All the kernels built in, the scalar reference first, NULL name at the end
+
+struct fftKernel *fftSelect(char *name);
+int 	fftSetup(struct fft *f, int n);
+void 	fftFree(struct fft *f);
+void 	fftForward(struct fft *f, float *x, float *re, float *im);
+void 	fftInverse(struct fft *f, float *re, float *im, float *x);
+
+#endif
@@ -0,0 +1,90 @@
+/*
+ * filter : runs the chains compiled from the ecasound presets of the crossover (see ecp.c)
+ *
+ * The chains fed by the same signal are loaded in one bank, their biquads run side by side in the
+ * vector kernel (see biquad.c), then the delay stage of each chain runs on its own lanes.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "filter.h"
+
+//Compiles the preset files for the sample rate and sets up the bank running them
+//ecpFiles : one preset file per chain, NULL for a full range chain
+//Returns -1 on error
+int filterLoad(struct filterBank *f, char **ecpFiles, int nbChains, int rate){
+	float	*sos[FLT_MAX_CHAINS];
+	int		nbSections[FLT_MAX_CHAINS];
+	int		c;
+
+	memset(f, 0, sizeof(struct filterBank));
+	if (nbChains > FLT_MAX_CHAINS) {
+		logError("More than %i filter chains", FLT_MAX_CHAINS);
+		return -1;
+	}
+	f->nbChains = nbChains;
+	for (c = 0 ; c < nbChains ; c++) {
+		if (ecpFiles[c] != NULL && ecpCompile(&f->ecp[c], ecpFiles[c], rate) < 0) {
+			filterFree(f);
+			return -1;
+		}
+		sos[c] = f->ecp[c].sos;
+		nbSections[c] = f->ecp[c].nbSections;
+		if ((f->line[c] = calloc(f->ecp[c].delay * FLT_CHANNELS + 1, sizeof(float))) == NULL) {
+			filterFree(f);
+			return -1;
+		}
+	}
+	if (biquadSetup(&f->bank, sos, nbSections, nbChains, FLT_CHANNELS) < 0) {
+		filterFree(f);
+		return -1;
+	}
+	f->width = f->bank.width;
+	return 0;
+}
+
+void filterFree(struct filterBank *f){
+	int c;
+
+	for (c = 0 ; c < f->nbChains ; c++) {
+		ecpFree(&f->ecp[c]);
+		free(f->line[c]);
+		f->line[c] = NULL;
+	}
+	biquadFree(&f->bank);
+}
+
+void filterReset(struct filterBank *f){
+	int c;
+
+	biquadReset(&f->bank);
+	for (c = 0 ; c < f->nbChains ; c++) {
+		if (f->line[c] != NULL) memset(f->line[c], 0, f->ecp[c].delay * FLT_CHANNELS * sizeof(float));
+		f->pos[c] = 0;
+	}
+}
+
+//Runs the chains in place on frames of width floats
+void filterRun(struct filterBank *f, float *buf, int frames){
+	struct ecpChain	*e;
+	float			*s, *d, x;
+	int				c, j, ch;
+
+	biquadRun(&f->bank, buf, frames);
+	for (c = 0 ; c < f->nbChains ; c++) {
+		e = &f->ecp[c];
+		if (e->delay == 0) continue;
+		for (j = 0 ; j < frames ; j++) {
+			s = &buf[j * f->width + c * FLT_CHANNELS];
+			d = &f->line[c][f->pos[c] * FLT_CHANNELS];
+			for (ch = 0 ; ch < FLT_CHANNELS ; ch++) {
+				x = s[ch];
+				s[ch] = e->dry * x + e->wet * d[ch];
+				d[ch] = x;
+			}
+			if (++f->pos[c] == e->delay) f->pos[c] = 0;
+		}
+	}
+}
@@ -0,0 +1,24 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include "ecp.h"
+#include "biquad.h"
+
+#define FLT_CHANNELS		2				/* Chains process stereo */
+#define FLT_MAX_CHAINS		8
+
+struct filterBank {							//Compiled chains run side by side on the same signal, with their state
+	int					nbChains;
+	int					width;				//Floats per frame of the buffers : chain c uses the lanes c * FLT_CHANNELS...
+	struct ecpChain		ecp[FLT_MAX_CHAINS];	//Empty chain : full range
+	struct biquadBank	bank;
+	float				*line[FLT_MAX_CHAINS];	//Delay lines : ecp.delay frames of FLT_CHANNELS samples
+	int					pos[FLT_MAX_CHAINS];	//Oldest frame of the delay lines
+};
+
+int 	filterLoad(struct filterBank *f, char **ecpFiles, int nbChains, int rate);
+void 	filterFree(struct filterBank *f);
+void 	filterReset(struct filterBank *f);
+void 	filterRun(struct filterBank *f, float *buf, int frames);
+
+#endif
@@ -0,0 +1,228 @@
+/*
+ * fir : FIR convolution with measured impulse responses (room correction exported by REW)
+ *
+ * The impulse response of each channel is read from WAV files (PCM 16, 24 or 32 bits or float 32 or 64 bits,
+ * at the rate of the engine) : one mono file for both channels, one stereo file, or one mono file per channel.
+ * It is cut into partitions of the block size, each one transformed once at load time with an FFT of twice its size.
+ * For each block of input, overlap-save : the FFT of the previous and current blocks is kept in a delay line of
+ * spectra, the output spectrum is the sum of the products of the nbParts last input spectra with the partitions,
+ * and the second half of its inverse FFT is the output block. No latency beyond the block, and a cost per frame
+ * growing with taps / partition instead of taps.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "log.h"
+#include "fir.h"
+
+static float *firAlloc(int floats){
+	float *p;
+
+	if (posix_memalign((void **) &p, FFT_ALIGN, floats * sizeof(float)) != 0) return NULL;
+	memset(p, 0, floats * sizeof(float));
+	return p;
+}
+
+static uint32_t le16(unsigned char *p){
+	return p[0] | p[1] << 8;
+}
+
+static uint32_t le32(unsigned char *p){
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+//Reads the samples of a WAV file, converted to float and interleaved
+//Returns the number of frames, -1 on error
+int readWav(char *file, int rate, float **data, int *channels){
+	FILE			*fp;
+	unsigned char	h[40], *raw = NULL, *p;
+	uint32_t		size, format = 0, fileRate = 0, bits = 0;
+	int32_t			v;
+	float			fv;
+	double			dv;
+	int				i, n = 0, bytes;
+
+	*channels = 0;
+	if ((fp = fopen(file, "rb")) == NULL) {
+		logError("Impulse response %s : cannot open", file);
+		return -1;
+	}
+	if (fread(h, 1, 12, fp) != 12 || memcmp(h, "RIFF", 4) != 0 || memcmp(h + 8, "WAVE", 4) != 0) {
+		logError("Impulse response %s : not a WAV file", file);
+		fclose(fp);
+		return -1;
+	}
+	while (raw == NULL && fread(h, 1, 8, fp) == 8) {
+		size = le32(h + 4);
+		if (memcmp(h, "fmt ", 4) == 0) {
+			if (size < 16 || fread(h, 1, size < 40 ? size : 40, fp) != (size < 40 ? size : 40)) break;
+			format = le16(h);
+			if (format == 0xFFFE && size >= 26) format = le16(h + 24);		//WAVE_FORMAT_EXTENSIBLE : sub format
+			*channels = le16(h + 2);
+			fileRate = le32(h + 4);
+			bits = le16(h + 14);
+			fseek(fp, size - (size < 40 ? size : 40) + (size & 1), SEEK_CUR);
+		}
+		else if (memcmp(h, "data", 4) == 0 && *channels > 0 && bits >= 8) {
+			if ((raw = malloc(size)) == NULL || fread(raw, 1, size, fp) != size) break;
+			bytes = bits / 8;
+			n = size / (bytes * *channels);
+		}
+		else fseek(fp, size + (size & 1), SEEK_CUR);
+	}
+	fclose(fp);
+
+	if (raw == NULL || n == 0 || !((format == 1 && (bits == 16 || bits == 24 || bits == 32)) || (format == 3 && (bits == 32 || bits == 64)))) {
+		logError("Impulse response %s : no PCM 16, 24, 32 bits or float data", file);
+		free(raw);
+		return -1;
+	}
+	if (fileRate != rate) logError("Impulse response %s : sampled at %u Hz, played at %i Hz", file, fileRate, rate);
+	if ((*data = malloc(n * *channels * sizeof(float))) == NULL) {
+		free(raw);
+		return -1;
+	}
+	for (i = 0, p = raw ; i < n * *channels ; i++, p += bytes) {
+		if (format == 3 && bits == 32) {
+			memcpy(&fv, p, 4);
+			(*data)[i] = fv;
+		}
+		else if (format == 3) {
+			memcpy(&dv, p, 8);
+			(*data)[i] = dv;
+		}
+		else {
+			if (bits == 16) v = (int32_t) (le16(p) << 16);
+			else if (bits == 24) v = (int32_t) ((uint32_t) p[0] << 8 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 24);
+			else v = (int32_t) le32(p);
+			(*data)[i] = v * (1.0f / 2147483648.0f);
+		}
+	}
+	free(raw);
+	return n;
+}
+
+//Transforms the partitions of the impulse responses of each channel
+//ir : taps samples per channel, partition : frames per block, a power of 2
+//Returns -1 on error
+int firSetup(struct firFilter *f, float **ir, int taps, int partition){
+	float	*seg, *h;
+	int		c, p, i;
+
+	memset(f, 0, sizeof(struct firFilter));
+	if (taps > FIR_MAX_TAPS) {
+		logError("Impulse response of %i taps, at most %i", taps, FIR_MAX_TAPS);
+		return -1;
+	}
+	if (fftSetup(&f->fft, 2 * partition) < 0) return -1;
+	f->taps = taps;
+	f->partition = partition;
+	f->nbParts = (taps + partition - 1) / partition;
+	f->bins = (partition + 1 + FFT_MAX_WIDTH - 1) / FFT_MAX_WIDTH * FFT_MAX_WIDTH;
+	f->y = firAlloc(2 * f->bins);
+	f->t = firAlloc(2 * partition);
+	seg = firAlloc(2 * partition);
+	if (f->y == NULL || f->t == NULL || seg == NULL) goto fail;
+	for (c = 0 ; c < FIR_CHANNELS ; c++) {
+		f->h[c] = firAlloc(f->nbParts * 2 * f->bins);
+		f->x[c] = firAlloc(f->nbParts * 2 * f->bins);
+		f->in[c] = firAlloc(2 * partition);
+		if (f->h[c] == NULL || f->x[c] == NULL || f->in[c] == NULL) goto fail;
+		for (p = 0 ; p < f->nbParts ; p++) {
+			for (i = 0 ; i < partition ; i++) seg[i] = p * partition + i < taps ? ir[c][p * partition + i] / partition : 0;	//1 / partition : gain of the inverse FFT
+			h = f->h[c] + p * 2 * f->bins;
+			fftForward(&f->fft, seg, h, h + f->bins);
+		}
+	}
+	free(seg);
+	return 0;
+
+fail:
+	logError("FIR : out of memory");
+	free(seg);
+	firFree(f);
+	return -1;
+}
+
+//Loads the impulse responses of the WAV files and sets up the convolution
+//files : one mono or stereo file, or one mono file per channel
+//Returns -1 on error
+int firLoad(struct firFilter *f, char **files, int nbFiles, int rate, int partition){
+	float	*data[FIR_MAX_FILES] = {NULL}, *ir[FIR_CHANNELS];
+	int		channels[FIR_MAX_FILES], frames[FIR_MAX_FILES];
+	int		c, i, k, taps = 0, status = -1;
+
+	for (k = 0 ; k < nbFiles && k < FIR_MAX_FILES ; k++) {
+		if ((frames[k] = readWav(files[k], rate, &data[k], &channels[k])) < 0) goto end;
+		if (channels[k] > FIR_CHANNELS || (nbFiles > 1 && channels[k] > 1)) {
+			logError("Impulse response %s : %i channels, one stereo file or mono files expected", files[k], channels[k]);
+			goto end;
+		}
+		if (frames[k] > taps) taps = frames[k];
+	}
+	for (c = 0 ; c < FIR_CHANNELS ; c++) {								//One channel per file, or the channels of one file
+		k = nbFiles > 1 ? c : 0;
+		if ((ir[c] = calloc(taps, sizeof(float))) == NULL) goto end;
+		for (i = 0 ; i < frames[k] ; i++) ir[c][i] = data[k][i * channels[k] + (nbFiles > 1 ? 0 : c % channels[k])];
+	}
+	status = firSetup(f, ir, taps, partition);
+	if (status == 0) logInfo("FIR %s : %i taps, %i partitions of %i frames", files[0], taps, f->nbParts, partition);
+	for (c = 0 ; c < FIR_CHANNELS ; c++) free(ir[c]);
+
+end:
+	for (k = 0 ; k < FIR_MAX_FILES ; k++) free(data[k]);
+	return status;
+}
+
+//Starts a session : silence in the delay line
+void firReset(struct firFilter *f){
+	int c;
+
+	for (c = 0 ; c < FIR_CHANNELS ; c++) {
+		memset(f->x[c], 0, f->nbParts * 2 * f->bins * sizeof(float));
+		memset(f->in[c], 0, 2 * f->partition * sizeof(float));
+	}
+	f->cur = 0;
+}
+
+void firFree(struct firFilter *f){
+	int c;
+
+	for (c = 0 ; c < FIR_CHANNELS ; c++) {
+		free(f->h[c]); free(f->x[c]); free(f->in[c]);
+	}
+	free(f->y); free(f->t);
+	fftFree(&f->fft);
+	memset(f, 0, sizeof(struct firFilter));
+}
+
+//Convolves stereo frames, left at in[i * inStride] and right just after, out may be in
+//frames : a multiple of the partition, except for the last block of a session which is padded with silence
+void firRun(struct firFilter *f, float *in, int inStride, float *out, int outStride, int frames){
+	float	*x, *h, *buf;
+	int		c, p, i, n, s, done, P = f->partition, B = f->bins;
+
+	for (done = 0 ; done < frames ; done += P) {
+		n = frames - done < P ? frames - done : P;
+		for (c = 0 ; c < FIR_CHANNELS ; c++) {
+			buf = f->in[c];
+			memcpy(buf, buf + P, P * sizeof(float));
+			for (i = 0 ; i < P ; i++) buf[P + i] = i < n ? in[(done + i) * inStride + c] : 0;
+			x = f->x[c] + f->cur * 2 * B;
+			fftForward(&f->fft, buf, x, x + B);
+
+			memset(f->y, 0, 2 * B * sizeof(float));
+			for (p = 0 ; p < f->nbParts ; p++) {						//Partition p of the response with the input p blocks ago
+				s = f->cur - p < 0 ? f->cur - p + f->nbParts : f->cur - p;
+				x = f->x[c] + s * 2 * B;
+				h = f->h[c] + p * 2 * B;
+				f->fft.kernel->mac(f->y, f->y + B, x, x + B, h, h + B, B);
+			}
+			fftInverse(&f->fft, f->y, f->y + B, f->t);
+			for (i = 0 ; i < n ; i++) out[(done + i) * outStride + c] = f->t[P + i];
+		}
+		f->cur = f->cur + 1 == f->nbParts ? 0 : f->cur + 1;
+	}
+}
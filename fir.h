@@ -0,0 +1,31 @@
+#ifndef FIR_H
+#define FIR_H
+
+#include "fft.h"
+
+#define FIR_CHANNELS		2
+#define FIR_MAX_TAPS		65536
+#define FIR_MAX_FILES		2				/* One stereo or mono file, or one mono file per channel */
+
+struct firFilter {							//Uniformly partitioned overlap-save convolution, one impulse response per channel
+	int			taps;
+	int			partition;					//Frames per partition : the FFT runs on 2 * partition points
+	int			nbParts;
+	int			bins;						//Floats per half spectrum : partition + 1 bins padded to the vector width
+	struct fft	fft;
+	float		*h[FIR_CHANNELS];			//Spectra of the partitions of the impulse response : re then im, nbParts of them
+	float		*x[FIR_CHANNELS];			//Spectra of the last nbParts input partitions
+	int			cur;						//Partition of x of the current input
+	float		*in[FIR_CHANNELS];			//Previous and current input partitions
+	float		*y;							//Spectrum of the output
+	float		*t;							//Output of the inverse FFT
+};
+
+int 	readWav(char *file, int rate, float **data, int *channels);
+int 	firSetup(struct firFilter *f, float **ir, int taps, int partition);
+int 	firLoad(struct firFilter *f, char **files, int nbFiles, int rate, int partition);
+void 	firReset(struct firFilter *f);
+void 	firFree(struct firFilter *f);
+void 	firRun(struct firFilter *f, float *in, int inStride, float *out, int outStride, int frames);
+
+#endif
@@ -0,0 +1,158 @@
+/*
+ * firBench : checks the FIR convolution against a direct convolution and measures it
+ *
+ * Check : each kernel the CPU supports convolves noise with a random decaying impulse response, partition by
+ * partition, and is compared with the direct convolution computed in double. The largest error relative to the RMS
+ * of the output must stay below the tolerance in dB.
+ * Benchmark : CPU load of a stereo convolution at 44100 Hz, in % of one core, by number of taps and block size
+ * (partition), for each kernel.
+ * The exit status is 1 if a kernel fails the check.
+ *
+ * Usage : firBench [-e tolerance dB] [-t seconds per measure] [-c check only]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+
+#include "log.h"
+#include "fir.h"
+
+#define BENCH_RATE		44100
+#define BENCH_TAPS		3000		/* Impulse response of the check */
+#define BENCH_FRAMES	16384		/* Frames compared by the check */
+#define BENCH_TIME		0.2			/* Seconds per measure */
+
+static int taps[] = {1024, 4096, 16384, 65536, 0};
+static int blocks[] = {64, 128, 256, 512, 1024, 0};
+
+//Random impulse responses of n taps decaying by 60 dB, one per channel
+void randomIr(float **ir, int n){
+	int c, i;
+
+	for (c = 0 ; c < FIR_CHANNELS ; c++) {
+		ir[c] = malloc(n * sizeof(float));
+		for (i = 0 ; i < n ; i++) ir[c][i] = (drand48() - 0.5) * pow(10, -3.0 * i / n);
+	}
+}
+
+//Compares a kernel with the direct convolution for a block size, returns the largest error in dB of the output RMS
+double check(struct fftKernel *k, int block){
+	struct firFilter	f;
+	float				*ir[FIR_CHANNELS], *in, *out;
+	double				y, err, maxErr = 0, power = 0;
+	int					i, j, c;
+
+	randomIr(ir, BENCH_TAPS);
+	in = malloc(BENCH_FRAMES * FIR_CHANNELS * sizeof(float));
+	out = malloc(BENCH_FRAMES * FIR_CHANNELS * sizeof(float));
+	for (i = 0 ; i < BENCH_FRAMES * FIR_CHANNELS ; i++) in[i] = drand48() - 0.5;
+	fftSelect(k->name);
+	firSetup(&f, ir, BENCH_TAPS, block);
+	for (i = 0 ; i < BENCH_FRAMES ; i += block) firRun(&f, in + i * FIR_CHANNELS, FIR_CHANNELS, out + i * FIR_CHANNELS, FIR_CHANNELS, block);
+
+	for (i = 0 ; i < BENCH_FRAMES ; i++) {
+		for (c = 0 ; c < FIR_CHANNELS ; c++) {
+			for (y = 0, j = 0 ; j < BENCH_TAPS && j <= i ; j++) y += (double) ir[c][j] * in[(i - j) * FIR_CHANNELS + c];
+			err = fabs(y - out[i * FIR_CHANNELS + c]);
+			if (err > maxErr) maxErr = err;
+			power += y * y;
+		}
+	}
+	firFree(&f);
+	for (c = 0 ; c < FIR_CHANNELS ; c++) free(ir[c]);
+	free(in); free(out);
+	return 20 * log10(maxErr / sqrt(power / (BENCH_FRAMES * FIR_CHANNELS)) + 1e-30);
+}
+
+//Returns the CPU load of a stereo convolution in real time, in % of one core
+double measure(struct fftKernel *k, int nbTaps, int block, double seconds){
+	struct firFilter	f;
+	struct timespec		t0, t1;
+	float				*ir[FIR_CHANNELS], *buf = NULL;
+	double				elapsed;
+	long				frames = 0;
+	int					i, c;
+
+	randomIr(ir, nbTaps);
+	fftSelect(k->name);
+	if (firSetup(&f, ir, nbTaps, block) < 0) return -1;
+	posix_memalign((void **) &buf, FFT_ALIGN, block * FIR_CHANNELS * sizeof(float));
+	for (i = 0 ; i < block * FIR_CHANNELS ; i++) buf[i] = drand48() - 0.5;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	do {
+		for (i = 0 ; i < 16 ; i++) {
+			firRun(&f, buf, FIR_CHANNELS, buf, FIR_CHANNELS, block);
+			frames += block;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	} while (elapsed < seconds);
+
+	firFree(&f);
+	for (c = 0 ; c < FIR_CHANNELS ; c++) free(ir[c]);
+	free(buf);
+	return 100 * elapsed * BENCH_RATE / frames;
+}
+
+//Flushes denormal numbers to zero, as the DSP engine does
+void flushDenormals(){
+#if defined(__SSE__)
+	unsigned int csr;
+	__asm__ volatile ("stmxcsr %0" : "=m" (csr));
+	csr |= 0x8040;
+	__asm__ volatile ("ldmxcsr %0" : : "m" (csr));
+#endif
+}
+
+int main(int argc, char *argv[]){
+	struct fftKernel	*k;
+	double				d, e, tolerance = -100, seconds = BENCH_TIME;
+	bool				checkOnly = false;
+	int					opt, i, j, status = 0;
+
+	while ((opt = getopt(argc, argv, "e:t:c")) != -1) {
+		switch (opt) {
+			case 'e': tolerance = atof(optarg); break;
+			case 't': seconds = atof(optarg); break;
+			case 'c': checkOnly = true; break;
+			default:
+				fprintf(stderr, "Usage : %s [-e tolerance dB] [-t seconds per measure] [-c]\n", argv[0]);
+				return 1;
+		}
+	}
+	flushDenormals();
+	srand48(1);
+
+	printf("Check against the direct convolution, %i taps, %i frames, tolerance %.0f dB\n", BENCH_TAPS, BENCH_FRAMES, tolerance);
+	for (k = fftKernels ; k->name != NULL ; k++) {
+		if (!k->supported()) {
+			printf("  %-8s not supported by this CPU\n", k->name);
+			continue;
+		}
+		for (d = -1000, j = 0 ; blocks[j] != 0 ; j++) {
+			e = check(k, blocks[j]);
+			if (e > d) d = e;
+		}
+		printf("  %-8s max error %.1f dB %s\n", k->name, d, d > tolerance ? "FAILED" : "ok");
+		if (d > tolerance) status = 1;
+	}
+	if (checkOnly) return status;
+
+	printf("\nCPU load in %% of one core, stereo at %i Hz\n%-8s %-7s", BENCH_RATE, "kernel", "taps");
+	for (j = 0 ; blocks[j] != 0 ; j++) printf(" %7i", blocks[j]);
+	printf("  block frames\n");
+	for (k = fftKernels ; k->name != NULL ; k++) {
+		if (!k->supported()) continue;
+		for (i = 0 ; taps[i] != 0 ; i++) {
+			printf("%-8s %-7i", k->name, taps[i]);
+			for (j = 0 ; blocks[j] != 0 ; j++) printf(" %7.2f", measure(k, taps[i], blocks[j], seconds));
+			printf("\n");
+		}
+	}
+	return status;
+}
@@ -0,0 +1,821 @@
+/*
+ * graph : processing graph of the DSP engine
+ *
+ * The graph is described in the configuration file by named nodes reading the output of other nodes :
+ *   node "pre"  { type = "chain" chain = "/etc/ampCtl/pre.ecp" input = "in" }
+ *   node "low"  { type = "chain" chain = "/etc/ampCtl/woofer.ecp" input = "pre" }
+ *   node "mid"  { type = "gain" gain = -3 input = "pre" }
+ *   node "sub"  { type = "sum" input = {"low", "mid"} }
+ *   node "room" { type = "fir" ir = "/etc/ampCtl/room.wav" input = "in" }
+ *   output "woofer" { input = "low" sink = "alsa:sysdefault:CARD=Audio" }
+ * "in" is the input of the engine. A split is a node read by several nodes, a sum a node reading several ones.
+ * The former configuration (dspPre and output sections with a chain) is turned into the same graph.
+ *
+ * At load time the graph is checked (unknown nodes, number of inputs, cycles), sorted in topological order and
+ * shared out between the threads : each output goes to a worker, a node feeding the outputs of a single worker
+ * runs in this worker, the others in the reader thread. Each thread then gets its schedule : the chains of the
+ * same thread reading the same node run side by side in one bank, a gain, a delay or a sum works in the buffer
+ * of its input when it is its only reader, and the nodes read the buffers of their inputs where they are :
+ * a split costs no copy. Only the outputs of the reader thread used by a worker are copied, into the block
+ * handed over to this worker.
+ *
+ * An output with "follow" is kept in lock with the device of the output it names (see drift.c).
+ * A delay node and an output with "delay" are set in us, up to GRAPH_MAX_DELAY s.
+ * An output with "delay" goes through a delay node "<output>.delay" : once one output has it, all of them get
+ * one, lengthened by the latency of the fractional delay filter (see delay.c) so that they stay aligned.
+ * The delays may be changed while playing (graphSetDelays).
+ * An output with "limit" (dBFS) goes through a look-ahead limiter "<output>.limit" after its delay (see limit.c) : the
+ * other outputs get a delay node lengthened by the look-ahead of the limiter, their own one deducted, so that the
+ * drivers stay aligned whichever of them are limited.
+ *
+ * The preset files of the chains are watched with inotify (graphWatch). When one changes, the banks using it are
+ * compiled again in the watching thread and published with a pointer. The thread running the step takes the new
+ * bank at the start of a block, runs it along with the former one for GRAPH_WARMUP s so that its filters settle on
+ * the signal, then crossfades from the former to the new one over GRAPH_FADE s and hands the former one back to be
+ * freed : tuning the filters while listening, without restart nor click.
+ *
+ * The input node applies the volume (graphSetVolume) and the soft mute (graphSetMute) when converting the input to
+ * float. The frame a mute becomes silent is marked so that the mute relay waits until the devices have played it.
+ * With a loudness compensation set (see loudness.c), the input node then runs its shelves at the volume reached.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/inotify.h>
+
+#include "log.h"
+#include "graph.h"
+
+#define GRAPH_ALIGN		64
+
+static char *typeNames[] = {"input", "chain", "gain", "delay", "sum", "fir", "sink", "limit"};
+
+static float *graphAlloc(int floats){
+	float *p;
+
+	if (posix_memalign((void **) &p, GRAPH_ALIGN, (floats > 0 ? floats : 1) * sizeof(float)) != 0) return NULL;
+	memset(p, 0, (floats > 0 ? floats : 1) * sizeof(float));
+	return p;
+}
+
+int findNode(struct graph *g, char *name){
+	int i;
+
+	for (i = 0 ; i < g->nbNodes ; i++) if (strcmp(g->node[i].name, name) == 0) return i;
+	return -1;
+}
+
+//Adds a node, its inputs are given by name and resolved once all the nodes are known
+//Returns the node, NULL if the name is already used or the graph is full
+struct graphNode *addNode(struct graph *g, char inputs[][GRAPH_MAX_INPUTS][64], char *name, enum graphType type){
+	struct graphNode *n;
+
+	if (findNode(g, name) >= 0) {
+		logError("DSP graph : node %s defined twice", name);
+		return NULL;
+	}
+	if (g->nbNodes == GRAPH_MAX_NODES) {
+		logError("DSP graph : more than %i nodes", GRAPH_MAX_NODES);
+		return NULL;
+	}
+	n = &g->node[g->nbNodes++];
+	memset(inputs[n - g->node], 0, sizeof(inputs[0]));
+	n->name = strdup(name);
+	n->type = type;
+	n->gain = 1;
+	n->owner = -1;
+	n->follow = -1;
+	return n;
+}
+
+//Sorts the nodes in topological order, returns -1 if there is a cycle
+int sortNodes(struct graph *g){
+	int pending[GRAPH_MAX_NODES];
+	int i, j, k, n = 0;
+
+	for (i = 0 ; i < g->nbNodes ; i++) pending[i] = g->node[i].nbInputs;
+	while (n < g->nbNodes) {
+		for (i = 0 ; i < g->nbNodes && pending[i] != 0 ; i++);
+		if (i == g->nbNodes) {
+			for (i = 0 ; i < g->nbNodes ; i++) if (pending[i] > 0) logError("DSP graph : node %s is in a cycle or reads one", g->node[i].name);
+			return -1;
+		}
+		pending[i] = -1;
+		g->order[n++] = i;
+		for (j = 0 ; j < g->nbNodes ; j++)							//The readers of this node have one input less to wait for
+			for (k = 0 ; k < g->node[j].nbInputs ; k++) if (g->node[j].input[k] == i) pending[j]--;
+	}
+	return 0;
+}
+
+//Shares the nodes out between the threads, from the outputs back to the input
+//Nodes feeding no output are left out
+void assignOwners(struct graph *g, int workers){
+	struct graphNode	*n, *m;
+	int					i, j, k, s = 0, sinks = 0;
+
+	for (i = 0 ; i < g->nbNodes ; i++) sinks += g->node[i].type == NODE_SINK;
+	g->nbThreads = workers > 0 ? 1 + (workers < sinks ? workers : sinks) : 1;
+
+	for (i = g->nbNodes - 1 ; i >= 0 ; i--) {
+		n = &g->node[g->order[i]];
+		if (n->type == NODE_SINK) n->owner = g->nbThreads > 1 ? 1 + s++ % (g->nbThreads - 1) : 0;
+		else {
+			for (j = 0 ; j < g->nbNodes ; j++) {						//Readers of the node
+				m = &g->node[j];
+				for (k = 0 ; k < m->nbInputs ; k++) {
+					if (m->input[k] != g->order[i] || m->owner < 0) continue;
+					n->consumers++;
+					n->owner = n->owner < 0 || n->owner == m->owner ? m->owner : 0;
+				}
+			}
+			if (n->type == NODE_INPUT) n->owner = 0;
+			else if (n->owner < 0) logInfo("DSP graph : node %s feeds no output, left out", n->name);
+		}
+	}
+}
+
+//Latency of the limiter of an output in frames, 0 without limiter
+int outputLatency(cfg_t *sec, int rate){
+	return cfg_size(sec, "limit") > 0 ? limitLatency(cfg_getfloat(sec, "attack") * 1e-3, rate) : 0;
+}
+
+//Offset of the delay of an output in s : latency of the fractional delay filter shared by all the outputs, and of the
+//longest limiter less the one of the output
+double outputOffset(cfg_t *sec, int rate, int latency){
+	return (double) (DELAY_LATENCY + latency - outputLatency(sec, rate)) / rate;
+}
+
+//Is a delay in s within the ring of a delay node ?
+static bool delayValid(double delay){
+	return delay >= 0 && delay <= GRAPH_MAX_DELAY;
+}
+
+//Reads the graph from the configuration file
+//pre : pre chain of the former configuration (dspPre), workers : worker threads (0 : all the graph in the reader thread)
+//Returns -1 if the graph is invalid
+int graphLoad(struct graph *g, cfg_t *cfg, char *pre, int workers, int rate){
+	static char			inputs[GRAPH_MAX_NODES][GRAPH_MAX_INPUTS][64];
+	char				*follows[GRAPH_MAX_NODES];
+	struct graphNode	*n;
+	cfg_t				*sec;
+	char				name[64], delayName[64], *type, *def;
+	bool				aligned = false;
+	int					i, j, k, latency = 0;
+
+	memset(g, 0, sizeof(struct graph));
+	g->rate = rate;
+	g->volume = g->gain = 1;
+	g->glide = 1 - exp(-1 / (GRAPH_VOLUME_TIME * rate));
+	g->rampFrames = g->ramp = lrint(GRAPH_MUTE_TIME * rate);
+	if (addNode(g, inputs, GRAPH_INPUT, NODE_INPUT) == NULL) return -1;
+	if (pre != NULL) {
+		if ((n = addNode(g, inputs, "pre", NODE_CHAIN)) == NULL) return -1;
+		n->chainFile = strdup(pre);
+		snprintf(inputs[n - g->node][n->nbInputs++], 64, "%s", GRAPH_INPUT);
+	}
+
+	for (i = 0 ; i < cfg_size(cfg, "node") ; i++) {
+		sec = cfg_getnsec(cfg, "node", i);
+		type = cfg_getstr(sec, "type");
+		for (k = NODE_CHAIN ; k < NODE_SINK && strcmp(typeNames[k], type) != 0 ; k++);
+		if (k == NODE_SINK) {
+			logError("DSP graph : node %s of unknown type %s", cfg_title(sec), type);
+			return -1;
+		}
+		if ((n = addNode(g, inputs, (char *) cfg_title(sec), k)) == NULL) return -1;
+		if (cfg_getstr(sec, "chain") != NULL) n->chainFile = strdup(cfg_getstr(sec, "chain"));
+		n->gain = pow(10, cfg_getfloat(sec, "gain") / 20);
+		n->delay = cfg_getfloat(sec, "delay") * 1e-6;
+		for (j = 0 ; j < cfg_size(sec, "ir") && j < FIR_MAX_FILES ; j++) n->irFiles[n->nbIrFiles++] = strdup(cfg_getnstr(sec, "ir", j));
+		n->partition = cfg_getint(sec, "partition");
+		for (j = 0 ; j < cfg_size(sec, "input") && j < GRAPH_MAX_INPUTS ; j++)
+			snprintf(inputs[n - g->node][n->nbInputs++], 64, "%s", cfg_getnstr(sec, "input", j));
+	}
+
+	def = pre != NULL ? "pre" : GRAPH_INPUT;								//Input of the outputs of the former configuration
+	for (i = 0 ; i < cfg_size(cfg, "output") ; i++) {
+		sec = cfg_getnsec(cfg, "output", i);
+		aligned |= cfg_size(sec, "delay") > 0 || cfg_size(sec, "limit") > 0;
+		if (outputLatency(sec, rate) > latency) latency = outputLatency(sec, rate);
+	}
+	for (i = 0 ; i < cfg_size(cfg, "output") ; i++) {
+		sec = cfg_getnsec(cfg, "output", i);
+		snprintf(name, sizeof(name), "%s", cfg_getstr(sec, "input") ? cfg_getstr(sec, "input") : def);
+		if (cfg_getstr(sec, "chain") != NULL) {							//Chain of the output : node "<output>.chain"
+			snprintf(name, sizeof(name), "%s.chain", cfg_title(sec));
+			if ((n = addNode(g, inputs, name, NODE_CHAIN)) == NULL) return -1;
+			n->chainFile = strdup(cfg_getstr(sec, "chain"));
+			snprintf(inputs[n - g->node][n->nbInputs++], 64, "%s", cfg_getstr(sec, "input") ? cfg_getstr(sec, "input") : def);
+		}
+		if (aligned) {													//Delay of the output : node "<output>.delay"
+			snprintf(delayName, sizeof(delayName), "%s.delay", cfg_title(sec));
+			if ((n = addNode(g, inputs, delayName, NODE_DELAY)) == NULL) return -1;
+			n->offset = outputOffset(sec, rate, latency);
+			n->delay = (cfg_size(sec, "delay") > 0 ? cfg_getfloat(sec, "delay") * 1e-6 : 0) + n->offset;
+			snprintf(inputs[n - g->node][n->nbInputs++], 64, "%s", name);
+			snprintf(name, sizeof(name), "%s", delayName);
+		}
+		if (cfg_size(sec, "limit") > 0) {								//Limiter of the output : node "<output>.limit"
+			snprintf(delayName, sizeof(delayName), "%s.limit", cfg_title(sec));
+			if ((n = addNode(g, inputs, delayName, NODE_LIMIT)) == NULL) return -1;
+			n->ceiling = pow(10, cfg_getfloat(sec, "limit") / 20);
+			n->attack = cfg_getfloat(sec, "attack") * 1e-3;
+			n->release = cfg_getfloat(sec, "release") * 1e-3;
+			if (cfg_getfloat(sec, "limit") > 0 || n->attack <= 0 || n->attack > LIMIT_MAX_ATTACK * 1e-3 || n->release <= 0) {
+				logError("DSP graph : limit of output %s, ceiling above 0 dBFS, attack out of 0..%g ms or release not positive", cfg_title(sec), LIMIT_MAX_ATTACK);
+				return -1;
+			}
+			snprintf(inputs[n - g->node][n->nbInputs++], 64, "%s", name);
+			snprintf(name, sizeof(name), "%s", delayName);
+		}
+		if ((n = addNode(g, inputs, (char *) cfg_title(sec), NODE_SINK)) == NULL) return -1;
+		n->sinkSpec = strdup(cfg_getstr(sec, "sink"));
+		n->skew = cfg_getfloat(sec, "skew");
+		if ((k = ditherMode(cfg_getstr(sec, "dither"))) < 0) {
+			logError("DSP graph : output %s with unknown dither %s", n->name, cfg_getstr(sec, "dither"));
+			return -1;
+		}
+		ditherInit(&n->dither, k, n - g->node);
+		follows[n - g->node] = cfg_getstr(sec, "follow");
+		snprintf(inputs[n - g->node][n->nbInputs++], 64, "%s", name);
+	}
+
+	for (i = 0 ; i < g->nbNodes ; i++) {								//Locked outputs
+		n = &g->node[i];
+		if (n->type != NODE_SINK || follows[i] == NULL) continue;
+		n->follow = findNode(g, follows[i]);
+		if (n->follow < 0 || n->follow == i || g->node[n->follow].type != NODE_SINK || follows[n->follow] != NULL) {
+			logError("DSP graph : output %s follows %s, which is not an output followed by others", n->name, follows[i]);
+			return -1;
+		}
+	}
+
+	for (i = 0 ; i < g->nbNodes ; i++) {
+		n = &g->node[i];
+		for (j = 0 ; j < n->nbInputs ; j++) {
+			if ((n->input[j] = findNode(g, inputs[i][j])) < 0) {
+				logError("DSP graph : node %s reads unknown node %s", n->name, inputs[i][j]);
+				return -1;
+			}
+		}
+		if ((n->type == NODE_SUM && n->nbInputs < 2) || (n->type != NODE_SUM && n->type != NODE_INPUT && n->nbInputs != 1)) {
+			logError("DSP graph : %s node %s with %i inputs", typeNames[n->type], n->name, n->nbInputs);
+			return -1;
+		}
+		if ((n->type == NODE_CHAIN && n->chainFile == NULL) || (n->type == NODE_DELAY && !delayValid(n->delay - n->offset))
+			|| (n->type == NODE_FIR && n->nbIrFiles == 0)) {
+			logError("DSP graph : %s node %s without chain or impulse response, or with a delay out of 0..%g us", typeNames[n->type], n->name, GRAPH_MAX_DELAY * 1e6);
+			return -1;
+		}
+	}
+	if (sortNodes(g) < 0) return -1;
+	assignOwners(g, workers);
+
+	for (i = 0 ; i < g->nbNodes ; i++) {
+		n = &g->node[g->order[i]];
+		if (n->owner >= 0) logDebug("DSP graph : %s node %s, %i inputs, %i readers, thread %i", typeNames[n->type], n->name, n->nbInputs, n->consumers, n->owner);
+	}
+	return 0;
+}
+
+//Returns the buffer of node i in thread t : its output when the thread runs it, a view of the block handed over otherwise
+struct graphBuf *resolve(struct graph *g, int t, int i){
+	struct graphThread	*th = &g->thread[t];
+	struct graphImport	*imp;
+	int					k;
+
+	if (g->node[i].owner == t) return &g->node[i].out;
+	for (k = 0 ; k < th->nbImports ; k++) if (th->import[k].node == i) return &th->import[k].buf;
+	imp = &th->import[th->nbImports];
+	imp->node = i;
+	imp->offset = th->nbImports * g->block * GRAPH_CHANNELS;
+	imp->buf.stride = GRAPH_CHANNELS;
+	th->nbImports++;
+	th->importFloats = th->nbImports * GRAPH_CHANNELS;
+	return &imp->buf;
+}
+
+//Sets the output of a node running in thread t : the buffer of its first input when it is its only reader, its own buffer otherwise
+int setOutput(struct graph *g, int t, struct graphNode *n, struct graphStep *s){
+	struct graphNode *in = &g->node[n->input[0]];
+
+	if (in->owner == t && in->consumers == 1 && in->type != NODE_INPUT) n->out = *s->in[0];
+	else {
+		n->out.stride = GRAPH_CHANNELS;
+		if ((n->out.base = graphAlloc(g->block * GRAPH_CHANNELS)) == NULL) return -1;
+	}
+	return 0;
+}
+
+//Publishes the delay of a delay node, in s
+//offset : latency of the fractional delay filter included in the delay of an output, not logged
+void setDelay(struct graphNode *n, double delay, double offset){
+	double applied = delaySet(n->line, delay + offset) - offset;
+
+	if (fabs(applied - delay) > 1e-9) logInfo("DSP graph : delay node %s, %.1f us rounded to %.1f us", n->name, delay * 1e6, applied * 1e6);
+	else logDebug("DSP graph : delay node %s, %.1f us", n->name, delay * 1e6);
+}
+
+//Builds the schedule of a thread
+int schedule(struct graph *g, int t, int latency, int period, bool *banked){
+	struct graphThread	*th = &g->thread[t];
+	struct graphStep	*s;
+	struct graphNode	*n, *m;
+	char				*files[FLT_MAX_CHAINS];
+	float				*buf;
+	int					i, j, k;
+
+	for (i = 0 ; i < g->nbNodes ; i++) {
+		n = &g->node[g->order[i]];
+		if (n->owner != t || banked[g->order[i]]) continue;
+		s = &th->step[th->nbSteps++];
+		s->type = n->type;
+		s->node = g->order[i];
+		s->nbInputs = n->nbInputs;
+		for (k = 0 ; k < n->nbInputs ; k++) s->in[k] = resolve(g, t, n->input[k]);
+
+		switch (n->type) {
+			case NODE_INPUT:
+				n->out.stride = GRAPH_CHANNELS;
+				if ((n->out.base = graphAlloc(g->block * GRAPH_CHANNELS)) == NULL) return -1;
+				break;
+
+			case NODE_CHAIN:										//All the chains of the thread reading the same node
+				for (j = i ; j < g->nbNodes && s->nbMembers < FLT_MAX_CHAINS ; j++) {
+					m = &g->node[g->order[j]];
+					if (m->type != NODE_CHAIN || m->owner != t || banked[g->order[j]] || m->input[0] != n->input[0]) continue;
+					banked[g->order[j]] = true;
+					s->member[s->nbMembers] = g->order[j];
+					files[s->nbMembers++] = m->chainFile;
+				}
+				if ((s->bank = calloc(1, sizeof(struct filterBank))) == NULL) return -1;
+				if (filterLoad(s->bank, files, s->nbMembers, g->rate) < 0) return -1;
+				if ((buf = graphAlloc(g->block * s->bank->width)) == NULL) return -1;
+				if ((s->fadeBuf = graphAlloc(g->block * s->bank->width)) == NULL) return -1;
+				for (j = 0 ; j < s->nbMembers ; j++) {
+					g->node[s->member[j]].out.base = buf + j * GRAPH_CHANNELS;
+					g->node[s->member[j]].out.stride = s->bank->width;
+				}
+				break;
+
+			case NODE_GAIN:
+			case NODE_SUM:
+				if (setOutput(g, t, n, s) < 0) return -1;
+				break;
+
+			case NODE_DELAY:										//Ring for the longest delay : may be changed while playing
+				if (setOutput(g, t, n, s) < 0) return -1;
+				if ((n->line = malloc(sizeof(struct delayLine))) == NULL || delayInit(n->line, GRAPH_MAX_DELAY + n->offset, g->rate) < 0) return -1;
+				setDelay(n, n->delay, 0);
+				break;
+
+			case NODE_FIR:											//Whole partitions per block : no latency added
+				if (n->partition == 0) n->partition = g->block;
+				if (g->block % n->partition != 0) {
+					logError("DSP graph : fir node %s, partition of %i frames not dividing the block of %i frames", n->name, n->partition, g->block);
+					return -1;
+				}
+				if (setOutput(g, t, n, s) < 0) return -1;
+				if ((n->fir = malloc(sizeof(struct firFilter))) == NULL) return -1;
+				if (firLoad(n->fir, n->irFiles, n->nbIrFiles, g->rate, n->partition) < 0) return -1;
+				break;
+
+			case NODE_LIMIT:										//Delays by its look-ahead, matched by the delays of the other outputs
+				if (setOutput(g, t, n, s) < 0) return -1;
+				if ((n->limiter = malloc(sizeof(struct limiter))) == NULL) return -1;
+				if (limitInit(n->limiter, n->ceiling, n->attack, n->release, g->rate, g->block) < 0) return -1;
+				logInfo("DSP graph : limit node %s, ceiling %.1f dBFS, look-ahead %i frames, release %.0f ms", n->name,
+					20 * log10(n->ceiling), n->limiter->lookahead, n->release * 1e3);
+				break;
+
+			case NODE_SINK:
+				if ((n->pcm = malloc((g->block + g->block / 512 + 4) * GRAPH_CHANNELS * sizeof(int16_t))) == NULL) return -1;
+				if (sinkOpen(&n->sink, n->sinkSpec, g->rate, GRAPH_CHANNELS, latency, period) < 0) return -1;
+				for (j = 0 ; j < g->nbNodes && g->node[j].follow != s->node ; j++);
+				if (n->skew != 0 || n->follow >= 0 || j < g->nbNodes) sinkSimulate(&n->sink, n->skew);
+				if (n->follow >= 0 || j < g->nbNodes) {						//Locked or followed
+					if ((n->drift = malloc(sizeof(struct drift))) == NULL) return -1;
+					if (driftInit(n->drift, g->block, g->rate, n->follow < 0) < 0) return -1;
+				}
+				th->nbSinks++;
+				break;
+		}
+	}
+	return 0;
+}
+
+//Allocates the buffers, loads the chains, opens the sinks and builds the schedule of each thread
+//latency : buffering requested to the sinks in micro seconds
+//periods : 0, or the devices get periods of one block and buffer this many periods in place of the latency
+//Returns -1 on error
+int graphOpen(struct graph *g, int block, int latency, int periods){
+	bool	banked[GRAPH_MAX_NODES];
+	int		t;
+
+	memset(banked, 0, sizeof(banked));
+	g->block = block;
+	g->frames = 0;
+	if (periods > 0) latency = ceil((double) periods * block * 1000000 / g->rate);
+	for (t = 0 ; t < g->nbThreads ; t++) {
+		if (schedule(g, t, latency, periods > 0 ? block : 0, banked) < 0) return -1;
+		logInfo("DSP graph : thread %i runs %i steps, %i outputs, reads %i nodes of the reader thread",
+			t, g->thread[t].nbSteps, g->thread[t].nbSinks, g->thread[t].nbImports);
+	}
+	return 0;
+}
+
+//Marks the frame of the last soft mute request taken, for graphMuteTime
+static void markMute(struct graph *g, uint64_t frame){
+	g->muteMarked = true;
+	__atomic_store_n(&g->markFrame, frame, __ATOMIC_RELAXED);
+	__atomic_store_n(&g->markSeq, g->muteSeen, __ATOMIC_RELEASE);
+}
+
+void graphReset(struct graph *g){
+	struct graphStep	*s;
+	struct graphNode	*n;
+	float				volume;
+	int					t, i;
+
+	__atomic_load(&g->volume, &volume, __ATOMIC_ACQUIRE);
+	g->gain = volume;												//A session starts at the volume and the mute, without ramp
+	if (g->loudness != NULL) loudnessReset(g->loudness, g->gain);
+	g->muteSeen = __atomic_load_n(&g->muteSeq, __ATOMIC_ACQUIRE);
+	g->ramp = __atomic_load_n(&g->mute, __ATOMIC_RELAXED) ? 0 : g->rampFrames;
+	markMute(g, g->frames);
+	for (t = 0 ; t < g->nbThreads ; t++) {
+		for (i = 0 ; i < g->thread[t].nbSteps ; i++) {
+			s = &g->thread[t].step[i];
+			n = &g->node[s->node];
+			if (s->bank != NULL) filterReset(s->bank);
+			if (s->prev != NULL) filterReset(s->prev);
+			if (n->line != NULL) delayReset(n->line);
+			if (n->drift != NULL) driftReset(n->drift);
+			if (n->fir != NULL) firReset(n->fir);
+			if (n->limiter != NULL) limitReset(n->limiter);
+			if (n->type == NODE_SINK) ditherReset(&n->dither);
+			n->startTime = INT64_MIN;									//Not played yet
+		}
+	}
+}
+
+//Runs the steps of thread t on one block, the sinks get their samples in s16 but are not written yet
+//in : block read from the input, for the reader thread
+void graphProcess(struct graph *g, int t, int32_t *in, int frames){
+	struct graphThread	*th = &g->thread[t];
+	struct graphStep	*s;
+	struct graphNode	*n;
+	struct graphBuf		*src, *dst, resampled = {NULL, GRAPH_CHANNELS};
+	struct filterBank	*bank;
+	float				*d, x, a, volume;
+	double				gain;
+	int					i, j, k, ch, fade = lrint(GRAPH_FADE * g->rate), seq, target;
+
+	for (k = 0 ; k < th->nbSteps ; k++) {
+		s = &th->step[k];
+		n = &g->node[s->node];
+		src = s->in[0];
+		dst = &n->out;
+		switch (s->type) {
+			case NODE_INPUT:										//Volume and soft mute applied in double, rounded once to float
+				__atomic_load(&g->volume, &volume, __ATOMIC_ACQUIRE);
+				if ((seq = __atomic_load_n(&g->muteSeq, __ATOMIC_ACQUIRE)) != g->muteSeen) {
+					g->muteSeen = seq;
+					g->muteMarked = false;
+				}
+				target = __atomic_load_n(&g->mute, __ATOMIC_RELAXED) ? 0 : g->rampFrames;
+				if (!g->muteMarked && (target > 0 || g->ramp == 0)) markMute(g, g->frames);	//Ramp up starting, or already silent
+				g->frames += frames;
+				if (g->gain == volume && g->ramp == target) {
+					gain = target > 0 ? volume * (1.0 / 2147483648.0) : 0;
+					for (i = 0 ; i < frames * GRAPH_CHANNELS ; i++) dst->base[i] = in[i] * gain;
+				}
+				else for (i = 0 ; i < frames ; i++) {					//Gliding to the new volume, without zipper noise
+					g->gain += (volume - g->gain) * g->glide;
+					if (fabs(volume - g->gain) < 1e-7) g->gain = volume;
+					g->ramp += (g->ramp < target) - (g->ramp > target);	//Raised cosine ramp of the soft mute
+					if (g->ramp == 0 && !g->muteMarked) markMute(g, g->frames - frames + i);
+					gain = g->gain * (0.5 - 0.5 * cos(M_PI * g->ramp / g->rampFrames)) * (1.0 / 2147483648.0);
+					for (ch = 0 ; ch < GRAPH_CHANNELS ; ch++) dst->base[i * GRAPH_CHANNELS + ch] = in[i * GRAPH_CHANNELS + ch] * gain;
+				}
+				if (g->loudness != NULL) loudnessRun(g->loudness, dst->base, frames, g->gain);	//Shelves of the volume reached
+				break;
+
+			case NODE_CHAIN:
+				//Chains reloaded, once the former ones are freed
+				if (s->fade == 0 && __atomic_load_n(&s->retired, __ATOMIC_ACQUIRE) == NULL
+					&& (bank = __atomic_exchange_n(&s->next, NULL, __ATOMIC_ACQUIRE)) != NULL) {
+					s->prev = s->bank;
+					s->bank = bank;
+					s->fade = lrint(GRAPH_WARMUP * g->rate) + fade;
+				}
+				d = g->node[s->member[0]].out.base;
+				for (i = 0 ; i < frames ; i++)
+					for (j = 0 ; j < s->nbMembers ; j++)
+						for (ch = 0 ; ch < GRAPH_CHANNELS ; ch++) d[i * s->bank->width + j * GRAPH_CHANNELS + ch] = src->base[i * src->stride + ch];
+				if (s->prev != NULL) memcpy(s->fadeBuf, d, frames * s->bank->width * sizeof(float));
+				filterRun(s->bank, d, frames);
+				if (s->prev == NULL) break;
+				filterRun(s->prev, s->fadeBuf, frames);					//Former chains until the new ones have faded in
+				for (i = 0 ; i < frames ; i++, s->fade -= s->fade > 0) {
+					a = s->fade > fade ? 1 : 0.5f - 0.5f * cosf((float) M_PI * s->fade / fade);	//Raised cosine
+					for (j = 0 ; j < s->bank->width ; j++) d[i * s->bank->width + j] += (s->fadeBuf[i * s->bank->width + j] - d[i * s->bank->width + j]) * a;
+				}
+				if (s->fade == 0) {
+					__atomic_store_n(&s->retired, s->prev, __ATOMIC_RELEASE);
+					s->prev = NULL;
+				}
+				break;
+
+			case NODE_GAIN:
+				for (i = 0 ; i < frames ; i++)
+					for (ch = 0 ; ch < GRAPH_CHANNELS ; ch++) dst->base[i * dst->stride + ch] = src->base[i * src->stride + ch] * n->gain;
+				break;
+
+			case NODE_DELAY:
+				delayRun(n->line, src->base, src->stride, dst->base, dst->stride, frames);
+				break;
+
+			case NODE_FIR:
+				firRun(n->fir, src->base, src->stride, dst->base, dst->stride, frames);
+				break;
+
+			case NODE_LIMIT:
+				limitRun(n->limiter, src->base, src->stride, dst->base, dst->stride, frames);
+				break;
+
+			case NODE_SUM:
+				for (i = 0 ; i < frames ; i++) {
+					for (ch = 0 ; ch < GRAPH_CHANNELS ; ch++) {
+						x = src->base[i * src->stride + ch];
+						for (j = 1 ; j < s->nbInputs ; j++) x += s->in[j]->base[i * s->in[j]->stride + ch];
+						dst->base[i * dst->stride + ch] = x;
+					}
+				}
+				break;
+
+			case NODE_SINK:											//s16 dithered, with saturation
+				if (n->meter != NULL) meterRun(n->meter, src->base, src->stride, frames);
+				n->pcmFrames = frames;
+				if (n->drift != NULL) {
+					n->pcmFrames = driftRun(n->drift, src->base, src->stride, frames);
+					resampled.base = n->drift->out;
+					src = &resampled;
+				}
+				ditherRun(&n->dither, src->base, src->stride, n->pcm, n->pcmFrames);
+				break;
+		}
+	}
+}
+
+//Publishes the gain of the volume, linear : the input node glides to it from its next block
+//May be called from any thread, without lock
+void graphSetVolume(struct graph *g, float gain){
+	__atomic_store(&g->volume, &gain, __ATOMIC_RELEASE);
+}
+
+//Requests the soft mute (mute 1) or its release : the input node ramps to silence or back to unity from its next block
+//May be called from any thread, without lock. Returns the number of the request, for graphMuteTime
+int graphSetMute(struct graph *g, int mute){
+	__atomic_store_n(&g->mute, mute, __ATOMIC_RELAXED);
+	return __atomic_add_fetch(&g->muteSeq, 1, __ATOMIC_RELEASE);
+}
+
+//Returns the time the devices play the frame marked for the soft mute request seq, in ns of CLOCK_MONOTONIC : the first
+//frame silent for a mute, the first frame of the ramp up for an unmute. 0 : no device played yet, or simulated ones only
+//-1 : the engine has not reached this point of the request yet
+int64_t graphMuteTime(struct graph *g, int seq){
+	struct graphNode	*n;
+	int64_t				start, t = 0, frame;
+	int					i;
+
+	if (__atomic_load_n(&g->markSeq, __ATOMIC_ACQUIRE) != seq) return -1;
+	frame = __atomic_load_n(&g->markFrame, __ATOMIC_RELAXED);
+	for (i = 0 ; i < g->nbNodes ; i++) {
+		n = &g->node[i];
+		if (n->type != NODE_SINK || n->owner < 0 || n->sink.simulated) continue;
+		if ((start = __atomic_load_n(&n->startTime, __ATOMIC_RELAXED)) == INT64_MIN) continue;
+		if (start + frame * 1000000000 / g->rate > t) t = start + frame * 1000000000 / g->rate;
+	}
+	return t;
+}
+
+//Returns the longest delay of the devices sampled after their last block, in frames
+int graphBuffered(struct graph *g){
+	int i, d, max = 0;
+
+	for (i = 0 ; i < g->nbNodes ; i++) {
+		if (g->node[i].type != NODE_SINK || g->node[i].owner < 0) continue;
+		if ((d = __atomic_load_n(&g->node[i].deviceDelay, __ATOMIC_RELAXED)) > max) max = d;
+	}
+	return max;
+}
+
+//Applies the delays of the configuration file to the delay nodes running, with a crossfade
+//Called while playing : the other changes of the graph need a restart
+void graphSetDelays(struct graph *g, cfg_t *cfg){
+	struct graphNode	*n;
+	cfg_t				*sec;
+	char				name[64];
+	double				delay;
+	int					i, k;
+
+	for (i = 0 ; i < cfg_size(cfg, "output") ; i++) {
+		sec = cfg_getnsec(cfg, "output", i);
+		if (cfg_size(sec, "delay") == 0) continue;
+		snprintf(name, sizeof(name), "%s.delay", cfg_title(sec));
+		if ((k = findNode(g, name)) < 0 || g->node[k].line == NULL) {
+			logError("DSP graph : delay of output %s not applied, needs a restart", cfg_title(sec));
+			continue;
+		}
+		if (!delayValid(delay = cfg_getfloat(sec, "delay") * 1e-6)) {
+			logError("DSP graph : delay of output %s out of 0..%g us, not applied", cfg_title(sec), GRAPH_MAX_DELAY * 1e6);
+			continue;
+		}
+		setDelay(&g->node[k], delay, g->node[k].offset);
+	}
+	for (i = 0 ; i < cfg_size(cfg, "node") ; i++) {
+		sec = cfg_getnsec(cfg, "node", i);
+		if ((k = findNode(g, (char *) cfg_title(sec))) < 0) continue;
+		n = &g->node[k];
+		if (n->type != NODE_DELAY || n->line == NULL) continue;
+		if (!delayValid(delay = cfg_getfloat(sec, "delay") * 1e-6)) {
+			logError("DSP graph : delay node %s out of 0..%g us, not applied", n->name, GRAPH_MAX_DELAY * 1e6);
+			continue;
+		}
+		setDelay(n, delay, 0);
+	}
+}
+
+//Publishes new banks for the chain steps using the preset files changed
+void reloadChains(struct graph *g, bool *changed){
+	struct graphStep	*s;
+	struct filterBank	*bank;
+	char				*files[FLT_MAX_CHAINS];
+	int					t, k, j;
+	bool				used;
+
+	for (t = 0 ; t < g->nbThreads ; t++) {
+		for (k = 0 ; k < g->thread[t].nbSteps ; k++) {
+			s = &g->thread[t].step[k];
+			if (s->type != NODE_CHAIN) continue;
+			for (used = false, j = 0 ; j < s->nbMembers ; j++) {
+				files[j] = g->node[s->member[j]].chainFile;
+				used |= changed[s->member[j]];
+			}
+			if (!used) continue;
+			if ((bank = calloc(1, sizeof(struct filterBank))) == NULL) return;
+			if (filterLoad(bank, files, s->nbMembers, g->rate) < 0 || bank->width != s->bank->width) {
+				logError("DSP graph : chains of node %s not reloaded, the former ones are kept", g->node[s->node].name);
+				filterFree(bank);
+				free(bank);
+				continue;
+			}
+			if ((bank = __atomic_exchange_n(&s->next, bank, __ATOMIC_RELEASE)) != NULL) {		//Not taken yet : replaced
+				filterFree(bank);
+				free(bank);
+			}
+			for (j = 0 ; j < s->nbMembers ; j++) if (changed[s->member[j]]) logInfo("DSP graph : chain %s reloaded from %s", g->node[s->member[j]].name, files[j]);
+		}
+	}
+}
+
+//Frees the banks handed back by the threads once faded out
+void freeRetired(struct graph *g){
+	struct filterBank	*bank;
+	int					t, k;
+
+	for (t = 0 ; t < g->nbThreads ; t++) {
+		for (k = 0 ; k < g->thread[t].nbSteps ; k++) {
+			if ((bank = __atomic_exchange_n(&g->thread[t].step[k].retired, NULL, __ATOMIC_ACQUIRE)) == NULL) continue;
+			filterFree(bank);
+			free(bank);
+		}
+	}
+}
+
+//Splits a path into its directory and its file name
+static void splitPath(char *path, char *dir, int size, char **name){
+	char *slash = strrchr(path, '/');
+
+	*name = slash != NULL ? slash + 1 : path;
+	if (slash == NULL) snprintf(dir, size, ".");
+	else snprintf(dir, size, "%.*s", slash == path ? 1 : (int) (slash - path), path);
+}
+
+//Watches the preset files of the chains and reloads the banks using them when they change
+//The directories are watched : editors often write a new file and rename it. The files are compiled once they have
+//not changed for GRAPH_SETTLE ms. Runs forever in its own thread, returns -1 if inotify cannot be used
+int graphWatch(struct graph *g){
+	char					buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	char					dirs[GRAPH_MAX_NODES][256], dir[256], *name;
+	int						wds[GRAPH_MAX_NODES];
+	bool					changed[GRAPH_MAX_NODES], pending = false;
+	struct inotify_event	*ev;
+	struct pollfd			p;
+	ssize_t					len;
+	char					*e;
+	int						i, k, nbDirs = 0;
+
+	if ((p.fd = inotify_init1(IN_CLOEXEC)) < 0) {
+		logError("DSP graph : cannot watch the preset files");
+		return -1;
+	}
+	p.events = POLLIN;
+	for (i = 0 ; i < g->nbNodes ; i++) {
+		if (g->node[i].type != NODE_CHAIN || g->node[i].owner < 0 || g->node[i].chainFile == NULL) continue;
+		splitPath(g->node[i].chainFile, dir, sizeof(dir), &name);
+		for (k = 0 ; k < nbDirs && strcmp(dirs[k], dir) != 0 ; k++);
+		if (k < nbDirs) continue;
+		if ((wds[nbDirs] = inotify_add_watch(p.fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO)) < 0) logError("DSP graph : cannot watch %s", dir);
+		else snprintf(dirs[nbDirs++], sizeof(dirs[0]), "%s", dir);
+	}
+	memset(changed, 0, sizeof(changed));
+
+	for (;;) {
+		if (poll(&p, 1, pending ? GRAPH_SETTLE : 1000) > 0) {
+			if ((len = read(p.fd, buf, sizeof(buf))) <= 0) continue;
+			for (e = buf ; e < buf + len ; e += sizeof(struct inotify_event) + ev->len) {
+				ev = (struct inotify_event *) e;
+				if (ev->len == 0) continue;
+				for (k = 0 ; k < nbDirs && wds[k] != ev->wd ; k++);
+				for (i = 0 ; k < nbDirs && i < g->nbNodes ; i++) {
+					if (g->node[i].type != NODE_CHAIN || g->node[i].chainFile == NULL) continue;
+					splitPath(g->node[i].chainFile, dir, sizeof(dir), &name);
+					if (strcmp(dir, dirs[k]) != 0 || strcmp(name, ev->name) != 0) continue;
+					changed[i] = true;
+					pending = true;
+				}
+			}
+			continue;
+		}
+		if (pending) {
+			reloadChains(g, changed);
+			memset(changed, 0, sizeof(changed));
+			pending = false;
+		}
+		freeRetired(g);
+	}
+	return 0;
+}
+
+//Writes the block processed to the sinks of thread t, samples their delays and adjusts the locked ones
+//Returns -1 on a sink error, the other sinks of the thread being written all the same
+int graphWrite(struct graph *g, int t, int frames){
+	struct graphThread	*th = &g->thread[t];
+	struct graphNode	*n;
+	int64_t				start;
+	int					k, status = 0;
+
+	for (k = 0 ; k < th->nbSteps ; k++) {
+		n = &g->node[th->step[k].node];
+		if (th->step[k].type != NODE_SINK) continue;
+		if (sinkWrite(&n->sink, n->pcm, n->pcmFrames) < 0) {
+			status = -1;
+			continue;
+		}
+		sinkTick(&n->sink, frames);
+		__atomic_store_n(&n->deviceDelay, sinkDelay(&n->sink), __ATOMIC_RELAXED);	//Also read by graphBuffered
+		//Time the device will have played the block, back to the first frame of the input : compares with the other
+		//devices whatever block their threads are at. Read by the threads of the outputs following this one
+		__atomic_store_n(&n->startTime, (int64_t) sinkTime(&n->sink) + ((int64_t) n->deviceDelay - (int64_t) n->sink.input) * 1000000000 / g->rate,
+			__ATOMIC_RELAXED);
+		if (n->follow >= 0 && (start = __atomic_load_n(&g->node[n->follow].startTime, __ATOMIC_RELAXED)) != INT64_MIN)
+			driftUpdate(n->drift, (double) (n->startTime - start) * g->rate / 1e9, frames);
+	}
+	return status;
+}
+
+//Copies the outputs of the reader thread used by thread t into the block handed over to it
+void graphExport(struct graph *g, int t, float *data, int frames){
+	struct graphThread	*th = &g->thread[t];
+	struct graphBuf		*src;
+	float				*d;
+	int					i, k, ch;
+
+	for (k = 0 ; k < th->nbImports ; k++) {
+		src = &g->node[th->import[k].node].out;
+		d = data + th->import[k].offset;
+		for (i = 0 ; i < frames ; i++)
+			for (ch = 0 ; ch < GRAPH_CHANNELS ; ch++) d[i * GRAPH_CHANNELS + ch] = src->base[i * src->stride + ch];
+	}
+}
+
+//Points the inputs of thread t read from the reader thread to the block handed over
+void graphImport(struct graph *g, int t, float *data){
+	struct graphThread	*th = &g->thread[t];
+	int					k;
+
+	for (k = 0 ; k < th->nbImports ; k++) th->import[k].buf.base = data + th->import[k].offset;
+}
+
+void graphClose(struct graph *g){
+	int i;
+
+	for (i = 0 ; i < g->nbNodes ; i++) if (g->node[i].type == NODE_SINK && g->node[i].owner >= 0) sinkClose(&g->node[i].sink);
+}
@@ -0,0 +1,138 @@
+#ifndef GRAPH_H
+#define GRAPH_H
+
+#include <stdint.h>
+#include <confuse.h>
+
+#include "filter.h"
+#include "sink.h"
+#include "drift.h"
+#include "fir.h"
+#include "delay.h"
+#include "dither.h"
+#include "meter.h"
+#include "limit.h"
+#include "loudness.h"
+
+#define GRAPH_MAX_NODES		32
+#define GRAPH_MAX_INPUTS	8				/* Inputs of a sum node */
+#define GRAPH_MAX_THREADS	8				/* Reader thread and workers */
+#define GRAPH_MAX_DELAY		1.0				/* Longest delay of a node or an output in s */
+#define GRAPH_CHANNELS		2
+#define GRAPH_INPUT			"in"			/* Name of the input node */
+#define GRAPH_WARMUP		0.25			/* Chains reloaded : s run in the background before fading in */
+#define GRAPH_FADE			0.05			/* Chains reloaded : crossfade in s */
+#define GRAPH_SETTLE		100				/* Chains reloaded : ms without change of the preset files before compiling them */
+#define GRAPH_VOLUME_TIME	0.005			/* Volume : time constant in s of the gain following its target */
+#define GRAPH_MUTE_TIME		0.01			/* Soft mute : raised cosine ramp in s */
+
+enum graphType {NODE_INPUT, NODE_CHAIN, NODE_GAIN, NODE_DELAY, NODE_SUM, NODE_FIR, NODE_SINK, NODE_LIMIT};	//Limit : output nodes only, as the sinks
+
+struct graphBuf {							//Block of stereo frames : left at base[i * stride], right just after
+	float	*base;
+	int		stride;
+};
+
+struct graphNode {
+	char				*name;
+	enum graphType		type;
+	int					nbInputs;
+	int					input[GRAPH_MAX_INPUTS];	//Indices of the input nodes
+	char				*chainFile;			//Chain
+	char				*irFiles[FIR_MAX_FILES];	//FIR : impulse responses
+	int					nbIrFiles;
+	int					partition;			//FIR : frames per partition, 0 : the block
+	struct firFilter	*fir;
+	float				gain;				//Gain, linear
+	double				delay;				//Delay in s
+	double				offset;				//Delay of an output : latency of the filter and of the limiters of the other outputs, in s
+	float				ceiling;			//Limit : linear
+	double				attack;				//Limit : look-ahead in s
+	double				release;			//Limit : time constant in s
+	struct limiter		*limiter;			//Limit
+	char				*sinkSpec;			//Sink
+	int					consumers;			//Nodes reading the output of this one
+	int					owner;				//Thread running the node, -1 : not scheduled (feeds no sink)
+	struct graphBuf		out;				//Output in the owner thread
+	struct sink			sink;
+	int16_t				*pcm;				//Sink : block converted to s16
+	struct dither		dither;				//Sink : conversion to s16
+	struct meter		*meter;				//Sink : levels published, NULL : not measured
+	int					pcmFrames;
+	int					deviceDelay;		//Sink : device delay sampled after the last block, in frames
+	int64_t				startTime;			//Sink : time the device plays the first input frame at its pace, in ns (see sinkTime)
+	double				skew;				//Sink : simulated clock skew in ppm
+	int					follow;				//Sink : output whose device this one is locked to, -1 : none
+	struct drift		*drift;				//Sink : resampler of a locked output, or delay of an output followed
+	struct delayLine	*line;				//Delay
+};
+
+struct graphStep {							//One operation of the schedule of a thread
+	enum graphType		type;
+	int					node;				//Node computed, first of the bank for chains
+	int					nbInputs;
+	struct graphBuf		*in[GRAPH_MAX_INPUTS];	//In the thread running the step
+	struct filterBank	*bank;				//Chains reading the same input, run side by side
+	struct filterBank	*next;				//Chains reloaded, published by graphWatch and taken by the thread of the step
+	struct filterBank	*prev;				//Chains faded out
+	struct filterBank	*retired;			//Chains faded out, handed back to graphWatch to be freed
+	float				*fadeBuf;			//Output of prev
+	int					fade;				//Frames left in the warm up and the crossfade
+	int					nbMembers;
+	int					member[FLT_MAX_CHAINS];
+};
+
+struct graphImport {						//Output of a node of the reader thread used by a worker
+	int					node;
+	int					offset;				//Floats from the start of the block handed over
+	struct graphBuf		buf;				//View in the worker thread
+};
+
+struct graphThread {
+	int					nbSteps;
+	struct graphStep	step[GRAPH_MAX_NODES];
+	int					nbImports;
+	struct graphImport	import[GRAPH_MAX_NODES];
+	int					importFloats;		//Floats per frame handed over to this thread
+	int					nbSinks;
+};
+
+struct graph {
+	int					nbNodes;
+	struct graphNode	node[GRAPH_MAX_NODES];
+	int					order[GRAPH_MAX_NODES];	//Node indices in topological order
+	int					nbThreads;
+	struct graphThread	thread[GRAPH_MAX_THREADS];
+	int					block;
+	int					rate;
+	float				volume;				//Gain of the volume, published by graphSetVolume
+	double				gain;				//Gain applied to the last input frame, following volume sample after sample
+	double				glide;				//Part of the gap to volume closed per frame
+	struct loudness		*loudness;			//Compensation of the input following the volume, NULL : none
+	int					mute;				//Soft mute requested, published by graphSetMute
+	int					muteSeq;			//Incremented by each graphSetMute
+	int					muteSeen;			//Last request taken by the input node
+	bool				muteMarked;			//The last request taken is marked
+	int					ramp;				//Frames of the ramp from silence, rampFrames : unity
+	int					rampFrames;
+	uint64_t			frames;				//Input frames processed since the graph was opened, as sink.input
+	uint64_t			markFrame;			//Input frame the output became silent (mute) or the ramp up started (unmute)
+	int					markSeq;			//Request marked, published after markFrame
+};
+
+int 	graphLoad(struct graph *g, cfg_t *cfg, char *pre, int workers, int rate);
+int 	graphOpen(struct graph *g, int block, int latency, int periods);
+void 	graphSetDelays(struct graph *g, cfg_t *cfg);
+void 	graphSetVolume(struct graph *g, float gain);
+int 	graphSetMute(struct graph *g, int mute);
+int64_t	graphMuteTime(struct graph *g, int seq);
+int 	graphBuffered(struct graph *g);
+int 	graphWatch(struct graph *g);
+void 	graphReset(struct graph *g);
+void 	graphProcess(struct graph *g, int t, int32_t *in, int frames);
+int 	graphWrite(struct graph *g, int t, int frames);
+void 	graphExport(struct graph *g, int t, float *data, int frames);
+void 	graphImport(struct graph *g, int t, float *data);
+void 	graphClose(struct graph *g);
+
+#endif
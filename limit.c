@@ -0,0 +1,267 @@
+/*
+ * limit : look-ahead peak limiter of an output of the DSP engine
+ *
+ * A chain boosting a band (+18 dB at 47 Hz in the pre chain) may drive its output beyond full scale on a loud song :
+ * the sink then clips, the amplifier and the driver get the harmonics. The limiter keeps the output below its ceiling
+ * by lowering the gain before the peak, never after it : the output is delayed by the look-ahead (attack) and the
+ * gain reaches the level the peak needs over the look-ahead, as a linear ramp. The gain comes back with the release
+ * time constant once the peaks are gone.
+ *
+ * The detector takes the peak of each chunk of LIMIT_CHUNK frames (both channels, one vector kernel chosen at run
+ * time as the biquad kernels, see biquad.c), then the max of the chunks of the look-ahead from a monotonic queue :
+ * a few operations per chunk whatever the look-ahead. The gain of each chunk is the ceiling over this max, released
+ * frame by frame, and averaged over the look-ahead by a running sum : each output frame is multiplied by the mean of
+ * the lookahead gains that followed it, all of them low enough for it, so that no sample goes beyond the ceiling.
+ * Below the ceiling for a whole look-ahead, the block is only delayed : the same samples, one copy.
+ *
+ * The latency is the look-ahead, the same whatever the signal : the graph delays the other outputs by as much so that
+ * the drivers stay aligned (see graph.c). The reductions are counted for the log and the stats.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#include "log.h"
+#include "cpu.h"
+#include "limit.h"
+
+#define LIMIT_ALIGN			64
+#define LIMIT_FLOATS		(LIMIT_CHUNK * LIMIT_CHANNELS)
+
+static struct limitKernel	*kernel = NULL;		//Kernel of the limiters set up from now on
+
+//Peak of n interleaved samples
+static float peakOf(const float *x, int n){
+	float	p = 0;
+	int		i;
+
+	for (i = 0 ; i < n ; i++) p = fabsf(x[i]) > p ? fabsf(x[i]) : p;
+	return p;
+}
+
+//Reference implementation
+static void peaksScalar(const float *x, int chunks, float *peak){
+	int j;
+
+	for (j = 0 ; j < chunks ; j++) peak[j] = peakOf(x + j * LIMIT_FLOATS, LIMIT_FLOATS);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2")))
+static void peaksSse2(const float *x, int chunks, float *peak){
+	__m128	sign = _mm_set1_ps(-0.0f), a, b;
+	int		j;
+
+	for (j = 0 ; j < chunks ; j++, x += LIMIT_FLOATS) {
+		a = _mm_max_ps(_mm_andnot_ps(sign, _mm_loadu_ps(x)), _mm_andnot_ps(sign, _mm_loadu_ps(x + 4)));
+		b = _mm_max_ps(_mm_andnot_ps(sign, _mm_loadu_ps(x + 8)), _mm_andnot_ps(sign, _mm_loadu_ps(x + 12)));
+		a = _mm_max_ps(a, b);
+		a = _mm_max_ps(a, _mm_movehl_ps(a, a));
+		a = _mm_max_ss(a, _mm_shuffle_ps(a, a, 1));
+		peak[j] = _mm_cvtss_f32(a);
+	}
+}
+
+__attribute__((target("avx2")))
+static void peaksAvx2(const float *x, int chunks, float *peak){
+	__m256	sign = _mm256_set1_ps(-0.0f), v;
+	__m128	a;
+	int		j;
+
+	for (j = 0 ; j < chunks ; j++, x += LIMIT_FLOATS) {
+		v = _mm256_max_ps(_mm256_andnot_ps(sign, _mm256_loadu_ps(x)), _mm256_andnot_ps(sign, _mm256_loadu_ps(x + 8)));
+		a = _mm_max_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+		a = _mm_max_ps(a, _mm_movehl_ps(a, a));
+		a = _mm_max_ss(a, _mm_shuffle_ps(a, a, 1));
+		peak[j] = _mm_cvtss_f32(a);
+	}
+}
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+static void peaksNeon(const float *x, int chunks, float *peak){
+	float32x4_t	a;
+	float32x2_t	b;
+	int			j;
+
+	for (j = 0 ; j < chunks ; j++, x += LIMIT_FLOATS) {
+		a = vmaxq_f32(vmaxq_f32(vabsq_f32(vld1q_f32(x)), vabsq_f32(vld1q_f32(x + 4))),
+			vmaxq_f32(vabsq_f32(vld1q_f32(x + 8)), vabsq_f32(vld1q_f32(x + 12))));
+		b = vpmax_f32(vget_low_f32(a), vget_high_f32(a));
+		peak[j] = vget_lane_f32(vpmax_f32(b, b), 0);
+	}
+}
+#endif
+
+//Kernels by order of preference, the last supported one is chosen
+struct limitKernel limitKernels[] = {
+	{"scalar",	cpuAlways,	peaksScalar},
+#if defined(__x86_64__) || defined(__i386__)
+	{"sse2",	cpuSse2,	peaksSse2},
+	{"avx2",	cpuAvx2,	peaksAvx2},
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+	{"neon",	cpuNeon,	peaksNeon},
+#endif
+	{NULL}
+};
+
+//Selects the kernel of the limiters set up from now on
+//name : kernel name, NULL or "auto" for the best one the CPU supports
+//Returns NULL if the kernel is unknown or not supported by the CPU
+struct limitKernel *limitSelect(char *name){
+	struct limitKernel *k;
+
+	if ((k = cpuSelect(limitKernels, sizeof(struct limitKernel), name, "Limiter")) == NULL) return NULL;
+	kernel = k;
+	return kernel;
+}
+
+static void *limitAlloc(size_t bytes){
+	void *p;
+
+	if (posix_memalign(&p, LIMIT_ALIGN, bytes > 0 ? bytes : 1) != 0) return NULL;
+	return p;
+}
+
+//Returns the latency of a limiter in frames : its look-ahead, attack in s
+int limitLatency(double attack, int rate){
+	return lrint(attack * rate) > 0 ? lrint(attack * rate) : 1;
+}
+
+//Sets up a limiter, up to block frames per run
+//ceiling : linear, attack : look-ahead in s, release : time constant in s
+//Returns -1 on error
+int limitInit(struct limiter *l, float ceiling, double attack, double release, int rate, int block){
+	memset(l, 0, sizeof(struct limiter));
+	if (kernel == NULL) limitSelect(NULL);
+	l->kernel = kernel;
+	l->ceiling = ceiling;
+	l->lookahead = limitLatency(attack, rate);
+	l->release = 1 - exp(-1 / (release * rate));
+	l->block = block;
+	l->size = l->lookahead + 2;											//Chunks of one frame at least, the look-ahead and the chunk run
+	l->line = limitAlloc((size_t) (l->lookahead + block) * LIMIT_CHANNELS * sizeof(float));
+	l->target = limitAlloc((size_t) (block / LIMIT_CHUNK + 1) * sizeof(float));
+	l->held = limitAlloc((size_t) l->size * sizeof(float));
+	l->heldEnd = limitAlloc((size_t) l->size * sizeof(int64_t));
+	l->box = limitAlloc((size_t) l->lookahead * sizeof(float));
+	if (l->line == NULL || l->target == NULL || l->held == NULL || l->heldEnd == NULL || l->box == NULL) {
+		logError("Limiter : out of memory");
+		limitFree(l);
+		return -1;
+	}
+	l->minGain = 1;
+	limitReset(l);
+	return 0;
+}
+
+//Starts a new stream : silence before it, no gain reduction
+void limitReset(struct limiter *l){
+	int i;
+
+	memset(l->line, 0, (size_t) l->lookahead * LIMIT_CHANNELS * sizeof(float));
+	for (i = 0 ; i < l->lookahead ; i++) l->box[i] = 1;
+	l->boxSum = l->lookahead;
+	l->boxPos = 0;
+	l->gain = 1;
+	l->unity = l->lookahead;
+	l->head = l->count = 0;
+	l->frame = 0;
+}
+
+//Gain of each chunk of the block from the max of the chunks of the look-ahead
+//Returns 1 if none is below unity
+static int targets(struct limiter *l, float *x, int frames){
+	int64_t	start, end;
+	float	p;
+	int		j, chunks = frames / LIMIT_CHUNK, flat = 1;
+
+	l->kernel->peaks(x, chunks, l->target);
+	if (chunks * LIMIT_CHUNK < frames) {								//Block shorter than the others : end of the input
+		l->target[chunks] = peakOf(x + chunks * LIMIT_FLOATS, (frames - chunks * LIMIT_CHUNK) * LIMIT_CHANNELS);
+		chunks++;
+	}
+	for (j = 0 ; j < chunks ; j++) {
+		start = l->frame + j * LIMIT_CHUNK;
+		end = start + LIMIT_CHUNK < l->frame + frames ? start + LIMIT_CHUNK - 1 : l->frame + frames - 1;
+		p = l->target[j];
+		while (l->count > 0 && l->heldEnd[l->head] < start - l->lookahead) {	//Out of the look-ahead of the chunk
+			l->head = l->head + 1 == l->size ? 0 : l->head + 1;
+			l->count--;
+		}
+		while (l->count > 0 && l->held[(l->head + l->count - 1) % l->size] <= p) l->count--;	//Never the max again
+		l->held[(l->head + l->count) % l->size] = p;
+		l->heldEnd[(l->head + l->count) % l->size] = end;
+		l->count++;
+		p = l->held[l->head];
+		l->target[j] = p > l->ceiling ? l->ceiling / p : 1;
+		flat &= l->target[j] == 1;
+	}
+	return flat;
+}
+
+//Limits a block of interleaved stereo at in[i * inStride], written delayed by the look-ahead to out[i * outStride]
+//in and out may be the same buffer
+void limitRun(struct limiter *l, float *in, int inStride, float *out, int outStride, int frames){
+	float		*x = l->line + l->lookahead * LIMIT_CHANNELS, h, g, minGain = l->minGain;
+	double		scale = 1.0 / l->lookahead;
+	uint64_t	events = l->events, limited = l->limited;
+	int			i;
+
+	for (i = 0 ; i < frames ; i++) {
+		x[i * 2] = in[i * inStride];
+		x[i * 2 + 1] = in[i * inStride + 1];
+	}
+	if (targets(l, x, frames) && l->unity == l->lookahead) {			//Unity gain over the look-ahead : only delayed
+		for (i = 0 ; i < frames ; i++) {
+			out[i * outStride] = l->line[i * 2];
+			out[i * outStride + 1] = l->line[i * 2 + 1];
+		}
+	} else {
+		for (i = 0 ; i < frames ; i++) {
+			h = l->target[i / LIMIT_CHUNK];
+			if (h < l->gain) {											//Down at once, the ramp is the mean
+				events += l->gain == 1;
+				l->gain = h;
+			} else if (h == 1 && 1 - l->gain < LIMIT_UNITY) l->gain = 1;
+			else {
+				l->gain += (h - l->gain) * l->release;
+				if (l->gain > h) l->gain = h;
+			}
+			l->unity = l->gain < 1 ? 0 : l->unity + (l->unity < l->lookahead);
+			l->boxSum += l->gain - l->box[l->boxPos];
+			l->box[l->boxPos] = l->gain;
+			l->boxPos = l->boxPos + 1 == l->lookahead ? 0 : l->boxPos + 1;
+			if (l->unity == l->lookahead) l->boxSum = l->lookahead;		//All ones : no rounding left in the sum
+			g = l->boxSum * scale;
+			if (g < 1 - LIMIT_UNITY) {
+				limited++;
+				if (g < minGain) minGain = g;
+			}
+			out[i * outStride] = l->line[i * 2] * g;
+			out[i * outStride + 1] = l->line[i * 2 + 1] * g;
+		}
+	}
+	__atomic_store_n(&l->events, events, __ATOMIC_RELAXED);					//Read by the log and the stats
+	__atomic_store_n(&l->limited, limited, __ATOMIC_RELAXED);
+	__atomic_store(&l->minGain, &minGain, __ATOMIC_RELAXED);
+	memmove(l->line, l->line + frames * LIMIT_CHANNELS, (size_t) l->lookahead * LIMIT_CHANNELS * sizeof(float));
+	l->frame += frames;
+}
+
+void limitFree(struct limiter *l){
+	free(l->line); free(l->target);
+	free(l->held); free(l->heldEnd);
+	free(l->box);
+	l->line = l->target = l->held = l->box = NULL;
+	l->heldEnd = NULL;
+}
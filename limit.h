@@ -0,0 +1,51 @@
+#ifndef LIMIT_H
+#define LIMIT_H
+
+#include <stdint.h>
+
+#define LIMIT_CHANNELS		2
+#define LIMIT_CHUNK			8				/* Frames of each peak of the detector */
+#define LIMIT_ATTACK		5.0				/* Look-ahead in ms, default */
+#define LIMIT_MAX_ATTACK	20.0
+#define LIMIT_RELEASE		100.0			/* Release time constant in ms, default */
+#define LIMIT_UNITY			1e-6			/* Gain reduction below which the gain is back at unity */
+
+struct limitKernel {						//One implementation of the peaks of the detector
+	char	*name;							//First fields : those of struct cpuKernel (cpu.h)
+	int		(*supported)(void);				//Runtime CPU detection
+	void	(*peaks)(const float *x, int chunks, float *peak);	//Interleaved stereo, peak[j] : max |x| of chunk j
+};
+
+struct limiter {							//Look-ahead peak limiter of one output, keeping it below its ceiling
+	struct limitKernel	*kernel;
+	float				ceiling;			//Linear
+	int					lookahead;			//Frames : attack, latency and length of the gain smoothing
+	int					block;
+	double				release;			//Part of the gap to the target closed per frame when the gain rises
+	float				*line;				//lookahead frames of history then the block, interleaved stereo
+	float				*target;			//Gain of each chunk of the block, from the peaks
+	float				*held;				//Peaks of the chunks of the look-ahead, decreasing from head : max first
+	int64_t				*heldEnd;			//Last frame of each chunk held
+	int					size;				//Ring of the queue
+	int					head, count;
+	int64_t				frame;				//Frames since the reset
+	float				*box;				//Last lookahead gains, averaged : ramps of lookahead frames
+	int					boxPos;
+	double				boxSum;
+	double				gain;				//Target after the release, in double : the release steps are below the rounding of a float near 1
+	int					unity;				//Frames since the gain was last below unity, up to lookahead
+	uint64_t			events;				//Gain reductions started, since the start
+	uint64_t			limited;			//Frames with a gain reduction
+	float				minGain;			//Deepest reduction
+};
+
+extern struct limitKernel limitKernels[];	// All the kernels built in, the scalar reference first, NULL name at the end
+
+struct limitKernel *limitSelect(char *name);
+int 	limitLatency(double attack, int rate);
+int 	limitInit(struct limiter *l, float ceiling, double attack, double release, int rate, int block);
+void 	limitReset(struct limiter *l);
+void 	limitRun(struct limiter *l, float *in, int inStride, float *out, int outStride, int frames);
+void 	limitFree(struct limiter *l);
+
+#endif
@@ -0,0 +1,187 @@
+/*
+ * limitBench : checks the look-ahead limiter of the outputs and measures its CPU
+ *
+ * Check : the peaks of each kernel the CPU supports must be the ones of the scalar reference, exactly. Then with each
+ * kernel, blocks of several sizes and a short last block :
+ *   - below the ceiling, the output is the input delayed by the look-ahead, the same samples ;
+ *   - an impulse at the ceiling comes out after exactly the look-ahead, unchanged ;
+ *   - a 47 Hz tone boosted by 18 dB, noise with bursts up to +18 dB and full scale square waves never go beyond the
+ *     ceiling, and the gain comes back to unity after the release once the signal is below it again.
+ * Benchmark : ns per stereo frame of each kernel below the ceiling (delay only) and while limiting, and the CPU load.
+ * The exit status is 1 if a check fails.
+ *
+ * Usage : limitBench [-t seconds per measure] [-c check only]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+
+#include "log.h"
+#include "limit.h"
+
+#define BENCH_RATE		44100
+#define BENCH_BLOCK		1024
+#define BENCH_TIME		0.2
+#define BENCH_CEILING	0.891		/* -1 dBFS */
+#define BENCH_FRAMES	(4 * BENCH_RATE)
+
+static int blocks[] = {1024, 37, 3, 512, 8, 1000, 0};
+
+//Limits frames of in to out with kernel k in blocks of varied sizes, the last one shorter
+//Returns the frame where the gain is back at unity for good, -1 if it never was
+int limit(struct limitKernel *k, float *in, float *out, int frames, struct limiter *l){
+	int i, j, n, back = -1;
+
+	limitSelect(k->name);
+	if (limitInit(l, BENCH_CEILING, LIMIT_ATTACK * 1e-3, LIMIT_RELEASE * 1e-3, BENCH_RATE, BENCH_BLOCK) < 0) return -1;
+	for (i = 0, j = 0 ; i < frames ; i += n, j++) {
+		n = blocks[j % 6] < frames - i ? blocks[j % 6] : frames - i;
+		limitRun(l, in + i * 2, 2, out + i * 2, 2, n);
+		if (l->gain < 1) back = -1;
+		else if (back < 0) back = i + n;
+	}
+	return back;
+}
+
+//Compares the peaks of each kernel with the scalar ones, returns the number of kernels failing
+int checkPeaks(){
+	struct limitKernel	*k;
+	float				x[BENCH_BLOCK * 2], ref[BENCH_BLOCK / LIMIT_CHUNK], peak[BENCH_BLOCK / LIMIT_CHUNK];
+	int					i, failed = 0, diff;
+
+	for (i = 0 ; i < BENCH_BLOCK * 2 ; i++) x[i] = (drand48() - 0.5) * pow(10, drand48() * 4 - 3);
+	x[77] = -4;																//Negative peak
+	limitKernels[0].peaks(x, BENCH_BLOCK / LIMIT_CHUNK, ref);
+	printf("Check of the peaks against the scalar kernel\n");
+	for (k = limitKernels + 1 ; k->name != NULL ; k++) {
+		if (!k->supported()) {
+			printf("  %-8s not supported by this CPU\n", k->name);
+			continue;
+		}
+		k->peaks(x, BENCH_BLOCK / LIMIT_CHUNK, peak);
+		for (diff = 0, i = 0 ; i < BENCH_BLOCK / LIMIT_CHUNK ; i++) diff += peak[i] != ref[i];
+		printf("  %-8s %i chunks differing %s\n", k->name, diff, diff > 0 ? "FAILED" : "ok");
+		failed += diff > 0;
+	}
+	return failed;
+}
+
+//Signals of the check, interleaved stereo
+//Returns the number of frames at the end below the ceiling
+int signal(int s, float *x){
+	int i, n, quiet = 2 * BENCH_RATE;
+
+	for (i = 0 ; i < BENCH_FRAMES ; i++) {
+		switch (s) {
+			case 0 : x[i * 2] = 7.94 * BENCH_CEILING * sin(2 * M_PI * 47 * i / BENCH_RATE); break;	//+18 dB
+			case 1 : x[i * 2] = (drand48() - 0.5) * ((i / 2000) % 3 == 0 ? 2 * 7.94 : 1.5); break;	//Bursts
+			default : x[i * 2] = (i / 100) % 2 ? 1 : -1; break;
+		}
+		x[i * 2 + 1] = s == 2 ? -x[i * 2] : x[i * 2] * 0.5;
+	}
+	for (n = BENCH_FRAMES - quiet, i = n ; i < BENCH_FRAMES ; i++) {		//Below the ceiling again
+		x[i * 2] *= BENCH_CEILING / 8;
+		x[i * 2 + 1] *= BENCH_CEILING / 8;
+	}
+	return quiet;
+}
+
+//Checks the delay, the ceiling and the release with kernel k, returns 1 if it fails
+int checkKernel(struct limitKernel *k){
+	static char		*names[] = {"47 Hz +18 dB", "bursts +18 dB", "square 0 dBFS"};
+	struct limiter	l;
+	float			*x = malloc(BENCH_FRAMES * 2 * sizeof(float)), *y = malloc(BENCH_FRAMES * 2 * sizeof(float)), peak;
+	int				i, s, a, back, quiet, diff, failed = 0;
+
+	for (i = 0 ; i < BENCH_FRAMES * 2 ; i++) x[i] = (drand48() - 0.5) * BENCH_CEILING * 2;
+	limit(k, x, y, BENCH_FRAMES, &l);
+	a = l.lookahead;
+	for (diff = 0, i = 0 ; i < BENCH_FRAMES * 2 ; i++) diff += y[i] != (i < a * 2 ? 0 : x[i - a * 2]);
+	printf("  %-8s noise below the ceiling : %i samples not delayed by %i frames %s\n", k->name, diff, a, diff > 0 ? "FAILED" : "ok");
+	failed |= diff > 0;
+	limitFree(&l);
+
+	memset(x, 0, BENCH_FRAMES * 2 * sizeof(float));
+	x[1000 * 2] = BENCH_CEILING;
+	x[1000 * 2 + 1] = -BENCH_CEILING;
+	limit(k, x, y, BENCH_FRAMES, &l);
+	for (diff = 0, i = 0 ; i < BENCH_FRAMES * 2 ; i++) diff += y[i] != (i < a * 2 ? 0 : x[i - a * 2]);
+	printf("  %-8s impulse at the ceiling : %s after %i frames %s\n", k->name, diff > 0 ? "changed" : "same", a, diff > 0 ? "FAILED" : "ok");
+	failed |= diff > 0;
+	limitFree(&l);
+
+	for (s = 0 ; s < 3 ; s++) {
+		quiet = signal(s, x);
+		back = limit(k, x, y, BENCH_FRAMES, &l);
+		for (peak = 0, i = 0 ; i < BENCH_FRAMES * 2 ; i++) peak = fabsf(y[i]) > peak ? fabsf(y[i]) : peak;
+		//Back at unity within a look-ahead and 15 time constants of the release from the quiet end
+		back = back < 0 ? -1 : back - (BENCH_FRAMES - quiet);
+		printf("  %-8s %-14s : peak %+.4f dB of the ceiling, %llu reductions, max %.1f dB, unity after %.0f ms %s\n", k->name, names[s],
+			20 * log10(peak / BENCH_CEILING), (unsigned long long) l.events, -20 * log10(l.minGain), back * 1e3 / BENCH_RATE,
+			peak > BENCH_CEILING * (1 + 1e-6) || back < 0 || back > a + 15 * LIMIT_RELEASE * 1e-3 * BENCH_RATE ? "FAILED" : "ok");
+		failed |= peak > BENCH_CEILING * (1 + 1e-6) || back < 0 || back > a + 15 * LIMIT_RELEASE * 1e-3 * BENCH_RATE;
+		limitFree(&l);
+	}
+	free(x); free(y);
+	return failed;
+}
+
+//Returns ns per stereo frame, limiting or not
+double measure(struct limitKernel *k, bool limiting, double seconds){
+	struct limiter	l;
+	struct timespec	t0, t1;
+	float			*x = malloc(BENCH_BLOCK * 2 * sizeof(float)), *y = malloc(BENCH_BLOCK * 2 * sizeof(float));
+	double			elapsed;
+	long			frames = 0;
+	int				i;
+
+	for (i = 0 ; i < BENCH_BLOCK * 2 ; i++) x[i] = (drand48() - 0.5) * (limiting ? 4 : 1);
+	limitSelect(k->name);
+	limitInit(&l, BENCH_CEILING, LIMIT_ATTACK * 1e-3, LIMIT_RELEASE * 1e-3, BENCH_RATE, BENCH_BLOCK);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	do {
+		for (i = 0 ; i < 16 ; i++, frames += BENCH_BLOCK) limitRun(&l, x, 2, y, 2, BENCH_BLOCK);
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	} while (elapsed < seconds);
+	limitFree(&l);
+	free(x); free(y);
+	return elapsed * 1e9 / frames;
+}
+
+int main(int argc, char *argv[]){
+	struct limitKernel	*k;
+	double				seconds = BENCH_TIME, ns;
+	bool				checkOnly = false;
+	int					opt, i, status = 0;
+
+	while ((opt = getopt(argc, argv, "t:c")) != -1) {
+		switch (opt) {
+			case 't': seconds = atof(optarg); break;
+			case 'c': checkOnly = true; break;
+			default:
+				fprintf(stderr, "Usage : %s [-t seconds per measure] [-c]\n", argv[0]);
+				return 1;
+		}
+	}
+	srand48(1);
+
+	if (checkPeaks() > 0) status = 1;
+	printf("\nCheck of the limiter, ceiling %.1f dBFS, attack %.0f ms, release %.0f ms\n", 20 * log10(BENCH_CEILING), LIMIT_ATTACK, LIMIT_RELEASE);
+	for (k = limitKernels ; k->name != NULL ; k++) if (k->supported()) status |= checkKernel(k);
+	if (checkOnly) return status;
+
+	printf("\nns per stereo frame, CPU load at %i Hz in %% of one core, blocks of %i frames\n", BENCH_RATE, BENCH_BLOCK);
+	for (k = limitKernels ; k->name != NULL ; k++) {
+		if (!k->supported()) continue;
+		for (i = 0 ; i < 2 ; i++) {
+			ns = measure(k, i == 1, seconds);
+			printf("  %-8s %-8s : %6.2f ns, %.3f %%\n", k->name, i == 1 ? "limiting" : "below", ns, ns * BENCH_RATE * 1e-7);
+		}
+	}
+	return status;
+}
@@ -7,6 +7,7 @@
 #include <zlib.h>
 #include <limits.h> /* for PATH_MAX */
 #include "log.h"
+#include "rtcheck.h"
 
 char log_tags[3][20] = {"Error", "Info", "Debug"};
 static int verboseLevel = LOG_ERROR;
@@ -20,6 +21,7 @@ void rotateLog(char *s);
 void log_format(const int level, const char* message, va_list args) {   
 	time_t now;
 
+	RT_CHECK("log");
 	if (level > verboseLevel) return;
 	if (fp == NULL) setLogFile(NULL);
 	
@@ -0,0 +1,134 @@
+/*
+ * loudness : equal-loudness compensation of the input of the DSP engine, following the volume
+ *
+ * The ear loses the bass, and a little of the treble, faster than the midrange as the level goes down : the chains
+ * tuned at a normal level sound thin when the volume is low. With dspLoudness, the input goes through a low shelf
+ * (LOUDNESS_LOW) and a high shelf (LOUDNESS_HIGH) after the volume, boosting dspLoudness dB and LOUDNESS_TREBLE of it
+ * at the bottom of the volume range, and less as the volume rises up to the reference step, where they are flat.
+ *
+ * Both shelves are designed for each of the LOUDNESS_STEPS volume steps when the engine loads : the audio thread never
+ * designs a filter. At each block it takes the step of the gain the volume has glided to (see graph.c), interpolates
+ * the coefficients of the two steps around it, and moves the coefficients linearly from the ones of the last block to
+ * these ones over the block : the boost follows the volume as smoothly as the volume itself, without zipper noise.
+ * The filters run in double, on the interleaved stereo block in place. At or above the reference step, once what the
+ * boost left in the filters has died out, the block is left as it is.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "log.h"
+#include "loudness.h"
+
+//Designs a shelf of gain dB, slope 1 (RBJ cookbook), high : high shelf at LOUDNESS_HIGH, low shelf at LOUDNESS_LOW otherwise
+//At 0 dB the zeros cancel the poles : kept as they are, the coefficients interpolate with the ones of the steps below
+void loudnessShelf(struct loudnessCoefs *c, bool high, double gain, int rate){
+	double	a = pow(10, gain / 40), w = 2 * M_PI * (high ? LOUDNESS_HIGH : LOUDNESS_LOW) / rate, cs = cos(w);
+	double	q = 2 * sqrt(a) * sin(w) / 2 * M_SQRT2, s = high ? -1 : 1, a0;
+
+	a0 = (a + 1) + s * (a - 1) * cs + q;
+	c->h[0] = a * ((a + 1) - s * (a - 1) * cs + q) / a0;
+	c->h[1] = 2 * s * a * ((a - 1) - s * (a + 1) * cs) / a0;
+	c->h[2] = a * ((a + 1) - s * (a - 1) * cs - q) / a0;
+	c->h[3] = -2 * s * ((a - 1) + s * (a + 1) * cs) / a0;
+	c->h[4] = ((a + 1) + s * (a - 1) * cs - q) / a0;
+}
+
+//Returns the boost of the low shelf in dB at a volume step
+double loudnessBoost(struct loudness *l, double step){
+	return step >= l->reference ? 0 : l->boost * (l->reference - step) / l->reference;
+}
+
+//Returns the volume step of a gain, linear : the inverse of dspSetVolume
+double loudnessStep(struct loudness *l, double gain){
+	double step = gain > 0 ? LOUDNESS_STEPS * (1 + 20 * log10(gain) / l->range) : 0;
+
+	return step < 0 ? 0 : step > LOUDNESS_STEPS ? LOUDNESS_STEPS : step;
+}
+
+//Coefficients of both shelves at a step, interpolated between the two steps around it
+static void interpolate(struct loudness *l, double step, struct loudnessCoefs *c){
+	int		i = floor(step), k, j;
+	double	f = step - i;
+
+	if (i >= LOUDNESS_STEPS) {
+		i = LOUDNESS_STEPS - 1;
+		f = 1;
+	}
+	for (k = 0 ; k < 2 ; k++)
+		for (j = 0 ; j < 5 ; j++) c[k].h[j] = l->table[i][k].h[j] + (l->table[i + 1][k].h[j] - l->table[i][k].h[j]) * f;
+}
+
+//Designs the shelves of each volume step
+//boost : dB of the low shelf at step 0, reference : step from which the shelves are flat, range : dB of the volume
+//Returns -1 if the options are invalid
+int loudnessInit(struct loudness *l, int boost, int reference, int range, int rate){
+	int step;
+
+	memset(l, 0, sizeof(struct loudness));
+	if (boost <= 0 || boost > LOUDNESS_MAX || reference <= 0 || reference > LOUDNESS_STEPS || range <= 0) {
+		logError("DSP loudness : boost of %i dB out of 1..%i, reference step %i out of 1..%i, or no volume in the engine",
+			boost, LOUDNESS_MAX, reference, LOUDNESS_STEPS);
+		return -1;
+	}
+	l->boost = boost;
+	l->reference = reference;
+	l->range = range;
+	for (step = 0 ; step <= LOUDNESS_STEPS ; step++) {
+		loudnessShelf(&l->table[step][0], false, loudnessBoost(l, step), rate);
+		loudnessShelf(&l->table[step][1], true, loudnessBoost(l, step) * LOUDNESS_TREBLE, rate);
+	}
+	loudnessReset(l, 1);
+	logInfo("DSP loudness : +%i dB at %.0f Hz and +%.1f dB at %.0f Hz at the bottom of the volume, flat from step %i (%i dB)",
+		boost, LOUDNESS_LOW, boost * LOUDNESS_TREBLE, LOUDNESS_HIGH, reference, (reference - LOUDNESS_STEPS) * range / LOUDNESS_STEPS);
+	return 0;
+}
+
+//Starts a new stream at the gain of the volume, without ramp
+void loudnessReset(struct loudness *l, double gain){
+	memset(l->s, 0, sizeof(l->s));
+	l->pos = loudnessStep(l, gain);
+	interpolate(l, l->pos, l->cur);
+	l->flat = l->pos >= l->reference;
+}
+
+//Compensates a block of interleaved stereo in place, gain : gain the volume has reached at the end of the block
+void loudnessRun(struct loudness *l, float *x, int frames, double gain){
+	struct loudnessCoefs	to[2], d[2], *c = l->cur;
+	double					pos = loudnessStep(l, gain), v, y;
+	bool					ramp = pos != l->pos;
+	int						i, k, j, ch;
+
+	if (!ramp && l->flat) return;
+	if (ramp) {															//From the coefficients of the last block to these ones
+		interpolate(l, pos, to);
+		for (k = 0 ; k < 2 ; k++)
+			for (j = 0 ; j < 5 ; j++) d[k].h[j] = (to[k].h[j] - c[k].h[j]) / frames;
+	}
+	for (i = 0 ; i < frames ; i++) {
+		for (k = 0 ; ramp && k < 2 ; k++) for (j = 0 ; j < 5 ; j++) c[k].h[j] += d[k].h[j];
+		for (ch = 0 ; ch < LOUDNESS_CHANNELS ; ch++) {
+			v = x[i * LOUDNESS_CHANNELS + ch];
+			for (k = 0 ; k < 2 ; k++) {										//Low then high shelf, rounded once to float
+				y = c[k].h[0] * v + l->s[k][ch][0];
+				l->s[k][ch][0] = c[k].h[1] * v - c[k].h[3] * y + l->s[k][ch][1];
+				l->s[k][ch][1] = c[k].h[2] * v - c[k].h[4] * y;
+				v = y;
+			}
+			x[i * LOUDNESS_CHANNELS + ch] = v;
+		}
+	}
+	if (ramp) {
+		l->cur[0] = to[0];													//No rounding left from the ramp
+		l->cur[1] = to[1];
+		l->pos = pos;
+		l->flat = false;
+	}
+	if (l->pos < l->reference) return;
+	for (k = 0 ; k < 2 ; k++)												//Flat once what the boost left has died out
+		for (ch = 0 ; ch < LOUDNESS_CHANNELS ; ch++)
+			if (fabs(l->s[k][ch][0]) > LOUDNESS_TAIL || fabs(l->s[k][ch][1]) > LOUDNESS_TAIL) return;
+	memset(l->s, 0, sizeof(l->s));
+	l->flat = true;
+}
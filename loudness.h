@@ -0,0 +1,36 @@
+#ifndef LOUDNESS_H
+#define LOUDNESS_H
+
+#include <stdbool.h>
+
+#define LOUDNESS_CHANNELS	2
+#define LOUDNESS_STEPS		100				/* Volume steps, as mpd : one set of coefficients per step */
+#define LOUDNESS_LOW		100.0			/* Hz, low shelf */
+#define LOUDNESS_HIGH		10000.0			/* Hz, high shelf */
+#define LOUDNESS_TREBLE		0.4				/* Boost of the high shelf, part of the one of the low shelf */
+#define LOUDNESS_MAX		18				/* dB, largest boost of the low shelf */
+#define LOUDNESS_TAIL		1e-7			/* State of the shelves under which the block is left as it is at the reference */
+
+struct loudnessCoefs {						//One shelf, transposed direct form II
+	double	h[5];							//b0 b1 b2 a1 a2, a0 = 1
+};
+
+struct loudness {							//Equal-loudness compensation of the input, following the volume
+	int						boost;			//dB of the low shelf at step 0
+	int						reference;		//Step of the level the chains are tuned at : no boost from this step up
+	int						range;			//dB of the volume from step LOUDNESS_STEPS to step 0
+	struct loudnessCoefs	table[LOUDNESS_STEPS + 1][2];	//Low and high shelf of each step, designed at load time
+	double					pos;			//Step of the coefficients at the end of the last block
+	struct loudnessCoefs	cur[2];			//Coefficients at the end of the last block
+	bool					flat;			//No boost and no state left : the block is left as it is
+	double					s[2][LOUDNESS_CHANNELS][2];	//State of each shelf and channel
+};
+
+void 	loudnessShelf(struct loudnessCoefs *c, bool high, double gain, int rate);
+int 	loudnessInit(struct loudness *l, int boost, int reference, int range, int rate);
+void 	loudnessReset(struct loudness *l, double gain);
+double 	loudnessStep(struct loudness *l, double gain);
+void 	loudnessRun(struct loudness *l, float *x, int frames, double gain);
+double 	loudnessBoost(struct loudness *l, double step);
+
+#endif
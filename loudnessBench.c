@@ -0,0 +1,169 @@
+/*
+ * loudnessBench : checks the loudness compensation of the DSP input and measures its CPU
+ *
+ * Check : the shelves interpolated between two volume steps must be stable and within BENCH_TOLERANCE dB of the ones
+ * designed for the step in between, from 20 Hz to 20 kHz. Then a 50 Hz tone goes through the compensation while the
+ * volume jumps between low and high steps, gliding as in the engine : the clicks of the coefficients changing (zipper
+ * noise) are measured above 2 kHz, where the tone has no energy, and must stay below BENCH_ZIPPER dB of the tone. The
+ * tone is not scaled by the volume, whose glide has its own sidebands, and its start is left out. The same with the
+ * coefficients switched at once at each block, as a filter designed per block would, is printed beside.
+ * Benchmark : ns per stereo frame at a steady volume and while the volume glides, and the CPU load.
+ * The exit status is 1 if a check fails.
+ *
+ * Usage : loudnessBench [-t seconds per measure] [-c check only]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <math.h>
+#include <complex.h>
+#include <time.h>
+
+#include "log.h"
+#include "loudness.h"
+
+#define BENCH_RATE			44100
+#define BENCH_BLOCK			1024
+#define BENCH_TIME			0.2
+#define BENCH_BOOST			15			/* dB at the bottom of the volume */
+#define BENCH_RANGE			60			/* dB of the volume, dspVolume */
+#define BENCH_GLIDE			0.005		/* s, time constant of the volume, as GRAPH_VOLUME_TIME */
+#define BENCH_TOLERANCE		0.01		/* dB, interpolated shelves against the designed ones */
+#define BENCH_ZIPPER		-100			/* dB, noise of the coefficients changing against the tone */
+
+static int steps[] = {20, 80, 5, 95, 40, 60, 0};
+
+//Response of a shelf at f Hz
+double complex response(struct loudnessCoefs *c, double f){
+	double complex z = cexp(-I * 2 * M_PI * f / BENCH_RATE);
+
+	return (c->h[0] + c->h[1] * z + c->h[2] * z * z) / (1 + c->h[3] * z + c->h[4] * z * z);
+}
+
+//Compares the shelves half way between the steps with the ones designed there, returns 1 if they differ or are unstable
+int checkTable(struct loudness *l){
+	struct loudnessCoefs	c[2], ref;
+	double					f, d, err = 0, pos;
+	int						step, k, unstable = 0;
+
+	for (step = 0 ; step < LOUDNESS_STEPS ; step++) {
+		pos = step + 0.5;
+		loudnessReset(l, pow(10, (pos - LOUDNESS_STEPS) * BENCH_RANGE / (20.0 * LOUDNESS_STEPS)));
+		memcpy(c, l->cur, sizeof(c));
+		for (k = 0 ; k < 2 ; k++) {
+			loudnessShelf(&ref, k == 1, loudnessBoost(l, pos) * (k == 1 ? LOUDNESS_TREBLE : 1), BENCH_RATE);
+			unstable += fabs(c[k].h[4]) >= 1 || fabs(c[k].h[3]) >= 1 + c[k].h[4];
+			for (f = 20 ; f < 20001 ; f *= pow(2, 1 / 12.0)) {
+				d = fabs(20 * log10(cabs(response(&c[k], f)) / cabs(response(&ref, f))));
+				err = d > err ? d : err;
+			}
+		}
+	}
+	printf("Shelves interpolated half way between the steps : max deviation %.4f dB, %i unstable %s\n", err, unstable,
+		err > BENCH_TOLERANCE || unstable > 0 ? "FAILED" : "ok");
+	return err > BENCH_TOLERANCE || unstable > 0;
+}
+
+//Runs a 50 Hz tone through the compensation while the volume jumps between steps, gliding frame by frame
+//switched : the coefficients of each block are taken at once, without ramp
+//Returns the level of what the output has above 2 kHz, in dB of the tone
+double zipper(struct loudness *l, bool switched){
+	struct loudnessCoefs	hp;
+	double					gain = 1, volume, glide = 1 - exp(-1 / (BENCH_GLIDE * BENCH_RATE)), w = 2 * M_PI * 2000 / BENCH_RATE;
+	double					s[2][2] = {{0}}, y, v, sum = 0, tone = 0, alpha = sin(w) / (2 * M_SQRT1_2), a0 = 1 + alpha;
+	double					state[2][LOUDNESS_CHANNELS][2];
+	float					x[BENCH_BLOCK * 2];
+	long					n = 0;
+	int						b, i, j, k;
+
+	hp.h[0] = (1 + cos(w)) / 2 / a0;										//Butterworth high pass at 2 kHz, run twice
+	hp.h[1] = -(1 + cos(w)) / a0;
+	hp.h[2] = hp.h[0];
+	hp.h[3] = -2 * cos(w) / a0;
+	hp.h[4] = (1 - alpha) / a0;
+	loudnessReset(l, 1);
+	for (j = 0 ; steps[j] != 0 ; j++) {
+		volume = pow(10, (steps[j] - LOUDNESS_STEPS) * BENCH_RANGE / (20.0 * LOUDNESS_STEPS));
+		for (b = 0 ; b < BENCH_RATE / 2 / BENCH_BLOCK ; b++) {
+			for (i = 0 ; i < BENCH_BLOCK ; i++, n++) {
+				gain += (volume - gain) * glide;
+				x[i * 2] = x[i * 2 + 1] = 0.1 * sin(2 * M_PI * 50 * n / BENCH_RATE);
+			}
+			if (switched) {														//Coefficients of the block at once, state kept
+				memcpy(state, l->s, sizeof(state));
+				loudnessReset(l, gain);
+				memcpy(l->s, state, sizeof(state));
+			}
+			loudnessRun(l, x, BENCH_BLOCK, gain);
+			for (i = 0 ; i < BENCH_BLOCK ; i++) {
+				if (j > 0) tone += (double) x[i * 2] * x[i * 2];
+				for (v = x[i * 2], k = 0 ; k < 2 ; k++) {
+					y = hp.h[0] * v + s[k][0];
+					s[k][0] = hp.h[1] * v - hp.h[3] * y + s[k][1];
+					s[k][1] = hp.h[2] * v - hp.h[4] * y;
+					v = y;
+				}
+				if (j > 0) sum += v * v;
+			}
+		}
+	}
+	return 10 * log10(sum / tone + 1e-30);
+}
+
+//Returns ns per stereo frame, at a steady volume or gliding
+double measure(struct loudness *l, bool gliding, double seconds){
+	struct timespec	t0, t1;
+	float			*x = malloc(BENCH_BLOCK * 2 * sizeof(float));
+	double			elapsed, gain = 0.1;
+	long			frames = 0;
+	int				i;
+
+	for (i = 0 ; i < BENCH_BLOCK * 2 ; i++) x[i] = (drand48() - 0.5) * 0.1;
+	loudnessReset(l, gain);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	do {
+		for (i = 0 ; i < 16 ; i++, frames += BENCH_BLOCK) {
+			if (gliding) gain = gain > 0.5 ? 0.01 : gain * 1.1;
+			loudnessRun(l, x, BENCH_BLOCK, gain);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	} while (elapsed < seconds);
+	free(x);
+	return elapsed * 1e9 / frames;
+}
+
+int main(int argc, char *argv[]){
+	struct loudness	l;
+	double			seconds = BENCH_TIME, ns, z;
+	bool			checkOnly = false;
+	int				opt, i, status = 0;
+
+	while ((opt = getopt(argc, argv, "t:c")) != -1) {
+		switch (opt) {
+			case 't': seconds = atof(optarg); break;
+			case 'c': checkOnly = true; break;
+			default:
+				fprintf(stderr, "Usage : %s [-t seconds per measure] [-c]\n", argv[0]);
+				return 1;
+		}
+	}
+	srand48(1);
+	if (loudnessInit(&l, BENCH_BOOST, LOUDNESS_STEPS, BENCH_RANGE, BENCH_RATE) < 0) return 1;
+
+	status |= checkTable(&l);
+	z = zipper(&l, false);
+	printf("Zipper noise of a 50 Hz tone, volume jumping between steps : %.1f dB, %.1f dB with the coefficients switched per block %s\n",
+		z, zipper(&l, true), z > BENCH_ZIPPER ? "FAILED" : "ok");
+	status |= z > BENCH_ZIPPER;
+	if (checkOnly) return status;
+
+	printf("\nns per stereo frame, CPU load at %i Hz in %% of one core, blocks of %i frames\n", BENCH_RATE, BENCH_BLOCK);
+	for (i = 0 ; i < 2 ; i++) {
+		ns = measure(&l, i == 1, seconds);
+		printf("  %-8s : %6.2f ns, %.3f %%\n", i == 1 ? "gliding" : "steady", ns, ns * BENCH_RATE * 1e-7);
+	}
+	return status;
+}
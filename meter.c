@@ -0,0 +1,208 @@
+/*
+ * meter : levels and spectrum of the outputs of the DSP engine, published in shared memory
+ *
+ * Each output is measured in the thread running it, on the float samples handed over to its sink, before the conversion
+ * to s16 : the peak and the RMS of each channel over METER_RATE periods per second and the samples beyond full scale,
+ * those the sink clips. With the spectrum, the last METER_FFT frames go through a Hann window and an FFT at each update
+ * and the bins are summed into octave bands, as RMS levels : a full scale sine reads 0.707 in its band.
+ *
+ * The levels are published in a POSIX shared memory segment (METER_NAME, /dev/shm), one slot per output under a
+ * seqlock : the thread of the output makes the sequence odd, writes the slot and makes it even again, never waiting for
+ * the readers. A reader (see dspMeter.c) copies the slot between two reads of the sequence and starts again if it was
+ * odd or has changed : any number of readers at any rate, without lock nor system call, and without slowing down the
+ * audio threads. The segment outlives the engine : a reader stays attached while mpd restarts the "pipe" command, the
+ * sequences going on from their last value.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "log.h"
+#include "meter.h"
+
+#define METER_ALIGN			64
+#define METER_TRIES			100000		/* Reads of a slot being written before giving up */
+
+static float centres[METER_BANDS] = {31.5, 63, 125, 250, 500, 1000, 2000, 4000, 8000, 16000};
+
+static float *meterAlloc(int floats){
+	float *p;
+
+	if (posix_memalign((void **) &p, METER_ALIGN, floats * sizeof(float)) != 0) return NULL;
+	memset(p, 0, floats * sizeof(float));
+	return p;
+}
+
+//Creates or opens the shared memory segment name and sets its header, rate updates per s
+//Returns NULL on error
+struct meterShm *meterOpen(char *name, int rate, bool spectrum, int sampleRate){
+	struct meterShm	*shm;
+	int				fd, i;
+
+	if (rate <= 0 || rate > sampleRate / 32) {
+		logError("DSP meter : %i updates per s, 1..%i", rate, sampleRate / 32);
+		return NULL;
+	}
+	if ((fd = shm_open(name, O_CREAT | O_RDWR, 0644)) < 0 || ftruncate(fd, sizeof(struct meterShm)) < 0
+		|| (shm = mmap(NULL, sizeof(struct meterShm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		logError("DSP meter %s : %s", name, strerror(errno));
+		if (fd >= 0) close(fd);
+		return NULL;
+	}
+	close(fd);
+	shm->magic = 0;												//Not valid while the header changes
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	shm->version = METER_VERSION;
+	shm->size = sizeof(struct meterShm);
+	shm->rate = rate;
+	shm->nbOutputs = 0;
+	shm->bands = spectrum ? METER_BANDS : 0;
+	for (i = 0 ; i < METER_BANDS ; i++) shm->centre[i] = centres[i];
+	__atomic_store_n(&shm->magic, METER_MAGIC, __ATOMIC_RELEASE);
+	logInfo("DSP meter %s : %i updates per s%s", name, rate, spectrum ? ", octave spectrum" : "");
+	return shm;
+}
+
+//Sets up the measure of an output in the next slot of the segment
+//Returns -1 on error
+int meterInit(struct meter *m, struct meterShm *shm, char *name, int sampleRate){
+	double	res = (double) sampleRate / METER_FFT;
+	int		i;
+
+	memset(m, 0, sizeof(struct meter));
+	if (shm->nbOutputs == METER_MAX_OUTPUTS) {
+		logError("DSP meter : more than %i outputs, %s not measured", METER_MAX_OUTPUTS, name);
+		return -1;
+	}
+	m->levels = &shm->output[shm->nbOutputs];
+	m->period = lrint((double) sampleRate / shm->rate);
+	m->spectrum = shm->bands > 0;
+	memset(m->levels->name, 0, METER_NAME_SIZE);
+	strncpy(m->levels->name, name, METER_NAME_SIZE - 1);
+	m->levels->seq &= ~1u;										//Left odd by an engine stopped while writing
+	if (m->spectrum) {
+		if (fftSetup(&m->fft, METER_FFT) < 0) return -1;
+		m->history = meterAlloc(METER_FFT * METER_CHANNELS);
+		m->window = meterAlloc(METER_FFT);
+		m->x = meterAlloc(METER_FFT);
+		m->re = meterAlloc(METER_FFT / 2 + 1);
+		m->im = meterAlloc(METER_FFT / 2 + 1);
+		if (m->history == NULL || m->window == NULL || m->x == NULL || m->re == NULL || m->im == NULL) {
+			logError("DSP meter : out of memory");
+			meterFree(m);
+			return -1;
+		}
+		for (i = 0 ; i < METER_FFT ; i++) m->window[i] = 0.5 - 0.5 * cos(2 * M_PI * i / METER_FFT);
+		for (i = 0 ; i < METER_BANDS ; i++) m->bin[i] = ceil(centres[i] / M_SQRT2 / res);
+		m->bin[METER_BANDS] = ceil(centres[METER_BANDS - 1] * M_SQRT2 / res);
+		for (i = 0 ; i <= METER_BANDS ; i++) if (m->bin[i] > METER_FFT / 2) m->bin[i] = METER_FFT / 2;
+	}
+	__atomic_store_n(&shm->nbOutputs, shm->nbOutputs + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+//Octave bands of one channel over the history
+static void spectrum(struct meter *m, int ch, float *band){
+	double	sum, scale = 16.0 / (3.0 * METER_FFT * METER_FFT);		//Hann : a sine of RMS r sums to r^2 / scale over its bins
+	int		i, k, j = m->pos;
+
+	for (i = 0 ; i < METER_FFT ; i++, j = j + 1 == METER_FFT ? 0 : j + 1) m->x[i] = m->history[j * METER_CHANNELS + ch] * m->window[i];
+	fftForward(&m->fft, m->x, m->re, m->im);
+	for (k = 0 ; k < METER_BANDS ; k++) {
+		for (sum = 0, i = m->bin[k] ; i < m->bin[k + 1] ; i++) sum += (double) m->re[i] * m->re[i] + (double) m->im[i] * m->im[i];
+		band[k] = sqrt(sum * scale);
+	}
+}
+
+//Publishes the measures since the last update under the seqlock
+static void publish(struct meter *m){
+	struct meterLevels	*l = m->levels;
+	float				band[METER_CHANNELS][METER_BANDS];
+	struct timespec		t;
+	uint32_t			seq = l->seq;
+	int					ch;
+
+	if (m->spectrum) for (ch = 0 ; ch < METER_CHANNELS ; ch++) spectrum(m, ch, band[ch]);	//Before the sequence is odd
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	__atomic_store_n(&l->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);					//The slot is written after the sequence is seen odd
+	l->updates++;
+	l->time = (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+	for (ch = 0 ; ch < METER_CHANNELS ; ch++) {
+		l->peak[ch] = m->peak[ch];
+		l->rms[ch] = sqrt(m->sum[ch] / m->count);
+		l->clips[ch] = m->clips[ch];
+		if (m->peak[ch] > m->top) m->top = m->peak[ch];
+		m->peak[ch] = 0;
+		m->sum[ch] = 0;
+	}
+	if (m->spectrum) memcpy(l->band, band, sizeof(band));
+	__atomic_store_n(&l->seq, seq + 2, __ATOMIC_RELEASE);
+	m->count = 0;
+}
+
+//Measures a block of an output, interleaved stereo at in[i * stride], and publishes the levels each period
+//The update falls at the end of the block completing the period : blocks longer than the period give one update each
+void meterRun(struct meter *m, float *in, int stride, int frames){
+	float	x, a;
+	int		i, ch;
+
+	for (i = 0 ; i < frames ; i++) {
+		for (ch = 0 ; ch < METER_CHANNELS ; ch++) {
+			x = in[i * stride + ch];
+			a = fabsf(x);
+			if (a > m->peak[ch]) m->peak[ch] = a;
+			if (a >= 1) m->clips[ch]++;
+			m->sum[ch] += x * x;
+			if (m->spectrum) m->history[m->pos * METER_CHANNELS + ch] = x;
+		}
+		if (m->spectrum && ++m->pos == METER_FFT) m->pos = 0;
+	}
+	if ((m->count += frames) >= m->period) publish(m);
+}
+
+void meterFree(struct meter *m){
+	fftFree(&m->fft);
+	free(m->history); free(m->window);
+	free(m->x); free(m->re); free(m->im);
+	m->history = m->window = m->x = m->re = m->im = NULL;
+}
+
+//Maps the segment name read only, for the readers
+//Returns NULL if the engine has not created it
+struct meterShm *meterAttach(char *name){
+	struct meterShm	*shm;
+	int				fd;
+
+	if ((fd = shm_open(name, O_RDONLY, 0)) < 0) return NULL;
+	shm = mmap(NULL, sizeof(struct meterShm), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (shm == MAP_FAILED) return NULL;
+	if (__atomic_load_n(&shm->magic, __ATOMIC_ACQUIRE) != METER_MAGIC || shm->version != METER_VERSION || shm->size != sizeof(struct meterShm)) {
+		munmap(shm, sizeof(struct meterShm));
+		return NULL;
+	}
+	return shm;
+}
+
+//Copies the levels of output i, read again while they are being written
+//Returns false if the output has never been updated, or if it stays odd (engine stopped while writing it)
+bool meterRead(struct meterShm *shm, int i, struct meterLevels *l){
+	struct meterLevels	*src = &shm->output[i];
+	uint32_t			seq;
+	int					tries;
+
+	for (tries = 0 ; tries < METER_TRIES ; tries++) {
+		if ((seq = __atomic_load_n(&src->seq, __ATOMIC_ACQUIRE)) & 1) continue;
+		memcpy(l, src, sizeof(struct meterLevels));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);				//The copy is done before the sequence is read again
+		if (__atomic_load_n(&src->seq, __ATOMIC_RELAXED) == seq) return l->updates > 0;
+	}
+	return false;
+}
@@ -0,0 +1,66 @@
+#ifndef METER_H
+#define METER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "fft.h"
+
+#define METER_MAGIC			0x4d504d41	/* "AMPM" */
+#define METER_VERSION		1
+#define METER_NAME			"/ampCtl.meter"	/* Shared memory segment, /dev/shm/ampCtl.meter */
+#define METER_RATE			20			/* Updates per s */
+#define METER_MAX_OUTPUTS	16
+#define METER_CHANNELS		2
+#define METER_NAME_SIZE		32
+#define METER_BANDS			10			/* Octaves from 31.5 Hz to 16 kHz */
+#define METER_FFT			2048		/* Frames of the spectrum, 21.5 Hz per bin at 44100 Hz */
+
+struct meterLevels {					//Levels of one output, in the shared memory : written under the seqlock by the thread of the output
+	uint32_t	seq;					//Odd while an update is written : read again until it is even and unchanged
+	uint32_t	spare;
+	uint64_t	updates;				//Updates since the engine started
+	uint64_t	time;					//Time of the last update, ns of CLOCK_MONOTONIC
+	float		peak[METER_CHANNELS];	//Since the previous update, full scale 1 : above 1 the output clips
+	float		rms[METER_CHANNELS];
+	uint64_t	clips[METER_CHANNELS];	//Samples beyond full scale since the engine started
+	float		band[METER_CHANNELS][METER_BANDS];	//RMS of each octave over the last METER_FFT frames, full scale 1
+	char		name[METER_NAME_SIZE];	//Name of the output, set when the engine opens
+} __attribute__((aligned(64)));			//Cache lines of their own : the outputs are written by different threads
+
+struct meterShm {						//Shared memory segment, read without lock nor system call
+	uint32_t			magic;
+	uint32_t			version;
+	uint32_t			size;			//Of the segment
+	int32_t				rate;			//Updates per s
+	int32_t				nbOutputs;
+	int32_t				bands;			//0 : no spectrum
+	float				centre[METER_BANDS];	//Centre frequency of each band in Hz
+	struct meterLevels	output[METER_MAX_OUTPUTS];
+};
+
+struct meter {							//Measure of one output, in its thread
+	struct meterLevels	*levels;		//Slot published
+	int					period;			//Frames between two updates
+	int					count;			//Frames since the last update
+	float				peak[METER_CHANNELS];
+	double				sum[METER_CHANNELS];	//Sum of squares
+	uint64_t			clips[METER_CHANNELS];
+	float				top;			//Highest peak since the start, for the log
+	bool				spectrum;
+	struct fft			fft;
+	float				*history;		//Last METER_FFT frames, interleaved stereo, pos the oldest
+	int					pos;
+	float				*window;		//Hann
+	float				*x, *re, *im;
+	int					bin[METER_BANDS + 1];	//Bins of band k : bin[k] to bin[k + 1] excluded
+};
+
+struct meterShm *meterOpen(char *name, int rate, bool spectrum, int sampleRate);
+int 	meterInit(struct meter *m, struct meterShm *shm, char *name, int sampleRate);
+void 	meterRun(struct meter *m, float *in, int stride, int frames);
+void 	meterFree(struct meter *m);
+struct meterShm *meterAttach(char *name);
+bool 	meterRead(struct meterShm *shm, int i, struct meterLevels *l);
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef MPD_CAPTURE_H
+#define MPD_CAPTURE_H
+/*
+Binary format of the proxy session captures
+
+A capture file starts with a header followed by frames, all little endian :
+  header : magic "MPDCAP1\0" (8 bytes), capture start time in micro seconds since the epoch (8 bytes)
+  frame  : time in micro seconds since the capture start (8 bytes), payload length (4 bytes),
+           session number (2 bytes), direction (1 byte), payload
+Open and close frames have an empty payload.
+*/
+
+#include <stdint.h>
+
+#define CAP_MAGIC			"MPDCAP1"
+#define CAP_MAGIC_LEN		8
+
+#define CAP_CLT_TO_SRV		0			// Bytes sent by the client
+#define CAP_SRV_TO_CLT		1			// Bytes sent by the server
+#define CAP_OPEN			2			// Session opened
+#define CAP_CLOSE			3			// Session closed
+
+struct capHeader {
+	char		magic[CAP_MAGIC_LEN];
+	uint64_t	start;
+} __attribute__((packed));
+
+struct capFrame {
+	uint64_t	time;
+	uint32_t	len;
+	uint16_t	session;
+	uint8_t		dir;
+} __attribute__((packed));
+
+#endif
@@ -0,0 +1,885 @@
+/*
+ * mpdProxy : proxy between the mpd clients and the mpd server
+ *
+ * Derived from simple-tcp-proxy.c,v 1.11 2006/08/03 20:30:48 wessels
+ *
+ * The clients (MPDroid...) connect to the proxy which relays the traffic to mpd. The client commands are
+ * matched against the interception rules of the configuration file, which trigger amplifier actions.
+ */
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <netdb.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <poll.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <confuse.h>
+
+#include "log.h"
+#include "ampCtl.h"
+#include "mpdProxy.h"
+#include "mpdCapture.h"
+
+#define BUF_SIZE 			4096		/* Size of one chunk of a buffer chain */
+#define CNX_BUDGET 			(1024*1024)	/* Max bytes queued per direction and per connection */
+#define CNX_LINGER			2000		/* Max ms spent writing what is queued for a side once the other one hung up */
+#define MAX_IOV 			16			/* Max chunks flushed with one writev */
+#define MAX_LINE 			1024		/* Max length of a client command line inspected */
+#define MPD_DEF_HOST 		"localhost"
+
+#define MAX_CONNECTIONS 	32
+#define AMP_SLOT_WAIT 		100000  	/*  0.1 seconds */
+
+#define RULE_BUCKETS 		64			/* Size of the rule hash table, power of 2 */
+#define RULE_CMD_LEN 		32			/* Max length of a command name in a rule */
+#define RULE_ARG_LEN 		32			/* Max length of the argument matched by a rule */
+#define RESP_HEAD 			16			/* Beginning of a response line kept to recognize it */
+#define BULK_WAIT 			5			/* Poll period in ms of a connection waiting for a bulk slot */
+
+//Data flowing through the proxy is queued in a chain of fixed size chunks.
+//Reads append at the tail, writes consume from the head : nothing is ever moved
+//inside a chunk and a fully written chunk is recycled.
+//The chain grows on demand up to its budget, reaching it stops reading the
+//sending side (backpressure) until the receiving side has drained some data.
+struct chunk {
+	struct chunk	*next;
+	int				start;				//Offset of the first byte not yet written
+	int				end;				//Offset of the first free byte
+	char			data[BUF_SIZE];
+};
+
+struct bufChain {
+	struct chunk	*head;				//Chunk being written
+	struct chunk	*tail;				//Chunk being filled
+	struct chunk	*pool;				//Spare chunk kept to avoid malloc/free in the steady state
+	int				len;				//Bytes queued in the chain
+	int				budget;				//Max bytes queued in the chain
+};
+
+struct connection {
+	int		cltPort;
+	int 	srvPort;
+	int 	cltSock;
+	int 	srvSock;
+	char 	cltHostname[64];
+	struct	bufChain toSrv;				//Data from the client waiting to be sent to the server
+	struct	bufChain toClt;				//Data from the server waiting to be sent to the client
+	char	line[MAX_LINE];				//Client command line split across two reads
+	int		lineLen;
+	int		session;					//Session number in the capture file
+	int		cmdSent;					//Number of commands sent to mpd, a command list counting for one
+	int		respRecv;					//Number of responses received from mpd
+	int		playCmd;					//Number of the pending play command whose response is awaited (0 : none)
+	bool	inList;						//Inside a command list ?
+	char	resp[RESP_HEAD];			//Beginning of the response line being received
+	int		respLen;
+	int		binSkip;					//Bytes of binary data left to skip in the response
+	int		bulkCmd;					//Number of the last bulk query whose response is awaited (0 : none)
+	bool	bulkWait;					//Is the connection held until it gets a bulk slot ?
+	int		bulkSeq;					//Order of arrival among the connections waiting for a slot
+	struct ruleTable	*rules;			//Rule table the thread is matching a command with, kept by a reload until NULL
+};
+
+//Interception rules : 'rule "<command> [first argument]" { action = ... delay = ... }' sections of the configuration file.
+//They are compiled into a hash table on the command name, so that the commands without rule only cost
+//hashing their name. The table is replaced as a whole on reload.
+struct rule {
+	struct rule		*next;				//Next rule in the same bucket, in configuration file order
+	char			cmd[RULE_CMD_LEN];	//Command name
+	int				cmdLen;
+	char			args[RULE_ARG_LEN];	//First argument to match, empty : any
+	int				event;				//Event processed when the rule matches
+	int				delay;				//Delay in seconds for the delayed actions
+};
+
+struct ruleTable {
+	struct rule		*bucket[RULE_BUCKETS];
+	int				nbRules;
+	struct rule		rules[];
+};
+
+struct action {
+	char	*name;						//Name of the action in the configuration file
+	int		event;
+} actions[] = {
+	{"powerOn", 	AMP_PROXY_ON},		//Switch the amplifier on
+	{"powerOff", 	AMP_PROXY_OFF},		//Switch the amplifier off, after delay seconds
+	{"mute", 		AMP_PROXY_MUTE},
+	{"unmute", 		AMP_PROXY_UNMUTE},
+	{"volume", 		AMP_PROXY_VOLUME},	//Set the hardware volume with the first argument of the command
+	{NULL, 0}
+};
+
+cfg_opt_t proxyRuleOpts[] = {
+	CFG_STR("action", 0, CFGF_NODEFAULT),
+	CFG_INT("delay", 0, CFGF_NONE),
+	CFG_END()
+};
+
+static struct connection 	cnx[MAX_CONNECTIONS];
+static struct amp 			*amp;
+static struct ruleTable 	*ruleTbl = NULL;		//Current rules
+static char					*mpdHost = MPD_DEF_HOST;
+static FILE					*capFile = NULL;
+static uint64_t				capStart;
+static pthread_mutex_t		capMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t		bulkMutex = PTHREAD_MUTEX_INITIALIZER;
+static int					bulkUsed = 0;			//Bulk slots in use
+static int					priorityPending = 0;	//Front panel commands running
+static int					bulkSeq = 0;			//Arrival counter of the connections waiting for a slot
+
+//Bulk queries : commands whose response may be large and keep mpd busy (whole database, queue, searches...)
+//The other commands are interactive and are never held
+static char *bulkCommands[] = {
+	"listall", "listallinfo", "listfiles", "lsinfo", "list", "count", "find", "search", "findadd", "searchadd",
+	"searchaddpl", "playlistinfo", "playlistfind", "playlistsearch", "plchanges", "listplaylist", "listplaylistinfo",
+	"listplaylists", "albumart", "readpicture", NULL
+};
+
+int set_nonblock(int fd){
+    int fl;
+    int x;
+    fl = fcntl(fd, F_GETFL, 0);
+    if (fl < 0) {
+	logError("fcntl F_GETFL: FD %d: %s", fd, strerror(errno));
+	return -1;
+    }
+    x = fcntl(fd, F_SETFL, fl | O_NONBLOCK);
+    if (x < 0) {
+	logError("fcntl F_SETFL: FD %d: %s", fd, strerror(errno));
+	return -1;
+    }
+    return 0;
+}
+
+int createServerSock(int port) {
+
+    int addrlen, s, on = 1, x;
+    static struct sockaddr_in client_addr;
+
+    s = socket(AF_INET, SOCK_STREAM, 0);
+    if (s < 0) {
+	logError("Proxy socket : %s", strerror(errno));
+	return -1;
+    }
+
+    addrlen = sizeof(client_addr);
+    memset(&client_addr, '\0', addrlen);
+    client_addr.sin_family = AF_INET;
+    client_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    client_addr.sin_port = htons(port);
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &on, 4);
+    x = bind(s, (struct sockaddr *) &client_addr, addrlen);
+    if (x >= 0) x = listen(s, MAX_CONNECTIONS);
+    if (x < 0) {
+	logError("Proxy bind/listen port %d : %s", port, strerror(errno));
+	close(s);
+	return -1;
+    }
+
+    logInfo("Proxy listening on port %d", port);
+
+    return s;
+}
+
+int openServerConnection(int port)
+{
+    struct sockaddr_in rem_addr;
+    int len, s, x;
+    struct hostent *H;
+    int on = 1;
+
+    H = gethostbyname(mpdHost);
+    if (!H)	return (-2);
+
+    len = sizeof(rem_addr);
+
+    s = socket(AF_INET, SOCK_STREAM, 0);
+    if (s < 0) return s;
+
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &on, 4);
+
+    memset(&rem_addr, '\0', len);
+    rem_addr.sin_family = AF_INET;
+    memcpy(&rem_addr.sin_addr, H->h_addr, H->h_length);
+    rem_addr.sin_port = htons(port);
+    x = connect(s, (struct sockaddr *) &rem_addr, len);
+    if (x < 0 || set_nonblock(s) < 0) {
+	close(s);
+	return -1;
+    }
+
+    return s;
+}
+
+int
+get_hinfo_from_sockaddr(struct sockaddr_in addr, int len, char *fqdn)
+{
+    struct hostent *hostinfo;
+
+    hostinfo = gethostbyaddr((char *) &addr.sin_addr.s_addr, sizeof(addr.sin_addr.s_addr), AF_INET);
+    if (!hostinfo) {
+	sprintf(fqdn, "%s", inet_ntoa(addr.sin_addr));
+	return 0;
+    }
+    if (hostinfo && fqdn)
+	snprintf(fqdn, 64, "%s [%s]", hostinfo->h_name, inet_ntoa(addr.sin_addr));
+    return 0;
+}
+
+
+int waitForConnection(int s, struct connection *cnx)
+{
+    int newsock;
+    socklen_t len;
+    struct sockaddr_in peer;
+
+    len = sizeof(struct sockaddr);
+    newsock = accept(s, (struct sockaddr *) &peer, &len);
+    if (newsock < 0) {
+	if (errno != EINTR) logError("Proxy accept FD %d : %s", s, strerror(errno));
+	return -1;
+    }
+    get_hinfo_from_sockaddr(peer, len, cnx->cltHostname);
+    if (set_nonblock(newsock) < 0) {
+	close(newsock);
+	return -1;
+    }
+    return (newsock);
+}
+
+void chainInit(struct bufChain *b, int budget){
+	b->head = NULL;
+	b->tail = NULL;
+	b->pool = NULL;
+	b->len = 0;
+	b->budget = budget;
+}
+
+void chainFree(struct bufChain *b){
+	struct chunk *c;
+
+	while ((c = b->head) != NULL) { b->head = c->next; free(c); }
+	free(b->pool);
+	b->pool = NULL;
+	b->tail = NULL;
+	b->len = 0;
+}
+
+//Is there still room in the chain to read more data ?
+int chainHasRoom(struct bufChain *b){
+	return b->len < b->budget;
+}
+
+//Returns the chunk where new data can be appended, growing the chain if needed
+struct chunk *chainTail(struct bufChain *b){
+	struct chunk *c;
+
+	if (b->tail != NULL && b->tail->end < BUF_SIZE) return b->tail;
+
+	if ((c = b->pool) != NULL) b->pool = NULL;
+	else if ((c = malloc(sizeof(struct chunk))) == NULL) return NULL;
+	c->next = NULL;
+	c->start = 0;
+	c->end = 0;
+	if (b->tail != NULL) b->tail->next = c;
+	else b->head = c;
+	b->tail = c;
+	return c;
+}
+
+//Reads from fd directly at the tail of the chain
+//Returns the number of bytes read, 0 on end of file and -1 on error
+//*data points to the bytes just read (they never span two chunks)
+int chainRead(int fd, struct bufChain *b, char **data){
+	struct chunk *c;
+	int n;
+
+	if ((c = chainTail(b)) == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	n = read(fd, c->data + c->end, BUF_SIZE - c->end);
+	if (n <= 0) return n;
+	*data = c->data + c->end;
+	c->end += n;
+	b->len += n;
+	return n;
+}
+
+//Flushes as much of the chain as the socket accepts with a single writev
+//Fully written chunks are recycled, a partially written one just advances its start offset
+int chainWrite(int fd, struct bufChain *b){
+	struct iovec 	iov[MAX_IOV];
+	struct chunk 	*c;
+	int 			cnt = 0;
+	int 			x;
+
+	for (c = b->head ; c != NULL && cnt < MAX_IOV ; c = c->next) {
+		if (c->end == c->start) continue;
+		iov[cnt].iov_base = c->data + c->start;
+		iov[cnt].iov_len = c->end - c->start;
+		cnt++;
+	}
+	if (cnt == 0) return 0;
+
+	x = writev(fd, iov, cnt);
+	if (x <= 0) return x;
+	b->len -= x;
+
+	while ((c = b->head) != NULL) {
+		int avail = c->end - c->start;
+		if (x < avail) {
+			c->start += x;
+			break;
+		}
+		x -= avail;
+		if (c == b->tail) {								//Chain is empty : keep filling the tail from its beginning
+			c->start = c->end = 0;
+			break;
+		}
+		b->head = c->next;
+		if (b->pool == NULL) b->pool = c;
+		else free(c);
+	}
+	return 1;
+}
+
+uint64_t nowUsec(){
+	struct timeval t;
+
+	gettimeofday(&t, NULL);
+	return (uint64_t)t.tv_sec * 1000000 + t.tv_usec;
+}
+
+//Writes what is left in the chain before the connection is closed, for at most CNX_LINGER ms
+void chainFlush(int fd, struct bufChain *b){
+	struct pollfd	p = {fd, POLLOUT, 0};
+	uint64_t		end = nowUsec() + CNX_LINGER * 1000;
+	int				left;
+
+	while (b->len > 0 && (left = (int64_t)(end - nowUsec()) / 1000) > 0) {
+		if (poll(&p, 1, left) <= 0 || (p.revents & (POLLERR | POLLHUP))) return;
+		if (chainWrite(fd, b) < 0 && errno != EWOULDBLOCK) return;
+	}
+}
+
+//Opens the capture file and writes its header
+int openCapture(char *filename){
+	struct capHeader h;
+
+	capFile = fopen(filename, "wb");
+	if (capFile == NULL) {
+		logError("Capture file %s : %s", filename, strerror(errno));
+		return -1;
+	}
+	memset(&h, 0, sizeof(h));
+	strcpy(h.magic, CAP_MAGIC);
+	h.start = capStart = nowUsec();
+	fwrite(&h, sizeof(h), 1, capFile);
+	fflush(capFile);
+	logInfo("Capturing proxy sessions in %s", filename);
+	return 0;
+}
+
+//Appends a timestamped frame to the capture file, if any
+//The file is shared by all the connection threads : frames are written under a mutex
+//and flushed on session boundaries only, to keep the cost on the relay path low
+void capture(struct connection *cnx, int dir, char *data, int len){
+	struct capFrame f;
+
+	if (capFile == NULL) return;
+
+	f.time = nowUsec() - capStart;
+	f.len = len;
+	f.session = cnx->session;
+	f.dir = dir;
+	pthread_mutex_lock(&capMutex);
+	fwrite(&f, sizeof(f), 1, capFile);
+	if (len) fwrite(data, len, 1, capFile);
+	if (dir == CAP_OPEN || dir == CAP_CLOSE) fflush(capFile);
+	pthread_mutex_unlock(&capMutex);
+}
+
+/****************************************************************
+ * Priority classes
+ ****************************************************************/
+
+//mpd runs the commands of all its clients one after the other : a large response (listallinfo on a big
+//database) delays a mute or a volume change from the front panel or from another client.
+//The proxy cannot interrupt mpd but it limits the bulk queries sent to mpd at the same time to proxyBulkSlots,
+//and does not send new ones while a front panel command is running. Interactive commands always go through.
+
+//Holds the connection until it gets a bulk slot
+void bulkEnqueue(struct connection *waiting){
+	pthread_mutex_lock(&bulkMutex);
+	waiting->bulkWait = true;
+	waiting->bulkSeq = bulkSeq++;
+	pthread_mutex_unlock(&bulkMutex);
+}
+
+//Takes a bulk slot for a waiting connection, the slots are given in order of arrival
+//Returns false if none is free, if an older connection is waiting or if a front panel command is running
+bool bulkAcquire(struct connection *waiting){
+	bool ok;
+	int i;
+
+	pthread_mutex_lock(&bulkMutex);
+	ok = priorityPending == 0 && (amp->proxyBulkSlots == 0 || bulkUsed < amp->proxyBulkSlots);
+	for (i = 0 ; ok && i < MAX_CONNECTIONS ; i++)
+		if (cnx[i].bulkWait && cnx[i].bulkSeq - waiting->bulkSeq < 0) ok = false;
+	if (ok) {
+		bulkUsed++;
+		waiting->bulkWait = false;
+	}
+	pthread_mutex_unlock(&bulkMutex);
+	return ok;
+}
+
+//Gives back the slot of a connection, or leaves the waiting queue
+void bulkRelease(struct connection *holder){
+	pthread_mutex_lock(&bulkMutex);
+	if (holder->bulkWait) holder->bulkWait = false;
+	else bulkUsed--;
+	holder->bulkCmd = 0;
+	pthread_mutex_unlock(&bulkMutex);
+}
+
+//Called around the front panel commands : holds the bulk queries not yet sent to mpd
+//on : true when the command starts, false when it is completed
+void proxyPriority(bool on){
+	pthread_mutex_lock(&bulkMutex);
+	priorityPending += on ? 1 : -1;
+	pthread_mutex_unlock(&bulkMutex);
+}
+
+bool isBulkCommand(char *line, int n){
+	int i;
+
+	for (i = 0 ; bulkCommands[i] != NULL ; i++)
+		if (strncmp(bulkCommands[i], line, n) == 0 && bulkCommands[i][n] == '\0') return true;
+	return false;
+}
+
+void closeCnx(struct connection *cnx, char *reason) {
+
+	logInfo("Proxy connection from %s closed : %s", cnx->cltHostname, reason);
+	capture(cnx, CAP_CLOSE, NULL, 0);
+	if (cnx->bulkCmd) bulkRelease(cnx);
+	chainFree(&cnx->toSrv);
+	chainFree(&cnx->toClt);
+	close(cnx->srvSock);
+	close(cnx->cltSock);
+	cnx->srvSock = -1;
+	cnx->cltSock = -1;								//Last : releases the slot in the connection table
+}
+
+/****************************************************************
+ * Interception rules
+ ****************************************************************/
+
+//Compiles the rule sections of the configuration into a new table and makes it the current one
+//The connection threads match without lock : the previous table is freed once none of them is using it
+//Returns -1 if a rule is invalid, the current rules are then kept
+int proxyLoadRules(cfg_t *cfg){
+	struct ruleTable 	*t, *old;
+	struct rule 		*r, **last;
+	cfg_t 				*sec;
+	const char 			*title;
+	char 				*action, *sp;
+	unsigned 			h;
+	int 				i, j, n;
+
+	n = cfg_size(cfg, "rule");
+	if ((t = calloc(1, sizeof(struct ruleTable) + n * sizeof(struct rule))) == NULL) return -1;
+
+	for (i = 0 ; i < n ; i++) {
+		sec = cfg_getnsec(cfg, "rule", i);
+		r = &t->rules[i];
+		title = cfg_title(sec);
+		action = cfg_getstr(sec, "action");
+		for (j = 0 ; actions[j].name != NULL ; j++)
+			if (action != NULL && strcmp(action, actions[j].name) == 0) break;
+		sp = strchr(title, ' ');
+		r->cmdLen = sp ? sp - title : strlen(title);
+		if (actions[j].name == NULL || r->cmdLen == 0 || r->cmdLen >= RULE_CMD_LEN || (sp && strlen(sp + 1) >= RULE_ARG_LEN)) {
+			logError("Invalid proxy rule : %s, action : %s", title, action ? action : "none");
+			free(t);
+			return -1;
+		}
+		memcpy(r->cmd, title, r->cmdLen);
+		if (sp) strcpy(r->args, sp + 1);
+		r->event = actions[j].event;
+		r->delay = cfg_getint(sec, "delay");
+
+		for (h = 0, j = 0 ; j < r->cmdLen ; j++) h = h * 31 + (unsigned char) r->cmd[j];
+		for (last = &t->bucket[h & (RULE_BUCKETS - 1)] ; *last != NULL ; last = &(*last)->next);
+		*last = r;
+		logDebug("Proxy rule : %s %s -> %s %i", r->cmd, r->args, action, r->delay);
+	}
+	t->nbRules = n;
+
+	old = __atomic_exchange_n(&ruleTbl, t, __ATOMIC_SEQ_CST);
+	for (i = 0 ; old != NULL && i < MAX_CONNECTIONS ; i++)				//A match lasts a few us : wait until done
+		while (__atomic_load_n(&cnx[i].rules, __ATOMIC_SEQ_CST) == old) usleep(100);
+	free(old);
+	logInfo("%i proxy rules loaded", n);
+	return 0;
+}
+
+//Looks for the rule matching a client command line in the table t, published in cnx->rules by the caller
+//Lines look like : command "arg1" "arg2"... (the arguments may not be quoted)
+//arg receives the first argument, unquoted
+struct rule *findRule(struct ruleTable *t, char *line, int len, char *arg){
+	struct rule 		*r;
+	unsigned 			h = 0;
+	int 				i, n = 0;
+
+	if (t == NULL || t->nbRules == 0) return NULL;
+	for (i = 0 ; i < len && line[i] != ' ' && line[i] != '\t' && line[i] != '\r' ; i++)
+		h = h * 31 + (unsigned char) line[i];
+	if ((r = t->bucket[h & (RULE_BUCKETS - 1)]) == NULL) return NULL;		//Most commands stop here
+
+	while (i < len && (line[i] == ' ' || line[i] == '\t')) i++;				//Extract the first argument
+	if (i < len && line[i] == '"') i++;
+	while (i < len && n < RULE_ARG_LEN - 1 && line[i] != '"' && line[i] != ' ' && line[i] != '\r') arg[n++] = line[i++];
+	arg[n] = '\0';
+
+	for ( ; r != NULL ; r = r->next)
+		if (r->cmdLen <= len && memcmp(r->cmd, line, r->cmdLen) == 0
+			&& (r->cmdLen == len || line[r->cmdLen] == ' ' || line[r->cmdLen] == '\t' || line[r->cmdLen] == '\r')
+			&& (r->args[0] == '\0' || strcmp(r->args, arg) == 0)) return r;
+	return NULL;
+}
+
+//Applies the rules to a client command line
+//The table is published in cnx->rules while it is read : a reload frees the table it replaces once no thread uses it
+void lookForCommand(char *line, int len, struct connection *cnx){
+	struct ruleTable	*t;
+	struct rule 		*r;
+	char 				arg[RULE_ARG_LEN];
+	int					event, delay;
+
+	do {																	//Published before the table is read
+		t = __atomic_load_n(&ruleTbl, __ATOMIC_SEQ_CST);
+		__atomic_store_n(&cnx->rules, t, __ATOMIC_SEQ_CST);
+	} while (t != __atomic_load_n(&ruleTbl, __ATOMIC_SEQ_CST));
+	if ((r = findRule(t, line, len, arg)) == NULL) {
+		__atomic_store_n(&cnx->rules, NULL, __ATOMIC_RELEASE);
+		return;
+	}
+	logDebug("Proxy rule %s matched for %s", r->cmd, cnx->cltHostname);
+	event = r->event;
+	delay = r->delay;
+	__atomic_store_n(&cnx->rules, NULL, __ATOMIC_RELEASE);					//The event may take long : the table is not held meanwhile
+	if (event == AMP_PROXY_VOLUME) processEvent(amp, event, atoi(arg));
+	else processEvent(amp, event, delay);
+}
+
+//Is the command a request to play ?
+//play, playid, pause 0 and pause without argument (toggle, as sent by the clients play/pause button)
+//n : length of the command name
+bool isPlayCommand(char *line, int n, int len){
+	int i = n;
+
+	if (n == 4 && memcmp(line, "play", 4) == 0) return true;
+	if (n == 6 && memcmp(line, "playid", 6) == 0) return true;
+	if (n != 5 || memcmp(line, "pause", 5) != 0) return false;
+
+	while (i < len && (line[i] == ' ' || line[i] == '\t')) i++;
+	if (i < len && line[i] == '"') i++;
+	if (i >= len || line[i] == '\r') return true;
+	return line[i] == '0' && (i + 1 >= len || line[i + 1] == '"' || line[i + 1] == ' ' || line[i + 1] == '\r');
+}
+
+//Counts the commands sent to mpd to pair them with the responses and reports the play requests
+//Each command gets one response, except the commands of a list which get a single response at the end of the list
+//and noidle whose response is the one of the pending idle
+void trackCommand(char *line, int len, struct connection *cnx){
+	int n;
+
+	for (n = 0 ; n < len && line[n] != ' ' && line[n] != '\t' && line[n] != '\r' ; n++);
+	if (n == 6 && memcmp(line, "noidle", 6) == 0) return;
+	if (n >= 16 && memcmp(line, "command_list_", 13) == 0) {
+		if (memcmp(line + n - 4, "_end", 4) == 0) {
+			cnx->inList = false;
+			cnx->cmdSent++;
+		}
+		else cnx->inList = true;
+		return;
+	}
+	if (!cnx->inList) cnx->cmdSent++;
+
+	if (isBulkCommand(line, n)) {								//The connection is held until it gets a slot, kept until the last
+		if (cnx->bulkCmd == 0) bulkEnqueue(cnx);				//bulk query it sent is answered
+		cnx->bulkCmd = cnx->inList ? cnx->cmdSent + 1 : cnx->cmdSent;
+	}
+	if (isPlayCommand(line, n, len)) {
+		logDebug("Play request from %s", cnx->cltHostname);
+		stampPlayRequest(amp);
+		if (amp->predictivePowerOn > 0) {
+			cnx->playCmd = cnx->inList ? cnx->cmdSent + 1 : cnx->cmdSent;
+			postEvent(amp, AMP_PROXY_PLAY, amp->predictivePowerOn);
+		}
+	}
+}
+
+//Splits the bytes received from the client into command lines
+//Lines are inspected in place in the receive buffer, only a line split across two reads is copied
+//Lines longer than MAX_LINE are truncated
+void scanCommands(char *data, int n, struct connection *cnx){
+	char *end = data + n;
+	char *nl;
+	int len;
+
+	while (data < end) {
+		if ((nl = memchr(data, '\n', end - data)) == NULL) {		//Incomplete line : keep it for the next read
+			len = end - data;
+			if (len > MAX_LINE - cnx->lineLen) len = MAX_LINE - cnx->lineLen;
+			memcpy(cnx->line + cnx->lineLen, data, len);
+			cnx->lineLen += len;
+			return;
+		}
+		if (cnx->lineLen == 0) {
+			trackCommand(data, nl - data, cnx);
+			lookForCommand(data, nl - data, cnx);
+		}
+		else {
+			len = nl - data;
+			if (len > MAX_LINE - cnx->lineLen) len = MAX_LINE - cnx->lineLen;
+			memcpy(cnx->line + cnx->lineLen, data, len);
+			trackCommand(cnx->line, cnx->lineLen + len, cnx);
+			lookForCommand(cnx->line, cnx->lineLen + len, cnx);
+			cnx->lineLen = 0;
+		}
+		data = nl + 1;
+	}
+}
+
+//Processes a complete response line : a response ends with "OK" or "ACK [error] {command} message"
+//"binary: <n>" announces n bytes of raw data which are skipped
+//The greeting "OK MPD <version>" is counted as response 0
+void responseLine(struct connection *cnx){
+	bool ack;
+
+	cnx->resp[cnx->respLen] = '\0';
+	if (strncmp(cnx->resp, "binary: ", 8) == 0) {
+		cnx->binSkip = atoi(cnx->resp + 8);
+		return;
+	}
+	ack = strncmp(cnx->resp, "ACK ", 4) == 0;
+	if (!ack && !(cnx->resp[0] == 'O' && cnx->resp[1] == 'K' && (cnx->resp[2] == '\0' || cnx->resp[2] == ' '))) return;
+
+	cnx->respRecv++;
+	if (cnx->bulkCmd && cnx->respRecv == cnx->bulkCmd) bulkRelease(cnx);
+	if (cnx->playCmd == 0 || cnx->respRecv != cnx->playCmd) return;
+	cnx->playCmd = 0;
+	if (ack) {
+		logInfo("mpd rejected the play request from %s : %s", cnx->cltHostname, cnx->resp);
+		postEvent(amp, AMP_PROXY_ROLLBACK, 0);
+	}
+}
+
+//Follows the responses of mpd to find the ones answering the pending play request and bulk queries
+//Only the beginning of each line is kept, the state is kept in the connection as lines span reads
+void scanResponses(char *data, int n, struct connection *cnx){
+	char *end = data + n;
+	char *nl;
+	int len;
+
+	while (data < end) {
+		if (cnx->binSkip) {
+			len = end - data < cnx->binSkip ? end - data : cnx->binSkip;
+			cnx->binSkip -= len;
+			data += len;
+			continue;
+		}
+		nl = memchr(data, '\n', end - data);
+		len = (nl ? nl : end) - data;
+		if (len > RESP_HEAD - 1 - cnx->respLen) len = RESP_HEAD - 1 - cnx->respLen;
+		memcpy(cnx->resp + cnx->respLen, data, len);
+		cnx->respLen += len;
+		if (nl == NULL) return;
+		responseLine(cnx);
+		cnx->respLen = 0;
+		data = nl + 1;
+	}
+}
+
+//Relays the data between a client and the server
+//Each side is read only when the chain towards the other side has room left (backpressure)
+//When a side hangs up, what is queued for the other side is written before closing
+//and is polled for writing only when data is waiting for it : the thread sleeps in poll
+//while nothing can progress, and a slow client only ever holds its own budget
+static void *serviceClient(void *cnxData)
+{
+    struct 	pollfd fds[2];
+    char 	*data;
+    int 	x, n;
+    int 	cfd, sfd;
+    struct 	connection *cnx;
+
+    cnx = (struct connection *) cnxData;
+    logInfo("Proxy connection from %s fd=%d, mpd fd=%d", cnx->cltHostname, cnx->cltSock, cnx->srvSock);
+
+    cfd = cnx->cltSock;
+    sfd = cnx->srvSock;
+    chainInit(&cnx->toSrv, CNX_BUDGET);
+    chainInit(&cnx->toClt, CNX_BUDGET);
+    cnx->lineLen = 0;
+    cnx->cmdSent = 0;
+    cnx->respRecv = -1;
+    cnx->playCmd = 0;
+    cnx->inList = false;
+    cnx->respLen = 0;
+    cnx->binSkip = 0;
+    cnx->bulkCmd = 0;
+    cnx->bulkWait = false;
+    capture(cnx, CAP_OPEN, NULL, 0);
+    fds[0].fd = cfd;
+    fds[1].fd = sfd;
+
+    while (1) {
+	fds[0].events = 0;
+	fds[1].events = 0;
+	if (chainHasRoom(&cnx->toSrv)) fds[0].events |= POLLIN;
+	if (chainHasRoom(&cnx->toClt)) fds[1].events |= POLLIN;
+	if (cnx->toClt.len) fds[0].events |= POLLOUT;
+	if (cnx->bulkWait) bulkAcquire(cnx);
+	if (cnx->toSrv.len && !cnx->bulkWait) fds[1].events |= POLLOUT;
+
+	x = poll(fds, 2, cnx->bulkWait ? BULK_WAIT : -1);
+	if (x < 0) {
+		if (errno == EINTR) continue;
+		closeCnx(cnx, strerror(errno));
+		return NULL;
+	}
+
+	if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {			//Hung up with a full chain : closed without reading
+		n = fds[0].events & POLLIN ? chainRead(cfd, &cnx->toSrv, &data) : 0;
+		if (n <= 0 && !(n < 0 && errno == EWOULDBLOCK)) {
+			if (!cnx->bulkWait) chainFlush(sfd, &cnx->toSrv);
+			closeCnx(cnx, "client side");
+			return NULL;
+		}
+		if (n > 0) {
+			capture(cnx, CAP_CLT_TO_SRV, data, n);
+			scanCommands(data, n, cnx);
+		}
+	}
+	if (fds[1].revents & (POLLIN | POLLHUP | POLLERR)) {
+		n = fds[1].events & POLLIN ? chainRead(sfd, &cnx->toClt, &data) : 0;
+		if (n <= 0 && !(n < 0 && errno == EWOULDBLOCK)) {
+			chainFlush(cfd, &cnx->toClt);							//The responses already received reach the client
+			closeCnx(cnx, "server side");
+			return NULL;
+		}
+		if (n > 0) {
+			capture(cnx, CAP_SRV_TO_CLT, data, n);
+			scanResponses(data, n, cnx);
+		}
+	}
+	if ((fds[1].revents & POLLOUT) && !cnx->bulkWait) {
+		if ((chainWrite(sfd, &cnx->toSrv) < 0) && errno != EWOULDBLOCK) {
+			closeCnx(cnx, strerror(errno));
+			return NULL;
+		}
+	}
+	if (fds[0].revents & POLLOUT) {
+		if ((chainWrite(cfd, &cnx->toClt) < 0) && errno != EWOULDBLOCK) {
+			closeCnx(cnx, strerror(errno));
+			return NULL;
+		}
+	}
+    }
+}
+
+void initCnxTbl(struct connection *cnx){
+	int i;
+
+	for (i = 0; i < MAX_CONNECTIONS ; i++) {
+		cnx[i].cltSock = -1;
+		cnx[i].srvSock = -1;
+	}
+}
+
+
+int findFreeCnx(struct connection *cnx){
+	int i;
+
+	for (i = 0; i < MAX_CONNECTIONS ; i++)
+		if (cnx[i].cltSock == -1) return(i);
+
+	return -1;
+}
+
+//Proxy thread : accepts the clients connections and starts a thread relaying each of them
+//arg : listening socket
+static void *proxyHandler(void *arg){
+    int 		masterSock = (int)(long) arg;
+    int			curCnx	= 0;
+    int			session	= 0;
+    pthread_t	threadId;
+
+    while (1) {
+		if ((curCnx = findFreeCnx(cnx)) == -1) {
+			usleep(AMP_SLOT_WAIT);		//Wait for a connection to terminate
+			continue;
+		}
+		
+		cnx[curCnx].cltPort = amp->proxyPort;		//Port used by the clients
+		cnx[curCnx].srvPort = amp->mpdPort;			//Port used to connect to MPD server
+		cnx[curCnx].session = session++ & 0xffff;	//Session number in the capture
+
+		if ((cnx[curCnx].cltSock = waitForConnection(masterSock, &cnx[curCnx])) < 0) continue;
+
+		if ((cnx[curCnx].srvSock = openServerConnection(cnx[curCnx].srvPort)) < 0) {
+			logError("Proxy cannot connect to mpd on %s:%d", mpdHost, cnx[curCnx].srvPort);
+			close(cnx[curCnx].cltSock);
+			cnx[curCnx].cltSock = -1;
+			continue;
+		}
+		if (pthread_create(&threadId, NULL, serviceClient, &cnx[curCnx]) == 0)
+			pthread_detach(threadId);
+		else
+			closeCnx(&cnx[curCnx], "thread creation error");
+    }
+    return NULL;
+}
+
+//Starts the proxy : mpd must listen on mpdPort, the clients connect to proxyPort
+//ampCtl : pointer on the amplifier control structure
+int proxyStart(struct amp *ampCtl){
+	pthread_t 	threadId;
+	int 		s;
+
+	if (ampCtl->mpdPort == 0 || ampCtl->mpdPort == ampCtl->proxyPort) {
+		logError("The proxy needs mpd to listen on another port (mpdPort)");
+		return -1;
+	}
+	amp = ampCtl;
+	if (ampCtl->mpdHost != NULL) mpdHost = ampCtl->mpdHost;
+	initCnxTbl(cnx);
+	signal(SIGPIPE, SIG_IGN);				//A vanishing client must not kill the daemon : write returns EPIPE
+	if (ampCtl->captureFile != NULL) openCapture(ampCtl->captureFile);
+
+	if ((s = createServerSock(ampCtl->proxyPort)) < 0) return -1;
+	if (pthread_create(&threadId, NULL, proxyHandler, (void *)(long) s) != 0) {
+		close(s);
+		return -1;
+	}
+	pthread_detach(threadId);
+	return 0;
+}
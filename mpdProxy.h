@@ -0,0 +1,14 @@
+#ifndef MPDPROXY_H
+#define MPDPROXY_H
+
+#include <confuse.h>
+
+#include "ampCtl.h"
+
+extern cfg_opt_t proxyRuleOpts[];			// Options of the "rule" sections of the configuration file
+
+int proxyStart(struct amp *ampCtl);
+int proxyLoadRules(cfg_t *cfg);
+void proxyPriority(bool on);
+
+#endif
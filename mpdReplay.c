@@ -0,0 +1,679 @@
+/*
+ * mpdReplay : replays the sessions recorded by mpdProxy (see mpdCapture.h)
+ *
+ * Drives N concurrent synthetic clients against the proxy, each of them replaying one of the
+ * recorded sessions, either at the original pace or as fast as possible.
+ * A mock MPD answering with the recorded responses runs in the same process, so that the load
+ * is reproducible without a music database : point the proxy MpdPort to the mock port.
+ * At the end, throughput, latency percentiles and CPU per request are reported.
+ *
+ * Latency SLO test : bulk clients loop on listallinfo while the replayed sessions play the interactive
+ * clients. The mock runs the commands one after the other with a cost per response byte, as mpd does,
+ * and the p99 latency of the interactive clients is checked against the SLO.
+ *
+ * idle / noidle exchanges are not replayed as their timing depends on external events.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <netdb.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "mpdCapture.h"
+
+#define RPL_MAX_SESSIONS	65536
+#define RPL_HASH_SIZE		4096
+#define RPL_BUF_SIZE		65536
+#define RPL_DEF_CLIENTS		1
+#define RPL_DEF_MOCK_PORT	6601
+#define RPL_DEF_HOST		"127.0.0.1"
+#define RPL_GREETING		"OK MPD 0.19.0\n"
+#define RPL_DEF_BULK_SIZE	(1024*1024)
+#define RPL_BULK_REQUEST	"listallinfo\n"
+
+struct buffer {									//Growing byte buffer
+	char		*data;
+	int			len;
+	int			size;
+};
+
+struct exchange {								//One request and its recorded response
+	char		*request;
+	int			reqLen;
+	char		*response;
+	int			respLen;
+	uint64_t	time;							//Time of the request since the session start
+	bool		replay;							//false for idle / noidle
+};
+
+struct session {
+	bool			open;
+	uint64_t		start;
+	struct buffer	clt;						//Client bytes not yet split into requests
+	struct buffer	srv;						//Server bytes not yet split into responses
+	int				srvPos;						//Scan position in srv
+	bool			greeted;					//Has the server greeting been consumed ?
+	struct exchange	*ex;
+	int				nbEx;						//Number of exchanges (requests)
+	int				nbResp;						//Number of exchanges having their response
+};
+
+struct mockEntry {								//Mock MPD table : request -> response
+	struct mockEntry	*next;
+	struct exchange		*ex;
+};
+
+struct client {
+	pthread_t		thread;
+	struct session	*s;
+	uint32_t		*lat;						//Latencies in micro seconds
+	int				nbLat;
+	uint64_t		bytes;						//Bytes received
+	int				errors;
+};
+
+static struct session	*sessions[RPL_MAX_SESSIONS];
+static struct session	**replayed;				//Sessions having at least one replayable exchange
+static int				nbReplayed = 0;
+static struct mockEntry	*mockTbl[RPL_HASH_SIZE];
+static char				greeting[256] = RPL_GREETING;
+static char				*host = RPL_DEF_HOST;
+static int				port = 0;				//Port the clients connect to (the proxy), 0 : the mock itself
+static int				mockPort = RPL_DEF_MOCK_PORT;
+static bool				fast = false;
+static int				loops = 1;
+static int				costNs = 0;				//Mock execution cost per response byte in ns
+static pthread_mutex_t	mockLoop = PTHREAD_MUTEX_INITIALIZER;	//The mock runs one command at a time
+static char				*bulkResp;				//Synthetic listallinfo response
+static int				bulkRespLen = 0;
+static volatile bool	stopBulk = false;
+static uint64_t			nbBulk = 0;				//Bulk queries answered
+
+/****************************************************************
+ * Helpers
+ ****************************************************************/
+uint64_t nowUsec(){
+	struct timeval t;
+
+	gettimeofday(&t, NULL);
+	return (uint64_t)t.tv_sec * 1000000 + t.tv_usec;
+}
+
+void bufAppend(struct buffer *b, char *data, int len){
+	if (b->len + len > b->size) {
+		b->size = (b->len + len) * 2;
+		b->data = realloc(b->data, b->size);
+		if (b->data == NULL) {
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
+		}
+	}
+	memcpy(b->data + b->len, data, len);
+	b->len += len;
+}
+
+void bufConsume(struct buffer *b, int len){
+	memmove(b->data, b->data + len, b->len - len);
+	b->len -= len;
+}
+
+char *dupBytes(char *data, int len){
+	char *p = malloc(len + 1);
+
+	memcpy(p, data, len);
+	p[len] = '\0';
+	return p;
+}
+
+//Returns the length of the first complete request in buf (a line or a whole command list), 0 if incomplete
+int requestEnd(char *buf, int len){
+	char 	*p = buf;
+	char 	*end = buf + len;
+	char	*nl;
+	bool	list;
+
+	if ((nl = memchr(p, '\n', len)) == NULL) return 0;
+	list = (strncmp(p, "command_list_begin", 18) == 0) || (strncmp(p, "command_list_ok_begin", 21) == 0);
+	if (!list) return nl - buf + 1;
+
+	for (p = nl + 1 ; p < end ; p = nl + 1) {
+		if ((nl = memchr(p, '\n', end - p)) == NULL) return 0;
+		if (strncmp(p, "command_list_end\n", 17) == 0) return nl - buf + 1;
+	}
+	return 0;
+}
+
+//Incrementally looks for the end of a response (OK or ACK line), skipping binary payloads
+//*pos keeps the offset of the next line to scan between calls to avoid rescanning large responses
+//Returns the length of the response, 0 if incomplete
+int responseEnd(char *buf, int len, int *pos){
+	char *p, *nl;
+	long n;
+
+	while (*pos < len) {
+		p = buf + *pos;
+		if ((nl = memchr(p, '\n', len - *pos)) == NULL) return 0;
+		if (strncmp(p, "binary: ", 8) == 0) {
+			n = atol(p + 8);
+			if (nl + 1 + n + 1 > buf + len) return 0;		//Payload and its trailing newline not yet there
+			*pos = (nl + 1 + n + 1) - buf;
+			continue;
+		}
+		*pos = nl + 1 - buf;
+		if ((strncmp(p, "OK\n", 3) == 0) || (strncmp(p, "ACK ", 4) == 0)) return *pos;
+	}
+	return 0;
+}
+
+bool isIdle(char *req){
+	return (strncmp(req, "idle", 4) == 0) || (strncmp(req, "noidle", 6) == 0);
+}
+
+/****************************************************************
+ * Capture loading
+ ****************************************************************/
+struct exchange *newExchange(struct session *s){
+	s->ex = realloc(s->ex, (s->nbEx + 1) * sizeof(struct exchange));
+	memset(&s->ex[s->nbEx], 0, sizeof(struct exchange));
+	return &s->ex[s->nbEx++];
+}
+
+//Splits the client bytes received so far into requests
+void splitRequests(struct session *s, uint64_t time){
+	struct exchange *e;
+	int n;
+
+	while ((n = requestEnd(s->clt.data, s->clt.len)) > 0) {
+		e = newExchange(s);
+		e->request = dupBytes(s->clt.data, n);
+		e->reqLen = n;
+		e->time = time - s->start;
+		e->replay = !isIdle(e->request);
+		if (strncmp(e->request, "noidle", 6) == 0)			//noidle has no response of its own :
+			e->response = dupBytes("", 0);					//it completes the pending idle
+		bufConsume(&s->clt, n);
+	}
+}
+
+//Splits the server bytes received so far into responses and attaches them to their requests
+void splitResponses(struct session *s){
+	char *nl;
+	int n;
+
+	if (!s->greeted) {
+		if ((nl = memchr(s->srv.data, '\n', s->srv.len)) == NULL) return;
+		n = nl - s->srv.data + 1;
+		if (n < sizeof(greeting)) {
+			memcpy(greeting, s->srv.data, n);
+			greeting[n] = '\0';
+		}
+		bufConsume(&s->srv, n);
+		s->greeted = true;
+	}
+	while (true) {
+		while (s->nbResp < s->nbEx && s->ex[s->nbResp].response != NULL) s->nbResp++;
+		if (s->nbResp == s->nbEx) break;
+		if ((n = responseEnd(s->srv.data, s->srv.len, &s->srvPos)) == 0) break;
+		s->ex[s->nbResp].response = dupBytes(s->srv.data, n);
+		s->ex[s->nbResp].respLen = n;
+		s->nbResp++;
+		bufConsume(&s->srv, n);
+		s->srvPos = 0;
+	}
+}
+
+unsigned hashRequest(char *req, int len){
+	unsigned h = 5381;
+
+	while (len--) h = (h * 33) ^ (unsigned char)*req++;
+	return h % RPL_HASH_SIZE;
+}
+
+//The mock answers each request with the first response recorded for it
+void mockAdd(struct exchange *e){
+	struct mockEntry *m;
+	unsigned h = hashRequest(e->request, e->reqLen);
+
+	for (m = mockTbl[h] ; m != NULL ; m = m->next)
+		if (m->ex->reqLen == e->reqLen && memcmp(m->ex->request, e->request, e->reqLen) == 0) return;
+	m = malloc(sizeof(struct mockEntry));
+	m->ex = e;
+	m->next = mockTbl[h];
+	mockTbl[h] = m;
+}
+
+struct exchange *mockFind(char *req, int len){
+	struct mockEntry *m;
+
+	for (m = mockTbl[hashRequest(req, len)] ; m != NULL ; m = m->next)
+		if (m->ex->reqLen == len && memcmp(m->ex->request, req, len) == 0) return m->ex;
+	return NULL;
+}
+
+void addReplayed(struct session *s){
+	replayed = realloc(replayed, (nbReplayed + 1) * sizeof(struct session *));
+	replayed[nbReplayed++] = s;
+}
+
+int loadCapture(char *filename){
+	FILE 				*fp;
+	struct capHeader 	h;
+	struct capFrame 	f;
+	struct session 		*s;
+	char 				*data = NULL;
+	int 				size = 0, i, j, frames = 0;
+
+	if ((fp = fopen(filename, "rb")) == NULL) {
+		fprintf(stderr, "Cannot open %s : %s\n", filename, strerror(errno));
+		return -1;
+	}
+	if (fread(&h, sizeof(h), 1, fp) != 1 || memcmp(h.magic, CAP_MAGIC, CAP_MAGIC_LEN) != 0) {
+		fprintf(stderr, "%s is not a capture file\n", filename);
+		fclose(fp);
+		return -1;
+	}
+
+	while (fread(&f, sizeof(f), 1, fp) == 1) {
+		if (f.len > size) {
+			size = f.len;
+			data = realloc(data, size);
+		}
+		if (f.len && fread(data, f.len, 1, fp) != 1) break;		//Truncated capture : keep what was read
+		frames++;
+
+		s = sessions[f.session];
+		if (f.dir == CAP_OPEN) {								//Session numbers wrap : a new open starts a new session
+			if (s != NULL && s->nbEx) addReplayed(s);
+			s = sessions[f.session] = calloc(1, sizeof(struct session));
+			s->open = true;
+			s->start = f.time;
+			continue;
+		}
+		if (s == NULL || !s->open) continue;
+		if (f.dir == CAP_CLT_TO_SRV) {
+			bufAppend(&s->clt, data, f.len);
+			splitRequests(s, f.time);
+		}
+		else if (f.dir == CAP_SRV_TO_CLT) {
+			bufAppend(&s->srv, data, f.len);
+			splitResponses(s);
+		}
+		else if (f.dir == CAP_CLOSE) s->open = false;
+	}
+	fclose(fp);
+	free(data);
+
+	for (i = 0 ; i < RPL_MAX_SESSIONS ; i++) {
+		if ((s = sessions[i]) != NULL && s->nbEx) addReplayed(s);
+	}
+	for (i = 0 ; i < nbReplayed ; i++) {
+		s = replayed[i];
+		for (j = 0 ; j < s->nbEx ; j++) {
+			if (s->ex[j].response == NULL) s->ex[j].replay = false;	//Session closed before the response
+			else if (s->ex[j].replay) mockAdd(&s->ex[j]);
+		}
+	}
+	printf("Capture %s : %i frames, %i sessions\n", filename, frames, nbReplayed);
+	return nbReplayed ? 0 : -1;
+}
+
+/****************************************************************
+ * Mock MPD
+ ****************************************************************/
+int writeAll(int fd, char *data, int len){
+	int x;
+
+	while (len > 0) {
+		if ((x = write(fd, data, len)) <= 0) {
+			if (x < 0 && errno == EINTR) continue;
+			return -1;
+		}
+		data += x;
+		len -= x;
+	}
+	return 0;
+}
+
+//Simulates mpd executing a command : the clients are served one at a time,
+//the cost growing with the size of the response
+void mockRun(int respLen){
+	if (costNs == 0) return;
+	pthread_mutex_lock(&mockLoop);
+	usleep((uint64_t) respLen * costNs / 1000);
+	pthread_mutex_unlock(&mockLoop);
+}
+
+//Builds the synthetic listallinfo response of the bulk clients
+void buildBulk(int size){
+	char line[128];
+	int i, n;
+
+	bulkResp = malloc(size + sizeof(line));
+	for (i = 0 ; bulkRespLen < size ; i++) {
+		n = snprintf(line, sizeof(line), "file: bulk/%06i.flac\nTime: 180\nTitle: Track %i\n", i, i);
+		memcpy(bulkResp + bulkRespLen, line, n);
+		bulkRespLen += n;
+	}
+	memcpy(bulkResp + bulkRespLen, "OK\n", 3);
+	bulkRespLen += 3;
+}
+
+static void *mockClient(void *arg){
+	int 			fd = (int)(long) arg;
+	struct buffer 	in = {NULL, 0, 0};
+	struct exchange *e;
+	char 			buf[RPL_BUF_SIZE];
+	bool 			idle = false;
+	int 			n;
+
+	if (writeAll(fd, greeting, strlen(greeting)) < 0) goto end;
+	while ((n = read(fd, buf, sizeof(buf))) > 0) {
+		bufAppend(&in, buf, n);
+		while ((n = requestEnd(in.data, in.len)) > 0) {
+			if (strncmp(in.data, "idle", 4) == 0) idle = true;				//Answered by the next noidle
+			else if (strncmp(in.data, "noidle", 6) == 0) {
+				if (idle && writeAll(fd, "OK\n", 3) < 0) goto end;
+				idle = false;
+			}
+			else if ((e = mockFind(in.data, n)) != NULL) {
+				mockRun(e->respLen);
+				if (writeAll(fd, e->response, e->respLen) < 0) goto end;
+			}
+			else if (bulkRespLen && strncmp(in.data, RPL_BULK_REQUEST, n) == 0) {
+				mockRun(bulkRespLen);
+				if (writeAll(fd, bulkResp, bulkRespLen) < 0) goto end;
+			}
+			else if (writeAll(fd, "OK\n", 3) < 0) goto end;
+			bufConsume(&in, n);
+		}
+	}
+end:
+	close(fd);
+	free(in.data);
+	return NULL;
+}
+
+int listenOn(int p){
+	struct sockaddr_in addr;
+	int s, on = 1;
+
+	if ((s = socket(AF_INET, SOCK_STREAM, 0)) < 0) return -1;
+	setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(p);
+	if (bind(s, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(s, 64) < 0) {
+		close(s);
+		return -1;
+	}
+	return s;
+}
+
+static void *mockServer(void *arg){
+	int 		s = (int)(long) arg;
+	int 		fd;
+	pthread_t 	t;
+
+	while (true) {
+		if ((fd = accept(s, NULL, NULL)) < 0) {
+			if (errno == EINTR) continue;
+			return NULL;
+		}
+		if (pthread_create(&t, NULL, mockClient, (void *)(long) fd) == 0) pthread_detach(t);
+		else close(fd);
+	}
+}
+
+/****************************************************************
+ * Synthetic clients
+ ****************************************************************/
+int connectTo(char *h, int p){
+	struct sockaddr_in addr;
+	struct hostent *he;
+	int s, on = 1;
+
+	if ((he = gethostbyname(h)) == NULL) return -1;
+	if ((s = socket(AF_INET, SOCK_STREAM, 0)) < 0) return -1;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	memcpy(&addr.sin_addr, he->h_addr, he->h_length);
+	addr.sin_port = htons(p);
+	if (connect(s, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		close(s);
+		return -1;
+	}
+	setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+	return s;
+}
+
+//Reads a full response, returns its length or -1
+int readResponse(int fd, struct buffer *b){
+	char buf[RPL_BUF_SIZE];
+	int n, pos = 0, end;
+
+	b->len = 0;
+	while ((end = responseEnd(b->data, b->len, &pos)) == 0) {
+		if ((n = read(fd, buf, sizeof(buf))) <= 0) return -1;
+		bufAppend(b, buf, n);
+	}
+	return end;
+}
+
+static void *replayClient(void *arg){
+	struct client 	*c = (struct client *) arg;
+	struct session 	*s = c->s;
+	struct buffer 	in = {NULL, 0, 0};
+	struct exchange *e;
+	uint64_t 		start, t;
+	int 			fd, i, l, n;
+	char			*nl;
+
+	c->lat = malloc(s->nbEx * loops * sizeof(uint32_t));
+	for (l = 0 ; l < loops ; l++) {
+		if ((fd = connectTo(host, port ? port : mockPort)) < 0) {
+			c->errors++;
+			continue;
+		}
+		in.len = 0;										//Greeting
+		while (in.len == 0 || (nl = memchr(in.data, '\n', in.len)) == NULL) {
+			char buf[256];
+			if ((n = read(fd, buf, sizeof(buf))) <= 0) break;
+			bufAppend(&in, buf, n);
+		}
+		start = nowUsec();
+		for (i = 0 ; i < s->nbEx ; i++) {
+			e = &s->ex[i];
+			if (!e->replay) continue;
+			if (!fast) {								//Original pace : wait for the recorded request time
+				t = nowUsec() - start;
+				if (t < e->time) usleep(e->time - t);
+			}
+			t = nowUsec();
+			if (writeAll(fd, e->request, e->reqLen) < 0 || (n = readResponse(fd, &in)) < 0) {
+				c->errors++;
+				break;
+			}
+			c->lat[c->nbLat++] = nowUsec() - t;
+			c->bytes += n;
+		}
+		close(fd);
+	}
+	free(in.data);
+	return NULL;
+}
+
+//Bulk client : loops on listallinfo until the replay clients are done
+static void *bulkClient(void *arg){
+	struct buffer 	in = {NULL, 0, 0};
+	char			buf[256];
+	int 			fd, n;
+
+	if ((fd = connectTo(host, port ? port : mockPort)) < 0) return NULL;
+	if (read(fd, buf, sizeof(buf)) <= 0) goto end;				//Greeting
+	while (!stopBulk) {
+		if (writeAll(fd, RPL_BULK_REQUEST, strlen(RPL_BULK_REQUEST)) < 0 || (n = readResponse(fd, &in)) < 0) break;
+		__sync_fetch_and_add(&nbBulk, 1);
+	}
+end:
+	close(fd);
+	free(in.data);
+	return NULL;
+}
+
+/****************************************************************
+ * Report
+ ****************************************************************/
+int cmpLat(const void *a, const void *b){
+	uint32_t x = *(uint32_t *)a, y = *(uint32_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+//Process CPU time in micro seconds read from /proc/pid/stat
+uint64_t procCpu(int pid){
+	char 				path[64];
+	FILE 				*fp;
+	unsigned long 		utime, stime;
+	int 				n;
+
+	snprintf(path, sizeof(path), "/proc/%i/stat", pid);
+	if ((fp = fopen(path, "r")) == NULL) return 0;
+	n = fscanf(fp, "%*d %*s %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime);
+	fclose(fp);
+	if (n != 2) return 0;
+	return (uint64_t)(utime + stime) * 1000000 / sysconf(_SC_CLK_TCK);
+}
+
+uint64_t selfCpu(){
+	struct rusage r;
+
+	getrusage(RUSAGE_SELF, &r);
+	return (uint64_t)(r.ru_utime.tv_sec + r.ru_stime.tv_sec) * 1000000 + r.ru_utime.tv_usec + r.ru_stime.tv_usec;
+}
+
+//Returns the p99 latency in micro seconds
+uint32_t report(struct client *c, int nbClients, uint64_t duration, uint64_t cpu, uint64_t proxyCpu, int proxyPid){
+	uint32_t 	*lat, p99 = 0;
+	uint64_t 	bytes = 0;
+	int 		i, n = 0, errors = 0;
+
+	for (i = 0 ; i < nbClients ; i++) {
+		n += c[i].nbLat;
+		bytes += c[i].bytes;
+		errors += c[i].errors;
+	}
+	lat = malloc((n ? n : 1) * sizeof(uint32_t));
+	for (i = 0, n = 0 ; i < nbClients ; i++) {
+		memcpy(lat + n, c[i].lat, c[i].nbLat * sizeof(uint32_t));
+		n += c[i].nbLat;
+	}
+	qsort(lat, n, sizeof(uint32_t), cmpLat);
+
+	printf("Clients            : %i (%s pace, %i loop(s)), errors : %i\n", nbClients, fast ? "fast" : "original", loops, errors);
+	printf("Requests           : %i in %.3f s\n", n, duration / 1e6);
+	printf("Throughput         : %.1f req/s, %.2f MB/s\n", n * 1e6 / duration, bytes / (double) duration);
+	if (n) {
+		printf("Latency (us)       : p50 %u  p90 %u  p99 %u  p99.9 %u  max %u\n",
+			lat[n / 2], lat[(int)(n * 0.9)], lat[(int)(n * 0.99)], lat[(int)(n * 0.999)], lat[n - 1]);
+		printf("CPU mpdReplay      : %.1f us/req\n", (double) cpu / n);
+		if (proxyPid) printf("CPU proxy (pid %i) : %.1f us/req\n", proxyPid, (double) proxyCpu / n);
+		p99 = lat[(int)(n * 0.99)];
+	}
+	free(lat);
+	return p99;
+}
+
+void help(){
+	printf("\nUsage: mpdReplay [-c clients] [-l loops] [-f] [-s host] [-p proxy_port] [-m mock_port] [-P proxy_pid]\n");
+	printf("                 [-k cost] [-b bulk_clients] [-B bulk_size] [-S slo] capture_file\n");
+	printf("Replays sessions captured by mpdProxy against the proxy and a mock MPD\n\n");
+	printf("-c	: number of concurrent clients (default : %i)\n", RPL_DEF_CLIENTS);
+	printf("-l	: number of times each client replays its session (default : 1)\n");
+	printf("-f	: as fast as possible instead of the original pace\n");
+	printf("-s	: host of the proxy (default : %s)\n", RPL_DEF_HOST);
+	printf("-p	: port of the proxy (default : connect directly to the mock to get a baseline)\n");
+	printf("-m	: port of the mock MPD, the proxy MpdPort has to point to it (default : %i, 0 : no mock)\n", RPL_DEF_MOCK_PORT);
+	printf("-P	: pid of the proxy to report its CPU usage\n");
+	printf("-k	: mock execution cost in ns per response byte, commands run one at a time like in mpd (default : 0)\n");
+	printf("-b	: number of bulk clients looping on listallinfo during the replay (default : 0)\n");
+	printf("-B	: size of the listallinfo response of the mock (default : %i)\n", RPL_DEF_BULK_SIZE);
+	printf("-S	: p99 latency SLO of the replayed clients in us, exit status 2 if missed\n\n");
+	exit(-1);
+}
+
+int main(int argc, char **argv){
+	struct client 	*clients;
+	pthread_t 		mock, *bulk;
+	uint64_t 		start, duration, cpu, proxyCpu = 0;
+	uint32_t		p99, slo = 0;
+	int 			c, i, s, nbClients = RPL_DEF_CLIENTS, proxyPid = 0, nbBulkClients = 0, bulkSize = RPL_DEF_BULK_SIZE;
+
+	while ((c = getopt(argc, argv, "c:l:fs:p:m:P:k:b:B:S:h")) != -1) {
+		switch (c) {
+			case 'c': nbClients = atoi(optarg); break;
+			case 'l': loops = atoi(optarg); break;
+			case 'f': fast = true; break;
+			case 's': host = optarg; break;
+			case 'p': port = atoi(optarg); break;
+			case 'm': mockPort = atoi(optarg); break;
+			case 'P': proxyPid = atoi(optarg); break;
+			case 'k': costNs = atoi(optarg); break;
+			case 'b': nbBulkClients = atoi(optarg); break;
+			case 'B': bulkSize = atoi(optarg); break;
+			case 'S': slo = atoi(optarg); break;
+			default: help();
+		}
+	}
+	if (optind != argc - 1 || nbClients < 1 || loops < 1) help();
+	if (mockPort == 0 && port == 0) help();
+
+	signal(SIGPIPE, SIG_IGN);
+	if (loadCapture(argv[optind]) < 0) exit(1);
+	if (nbBulkClients) buildBulk(bulkSize);
+
+	if (mockPort) {
+		if ((s = listenOn(mockPort)) < 0) {
+			fprintf(stderr, "Cannot listen on port %i : %s\n", mockPort, strerror(errno));
+			exit(1);
+		}
+		pthread_create(&mock, NULL, mockServer, (void *)(long) s);
+	}
+
+	bulk = calloc(nbBulkClients + 1, sizeof(pthread_t));
+	for (i = 0 ; i < nbBulkClients ; i++) pthread_create(&bulk[i], NULL, bulkClient, NULL);
+	if (nbBulkClients) usleep(100000);							//Let the bulk load settle
+
+	clients = calloc(nbClients, sizeof(struct client));
+	if (proxyPid) proxyCpu = procCpu(proxyPid);
+	cpu = selfCpu();
+	start = nowUsec();
+	for (i = 0 ; i < nbClients ; i++) {
+		clients[i].s = replayed[i % nbReplayed];
+		pthread_create(&clients[i].thread, NULL, replayClient, &clients[i]);
+	}
+	for (i = 0 ; i < nbClients ; i++) pthread_join(clients[i].thread, NULL);
+	duration = nowUsec() - start;
+	stopBulk = true;
+	for (i = 0 ; i < nbBulkClients ; i++) pthread_join(bulk[i], NULL);
+
+	p99 = report(clients, nbClients, duration, selfCpu() - cpu, proxyPid ? procCpu(proxyPid) - proxyCpu : 0, proxyPid);
+	if (nbBulkClients) printf("Bulk queries       : %llu by %i client(s), %.2f MB/s\n", (unsigned long long) nbBulk, nbBulkClients,
+		(double) nbBulk * bulkRespLen / duration);
+	if (slo) {
+		printf("SLO p99 %8u us : %s\n", slo, p99 <= slo ? "met" : "MISSED");
+		if (p99 > slo) return 2;
+	}
+	return 0;
+}
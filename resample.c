@@ -0,0 +1,256 @@
+/*
+ * resample : conversion of the input of the DSP engine to its rate
+ *
+ * mpd plays each song at its own rate (format "*:32:2" on its output) and the engine converts it once to DSP_RATE,
+ * where the chains are designed : no conversion by mpd before the crossover.
+ *
+ * The ratio out / in is reduced to up / down (48000 to 44100 : 147 / 160). The filter is a Kaiser windowed sinc at
+ * up * in, flat up to RESAMPLE_PASS and rejecting RESAMPLE_ATTEN dB from the lower rate minus RESAMPLE_PASS : what
+ * would alias lands above RESAMPLE_PASS and is rejected on its way back. It is split into up phases of taps input
+ * frames, each output frame being the dot product of one phase with the last input frames : the kernels run it on
+ * the interleaved stereo frames, each tap being stored twice (left and right). An integer ratio (88200, 176400 Hz)
+ * has a single phase : the position moves by whole frames and the phase stays in the cache.
+ *
+ * The tables depend on the ratio only : they are built once per rate met and kept (RESAMPLE_CACHE), the engine
+ * building the ones of the common rates when it opens, so a song at another rate only has to reset the history.
+ * The kernel is chosen at run time as the biquad kernels (see biquad.c). The kernels only differ from the scalar
+ * reference by the order of their additions.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#include "log.h"
+#include "cpu.h"
+#include "sinc.h"
+#include "resample.h"
+
+#define RESAMPLE_ALIGN		64
+#define RESAMPLE_SCALE		2147483648.0f			/* s32 full scale */
+
+static struct resampleKernel	*kernel = NULL;		//Kernel of the resamplers set up from now on
+static struct resampleTable		cache[RESAMPLE_CACHE];
+static int						nbCached = 0;
+
+//Reference implementation : dot product of n interleaved stereo floats
+static void runScalar(const float *h, const float *x, int n, float *out){
+	float	l = 0, r = 0;
+	int		i;
+
+	for (i = 0 ; i < n ; i += 2) {
+		l += h[i] * x[i];
+		r += h[i + 1] * x[i + 1];
+	}
+	out[0] = l;
+	out[1] = r;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+//n multiple of 8 : two accumulators of left right left right
+__attribute__((target("sse2")))
+static void runSse2(const float *h, const float *x, int n, float *out){
+	__m128	a = _mm_setzero_ps(), b = _mm_setzero_ps();
+	float	l[4];
+	int		i;
+
+	for (i = 0 ; i < n ; i += 8) {
+		a = _mm_add_ps(a, _mm_mul_ps(_mm_load_ps(h + i), _mm_loadu_ps(x + i)));
+		b = _mm_add_ps(b, _mm_mul_ps(_mm_load_ps(h + i + 4), _mm_loadu_ps(x + i + 4)));
+	}
+	_mm_storeu_ps(l, _mm_add_ps(a, b));
+	out[0] = l[0] + l[2];
+	out[1] = l[1] + l[3];
+}
+
+__attribute__((target("avx2")))
+static void runAvx2(const float *h, const float *x, int n, float *out){
+	__m256	a = _mm256_setzero_ps();
+	float	l[8];
+	int		i;
+
+	for (i = 0 ; i < n ; i += 8) a = _mm256_add_ps(a, _mm256_mul_ps(_mm256_load_ps(h + i), _mm256_loadu_ps(x + i)));
+	_mm256_storeu_ps(l, a);
+	out[0] = (l[0] + l[2]) + (l[4] + l[6]);
+	out[1] = (l[1] + l[3]) + (l[5] + l[7]);
+}
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+static void runNeon(const float *h, const float *x, int n, float *out){
+	float32x4_t	a = vdupq_n_f32(0), b = vdupq_n_f32(0);
+	float		l[4];
+	int			i;
+
+	for (i = 0 ; i < n ; i += 8) {
+		a = vaddq_f32(a, vmulq_f32(vld1q_f32(h + i), vld1q_f32(x + i)));
+		b = vaddq_f32(b, vmulq_f32(vld1q_f32(h + i + 4), vld1q_f32(x + i + 4)));
+	}
+	vst1q_f32(l, vaddq_f32(a, b));
+	out[0] = l[0] + l[2];
+	out[1] = l[1] + l[3];
+}
+#endif
+
+//Kernels by order of preference, the last supported one is chosen
+struct resampleKernel resampleKernels[] = {
+	{"scalar",	cpuAlways,	runScalar},
+#if defined(__x86_64__) || defined(__i386__)
+	{"sse2",	cpuSse2,	runSse2},
+	{"avx2",	cpuAvx2,	runAvx2},
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+	{"neon",	cpuNeon,	runNeon},
+#endif
+	{NULL}
+};
+
+//Selects the kernel of the resamplers set up from now on
+//name : kernel name, NULL or "auto" for the best one the CPU supports
+//Returns NULL if the kernel is unknown or not supported by the CPU
+struct resampleKernel *resampleSelect(char *name){
+	struct resampleKernel *k;
+
+	if ((k = cpuSelect(resampleKernels, sizeof(struct resampleKernel), name, "Resampler")) == NULL) return NULL;
+	kernel = k;
+	return kernel;
+}
+
+static int gcd(int a, int b){
+	return b == 0 ? a : gcd(b, a % b);
+}
+
+//Designs the polyphase filter of a ratio, each phase normalised to a unity gain at DC
+static int buildTable(struct resampleTable *t, int in, int out){
+	double	low = in < out ? in : out, pass = fmin(RESAMPLE_PASS, 0.46 * low), stop = low - pass;
+	double	rate, cutoff, beta = 0.1102 * (RESAMPLE_ATTEN - 8.7), n, half, x, w, *h, sum;
+	int		g = gcd(in, out), p, k, len;
+
+	t->in = in;
+	t->out = out;
+	t->up = out / g;
+	t->down = in / g;
+	rate = (double) t->up * in;												//Rate of the prototype filter
+	n = (RESAMPLE_ATTEN - 7.95) / (14.36 * (stop - pass) / rate);			//Taps of the prototype, Kaiser estimate
+	t->taps = ((int) ceil(n / t->up) + 3) / 4 * 4;
+	len = t->taps * t->up;
+	half = (len - 1) / 2.0;
+	cutoff = (pass + stop) / 2 / rate;										//Fraction of the prototype rate
+	if ((h = malloc(len * sizeof(double))) == NULL
+		|| posix_memalign((void **) &t->h, RESAMPLE_ALIGN, (size_t) len * RESAMPLE_CHANNELS * sizeof(float)) != 0) {
+		logError("Resampler : out of memory");
+		free(h);
+		return -1;
+	}
+	for (k = 0 ; k < len ; k++) {
+		x = k - half;
+		w = sincKaiser(x, half, beta);
+		h[k] = sincLowpass(x, 2 * cutoff) * w;
+	}
+	//Phase p reads the last taps frames, the oldest first : its tap k is h[p + up * (taps - 1 - k)]
+	for (p = 0 ; p < t->up ; p++) {
+		for (sum = 0, k = 0 ; k < t->taps ; k++) sum += h[p + t->up * k];
+		for (k = 0 ; k < t->taps ; k++)
+			t->h[(p * t->taps + k) * 2] = t->h[(p * t->taps + k) * 2 + 1] = h[p + t->up * (t->taps - 1 - k)] / sum;
+	}
+	free(h);
+	logInfo("Resampler %i Hz to %i Hz : %i phases of %i taps, flat to %.0f Hz, -%i dB from %.0f Hz", in, out, t->up, t->taps,
+		pass, RESAMPLE_ATTEN, stop);
+	return 0;
+}
+
+//Returns the filter table of a ratio, designed at its first use and then kept
+//Returns NULL if the rates are invalid or too many rates were met
+struct resampleTable *resampleTable(int in, int out){
+	int i;
+
+	for (i = 0 ; i < nbCached ; i++) if (cache[i].in == in && cache[i].out == out) return &cache[i];
+	if (in <= 0 || out <= 0 || nbCached == RESAMPLE_CACHE) {
+		logError("Resampler : no table for %i Hz to %i Hz", in, out);
+		return NULL;
+	}
+	if (buildTable(&cache[nbCached], in, out) < 0) return NULL;
+	return &cache[nbCached++];
+}
+
+//Sets up a resampler from in Hz to out Hz, written up to block frames at once
+//Returns -1 on error
+int resampleInit(struct resampler *r, int in, int out, int block){
+	memset(r, 0, sizeof(struct resampler));
+	if (kernel == NULL) resampleSelect(NULL);
+	r->kernel = kernel;
+	if ((r->table = resampleTable(in, out)) == NULL) return -1;
+	r->size = 2 * r->table->taps + block + r->table->down / r->table->up + 1;
+	if (posix_memalign((void **) &r->x, RESAMPLE_ALIGN, (size_t) r->size * RESAMPLE_CHANNELS * sizeof(float)) != 0) {
+		logError("Resampler : out of memory");
+		r->x = NULL;
+		return -1;
+	}
+	resampleReset(r);
+	return 0;
+}
+
+//Starts a new stream : silence before it
+void resampleReset(struct resampler *r){
+	memset(r->x, 0, (size_t) r->size * RESAMPLE_CHANNELS * sizeof(float));
+	r->fill = r->table->taps - 1;
+	r->pos = 0;
+	r->phase = 0;
+}
+
+//Adds interleaved stereo s32 frames to the input, at most the block of resampleInit between two resampleRead
+//Returns -1 if they do not fit
+int resampleWrite(struct resampler *r, const int32_t *in, int frames){
+	float	*x;
+	int		i;
+
+	if (r->fill + frames > r->size) {										//Keeps the frames from the next output on
+		memmove(r->x, r->x + r->pos * RESAMPLE_CHANNELS, (size_t) (r->fill - r->pos) * RESAMPLE_CHANNELS * sizeof(float));
+		r->fill -= r->pos;
+		r->pos = 0;
+		if (r->fill + frames > r->size) return -1;
+	}
+	x = r->x + r->fill * RESAMPLE_CHANNELS;
+	for (i = 0 ; i < frames * RESAMPLE_CHANNELS ; i++) x[i] = in[i] * (1 / RESAMPLE_SCALE);
+	r->fill += frames;
+	return 0;
+}
+
+//Converts up to frames output frames from the input written, interleaved stereo s32
+//Returns the number of frames converted
+int resampleRead(struct resampler *r, int32_t *out, int frames){
+	struct resampleTable	*t = r->table;
+	float					y[RESAMPLE_CHANNELS];
+	double					v;
+	int						i, ch;
+
+	for (i = 0 ; i < frames && r->pos + t->taps <= r->fill ; i++) {
+		r->kernel->run(t->h + r->phase * t->taps * 2, r->x + r->pos * RESAMPLE_CHANNELS, t->taps * 2, y);
+		for (ch = 0 ; ch < RESAMPLE_CHANNELS ; ch++) {
+			v = (double) y[ch] * RESAMPLE_SCALE;							//Overshoots of a clipped master saturate
+			out[i * RESAMPLE_CHANNELS + ch] = v >= RESAMPLE_SCALE - 1 ? 2147483647 : v <= -RESAMPLE_SCALE ? -2147483647 - 1 : lrint(v);
+		}
+		r->phase += t->down;
+		r->pos += r->phase / t->up;
+		r->phase %= t->up;
+	}
+	return i;
+}
+
+//Returns the delay added by the filter in output frames
+int resampleLatency(struct resampler *r){
+	return lrint((r->table->taps * r->table->up - 1) / 2.0 / r->table->down);
+}
+
+//Frees the buffer of a resampler, its table stays cached
+void resampleFree(struct resampler *r){
+	free(r->x);
+	r->x = NULL;
+}
@@ -0,0 +1,48 @@
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define RESAMPLE_CHANNELS	2
+#define RESAMPLE_PASS		20000		/* Flat up to this frequency in Hz */
+#define RESAMPLE_ATTEN		110			/* Rejection of the images and aliases in dB */
+#define RESAMPLE_CACHE		8			/* Filter tables kept for the rates met */
+
+struct resampleKernel {					//One implementation of the dot product of a phase with the input
+	char	*name;							//First fields : those of struct cpuKernel (cpu.h)
+	int		(*supported)(void);			//Runtime CPU detection
+	void	(*run)(const float *h, const float *x, int n, float *out);	//n floats, interleaved stereo, out[2]
+};
+
+struct resampleTable {					//Polyphase filter of one ratio, shared by all the resamplers using it
+	int		in;							//Rates
+	int		out;
+	int		up;							//Ratio reduced : up phases, input read down frames per up output frames
+	int		down;
+	int		taps;						//Input frames per phase, multiple of 4
+	float	*h;							//h[phase * 2 * taps + 2 * k + ch] : tap k of the phase, doubled for both channels
+};
+
+struct resampler {						//Converts an interleaved stereo stream from one rate to another
+	struct resampleKernel	*kernel;
+	struct resampleTable	*table;		//Filter of the ratio
+	float					*x;			//Input frames waiting, interleaved stereo, taps frames of history first
+	int						size;		//Frames x holds
+	int						fill;		//Frames in x
+	int						phase;		//Phase of the next output frame
+	int						pos;		//Frame of x the next output frame starts at
+};
+
+extern struct resampleKernel resampleKernels[];	// All the kernels built in, the scalar reference first, NULL name at the end
+
+struct resampleKernel *resampleSelect(char *name);
+struct resampleTable *resampleTable(int in, int out);
+int 	resampleInit(struct resampler *r, int in, int out, int block);
+void 	resampleReset(struct resampler *r);
+int 	resampleWrite(struct resampler *r, const int32_t *in, int frames);
+int 	resampleRead(struct resampler *r, int32_t *out, int frames);
+int 	resampleLatency(struct resampler *r);
+void 	resampleFree(struct resampler *r);
+
+#endif
@@ -0,0 +1,223 @@
+/*
+ * resampleBench : checks the resampler of the DSP input, measures its CPU and its quality for the rates of the songs
+ *
+ * Check : each kernel the CPU supports resamples noise in blocks of several sizes and must give the output of the
+ * scalar reference within the rounding of the additions.
+ * Benchmark : for each rate converted to 44100 Hz, the filter (phases, taps, table), the ns per output frame of each
+ * kernel and the CPU load in % of one core.
+ * Quality : the gain of tones from 20 Hz to 20 kHz (ripple of the band), the THD+N of a 1 kHz tone at -1 dBFS and, when
+ * the input is above twice the output, the worst alias of tones between the stop frequency and the input Nyquist.
+ * The exit status is 1 if a kernel differs from the reference or if the quality is below RESAMPLE_ATTEN.
+ *
+ * Without the engine the songs are converted by mpd (format "44100:32:2", its samplerate_converter) : compare with the
+ * figures published for its converter, such as soxr "very high" (flat to 91 % of the Nyquist, 175 dB of rejection).
+ *
+ * Usage : resampleBench [-t seconds per measure] [-c check only]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+
+#include "log.h"
+#include "resample.h"
+
+#define BENCH_OUT		44100
+#define BENCH_BLOCK		1024
+#define BENCH_TIME		0.2
+#define BENCH_LEVEL		0.891		/* -1 dBFS */
+#define BENCH_RIPPLE	0.05		/* Max ripple of the band in dB */
+
+static int rates[] = {32000, 48000, 88200, 96000, 176400, 192000, 0};
+static int blocks[] = {1024, 37, 3, 512, 1, 0};
+static double tones[] = {20, 100, 1000, 5000, 10000, 15000, 19000, 20000, 0};
+
+//Resamples frames of in with a kernel in blocks of varied sizes, returns the frames written to out
+int convert(struct resampleKernel *k, int rate, int32_t *in, int frames, int32_t *out, int max){
+	struct resampler	r;
+	int					i, j, n, done = 0;
+
+	resampleSelect(k->name);
+	if (resampleInit(&r, rate, BENCH_OUT, BENCH_BLOCK) < 0) return 0;
+	for (i = 0, j = 0 ; i < frames ; i += n, j++) {
+		n = blocks[j % 5] < frames - i ? blocks[j % 5] : frames - i;
+		resampleWrite(&r, in + i * 2, n);
+		done += resampleRead(&r, out + done * 2, max - done);
+	}
+	resampleFree(&r);
+	return done;
+}
+
+//Compares the kernels with the scalar one, returns the number of kernels failing
+int check(){
+	struct resampleKernel	*k;
+	int32_t					*in, *ref, *out;
+	int						i, r, n, failed = 0, frames = 65536;
+	double					diff;
+
+	in = malloc(frames * 2 * sizeof(int32_t));
+	ref = malloc(frames * 4 * 2 * sizeof(int32_t));
+	out = malloc(frames * 4 * 2 * sizeof(int32_t));
+	for (i = 0 ; i < frames * 2 ; i++) in[i] = (drand48() - 0.5) * 2e9;
+	printf("Check against the scalar kernel, %i frames of noise\n", frames);
+	for (k = resampleKernels + 1 ; k->name != NULL ; k++) {
+		if (!k->supported()) {
+			printf("  %-8s not supported by this CPU\n", k->name);
+			continue;
+		}
+		for (diff = 0, r = 0 ; rates[r] != 0 ; r++) {
+			n = convert(&resampleKernels[0], rates[r], in, frames, ref, frames * 4);
+			if (convert(k, rates[r], in, frames, out, frames * 4) != n) diff = 1;
+			for (i = 0 ; i < n * 2 ; i++) diff = fmax(diff, fabs((double) ref[i] - out[i]) / 2147483648.0);
+		}
+		printf("  %-8s max difference %.1f dBFS %s\n", k->name, 20 * log10(diff + 1e-20), diff > 1e-6 ? "FAILED" : "ok");
+		failed += diff > 1e-6;
+	}
+	free(in); free(ref); free(out);
+	return failed;
+}
+
+//Returns ns per output frame
+double measure(struct resampleKernel *k, int rate, double seconds){
+	struct resampler	r;
+	struct timespec		t0, t1;
+	int32_t				*in = malloc(BENCH_BLOCK * 2 * sizeof(int32_t)), *out = malloc(BENCH_BLOCK * 2 * sizeof(int32_t));
+	double				elapsed;
+	long				frames = 0;
+	int					i;
+
+	for (i = 0 ; i < BENCH_BLOCK * 2 ; i++) in[i] = (drand48() - 0.5) * 2e9;
+	resampleSelect(k->name);
+	resampleInit(&r, rate, BENCH_OUT, BENCH_BLOCK);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	do {
+		for (i = 0 ; i < 16 ; i++) {
+			resampleWrite(&r, in, BENCH_BLOCK);
+			frames += resampleRead(&r, out, BENCH_BLOCK);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	} while (elapsed < seconds);
+	resampleFree(&r);
+	free(in); free(out);
+	return elapsed * 1e9 / frames;
+}
+
+//Resamples 1 s of a tone of frequency f and returns the part of the output after the filter has settled
+//Returns the number of frames
+int tone(int rate, double f, double level, int32_t **out){
+	struct resampler	r;
+	int32_t				*in = malloc(rate * 2 * sizeof(int32_t));
+	int					i, n, skip;
+
+	*out = malloc((BENCH_OUT + BENCH_BLOCK) * 2 * sizeof(int32_t));
+	for (i = 0 ; i < rate ; i++) in[i * 2] = in[i * 2 + 1] = lrint(level * 2147483647.0 * sin(2 * M_PI * f * i / rate));
+	resampleSelect(NULL);
+	resampleInit(&r, rate, BENCH_OUT, BENCH_BLOCK);
+	for (i = 0, n = 0 ; i < rate ; i += BENCH_BLOCK) {
+		resampleWrite(&r, in + i * 2, rate - i < BENCH_BLOCK ? rate - i : BENCH_BLOCK);
+		n += resampleRead(&r, *out + n * 2, BENCH_OUT + BENCH_BLOCK - n);
+	}
+	skip = 2 * resampleLatency(&r);
+	resampleFree(&r);
+	free(in);
+	memmove(*out, *out + skip * 2, (n - skip) * 2 * sizeof(int32_t));
+	return (n - skip) / 4 * 4;
+}
+
+//Fits a sine of frequency f on the left channel by least squares : level of the sine and of what remains, full scale 1
+void fit(int32_t *x, int n, double f, double *level, double *rest){
+	double	cc = 0, ss = 0, cs = 0, xc = 0, xs = 0, c, s, re, im, det, e, power = 0;
+	int		i;
+
+	for (i = 0 ; i < n ; i++) {
+		c = cos(2 * M_PI * f * i / BENCH_OUT);
+		s = sin(2 * M_PI * f * i / BENCH_OUT);
+		cc += c * c;
+		ss += s * s;
+		cs += c * s;
+		xc += x[i * 2] * c;
+		xs += x[i * 2] * s;
+	}
+	det = cc * ss - cs * cs;
+	re = (xc * ss - xs * cs) / det;
+	im = (xs * cc - xc * cs) / det;
+	for (i = 0 ; i < n ; i++) {
+		e = x[i * 2] - re * cos(2 * M_PI * f * i / BENCH_OUT) - im * sin(2 * M_PI * f * i / BENCH_OUT);
+		power += e * e;
+	}
+	*level = sqrt(re * re + im * im) / 2147483648.0;
+	*rest = sqrt(power / n * 2) / 2147483648.0;
+}
+
+//Prints the quality of a rate, returns 1 if it is below the specification
+int quality(int rate){
+	struct resampleTable	*t = resampleTable(rate, BENCH_OUT);
+	double					level, rest, ripple = 0, thd, alias = -300, pass = fmin(RESAMPLE_PASS, 0.46 * fmin(rate, BENCH_OUT));
+	double					stop = fmin(rate, BENCH_OUT) - pass, f, a;
+	int32_t					*y;
+	int						i, n;
+
+	for (i = 0 ; tones[i] != 0 ; i++) {
+		if (tones[i] > pass) continue;
+		n = tone(rate, tones[i], BENCH_LEVEL, &y);
+		fit(y, n, tones[i], &level, &rest);
+		ripple = fmax(ripple, fabs(20 * log10(level / BENCH_LEVEL)));
+		free(y);
+	}
+	n = tone(rate, 1000, BENCH_LEVEL, &y);
+	fit(y, n, 1000, &level, &rest);
+	thd = 20 * log10(rest / level);
+	free(y);
+	for (f = stop + 500 ; f < rate / 2.0 - 500 && rate > 2 * BENCH_OUT - 2 * pass ; f += 1500) {
+		a = fmod(f, BENCH_OUT);													//Where it would alias
+		if (a > BENCH_OUT / 2.0) a = BENCH_OUT - a;
+		if (a > pass) continue;
+		n = tone(rate, f, BENCH_LEVEL, &y);
+		fit(y, n, a, &level, &rest);
+		alias = fmax(alias, 20 * log10(level / BENCH_LEVEL + 1e-15));
+		free(y);
+	}
+	printf("  %6i Hz : %3i phases of %3i taps, %4li kB, ripple %.4f dB to %.0f Hz, THD+N %.1f dB, ", rate, t->up, t->taps,
+		(long) t->up * t->taps * 2 * sizeof(float) / 1024, ripple, pass, thd);
+	if (alias > -300) printf("worst alias %.1f dB\n", alias);
+	else printf("no alias in the band\n");
+	return ripple > BENCH_RIPPLE || thd > -RESAMPLE_ATTEN || alias > -RESAMPLE_ATTEN;
+}
+
+int main(int argc, char *argv[]){
+	struct resampleKernel	*k;
+	double					seconds = BENCH_TIME, ns;
+	bool					checkOnly = false;
+	int						opt, r, status = 0;
+
+	while ((opt = getopt(argc, argv, "t:c")) != -1) {
+		switch (opt) {
+			case 't': seconds = atof(optarg); break;
+			case 'c': checkOnly = true; break;
+			default:
+				fprintf(stderr, "Usage : %s [-t seconds per measure] [-c]\n", argv[0]);
+				return 1;
+		}
+	}
+	srand48(1);
+
+	if (check() > 0) status = 1;
+
+	printf("\nQuality to %i Hz, tones at -1 dBFS\n", BENCH_OUT);
+	for (r = 0 ; rates[r] != 0 ; r++) status |= quality(rates[r]);
+	if (checkOnly) return status;
+
+	printf("\nns per output frame, CPU load at %i Hz in %% of one core\n", BENCH_OUT);
+	for (k = resampleKernels ; k->name != NULL ; k++) {
+		if (!k->supported()) continue;
+		for (r = 0 ; rates[r] != 0 ; r++) {
+			ns = measure(k, rates[r], seconds);
+			printf("  %-8s %6i Hz : %7.2f ns, %.3f %%\n", k->name, rates[r], ns, ns * BENCH_OUT * 1e-7);
+		}
+	}
+	return status;
+}
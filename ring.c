@@ -0,0 +1,72 @@
+/*
+ * ring : hands blocks over from one thread to another without lock nor copy
+ *
+ * The blocks are allocated once. The producer fills the block at head then pushes it, the consumer reads
+ * the block at tail then pops it : each index is only used by one side, and the two semaphores count the
+ * blocks each side may use. They do not enter the kernel as long as the side does not have to wait, that is
+ * when the ring is full for the producer or empty for the consumer.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "log.h"
+#include "ring.h"
+
+#define RING_ALIGN		64
+
+//Allocates a ring of size blocks of blockSize bytes, returns -1 on error
+int ringInit(struct ring *r, int size, int blockSize){
+	memset(r, 0, sizeof(struct ring));
+	r->size = size;
+	r->blockSize = (blockSize + RING_ALIGN - 1) / RING_ALIGN * RING_ALIGN;		//Each block on its own cache lines
+	if (posix_memalign((void **) &r->blocks, RING_ALIGN, r->size * r->blockSize) != 0) {
+		logError("Ring : out of memory");
+		r->blocks = NULL;
+		return -1;
+	}
+	memset(r->blocks, 0, r->size * r->blockSize);
+	sem_init(&r->filled, 0, 0);
+	sem_init(&r->freed, 0, size);
+	return 0;
+}
+
+void ringFree(struct ring *r){
+	free(r->blocks);
+	r->blocks = NULL;
+	sem_destroy(&r->filled);
+	sem_destroy(&r->freed);
+}
+
+//Returns the block to fill, waiting while the ring is full
+void *ringWriteBlock(struct ring *r){
+	while (sem_wait(&r->freed) < 0 && errno == EINTR);
+	return r->blocks + r->head * r->blockSize;
+}
+
+//Hands the block filled over to the consumer
+void ringPush(struct ring *r){
+	r->head = (r->head + 1) % r->size;
+	sem_post(&r->filled);
+}
+
+//Returns the oldest block, waiting while the ring is empty
+void *ringReadBlock(struct ring *r){
+	while (sem_wait(&r->filled) < 0 && errno == EINTR);
+	return r->blocks + r->tail * r->blockSize;
+}
+
+//Gives the block read back to the producer
+void ringPop(struct ring *r){
+	r->tail = (r->tail + 1) % r->size;
+	sem_post(&r->freed);
+}
+
+//Returns the number of blocks waiting for the consumer
+int ringFill(struct ring *r){
+	int n;
+
+	sem_getvalue(&r->filled, &n);
+	return n;
+}
@@ -0,0 +1,24 @@
+#ifndef RING_H
+#define RING_H
+
+#include <semaphore.h>
+
+struct ring {							//Single producer single consumer ring of preallocated blocks
+	int		size;						//Blocks in the ring
+	int		blockSize;					//Bytes per block
+	char	*blocks;
+	int		head;						//Next block filled, only used by the producer
+	int		tail;						//Next block read, only used by the consumer
+	sem_t	filled;						//Blocks ready for the consumer
+	sem_t	freed;						//Blocks free for the producer
+};
+
+int 	ringInit(struct ring *r, int size, int blockSize);
+void 	ringFree(struct ring *r);
+void 	*ringWriteBlock(struct ring *r);
+void 	ringPush(struct ring *r);
+void 	*ringReadBlock(struct ring *r);
+void 	ringPop(struct ring *r);
+int 	ringFill(struct ring *r);
+
+#endif
@@ -0,0 +1,88 @@
+/*
+ * rtcheck : debug build checking that the audio threads neither allocate, lock nor log while processing a block
+ *
+ * make rtcheck builds ampCtl-rtcheck with DSP_RTCHECK and links it with --wrap : the calls of the program to malloc,
+ * calloc, realloc, posix_memalign, free and pthread_mutex_lock go through the wrappers below, and the log functions
+ * call RT_CHECK. A call made between RT_ENTER and RT_LEAVE (the block processing of the reader and worker threads, see
+ * dsp.c) is counted, and the first RT_REPORTS ones are written to stderr with a backtrace, without allocating.
+ * The count is logged with the measures of each playback session. Calls made inside the libraries (ALSA) are not seen.
+ *
+ * Usage : ampCtl-rtcheck --dsp -c ampCtl.conf < input.s32, or in place of the daemon
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <execinfo.h>
+
+#include "rtcheck.h"
+
+#define RT_REPORTS		10				/* Violations reported with a backtrace */
+#define RT_FRAMES		32
+
+__thread int	rtDepth = 0;			//Blocks being processed by the thread
+static int		violations = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *p, size_t size);
+int __real_posix_memalign(void **p, size_t align, size_t size);
+void __real_free(void *p);
+int __real_pthread_mutex_lock(pthread_mutex_t *m);
+
+//backtrace loads libgcc on its first call, which allocates : done once at start up
+__attribute__((constructor))
+static void rtInit(){
+	void *frames[RT_FRAMES];
+
+	backtrace(frames, RT_FRAMES);
+}
+
+//Counts a forbidden call and reports the first ones
+void rtViolation(const char *what){
+	void	*frames[RT_FRAMES];
+	int		n;
+
+	if (__atomic_add_fetch(&violations, 1, __ATOMIC_RELAXED) > RT_REPORTS) return;
+	rtDepth--;														//The report itself is allowed
+	if (write(2, "RT check : ", 11) < 0 || write(2, what, strlen(what)) < 0 || write(2, " while processing a block\n", 26) < 0) {}
+	n = backtrace(frames, RT_FRAMES);
+	backtrace_symbols_fd(frames, n, 2);
+	rtDepth++;
+}
+
+//Returns the number of forbidden calls since the start
+int rtViolations(){
+	return __atomic_load_n(&violations, __ATOMIC_RELAXED);
+}
+
+void *__wrap_malloc(size_t size){
+	RT_CHECK("malloc");
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size){
+	RT_CHECK("calloc");
+	return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *p, size_t size){
+	RT_CHECK("realloc");
+	return __real_realloc(p, size);
+}
+
+int __wrap_posix_memalign(void **p, size_t align, size_t size){
+	RT_CHECK("posix_memalign");
+	return __real_posix_memalign(p, align, size);
+}
+
+void __wrap_free(void *p){
+	RT_CHECK("free");
+	__real_free(p);
+}
+
+int __wrap_pthread_mutex_lock(pthread_mutex_t *m){
+	RT_CHECK("pthread_mutex_lock");
+	return __real_pthread_mutex_lock(m);
+}
@@ -0,0 +1,21 @@
+#ifndef RTCHECK_H
+#define RTCHECK_H
+
+// Debug build checking the audio threads (make rtcheck, see rtcheck.c) : RT_ENTER and RT_LEAVE frame the processing
+// of a block, RT_CHECK reports a call which must not happen inside. Empty in the normal build.
+#ifdef DSP_RTCHECK
+extern __thread int rtDepth;
+
+void 	rtViolation(const char *what);
+int 	rtViolations();
+
+#define RT_ENTER()			(rtDepth++)
+#define RT_LEAVE()			(rtDepth--)
+#define RT_CHECK(what)		do { if (rtDepth > 0) rtViolation(what); } while (0)
+#else
+#define RT_ENTER()
+#define RT_LEAVE()
+#define RT_CHECK(what)
+#endif
+
+#endif
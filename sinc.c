@@ -0,0 +1,32 @@
+/*
+ * sinc : design of the Kaiser windowed sinc filters
+ *
+ * Shared by the filters reading their input between two frames, which each sample the windowed sinc at their own
+ * positions : the interpolation of the drift correction first (drift.c).
+ */
+#include <math.h>
+
+#include "sinc.h"
+
+//Modified Bessel function of the first kind, order 0
+static double bessel0(double x){
+	double s = 1, t = 1;
+	int k;
+
+	for (k = 1 ; k < 60 ; k++) {
+		t *= (x / (2 * k)) * (x / (2 * k));
+		s += t;
+	}
+	return s;
+}
+
+//Ideal low pass at x frames from its center, cutoff : fraction of the Nyquist frequency
+double sincLowpass(double x, double cutoff){
+	return x == 0 ? cutoff : sin(M_PI * cutoff * x) / (M_PI * x);
+}
+
+//Kaiser window at x frames from its center, half : half of its length, 0 beyond
+double sincKaiser(double x, double half, double beta){
+	if (fabs(x) > half) return 0;
+	return bessel0(beta * sqrt(fmax(0, 1 - (x / half) * (x / half)))) / bessel0(beta);
+}
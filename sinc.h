@@ -0,0 +1,7 @@
+#ifndef SINC_H
+#define SINC_H
+
+double 	sincLowpass(double x, double cutoff);
+double 	sincKaiser(double x, double half, double beta);
+
+#endif
@@ -0,0 +1,221 @@
+/*
+ * sink : outputs of the DSP engine
+ *
+ * The samples are written as s16_le interleaved, as ecasound did with -f:16,2,44100,
+ * to an ALSA device, a raw file or nowhere (null, used to benchmark the processing alone).
+ * The clock sink discards the samples like null but at the pace of a device buffering latency micro seconds :
+ * writes block while the buffer is full and an underrun is counted when the buffer runs empty, which measures
+ * the real time behaviour of the engine without sound card.
+ * A skew in ppm makes the clock sink run faster or slower than the system clock, and gives file and null sinks the
+ * fill level of a simulated device : it starts when its buffer is full and then plays at the pace of the input frames
+ * processed for it (see sinkTick) scaled by the skew. Outputs on USB DACs drifting apart are tested this way without them.
+ *
+ * By default ALSA sizes the periods of a device from the latency requested. In the low latency mode of the engine
+ * the period is the block : the device plays one period while the engine fills the next one (see sinkAlsaParams).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "log.h"
+#include "sink.h"
+
+static uint64_t nowNs(){
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+//Frames played by a clock sink since it started
+static uint64_t played(struct sink *s, uint64_t now){
+	return (now - s->start) * s->rate * (1 + s->skew) / 1000000000;
+}
+
+//Sets the parameters of an ALSA device, interleaved
+//latency : buffering in micro seconds, period : frames per period, the buffer being whole periods (0 : chosen by ALSA)
+//The device starts once its buffer is full for a playback, at once for a capture. Returns an ALSA error code
+int sinkAlsaParams(snd_pcm_t *pcm, snd_pcm_format_t format, int channels, int rate, int latency, int period){
+	snd_pcm_hw_params_t	*hw;
+	snd_pcm_sw_params_t	*sw;
+	snd_pcm_uframes_t	p = period, b = (uint64_t) latency * rate / 1000000;
+	int					err;
+
+	if (period <= 0) return snd_pcm_set_params(pcm, format, SND_PCM_ACCESS_RW_INTERLEAVED, channels, rate, 0, latency);
+	b = (b + p / 2) / p * p;
+	if (b < 2 * p) b = 2 * p;
+	snd_pcm_hw_params_alloca(&hw);
+	snd_pcm_sw_params_alloca(&sw);
+	if ((err = snd_pcm_hw_params_any(pcm, hw)) < 0
+		|| (err = snd_pcm_hw_params_set_access(pcm, hw, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0
+		|| (err = snd_pcm_hw_params_set_format(pcm, hw, format)) < 0
+		|| (err = snd_pcm_hw_params_set_channels(pcm, hw, channels)) < 0
+		|| (err = snd_pcm_hw_params_set_rate_resample(pcm, hw, 0)) < 0
+		|| (err = snd_pcm_hw_params_set_rate(pcm, hw, rate, 0)) < 0
+		|| (err = snd_pcm_hw_params_set_period_size_near(pcm, hw, &p, NULL)) < 0
+		|| (err = snd_pcm_hw_params_set_buffer_size_near(pcm, hw, &b)) < 0
+		|| (err = snd_pcm_hw_params(pcm, hw)) < 0) return err;
+	if ((err = snd_pcm_sw_params_current(pcm, sw)) < 0
+		|| (err = snd_pcm_sw_params_set_start_threshold(pcm, sw, snd_pcm_stream(pcm) == SND_PCM_STREAM_PLAYBACK ? b / p * p : 1)) < 0
+		|| (err = snd_pcm_sw_params_set_avail_min(pcm, sw, p)) < 0
+		|| (err = snd_pcm_sw_params(pcm, sw)) < 0) return err;
+	if (p != (snd_pcm_uframes_t) period) logInfo("ALSA device : period of %i frames not supported, %lu frames", period, (unsigned long) p);
+	logDebug("ALSA device : period of %lu frames, buffer of %lu frames", (unsigned long) p, (unsigned long) b);
+	return 0;
+}
+
+//Opens a sink
+//spec : "alsa:<device>", "file:<path>", "clock" or "null"
+//latency : requested device buffering in micro seconds (ALSA and clock)
+//period : frames per period of an ALSA device (0 : chosen by ALSA from the latency)
+//Returns -1 on error
+int sinkOpen(struct sink *s, char *spec, int rate, int channels, int latency, int period){
+	int err;
+
+	memset(s, 0, sizeof(struct sink));
+	s->spec = spec;
+	s->rate = rate;
+	s->channels = channels;
+	s->fd = -1;
+
+	s->buffer = (uint64_t) latency * rate / 1000000;
+	if (period > 0) s->buffer = (s->buffer + period / 2) / period * period;		//Whole periods, as the devices
+	if (strcmp(spec, "null") == 0) s->type = SINK_NULL;
+	else if (strcmp(spec, "clock") == 0) s->type = SINK_CLOCK;
+	else if (strncmp(spec, "file:", 5) == 0) {
+		s->type = SINK_FILE;
+		if ((s->fd = open(spec + 5, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+			logError("Sink %s : %s", spec, strerror(errno));
+			return -1;
+		}
+	}
+	else if (strncmp(spec, "alsa:", 5) == 0) {
+		s->type = SINK_ALSA;
+		if ((err = snd_pcm_open(&s->pcm, spec + 5, SND_PCM_STREAM_PLAYBACK, 0)) < 0
+			|| (err = sinkAlsaParams(s->pcm, SND_PCM_FORMAT_S16_LE, channels, rate, latency, period)) < 0) {
+			logError("Sink %s : %s", spec, snd_strerror(err));
+			if (s->pcm != NULL) snd_pcm_close(s->pcm);
+			s->pcm = NULL;
+			return -1;
+		}
+	}
+	else {
+		logError("Unknown sink %s", spec);
+		return -1;
+	}
+	logInfo("Sink %s opened", spec);
+	return 0;
+}
+
+//Writes interleaved s16 frames, blocking until the device has taken them
+//Underruns are recovered and counted. Returns -1 on a fatal error
+int sinkWrite(struct sink *s, int16_t *data, int frames){
+	snd_pcm_sframes_t 	n;
+	struct timespec		wait;
+	uint64_t			now, t;
+	int 				len, x;
+
+	switch (s->type) {
+		case SINK_FILE:
+			len = frames * s->channels * sizeof(int16_t);
+			while (len > 0) {
+				if ((x = write(s->fd, data, len)) < 0) {
+					if (errno == EINTR) continue;
+					logError("Sink %s : %s", s->spec, strerror(errno));
+					return -1;
+				}
+				data += x / sizeof(int16_t);
+				len -= x;
+			}
+			break;
+
+		case SINK_ALSA:
+			while (frames > 0) {
+				if ((n = snd_pcm_writei(s->pcm, data, frames)) < 0) {
+					if (n == -EPIPE) s->xruns++;
+					if ((n = snd_pcm_recover(s->pcm, n, 1)) < 0) {
+						logError("Sink %s : %s", s->spec, snd_strerror(n));
+						return -1;
+					}
+					continue;
+				}
+				data += n * s->channels;
+				frames -= n;
+				s->frames += n;
+			}
+			return 0;
+
+		case SINK_CLOCK:
+			now = nowNs();
+			if (s->queued == 0 || played(s, now) >= s->queued) {			//Buffer empty : (re)start the device
+				if (s->queued != 0) s->xruns++;
+				s->start = now;
+				s->queued = 0;
+			}
+			s->queued += frames;
+			if (s->queued > s->buffer) {									//Wait until the buffer has room
+				t = s->start + (s->queued - s->buffer) * 1000000000 / s->rate;
+				wait.tv_sec = t / 1000000000;
+				wait.tv_nsec = t % 1000000000;
+				while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wait, NULL) == EINTR);
+			}
+			break;
+	}
+	s->frames += frames;
+	return 0;
+}
+
+//Returns the number of frames buffered in the device, not yet played
+int sinkDelay(struct sink *s){
+	snd_pcm_sframes_t	d;
+	uint64_t			p;
+	int64_t				t;
+
+	if (s->simulated) {
+		t = s->input - s->buffer;
+		p = t > 0 ? t * (1 + s->skew) : 0;
+		return s->frames > p ? s->frames - p : 0;
+	}
+	if (s->type == SINK_CLOCK) {
+		p = played(s, nowNs());
+		return s->queued > p ? s->queued - p : 0;
+	}
+	if (s->type != SINK_ALSA || snd_pcm_delay(s->pcm, &d) < 0) return 0;
+	return d;
+}
+
+void sinkClose(struct sink *s){
+	if (s->type == SINK_FILE && s->fd >= 0) close(s->fd);
+	if (s->type == SINK_ALSA && s->pcm != NULL) {
+		snd_pcm_drain(s->pcm);
+		snd_pcm_close(s->pcm);
+	}
+	s->fd = -1;
+	s->pcm = NULL;
+}
+
+//Sets the clock skew of a clock, file or null sink, in ppm
+//File and null sinks then report the fill level of a simulated device
+void sinkSimulate(struct sink *s, double ppm){
+	if (s->type == SINK_ALSA) {
+		if (ppm != 0) logError("Sink %s : clock skew ignored on a device", s->spec);
+		return;
+	}
+	s->skew = ppm * 1e-6;
+	s->simulated = s->type != SINK_CLOCK;
+}
+
+//Counts the input frames of the block written, they advance the clock of a simulated device
+void sinkTick(struct sink *s, int frames){
+	s->input += frames;
+}
+
+//Returns the time the delay of the sink refers to, in ns : the system clock, or the input of a simulated device
+uint64_t sinkTime(struct sink *s){
+	if (s->simulated) return s->input * 1000000000 / s->rate;
+	return nowNs();
+}
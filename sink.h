@@ -0,0 +1,39 @@
+#ifndef SINK_H
+#define SINK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <alsa/asoundlib.h>
+
+#define SINK_NULL		0				/* Discards the samples (benchmarks) */
+#define SINK_FILE		1				/* Raw s16_le interleaved file */
+#define SINK_ALSA		2				/* ALSA playback device */
+#define SINK_CLOCK		3				/* Discards the samples at the pace of a device (benchmarks) */
+
+struct sink {							//Output of the DSP engine, configured as "alsa:<device>", "file:<path>", "clock" or "null"
+	int			type;
+	char		*spec;
+	int			fd;						//File sink
+	snd_pcm_t	*pcm;					//ALSA sink
+	int			buffer;					//Clock and simulated sinks : frames the device buffers
+	uint64_t	start;					//Clock sink : time the device started playing in ns
+	uint64_t	queued;					//Clock sink : frames written since the device started
+	int			rate;
+	int			channels;
+	uint64_t	frames;					//Frames written
+	int			xruns;					//Underruns recovered
+	double		skew;					//Simulated clock skew of clock, file and null sinks, fraction of the rate
+	bool		simulated;				//File and null sinks : delay of a simulated device playing at the pace of the input
+	uint64_t	input;					//Frames of the input the engine has processed : clock of the simulated sinks
+};
+
+int 	sinkAlsaParams(snd_pcm_t *pcm, snd_pcm_format_t format, int channels, int rate, int latency, int period);
+int 	sinkOpen(struct sink *s, char *spec, int rate, int channels, int latency, int period);
+int 	sinkWrite(struct sink *s, int16_t *data, int frames);
+int 	sinkDelay(struct sink *s);
+void 	sinkClose(struct sink *s);
+void 	sinkSimulate(struct sink *s, double ppm);
+void 	sinkTick(struct sink *s, int frames);
+uint64_t	sinkTime(struct sink *s);
+
+#endif